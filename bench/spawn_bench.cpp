@@ -0,0 +1,227 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   spawn_bench.cpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/15 10:31:08 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/15 10:31:08 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+// Spawn latency with many open fds and a big heap, the way webserv looks
+// under load. Compares the old CGI spawn (fork + /proc/self/fd scan) with
+// fork + close_range and with what spawn_cgi uses now: posix_spawn, or
+// vfork + a setpriority in the child + execve on locations with cgi_* limits.
+//
+//   make spawn_bench
+//   ./spawn_bench [open_fds=10000] [heap_mb=512] [iterations=200]
+
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+extern char** environ;
+
+static const char* g_prog = "/bin/true";
+
+static double now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+// the child side of the old spawn_cgi, kept as it was
+static void close_fds_from(int start_fd)
+{
+    DIR* d = opendir("/proc/self/fd");
+    if (!d)
+        return;
+    std::vector<int> fds_to_close;
+
+    for (;;)
+    {
+        errno = 0;
+        struct dirent* ent = readdir(d);
+        if (!ent)
+            break;
+        const char* name = ent->d_name;
+        if (name[0] < '0' || name[0] > '9')
+            continue;
+        int fd = std::atoi(name);
+        if (fd < start_fd)
+            continue;
+        fds_to_close.push_back(fd);
+    }
+
+    int dir_fd = -1;
+    DIR* d2 = opendir("/proc/self/fd");
+    if (d2)
+    {
+        for (;;)
+        {
+            errno = 0;
+            struct dirent* ent = readdir(d2);
+            if (!ent)
+                break;
+            const char* name = ent->d_name;
+            if (name[0] < '0' || name[0] > '9')
+                continue;
+            int fd = std::atoi(name);
+            bool found = false;
+            for (size_t i = 0; i < fds_to_close.size(); ++i)
+            {
+                if (fds_to_close[i] == fd)
+                {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found && fd >= start_fd)
+            {
+                dir_fd = fd;
+                break;
+            }
+        }
+        closedir(d2);
+    }
+
+    closedir(d);
+
+    for (size_t i = 0; i < fds_to_close.size(); ++i)
+    {
+        if (fds_to_close[i] != dir_fd)
+            close(fds_to_close[i]);
+    }
+}
+
+static pid_t spawn_fork_procscan()
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close_fds_from(3);
+        char* argv[] = { const_cast<char*>(g_prog), NULL };
+        execve(g_prog, argv, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t spawn_fork_close_range()
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+#ifdef SYS_close_range
+        syscall(SYS_close_range, 3U, ~0U, 0U);
+#endif
+        char* argv[] = { const_cast<char*>(g_prog), NULL };
+        execve(g_prog, argv, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t spawn_posix()
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+    posix_spawn_file_actions_addclosefrom_np(&fa, 3);
+#endif
+    char* argv[] = { const_cast<char*>(g_prog), NULL };
+    pid_t pid = -1;
+    int rc = posix_spawn(&pid, g_prog, &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    return rc == 0 ? pid : -1;
+}
+
+// the cgi_* limits path: something applied between vfork and execve
+static pid_t spawn_vfork_limits()
+{
+    char* argv[] = { const_cast<char*>(g_prog), NULL };
+    pid_t pid = vfork();
+    if (pid == 0)
+    {
+        setpriority(PRIO_PROCESS, 0, 1);
+#ifdef SYS_close_range
+        syscall(SYS_close_range, 3U, ~0U, 0U);
+#endif
+        execve(g_prog, argv, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+static void run(const char* name, pid_t (*spawn)(), int iterations)
+{
+    std::vector<double> lat;
+    for (int i = 0; i < iterations; ++i)
+    {
+        double t0 = now_us();
+        pid_t pid = spawn();
+        double t1 = now_us();
+        if (pid < 0)
+        {
+            std::printf("%-22s spawn failed\n", name);
+            return;
+        }
+        waitpid(pid, NULL, 0);
+        lat.push_back(t1 - t0);
+    }
+    std::sort(lat.begin(), lat.end());
+    double sum = 0;
+    for (size_t i = 0; i < lat.size(); ++i)
+        sum += lat[i];
+    std::printf("%-22s mean %9.1f us   p50 %9.1f us   p99 %9.1f us\n", name,
+                sum / lat.size(), lat[lat.size() / 2], lat[(lat.size() * 99) / 100]);
+}
+
+int main(int argc, char** argv)
+{
+    int    nfds = (argc > 1) ? std::atoi(argv[1]) : 10000;
+    size_t heapMb = (argc > 2) ? (size_t)std::atol(argv[2]) : 512;
+    int    iterations = (argc > 3) ? std::atoi(argv[3]) : 200;
+
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t)nfds + 64)
+    {
+        rl.rlim_cur = std::min(rl.rlim_max, (rlim_t)nfds + 64);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // stand-ins for client sockets (not CLOEXEC, like the old server's uploads)
+    int opened = 0;
+    for (; opened < nfds; ++opened)
+        if (open("/dev/null", O_RDONLY) < 0)
+            break;
+
+    // stand-in for rxBuffers: touched so the pages are really mapped
+    std::vector<char> heap(heapMb * 1024 * 1024);
+    for (size_t i = 0; i < heap.size(); i += 4096)
+        heap[i] = 1;
+
+    std::printf("open fds: %d, heap: %lu MB, iterations: %d, program: %s\n\n",
+                opened, (unsigned long)heapMb, iterations, g_prog);
+    run("fork + /proc scan", spawn_fork_procscan, iterations);
+    run("fork + close_range", spawn_fork_close_range, iterations);
+    run("posix_spawn", spawn_posix, iterations);
+    run("vfork + limits", spawn_vfork_limits, iterations);
+    return 0;
+}
@@ -0,0 +1,58 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   BodyPart.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/11 09:40:17 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/11 09:40:17 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef BODYPART_HPP
+#define BODYPART_HPP
+
+#include "SharedBuffer.hpp"
+#include <string>
+#include <sys/types.h>
+
+// One piece of a streamed response body: either bytes already in memory,
+// or a span of a file that the reactor sends straight from disk (sendfile).
+struct BodyPart
+{
+    SharedBuffer bytes;    // used when path is empty
+    std::string  path;     // file to stream from
+    off_t        offset;   // first byte of the span
+    size_t       length;   // span length
+
+    BodyPart() : bytes(), path(), offset(0), length(0) {}
+
+    static BodyPart fromBytes(const std::string& b)
+    {
+        BodyPart p;
+        p.bytes = SharedBuffer(b);
+        return p;
+    }
+
+    static BodyPart fromShared(const SharedBuffer& b)
+    {
+        BodyPart p;
+        p.bytes = b;
+        return p;
+    }
+
+    static BodyPart fromFile(const std::string& path, off_t offset, size_t length)
+    {
+        BodyPart p;
+        p.path = path;
+        p.offset = offset;
+        p.length = length;
+        return p;
+    }
+
+    bool   isFile() const { return !path.empty(); }
+    size_t size() const { return isFile() ? length : bytes.size(); }
+};
+
+#endif
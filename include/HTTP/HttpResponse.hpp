@@ -17,6 +17,8 @@
 #include <string>
 #include <map>
 #include <vector>
+#include "SharedBuffer.hpp"
+#include "BodyPart.hpp"
 
 class HTTPResponse {
 	public:
@@ -24,8 +26,8 @@ class HTTPResponse {
 		std::string reason_phrase;                // "OK", "Not Found", etc.
 		std::vector<char> body;                         // Response body
 		std::map<std::string, std::string> headers; // Headers as key-value map
-	    bool is_file;
-	    std::string file_path;
+		std::vector<BodyPart> parts;              // streamed body (file spans), sent instead of body
+		SharedBuffer prebuilt;                    // full serialized response, sent as-is when set
 	
 	void set_body(const std::string& text)
     {
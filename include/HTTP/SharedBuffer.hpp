@@ -0,0 +1,50 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   SharedBuffer.hpp                                   :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/10 10:12:04 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/10 10:12:04 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef SHAREDBUFFER_HPP
+#define SHAREDBUFFER_HPP
+
+#include <string>
+#include <cstddef>
+
+// Immutable, reference counted byte buffer.
+// Copying a SharedBuffer only bumps a counter, so prebuilt responses
+// (error pages, canned errors) can be handed to many channels without
+// copying the bytes. The reactor is single threaded: the counter is not atomic.
+class SharedBuffer
+{
+public:
+    SharedBuffer();
+    explicit SharedBuffer(const std::string& bytes);
+    SharedBuffer(const char* data, size_t len);
+    SharedBuffer(const SharedBuffer& other);
+    SharedBuffer& operator=(const SharedBuffer& other);
+    ~SharedBuffer();
+
+    const char*        data() const;
+    size_t             size() const;
+    bool               empty() const;
+    const std::string& str() const;
+
+private:
+    struct Block
+    {
+        std::string bytes;
+        size_t      refs;
+    };
+
+    Block* _blk;
+
+    void release();
+};
+
+#endif
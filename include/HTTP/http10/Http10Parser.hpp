@@ -23,6 +23,12 @@ namespace http10
                       int listenPort,
                       HTTPRequest& outReq,
                       int& outErrCode);
+
+    bool parseRequestHead(const std::string& raw,
+                          int listenPort,
+                          HTTPRequest& outReq,
+                          int& outErrCode,
+                          size_t& outContentLen);
 }
 
 #endif
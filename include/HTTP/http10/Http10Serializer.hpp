@@ -14,12 +14,14 @@
 #define HTTP10SERIALIZER_HPP
 
 #include "../HttpResponse.hpp"
+#include "../SharedBuffer.hpp"
 #include <string>
 
 namespace http10
 {
-    std::string makeError(int code, const char* msg);
+    SharedBuffer makeError(int code, const char* msg);
     std::string serializeClose(const HTTPResponse& res);
+    std::string serializeHeadClose(const HTTPResponse& res);
 }
 
 #endif
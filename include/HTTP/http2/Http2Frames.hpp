@@ -0,0 +1,95 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Http2Frames.hpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 15:42:06 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 15:42:06 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef HTTP2FRAMES_HPP
+#define HTTP2FRAMES_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// what a client sends first on a prior-knowledge connection (RFC 9113 3.4)
+#define H2_PREFACE     "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+
+#define H2_FRAME_HEADER_LEN 9
+#define H2_DEFAULT_FRAME    16384        // SETTINGS_MAX_FRAME_SIZE initial value
+#define H2_DEFAULT_WINDOW   65535        // initial flow-control window
+#define H2_MAX_WINDOW       0x7fffffffL
+
+// frame types
+#define H2_DATA           0x0
+#define H2_HEADERS        0x1
+#define H2_PRIORITY       0x2
+#define H2_RST_STREAM     0x3
+#define H2_SETTINGS       0x4
+#define H2_PUSH_PROMISE   0x5
+#define H2_PING           0x6
+#define H2_GOAWAY         0x7
+#define H2_WINDOW_UPDATE  0x8
+#define H2_CONTINUATION   0x9
+
+// flags
+#define H2_FLAG_END_STREAM   0x1
+#define H2_FLAG_ACK          0x1
+#define H2_FLAG_END_HEADERS  0x4
+#define H2_FLAG_PADDED       0x8
+#define H2_FLAG_PRIORITY     0x20
+
+// settings
+#define H2_SET_HEADER_TABLE_SIZE      0x1
+#define H2_SET_ENABLE_PUSH            0x2
+#define H2_SET_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SET_INITIAL_WINDOW_SIZE    0x4
+#define H2_SET_MAX_FRAME_SIZE         0x5
+#define H2_SET_MAX_HEADER_LIST_SIZE   0x6
+
+// error codes
+#define H2_NO_ERROR            0x0
+#define H2_PROTOCOL_ERROR      0x1
+#define H2_INTERNAL_ERROR      0x2
+#define H2_FLOW_CONTROL_ERROR  0x3
+#define H2_STREAM_CLOSED       0x5
+#define H2_FRAME_SIZE_ERROR    0x6
+#define H2_REFUSED_STREAM      0x7
+#define H2_CANCEL              0x8
+#define H2_COMPRESSION_ERROR   0x9
+
+namespace http2
+{
+    struct FrameHeader
+    {
+        size_t       length;
+        int          type;
+        int          flags;
+        unsigned int streamId;
+    };
+
+    typedef std::vector<std::pair<int, unsigned int> > Settings;
+
+    unsigned int readU32(const char* p);
+    void         parseFrameHeader(const char* p, FrameHeader& out);
+    bool         parseSettings(const std::string& payload, Settings& out);
+
+    void appendFrameHeader(std::string& out, size_t length, int type, int flags, unsigned int streamId);
+    void appendSettings(std::string& out, const Settings& s);
+    void appendSettingsAck(std::string& out);
+    void appendWindowUpdate(std::string& out, unsigned int streamId, unsigned int increment);
+    void appendRstStream(std::string& out, unsigned int streamId, unsigned int code);
+    void appendGoaway(std::string& out, unsigned int lastStreamId, unsigned int code);
+    void appendPingAck(std::string& out, const std::string& opaque);
+    // one header block: HEADERS, plus CONTINUATION frames past maxFrame
+    void appendHeaders(std::string& out, unsigned int streamId, const std::string& block,
+                       bool endStream, size_t maxFrame);
+}
+
+#endif
@@ -0,0 +1,85 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Http2Hpack.hpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 15:10:24 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 15:10:24 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef HTTP2HPACK_HPP
+#define HTTP2HPACK_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+
+// SETTINGS_HEADER_TABLE_SIZE default, for both directions
+#define HPACK_TABLE_SIZE 4096
+
+namespace http2
+{
+    typedef std::pair<std::string, std::string> HeaderField;
+
+    // HPACK (RFC 7541) dynamic table: newest entry first, an entry costs
+    // name + value + 32 bytes, the oldest ones go when it gets too big.
+    class HpackTable
+    {
+    public:
+        HpackTable();
+
+        void   setMaxSize(size_t n);
+        size_t maxSize() const;
+        void   add(const std::string& name, const std::string& value);
+
+        // 1-based across the static table (1..61) and this one (62..)
+        bool   get(size_t index, HeaderField& out) const;
+        // 0: not found; `nameOnly` set when only the name matched
+        size_t find(const std::string& name, const std::string& value, bool& nameOnly) const;
+
+    private:
+        std::deque<HeaderField> _entries;
+        size_t                  _size;
+        size_t                  _maxSize;
+
+        void evict(size_t limit);
+    };
+
+    class HpackDecoder
+    {
+    public:
+        HpackDecoder();
+
+        // false: the block is malformed, or its header list (name + value + 32
+        // per field, as in SETTINGS_MAX_HEADER_LIST_SIZE) passes maxListSize:
+        // COMPRESSION_ERROR, the connection is lost
+        bool decode(const std::string& block, std::vector<HeaderField>& out, size_t maxListSize);
+
+    private:
+        HpackTable _table;
+    };
+
+    class HpackEncoder
+    {
+    public:
+        HpackEncoder();
+
+        // SETTINGS_HEADER_TABLE_SIZE from the peer; announced in the next block
+        void setPeerMaxSize(size_t n);
+        void encode(const std::vector<HeaderField>& fields, std::string& out);
+
+    private:
+        HpackTable _table;
+        bool       _sizeChanged;
+    };
+
+    bool huffmanDecode(const std::string& in, std::string& out);
+    void huffmanEncode(const std::string& in, std::string& out);
+    size_t huffmanLength(const std::string& in);
+}
+
+#endif
@@ -16,15 +16,59 @@
 #include "sockets/IByteHandler.hpp"
 #include "sockets/ICgiHandler.hpp"
 #include "config_headers/Config.hpp"
+#include "Router_headers/DeflateStream.hpp"
+#include "Router_headers/CgiCache.hpp"
+#include "HTTP/HttpRequest.hpp"
 #include <string>
+#include <map>
 
 class Router;
 
 class RouterByteHandler : public IByteHandler, public ICgiHandler
 {
 private:
-    Config  _cfg;
-    Router* _router;
+    Config      _cfg;
+    Router*     _router;
+    std::string _configPath;
+
+    // response compression decided when a CGI starts, applied when it finishes
+    struct CgiEncode
+    {
+        LocationConfig loc;
+        std::string    coding;
+        DeflateStream* stream;   // set while a streamed body is being compressed
+    };
+    std::map<int, CgiEncode> _cgiEncode;   // by client fd
+
+    // the request behind each running script (no body), for X-Accel-Redirect
+    std::map<int, HTTPRequest> _cgiRequests;
+
+    void dropCgiEncode(int clientFd);
+
+    // cgi_cache: output of a run whose answer may be stored, by client fd
+    // (or by refresh id, < 0, for the runs no client is waiting on)
+    struct CgiCapture
+    {
+        std::string    key;
+        LocationConfig loc;
+        HTTPResponse   head;
+        std::string    body;
+        bool           refresh;   // the entry's one refresh run
+        std::string    flightKey; // cgi_collapse: joined requests wait for this answer
+        std::string    coding;    // ...encoded the way the leader asked for it
+    };
+    std::map<int, CgiCapture> _cgiCapture;
+    CgiCache                  _cgiCache;
+    int                       _refreshSeq;
+
+    std::map<std::string, int>          _cgiFlights;   // collapse key -> leading client fd
+    std::map<std::string, SharedBuffer> _cgiLanded;    // finished leaders' answers, until taken
+
+    void         dropCgiCapture(int id);
+    void         storeCgiCapture(int id, HTTPResponse& res);
+    CgiStartResult startCgiRun(int acceptFd, int clientFd, const std::string& rawMessage,
+                               bool headOnly, int flags, int stdinFd);
+    SharedBuffer cachedCgiReply(CgiCache::Entry& e, const std::string& coding);
 
     RouterByteHandler(const RouterByteHandler&);
     RouterByteHandler& operator=(const RouterByteHandler&);
@@ -33,15 +77,27 @@ public:
     RouterByteHandler(const std::string& configPath);
     virtual ~RouterByteHandler();
 
+    bool reloadConfig();
+
     virtual ByteReply handleBytes(int acceptFd, const std::string& rawMessage);
 
-    virtual CgiStartResult tryStartCgi(int acceptFd, const std::string& rawMessage);
+    virtual CgiStartResult tryStartCgi(int acceptFd, int clientFd, const std::string& rawMessage,
+                                       bool headOnly, int flags);
+    virtual CgiStartResult startCgiWithStdin(int acceptFd, int clientFd,
+                                             const std::string& headMessage, int stdinFd);
     virtual CgiFinishResult finishCgi(int acceptFd, int clientFd, const std::string& cgiStdout);
+    virtual bool cgiDelegated(int acceptFd, int clientFd, const std::string& headerBlock, ByteReply& out);
+    virtual bool startCgiResponse(int acceptFd, int clientFd, const std::string& headerBlock, std::string& outHead);
+    virtual bool encodeCgiBody(int clientFd, const char* data, size_t len, bool last, std::string& out);
+    virtual void abortCgi(int clientFd);
+    virtual void finishCgiRefresh(int refreshId, const std::string& cgiStdout);
+    virtual bool takeCollapsed(const std::string& collapseKey, SharedBuffer& out);
     bool planUploadFd(int acceptFd,
                   const std::string& uri,
                   const std::string& mpFilename,
                   int& outFd,
-                  std::string& outErrBytes);
+                  SharedBuffer& outErrBytes,
+                  RouteLabel& outRoute);
 };
 
 #endif
@@ -0,0 +1,66 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   CgiCache.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 10:12:41 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 10:12:41 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef CGICACHE_HPP
+#define CGICACHE_HPP
+
+#include "HttpResponse.hpp"
+#include "Config.hpp"
+#include "SharedBuffer.hpp"
+#include <string>
+#include <map>
+#include <list>
+#include <ctime>
+
+// Micro-cache for CGI GET responses (`cgi_cache`), keyed by vhost + path +
+// query. An entry keeps the parsed response plus its serialized variants
+// (identity, gzip, ...) so a hit is one shared buffer, no copy. Past its TTL
+// it may still be served for `cgi_cache_stale` seconds; the first lookup in
+// that window gets REFRESH and is the one that re-runs the script.
+class CgiCache
+{
+public:
+    enum Lookup { MISS, FRESH, STALE, REFRESH };
+
+    struct Entry
+    {
+        HTTPResponse                        res;
+        LocationConfig                      loc;        // compression settings for the variants
+        std::map<std::string, SharedBuffer> variants;   // by content coding, "" = identity
+        std::time_t                         expires;
+        std::time_t                         staleUntil;
+        bool                                refreshing;
+        size_t                              bytes;
+        std::list<std::string>::iterator    lru;
+    };
+
+    CgiCache();
+
+    void   setLimit(size_t maxBytes);
+
+    Lookup lookup(const std::string& key, std::time_t now, Entry*& out);
+    void   put(const std::string& key, const HTTPResponse& res, const LocationConfig& loc,
+               int ttlSec, int staleSec, std::time_t now);
+    void   addVariant(Entry& e, const std::string& coding, const SharedBuffer& bytes);
+    void   refreshFailed(const std::string& key);
+    void   clear();
+
+private:
+    std::map<std::string, Entry> _entries;
+    std::list<std::string>       _lru;      // front = most recently used
+    size_t                       _bytes;
+    size_t                       _maxBytes;
+
+    void erase(std::map<std::string, Entry>::iterator it);
+};
+
+#endif
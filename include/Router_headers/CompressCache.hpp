@@ -0,0 +1,59 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   CompressCache.hpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/12 10:04:37 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/12 10:04:37 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef COMPRESSCACHE_HPP
+#define COMPRESSCACHE_HPP
+
+#include "SharedBuffer.hpp"
+#include <string>
+#include <map>
+#include <list>
+#include <sys/stat.h>
+
+// Compressed variants of static files, one per (coding, path).
+// An entry is only reused while the file's inode/size/mtime and the
+// compression level still match; total bytes are capped, oldest use evicted.
+class CompressCache
+{
+public:
+    CompressCache();
+
+    void setLimit(size_t maxBytes);
+    // would put() keep a variant this big (a quarter of the budget at most)
+    bool fits(size_t bytes) const;
+
+    bool get(const std::string& coding, int level, const std::string& path,
+             const struct stat& st, SharedBuffer& out);
+    void put(const std::string& coding, int level, const std::string& path,
+             const struct stat& st, const SharedBuffer& data);
+    void clear();
+
+private:
+    struct Entry
+    {
+        SharedBuffer                     data;
+        ino_t                            ino;
+        off_t                            size;
+        time_t                           mtime;
+        int                              level;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::map<std::string, Entry> _entries;
+    std::list<std::string>       _lru;      // front = most recently used
+    size_t                       _bytes;
+    size_t                       _maxBytes;
+
+    void erase(std::map<std::string, Entry>::iterator it);
+};
+
+#endif
@@ -0,0 +1,39 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   DeflateStream.hpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/15 14:06:51 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/15 14:06:51 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef DEFLATESTREAM_HPP
+#define DEFLATESTREAM_HPP
+
+#include <string>
+#include <zlib.h>
+
+// gzip/deflate encoder for a body that arrives in pieces (streamed CGI
+// output). Every push() ends with a sync flush, so whatever the script has
+// written so far reaches the client instead of waiting in zlib's window.
+class DeflateStream
+{
+public:
+    DeflateStream();
+    ~DeflateStream();
+
+    bool begin(const std::string& coding, int level);
+    bool push(const char* data, size_t len, bool last, std::string& out);
+
+private:
+    z_stream _zs;
+    bool     _open;
+
+    DeflateStream(const DeflateStream&);
+    DeflateStream& operator=(const DeflateStream&);
+};
+
+#endif
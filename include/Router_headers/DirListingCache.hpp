@@ -0,0 +1,65 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   DirListingCache.hpp                                :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/13 09:12:40 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/13 09:12:40 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef DIRLISTINGCACHE_HPP
+#define DIRLISTINGCACHE_HPP
+
+#include "SharedBuffer.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <sys/stat.h>
+
+// Autoindex state per directory: the scanned entries plus every rendered
+// page (by sort/page query), valid while the directory's mtime is unchanged.
+// Total bytes are capped; least recently used directories are dropped first.
+class DirListingCache
+{
+public:
+    struct Item
+    {
+        std::string name;
+        bool        isDir;
+        bool        statted;   // size/mtime filled (only needed to sort by them)
+        off_t       size;
+        time_t      mtime;
+        Item() : name(), isDir(false), statted(false), size(0), mtime(0) {}
+    };
+
+    struct Listing
+    {
+        time_t                                           mtimeSec;
+        long                                             mtimeNsec;
+        bool                                             scanned;
+        std::vector<Item>                                items;   // name order
+        std::map<std::string, std::vector<SharedBuffer> > views;  // rendered pages
+        std::list<std::string>::iterator                 lru;
+        size_t                                           bytes;
+    };
+
+    explicit DirListingCache(size_t maxBytes);
+
+    Listing& get(const std::string& dir, const struct stat& st);
+    void     account(const std::string& dir);
+    void     clear();
+
+private:
+    std::map<std::string, Listing> _dirs;
+    std::list<std::string>         _lru;      // front = most recently used
+    size_t                         _bytes;
+    size_t                         _maxBytes;
+
+    void erase(std::map<std::string, Listing>::iterator it);
+};
+
+#endif
@@ -0,0 +1,47 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FileMetaCache.hpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/11 15:20:44 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/11 15:20:44 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef FILEMETACACHE_HPP
+#define FILEMETACACHE_HPP
+
+#include <string>
+#include <map>
+#include <ctime>
+#include <sys/stat.h>
+
+// Small stat() cache: results (including "does not exist") are reused for
+// `validSec` seconds, so probing for optional files like `x.gz` / `x.br`
+// costs one stat per second per path instead of one per request.
+class FileMetaCache
+{
+public:
+    FileMetaCache(int validSec, size_t maxEntries);
+
+    bool lookup(const std::string& path, struct stat& out);
+    void clear();
+
+private:
+    struct Entry
+    {
+        bool        exists;
+        struct stat st;
+        std::time_t checked;
+    };
+
+    std::map<std::string, Entry> _entries;
+    int                          _validSec;
+    size_t                       _maxEntries;
+
+    void prune(std::time_t now);
+};
+
+#endif
@@ -0,0 +1,51 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   MimeTypes.hpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/10 14:02:11 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/10 14:02:11 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef MIMETYPES_HPP
+#define MIMETYPES_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+// Extension -> Content-Type table.
+// Built once per server from the built-in defaults plus the server's
+// `types { ... }` block (config entries win), then stored as a small
+// open-addressing hash table keyed by the lowercase extension.
+class MimeTypes
+{
+public:
+    MimeTypes();
+
+    void build(const std::map<std::string, std::string>& overrides);
+
+    const std::string& lookup(const std::string& filepath) const;
+    const std::string& lookupExt(const char* ext, size_t len) const;
+
+    static const std::string& defaultType();
+
+private:
+    struct Slot
+    {
+        bool        used;
+        std::string ext;
+        std::string type;
+        Slot() : used(false), ext(), type() {}
+    };
+
+    std::vector<Slot> _slots;
+    size_t            _mask;
+
+    void insert(const std::string& ext, const std::string& type);
+};
+
+#endif
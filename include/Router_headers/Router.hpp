@@ -16,6 +16,11 @@
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
 #include "Config.hpp"
+#include "MimeTypes.hpp"
+#include "FileMetaCache.hpp"
+#include "CompressCache.hpp"
+#include "DirListingCache.hpp"
+#include "IByteHandler.hpp"
 #include <iostream>
 #include <algorithm>
 #include <sstream>
@@ -32,7 +37,11 @@ public:
     Router(const Config& config);
     ~Router();
 
-    HTTPResponse handle_route_Request(const HTTPRequest& request) const;
+    HTTPResponse handle_route_Request(const HTTPRequest& request, RouteLabel* route = NULL) const;
+    HTTPResponse handle_internal_request(const HTTPRequest& request) const;
+    bool         internal_uri_for_file(const ServerConfig& server_config,
+                                       const std::string& path,
+                                       std::string& outUri) const;
     HTTPResponse apply_error_page(const ServerConfig& server_config, int status_code, HTTPResponse response) const;
 
     struct CgiSpawn
@@ -46,9 +55,11 @@ public:
     bool spawn_cgi(const HTTPRequest& request,
                    const std::string& fullpath,
                    const LocationConfig& location_config,
+                   int stdinFd,
                    CgiSpawn& outSpawn) const;
 
     HTTPResponse parse_cgi_response(const std::string& cgi_output) const;
+    void         parse_cgi_headers(const std::string& header_section, HTTPResponse& response) const;
 
     const ServerConfig&    find_server_config(const HTTPRequest& request) const;
     const LocationConfig*  find_location_config(const std::string &uri, const ServerConfig& server_config) const;
@@ -62,15 +73,81 @@ public:
     std::vector<std::string> build_cgi_environment(const HTTPRequest& request, const std::string& fullpath) const;
     bool        is_method_allowed(const LocationConfig& location_config, HTTPMethod method) const;
 
+    const std::string& get_mime_type(const ServerConfig& server_config, const std::string& filepath) const;
+
+    std::string negotiate_compression(const LocationConfig& location_config, const HTTPRequest& request) const;
+    void        compress_response(const LocationConfig& location_config,
+                                  const std::string& coding,
+                                  HTTPResponse& response) const;
+    bool        compress_stream_head(const LocationConfig& location_config,
+                                     const std::string& coding,
+                                     HTTPResponse& head) const;
+
 private:
     const Config& _config;
 
-    std::string get_mime_type(const std::string& filepath) const;
-    std::string read_file_binary(const std::string& filepath) const;
+    HTTPResponse route_request(const HTTPRequest& request, bool internal, RouteLabel* route) const;
+    HTTPResponse metrics_response(const HTTPRequest& request) const;
 
-    HTTPResponse generate_autoindex_response(const std::string& path) const;
+    // error_page files, read once when the router is built (config load/reload)
+    struct ErrorPage
+    {
+        std::vector<char> body;
+        std::map<std::string, std::string> headers;   // exactly what prebuilt carries
+        SharedBuffer      prebuilt;   // full response bytes for the plain case
+    };
+    std::map<const ServerConfig*, std::map<int, ErrorPage> > _errorPages;
+
+    void preload_error_pages();
+
+    // per-server extension -> Content-Type tables (defaults + `types` block)
+    std::map<const ServerConfig*, MimeTypes> _mimeTypes;
+
+    void build_mime_types();
+
+    // stat() results for optional files (precompressed sidecars), ~1s validity
+    mutable FileMetaCache _meta;
+
+    // per-server compressed variants of static files (gzip on)
+    mutable std::map<const ServerConfig*, CompressCache> _gzipCache;
+
+    void  build_compress_caches();
+    float accept_encoding_q(const HTTPRequest& request, const std::string& coding) const;
+    bool  compressible_type(const LocationConfig& location_config, const std::string& contentType) const;
+    bool  compress_static_file(const ServerConfig& server_config,
+                               const LocationConfig& location_config,
+                               const std::string& coding,
+                               const std::string& path,
+                               const struct stat& st,
+                               SharedBuffer& out) const;
+    bool  static_variant_fits(const ServerConfig& server_config, size_t fileSize) const;
+    bool  cached_static_variant(const ServerConfig& server_config,
+                                const LocationConfig& location_config,
+                                const std::string& coding,
+                                const std::string& path,
+                                const struct stat& st,
+                                SharedBuffer& out) const;
+
+    // scanned entries and rendered autoindex pages, per directory
+    mutable DirListingCache _listings;
+
+    HTTPResponse generate_autoindex_response(const LocationConfig& location_config,
+                                             const std::string& path,
+                                             const struct stat& dirSt,
+                                             const std::string& uri) const;
     // HTTPResponse handle_cgi_request(const HTTPRequest& request, const std::string& fullpath, const LocationConfig& location_config) const;
-    HTTPResponse serve_static_file(const std::string& fullpath) const;
+    HTTPResponse serve_static_file(const ServerConfig& server_config,
+                                   const LocationConfig& location_config,
+                                   const HTTPRequest& request,
+                                   const std::string& fullpath,
+                                   const struct stat& fileSt) const;
+    bool         pick_static_sidecar(const LocationConfig& location_config,
+                                     const HTTPRequest& request,
+                                     const std::string& fullpath,
+                                     const struct stat& st,
+                                     std::string& outPath,
+                                     struct stat& outSt,
+                                     std::string& outEncoding) const;
 
     HTTPResponse handle_post_request(const HTTPRequest& request,
                                      const LocationConfig& location_config,
@@ -16,6 +16,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <sys/socket.h>
 
 // location /images {
 //     autoindex on;
@@ -23,7 +24,36 @@
 //     upload_enable on;
 //     upload_store /var/www/uploads;
 //     cgi_extension .py /usr/bin/python3;
+//     fastcgi_pass unix:/run/php/php-fpm.sock;
+//     proxy_pass http://127.0.0.1:9000;
+//     proxy_connect_timeout 5;
+//     proxy_read_timeout 60;
 //     return 301 /new_images;
+//     gzip_static on;
+//     br_static on;
+//     gzip on;
+//     gzip_types text/css application/javascript;
+//     gzip_min_length 256;
+//     gzip_max_length 10485760;
+//     gzip_comp_level 1;
+//     autoindex_per_page 1000;
+//     cgi_timeout 30;
+//     cgi_max_concurrent 16;
+//     cgi_queue_size 100;
+//     cgi_queue_timeout 10;
+//     cgi_cache 5;
+//     cgi_cache_stale 30;
+//     cgi_collapse on;
+//     cgi_cache_cookies off;
+//     cgi_buffer_size 1048576;
+//     cgi_body_file 1048576;
+//     cgi_cpu_limit 10;
+//     cgi_memory_limit 536870912;
+//     cgi_nice 10;
+//     cgi_cgroup /sys/fs/cgroup/webserv-cgi;
+//     internal on;
+//     metrics on;
+//     slow_request_log 500;
 // }
 
 class LocationConfig {
@@ -31,14 +61,53 @@ class LocationConfig {
         int                                returnCode;        // redirect code (301), 0 if none
         bool                               uploadEnable;      // Upload enable on/off
         bool                               autoindex;         // Autoindex on/off
+        bool                               gzipStatic;        // gzip_static on/off (serve file.gz)
+        bool                               brStatic;          // br_static on/off (serve file.br)
+        bool                               gzip;              // gzip on/off (compress responses on the fly)
+        bool                               cgiCollapse;       // identical CGI GETs in flight share one run
+        bool                               cgiCacheCookies;   // requests with a Cookie may be cached / collapsed too
+        bool                               internal;          // only reachable through X-Accel-Redirect / X-Sendfile
+        bool                               metrics;           // answers with the server's counters (Prometheus / JSON)
+        int                                gzipCompLevel;     // zlib level 1..9
+        size_t                             gzipMinLength;     // smaller bodies are sent as is
+        size_t                             gzipMaxLength;     // bigger bodies are sent as is (CPU budget per response)
+        size_t                             autoindexPerPage;  // listing entries per page, 0 = one page up to 10000
+        int                                cgiTimeout;        // seconds a script may stay silent before 504
+        size_t                             cgiMaxConcurrent;  // scripts running at once here, 0 = no limit
+        size_t                             cgiQueueSize;      // requests waiting for a free slot before 503
+        int                                cgiQueueTimeout;   // seconds a request may wait for a slot
+        int                                cgiCache;          // seconds a GET response is reused, 0 = no caching
+        int                                cgiCacheStale;     // seconds past that it is still served while one run refreshes it
+        size_t                             cgiBufferSize;     // output held in memory for a slow client, past that spooled to a temp file (0 = pause the script)
+        size_t                             cgiBodyFile;       // bodies this big reach the script as a file on stdin, not a pipe (0 = never)
+        int                                cgiCpuLimit;       // CPU seconds a script may use (RLIMIT_CPU), 0 = no limit
+        size_t                             cgiMemoryLimit;    // address space of a script in bytes (RLIMIT_AS), 0 = no limit
+        int                                cgiNice;           // niceness of scripts, 0..19
+        int                                proxyConnectTimeout; // seconds to connect to the upstream before 502
+        int                                proxyReadTimeout;  // seconds the upstream may stay silent before 504
+        int                                slowRequestLog;    // ms: slower requests are logged with their phases, 0 = off
         std::string                        path;              // Location path (/images)
         std::string                        returnPath;        // redirect path (/new_images)
         std::string                        uploadStore;       // Upload storage path (/var/www/uploads)
         std::string                        root;              // Root for this location 
+        std::string                        fastcgiPass;       // FastCGI upstream (unix:/path or host:port)
+        std::string                        cgiCgroup;         // cgroup v2 directory scripts are moved into
+        std::string                        proxyPass;         // upstream HTTP server (http://host:port[/path])
         std::vector<std::string>           allowMethods;      // Allowed methods (GET, POST, DELETE)
         std::map<std::string, std::string> cgiExtensions;     // CGI (.py, /usr/bin/python3)
+        std::vector<std::string>           gzipTypes;         // MIME types to compress (text/html always)
+        std::string                        proxyAddress;      // proxy_pass "host:port"
+        std::string                        proxyPath;         // proxy_pass path ("" if none)
+        struct sockaddr_storage            proxyAddr;         // proxyAddress, resolved when the config is loaded
+        socklen_t                          proxyAddrLen;
 
-        LocationConfig() : returnCode(0), uploadEnable(false), autoindex(false) {}
+        LocationConfig() : returnCode(0), uploadEnable(false), autoindex(false), gzipStatic(false), brStatic(false),
+                           gzip(false), cgiCollapse(false), cgiCacheCookies(false), internal(false), metrics(false), gzipCompLevel(1), gzipMinLength(256), gzipMaxLength(10 * 1024 * 1024),
+                           autoindexPerPage(0), cgiTimeout(30), cgiMaxConcurrent(0), cgiQueueSize(100),
+                           cgiQueueTimeout(10), cgiCache(0), cgiCacheStale(0), cgiBufferSize(0), cgiBodyFile(0),
+                           cgiCpuLimit(0), cgiMemoryLimit(0), cgiNice(0),
+                           proxyConnectTimeout(5), proxyReadTimeout(60), slowRequestLog(0),
+                           proxyAddr(), proxyAddrLen(0) {}
 };
 
 // server {
@@ -48,6 +117,14 @@ class LocationConfig {
 //     index index.html;
 //     client_max_body_size 1000000;
 //     error_page 404 /errors/404.html;
+//     gzip_cache_size 16777216;
+//     listen 8443 ssl;
+//     ssl_certificate cert.pem;
+//     ssl_certificate_key key.pem;
+//     ssl_session_cache 20480;
+//     ssl_session_timeout 300;
+//     ssl_session_tickets on;
+//     access_log logs/access.log json;
 // }
 
 class ServerConfig {
@@ -59,9 +136,21 @@ class ServerConfig {
         std::string                              index;                // Index file (index.html)
         std::string                              server_name;          // Server name (mysite)
         std::map<int, std::string>               error_Pages;          // Error pages (404, /errors/404.html)
+        std::map<std::string, std::string>       mimeTypes;            // types { image/svg+xml svg; } (svg, image/svg+xml)
+        size_t                                   gzipCacheSize;        // bytes of compressed static variants kept (16M)
+        bool                                     ssl;                  // listen 443 ssl: TLS on this port
+        std::string                              sslCertificate;       // PEM certificate chain
+        std::string                              sslCertificateKey;    // PEM private key
+        size_t                                   sslSessionCache;      // sessions kept for resumption, 0 = no cache
+        int                                      sslSessionTimeout;    // seconds a session can be resumed
+        bool                                     sslSessionTickets;    // resume from tickets the client keeps
+        std::string                              accessLog;            // access log file, empty = no log
+        bool                                     accessLogJson;        // one JSON object per line instead of the combined format
         std::vector<LocationConfig>              locations;            // Location configurations
 
-        ServerConfig() : port(80), listen_line(-1), client_Max_Body_Size(0), root("./www"), index("index.html"), server_name("default") {}
+        ServerConfig() : port(80), listen_line(-1), client_Max_Body_Size(0), root("./www"), index("index.html"), server_name("default"), gzipCacheSize(16 * 1024 * 1024),
+                         ssl(false), sslCertificate(), sslCertificateKey(), sslSessionCache(20480), sslSessionTimeout(300),
+                         sslSessionTickets(true), accessLog(), accessLogJson(false) {}
 };
 
 // server {
@@ -95,6 +184,17 @@ class Config {
 //     index index.html;                 ==>     ServerConfig::index
 //     client_max_body_size 1000000;     ==>     ServerConfig::client_Max_Body_Size
 //     error_page 404 /errors/404.html;  ==>     ServerConfig::error_Pages[404] = returnPath::/errors/404.html
+//     types {                           ==>     ServerConfig::mimeTypes["svg"] = "image/svg+xml"
+//         image/svg+xml svg svgz;       ==>     ServerConfig::mimeTypes["svgz"] = "image/svg+xml"
+//     }
+//     gzip_cache_size 16777216;         ==>     ServerConfig::gzipCacheSize
+//     listen 8443 ssl;                  ==>     ServerConfig::port, ServerConfig::ssl
+//     ssl_certificate cert.pem;         ==>     ServerConfig::sslCertificate
+//     ssl_certificate_key key.pem;      ==>     ServerConfig::sslCertificateKey
+//     ssl_session_cache 20480;          ==>     ServerConfig::sslSessionCache
+//     ssl_session_timeout 300;          ==>     ServerConfig::sslSessionTimeout
+//     ssl_session_tickets on;           ==>     ServerConfig::sslSessionTickets
+//     access_log logs/access.log json;  ==>     ServerConfig::accessLog, ServerConfig::accessLogJson
 
 //     location /images {
 //         autoindex on;                       ==>     LocationConfig::autoindex
@@ -102,7 +202,34 @@ class Config {
 //         upload_enable on;                   ==>    LocationConfig::uploadEnable
 //         upload_store /var/www/uploads;      ==>    LocationConfig::uploadStore
 //         cgi_extension .py /usr/bin/python3; ==>    LocationConfig::cgiExtensions[".py"] = "/usr/bin/python3";
+//         fastcgi_pass 127.0.0.1:9000;        ==>    LocationConfig::fastcgiPass = "127.0.0.1:9000";
 //         return 301 /new_images;             ==>    LocationConfig::returnCode = 301; LocationConfig::returnPath = "/new_images";
+//         gzip on;                            ==>    LocationConfig::gzip
+//         gzip_types text/css text/plain;     ==>    LocationConfig::gzipTypes ["text/css", "text/plain"]
+//         gzip_min_length 256;                ==>    LocationConfig::gzipMinLength
+//         gzip_max_length 10485760;           ==>    LocationConfig::gzipMaxLength
+//         gzip_comp_level 1;                  ==>    LocationConfig::gzipCompLevel
+//         autoindex_per_page 1000;            ==>    LocationConfig::autoindexPerPage
+//         cgi_timeout 30;                     ==>    LocationConfig::cgiTimeout
+//         cgi_max_concurrent 16;              ==>    LocationConfig::cgiMaxConcurrent
+//         cgi_queue_size 100;                 ==>    LocationConfig::cgiQueueSize
+//         cgi_queue_timeout 10;               ==>    LocationConfig::cgiQueueTimeout
+//         cgi_cache 5;                        ==>    LocationConfig::cgiCache
+//         cgi_cache_stale 30;                 ==>    LocationConfig::cgiCacheStale
+//         cgi_collapse on;                    ==>    LocationConfig::cgiCollapse
+//         cgi_cache_cookies off;              ==>    LocationConfig::cgiCacheCookies
+//         cgi_buffer_size 1048576;            ==>    LocationConfig::cgiBufferSize
+//         cgi_body_file 1048576;              ==>    LocationConfig::cgiBodyFile
+//         cgi_cpu_limit 10;                   ==>    LocationConfig::cgiCpuLimit
+//         cgi_memory_limit 536870912;         ==>    LocationConfig::cgiMemoryLimit
+//         cgi_nice 10;                        ==>    LocationConfig::cgiNice
+//         cgi_cgroup /sys/fs/cgroup/x;        ==>    LocationConfig::cgiCgroup
+//         proxy_pass http://127.0.0.1:9000;   ==>    LocationConfig::proxyPass (+ proxyAddress, proxyAddr)
+//         proxy_connect_timeout 5;            ==>    LocationConfig::proxyConnectTimeout
+//         proxy_read_timeout 60;              ==>    LocationConfig::proxyReadTimeout
+//         internal on;                        ==>    LocationConfig::internal
+//         metrics on;                         ==>    LocationConfig::metrics
+//         slow_request_log 500;               ==>    LocationConfig::slowRequestLog
 //     }
 
 //     location /upload {
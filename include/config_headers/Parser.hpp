@@ -33,9 +33,17 @@ class Parser {
         int                    root_index_parse(int &_pos, ServerConfig &serverConfig);
         int                    location_root_parse(int &_pos, LocationConfig &locConfig);
         int                    server_name_parse(int &_pos, ServerConfig &serverConfig);
+        int                    ssl_parse(int &_pos, ServerConfig &serverConfig);
+        int                    access_log_parse(int &_pos, ServerConfig &serverConfig);
         int                    cgi_extension_parse(int &_pos, LocationConfig &locConfig);
+        int                    fastcgi_pass_parse(int &_pos, LocationConfig &locConfig);
+        int                    cgi_cgroup_parse(int &_pos, LocationConfig &locConfig);
+        int                    proxy_pass_parse(int &_pos, LocationConfig &locConfig);
         int                    allow_methods_parse(int &_pos, LocationConfig &locConfig);  
+        int                    gzip_types_parse(int &_pos, LocationConfig &locConfig);
+        int                    location_numbers_parse(int &_pos, LocationConfig &locConfig);
         int                    error_page_parse(int &_pos, ServerConfig &serverConfig);
+        int                    types_parse(int &_pos, ServerConfig &serverConfig);
         void error_duplicate_port(int port, int line);
 
     public:
@@ -0,0 +1,88 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   AccessLog.hpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 19:05:27 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 19:05:27 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef ACCESSLOG_HPP
+#define ACCESSLOG_HPP
+
+#include "NetChannel.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+
+// ring buffer of each log file; a record that does not fit is dropped
+#define ACCESS_LOG_BUFFER (256 * 1024)
+// buffered lines are written at least this often
+#define ACCESS_LOG_FLUSH_MS 1000
+
+// The access log: one line per request (nginx's combined format plus the
+// request time and its phases, or one JSON object), per `access_log` file.
+//
+// Lines go into a ring buffer per file; the reactor calls pump() every tick
+// and the buffer is written with one writev() a second, or as soon as it is
+// half full. The writes happen on the reactor thread, and O_NONBLOCK does
+// nothing for regular files: a flush to one waits for the disk (normally just
+// the page cache), so batching is what keeps the cost down. Only a fifo or a
+// socket is written non-blocking. What a write does not take stays for the
+// next flush, and a line that does not fit in the ring is dropped and counted
+// in the metrics.
+class AccessLog
+{
+public:
+    AccessLog();
+    ~AccessLog();
+
+    // at startup: a file that cannot be opened stops the server (`err` set)
+    bool open(const std::string& path, std::string& err);
+
+    // the request on a channel is over (after the metrics took it)
+    void record(const NetChannel::RequestTrace& t, int status, long long totalUs,
+                const long long* phaseUs, const std::string& peer);
+
+    void pump();        // timed flush, from the reactor
+    void flushAll();
+    void reopen();      // SIGUSR1: log rotation
+
+private:
+    struct Sink
+    {
+        std::string       path;
+        int               fd;
+        std::vector<char> ring;
+        size_t            head;     // oldest unwritten byte
+        size_t            used;
+        bool              failed;   // error already reported
+
+        Sink() : path(), fd(-1), ring(), head(0), used(0), failed(false) {}
+    };
+
+    std::map<std::string, Sink> _sinks;
+    bool                        _dirty;         // something buffered
+    long long                   _lastFlushUs;
+    std::time_t                 _stampSec;      // the time strings below are for this second
+    std::string                 _stampLocal;    // 19/Oct/2026:14:16:02 +0000
+    std::string                 _stampIso;      // 2026-10-19T14:16:02+0000
+
+    AccessLog(const AccessLog&);
+    AccessLog& operator=(const AccessLog&);
+
+    Sink& sinkFor(const std::string& path);
+    bool  openSink(Sink& s);
+    void  append(Sink& s, const std::string& line);
+    void  flush(Sink& s);
+    void  refreshStamps();
+};
+
+// the process-wide instance
+AccessLog& access_log();
+
+#endif
@@ -0,0 +1,125 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FastCgiPool.hpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/14 11:03:26 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/14 11:03:26 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef FASTCGIPOOL_HPP
+#define FASTCGIPOOL_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <utility>
+
+// upper bounds per upstream address
+#define FCGI_MAX_CONNS          8    // persistent connections
+#define FCGI_MAX_REQS_PER_CONN  16   // in flight per connection, if the app multiplexes
+// requests waiting for a connection, all addresses together; past it: BUSY
+#define FCGI_MAX_PENDING        256
+
+// What the reactor learns about a FastCGI request, by client fd.
+struct FcgiEvent
+{
+    enum Kind { DATA, END, FAIL, BUSY };
+
+    int         clientFd;
+    Kind        kind;
+    std::string data;    // DATA: a piece of the app's stdout (CGI response format)
+
+    FcgiEvent() : clientFd(-1), kind(FAIL), data() {}
+};
+
+// Persistent FastCGI connections to local workers (`unix:/path` or `host:port`).
+// Connections are kept open (FCGI_KEEP_CONN) and reused; if the app answers
+// FCGI_MPXS_CONNS=1 several requests share one connection, otherwise one at a time.
+// Requests that find every connection busy wait in a bounded queue.
+//
+// The request body goes out whole, as FCGI_STDIN records right after the
+// params: by the time a location is known to be FastCGI the reactor already
+// holds the body (capped by client_max_body_size), so it is not streamed.
+// Responses are streamed: each STDOUT record is handed on as it arrives.
+//
+// The pool never touches the reactor: it reports poll interest changes and
+// request events, and the reactor drains both (takePollChanges / takeEvents).
+class FastCgiPool
+{
+public:
+    FastCgiPool();
+    ~FastCgiPool();
+
+    void submit(int clientFd,
+                const std::string& address,
+                const std::vector<std::string>& params,   // "NAME=value"
+                const std::string& body);
+    void abort(int clientFd);
+    // stop / resume reading a request's output (the client is not keeping up);
+    // its connection is not read while any request on it is paused
+    void pause(int clientFd, bool paused);
+
+    bool owns(int fd) const;
+    void onEvent(int fd, short revents);
+
+    // (fd, events) to add or update in the poll set; events < 0 = remove
+    void takePollChanges(std::vector<std::pair<int, short> >& out);
+    void takeEvents(std::vector<FcgiEvent>& out);
+
+private:
+    struct Job
+    {
+        int         clientFd;
+        std::string address;
+        std::string params;    // encoded name-value pairs
+        std::string body;
+        bool        retried;   // already replayed once after a stale connection
+        bool        gotOutput;
+        bool        orphan;    // client went away; records are dropped until END_REQUEST
+        bool        paused;
+        Job() : clientFd(-1), address(), params(), body(), retried(false), gotOutput(false),
+                orphan(false), paused(false) {}
+    };
+
+    struct Conn
+    {
+        int                             fd;
+        std::string                     address;
+        bool                            connecting;
+        bool                            reused;    // finished at least one request
+        size_t                          maxReqs;   // 1 until the app says it multiplexes
+        std::string                     wbuf;
+        size_t                          woff;
+        std::string                     rbuf;
+        std::map<unsigned short, Job>   reqs;
+        unsigned short                  nextId;
+        short                           interest;
+        Conn() : fd(-1), address(), connecting(false), reused(false), maxReqs(1),
+                 wbuf(), woff(0), rbuf(), reqs(), nextId(1), interest(0) {}
+    };
+
+    std::map<int, Conn>                       _conns;     // by upstream fd
+    std::deque<Job>                           _pending;
+    std::map<int, std::pair<int, unsigned short> > _byClient; // client fd -> (upstream fd, request id)
+    std::vector<std::pair<int, short> >       _pollChanges;
+    std::vector<FcgiEvent>                    _events;
+
+    FastCgiPool(const FastCgiPool&);
+    FastCgiPool& operator=(const FastCgiPool&);
+
+    void dispatch();
+    bool assign(Job& job);
+    int  openConn(const std::string& address);
+    void startRequest(Conn& c, const Job& job);
+    void parseRecords(Conn& c);
+    void closeConn(int fd, bool failed);
+    void updateInterest(Conn& c);
+    void emit(int clientFd, FcgiEvent::Kind kind, const std::string& data);
+};
+
+#endif
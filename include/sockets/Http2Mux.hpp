@@ -0,0 +1,162 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Http2Mux.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 16:05:51 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 16:05:51 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef HTTP2MUX_HPP
+#define HTTP2MUX_HPP
+
+#include "../HTTP/http2/Http2Hpack.hpp"
+#include "../HTTP/http2/Http2Frames.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <ctime>
+
+// what we announce in SETTINGS / WINDOW_UPDATE
+#define H2_MAX_STREAMS    128                 // concurrent streams per connection
+#define H2_STREAM_WINDOW  (1024 * 1024)       // request body bytes in flight per stream
+#define H2_CONN_WINDOW    (16 * 1024 * 1024)  // ...and per connection
+
+#define H2_TX_HIGH_WATER  (256 * 1024)  // frames waiting for the client: responses are not read
+#define H2_MAX_RESP_HEAD  (64 * 1024)   // a response head bigger than this resets the stream
+
+// HTTP/2 cleartext connections (prior knowledge, or `Upgrade: h2c`).
+//
+// Every stream gets a socketpair. The reactor serves the other end as an
+// ordinary HTTP/1 client: the stream's request is written there as an
+// HTTP/1.1 message, and the HTTP/1.0 answer read back (it ends when the
+// reactor closes its end) becomes HEADERS + DATA frames. So static files,
+// CGI, uploads and proxying all work per stream unchanged, and a stream
+// whose client window is shut simply stops being read, which backs up
+// into that one request's send queue like a slow HTTP/1 client would.
+//
+// Like the upstream pools, it never touches the reactor: it reports poll
+// interest changes and new stream sockets, and the reactor takes both.
+class Http2Mux
+{
+public:
+    // maxHeaderBytes: announced as SETTINGS_MAX_HEADER_LIST_SIZE and enforced
+    // while a header block is decoded (body sizes are the reactor's business)
+    Http2Mux(size_t maxHeaderBytes, int idleTimeoutSec);
+    ~Http2Mux();
+
+    // the client sent the prior-knowledge preface; `rx`: bytes read so far
+    void adopt(int clientFd, int acceptFd, const std::string& rx);
+    // the client asked for h2c: answered with 101, `request` becomes stream 1
+    void adoptUpgrade(int clientFd, int acceptFd, const std::string& request,
+                      const std::string& settings, const std::string& rx);
+
+    bool owns(int fd) const;
+    void onEvent(int fd, short revents);
+    void sweep(std::time_t now);
+
+    // (fd, events) to add or update in the poll set; events < 0 = remove
+    void takePollChanges(std::vector<std::pair<int, short> >& out);
+    // (fd, accept fd): stream sockets to serve as HTTP/1 clients
+    void takeStreams(std::vector<std::pair<int, int> >& out);
+
+private:
+    struct Stream
+    {
+        unsigned int id;
+        int          fd;          // our end of the socketpair
+        std::string  out;         // request for the reactor's end: head, then body
+        size_t       outOff;
+        size_t       framingLeft; // bytes of `out` that are not body (head, chunk lines), not yet written
+        bool         chunked;     // no content-length: the body is passed on as chunked
+        bool         remoteDone;  // END_STREAM received
+        size_t       unacked;     // body bytes written to the socket, not yet given back as window
+        long         recvWindow;  // what the client may still send on it
+        std::string  head;        // the response until its blank line, then body bytes held for window
+        bool         headSent;
+        bool         headOnly;    // HEAD: no DATA whatever the response says
+        bool         hasLen;
+        size_t       left;        // content-length still to send
+        long         window;      // what we may still send on it
+        short        interest;
+        Stream() : id(0), fd(-1), out(), outOff(0), framingLeft(0), chunked(false),
+                   remoteDone(false), unacked(0), recvWindow(H2_STREAM_WINDOW), head(), headSent(false), headOnly(false),
+                   hasLen(false), left(0), window(H2_DEFAULT_WINDOW), interest(0) {}
+    };
+
+    struct Conn
+    {
+        int                  fd;
+        int                  acceptFd;
+        std::string          rbuf;
+        std::string          wbuf;
+        size_t               woff;
+        bool                 preface;       // client preface received
+        http2::HpackDecoder  dec;
+        http2::HpackEncoder  enc;
+        std::string          hdrBlock;      // HEADERS + CONTINUATION so far
+        unsigned int         hdrStream;     // != 0 while CONTINUATION frames are due
+        bool                 hdrEndStream;
+        long                 window;        // connection send window
+        size_t               unacked;       // received bytes not yet given back as window
+        long                 recvWindow;    // what the client may still send on the connection
+        long                 peerWindow;    // peer's SETTINGS_INITIAL_WINDOW_SIZE
+        size_t               peerFrame;     // peer's SETTINGS_MAX_FRAME_SIZE
+        unsigned int         lastStream;
+        bool                 goaway;        // closing once the frames are out
+        bool                 peerGoaway;    // no new streams, close when idle
+        std::map<unsigned int, Stream> streams;
+        std::time_t          lastSeen;
+        short                interest;
+        Conn() : fd(-1), acceptFd(-1), rbuf(), wbuf(), woff(0), preface(false), dec(), enc(),
+                 hdrBlock(), hdrStream(0), hdrEndStream(false), window(H2_DEFAULT_WINDOW),
+                 unacked(0), recvWindow(H2_CONN_WINDOW), peerWindow(H2_DEFAULT_WINDOW), peerFrame(H2_DEFAULT_FRAME),
+                 lastStream(0), goaway(false), peerGoaway(false), streams(), lastSeen(0),
+                 interest(0) {}
+    };
+
+    std::map<int, Conn>                                  _conns;     // by client fd
+    std::map<int, std::pair<int, unsigned int> >         _byStream;  // stream fd -> (client fd, id)
+    std::vector<std::pair<int, short> >                  _pollChanges;
+    std::vector<std::pair<int, int> >                    _newStreams;
+    size_t                                               _maxHeaderBytes;
+    int                                                  _idleTimeoutSec;
+
+    Http2Mux(const Http2Mux&);
+    Http2Mux& operator=(const Http2Mux&);
+
+    Conn& open(int clientFd, int acceptFd);
+    bool  readConn(Conn& c);
+    bool  writeConn(Conn& c);
+    bool  parseFrames(Conn& c);
+    bool  onFrame(Conn& c, const http2::FrameHeader& h, const std::string& payload);
+    bool  onHeaderBlock(Conn& c, unsigned int id, bool endStream);
+    bool  onData(Conn& c, const http2::FrameHeader& h, const std::string& payload);
+    bool  applySettings(Conn& c, const std::string& payload);
+    bool  onWindowUpdate(Conn& c, unsigned int id, const std::string& payload);
+    bool  openStream(Conn& c, unsigned int id, const std::string& request, bool headOnly,
+                     bool bodyKnown, bool endStream);
+    void  endRequestBody(Stream& s);
+
+    void  readStream(Conn& c, Stream& s);
+    bool  flushHeld(Conn& c, Stream& s);
+    void  writeStream(Conn& c, Stream& s);
+    bool  sendHead(Conn& c, Stream& s);
+    bool  sendData(Conn& c, Stream& s, const char* data, size_t len, bool end);
+    void  creditStream(Conn& c, Stream& s);
+    void  resetStream(Conn& c, Stream& s, unsigned int code);
+    void  closeStream(Conn& c, unsigned int id);
+    void  closeConn(int fd);
+    void  connError(Conn& c, unsigned int code);
+
+    size_t sendable(const Conn& c, const Stream& s) const;
+    void  updateInterest(Conn& c);
+    void  updateStreamInterest(Conn& c, Stream& s);
+};
+
+#endif
@@ -0,0 +1,141 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   HttpProxyPool.hpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 14:02:11 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 14:02:11 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef HTTPPROXYPOOL_HPP
+#define HTTPPROXYPOOL_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <utility>
+#include <ctime>
+#include <sys/socket.h>
+
+// upper bounds per upstream address
+#define PROXY_MAX_CONNS     64   // connections, busy or idle
+#define PROXY_MAX_IDLE      16   // idle keep-alive connections kept around
+#define PROXY_IDLE_TIMEOUT  30   // seconds an idle connection is kept
+
+// What the reactor learns about a proxied request, by client fd.
+struct ProxyEvent
+{
+    enum Kind { DATA, END, FAIL };
+
+    int         clientFd;
+    Kind        kind;
+    std::string data;    // DATA: a piece of the response, in CGI format (see below)
+
+    ProxyEvent() : clientFd(-1), kind(FAIL), data() {}
+};
+
+// Keep-alive HTTP/1.1 connections to upstream servers (`host:port`).
+// One request at a time per connection; finished connections go back to an
+// idle list and are reused by the next request for the same address.
+// Requests that find every connection busy wait in a queue.
+//
+// The upstream response is handed on as CGI output: a `Status:` line plus
+// its end-to-end headers, a blank line, then the body with the chunked
+// framing already removed. The reactor runs it through the same path as a
+// script's stdout (streaming, spooling, compression, cgi_cache).
+//
+// Like FastCgiPool, the pool never touches the reactor: it reports poll
+// interest changes and request events, and the reactor drains both.
+class HttpProxyPool
+{
+public:
+    HttpProxyPool();
+    ~HttpProxyPool();
+
+    // request: the whole upstream request, head and body; addr is the address
+    // resolved when the config was loaded, `address` names it
+    void submit(int clientFd, const std::string& address,
+                const struct sockaddr_storage& addr, socklen_t addrLen,
+                const std::string& request, int connectTimeoutSec);
+    void abort(int clientFd);
+    // stop / resume reading the response while the client is behind
+    void pause(int clientFd, bool paused);
+
+    bool owns(int fd) const;
+    void onEvent(int fd, short revents);
+    void sweep(std::time_t now);
+
+    // (fd, events) to add or update in the poll set; events < 0 = remove
+    void takePollChanges(std::vector<std::pair<int, short> >& out);
+    void takeEvents(std::vector<ProxyEvent>& out);
+
+private:
+    struct Job
+    {
+        int         clientFd;
+        std::string address;
+        struct sockaddr_storage addr;
+        socklen_t   addrLen;
+        std::string request;
+        int         connectTimeoutSec;
+        bool        noBody;     // HEAD: the response has no body whatever it says
+        bool        retryable;  // not a POST: may be replayed on a fresh connection
+        bool        retried;
+        Job() : clientFd(-1), address(), addr(), addrLen(0), request(), connectTimeoutSec(0),
+                noBody(false), retryable(false), retried(false) {}
+    };
+
+    enum Phase { IDLE, HEAD, BODY_LENGTH, BODY_CHUNKED, BODY_CLOSE };
+    enum ChunkPhase { CHUNK_SIZE, CHUNK_DATA, CHUNK_CRLF, CHUNK_TRAILER };
+
+    struct Conn
+    {
+        int         fd;
+        std::string address;
+        bool        connecting;
+        std::time_t since;       // connect start, or when it went idle
+        bool        reused;      // finished at least one request
+        bool        busy;
+        Job         job;
+        std::string wbuf;
+        size_t      woff;
+        std::string rbuf;
+        Phase       phase;
+        ChunkPhase  chunk;
+        size_t      left;        // body (or chunk) bytes still to come
+        bool        keepAlive;   // the upstream lets us reuse it
+        bool        gotOutput;
+        bool        paused;
+        short       interest;
+        Conn() : fd(-1), address(), connecting(false), since(0), reused(false), busy(false),
+                 job(), wbuf(), woff(0), rbuf(), phase(IDLE), chunk(CHUNK_SIZE), left(0),
+                 keepAlive(false), gotOutput(false), paused(false), interest(0) {}
+    };
+
+    std::map<int, Conn>                 _conns;     // by upstream fd
+    std::deque<Job>                     _pending;
+    std::map<int, int>                  _byClient;  // client fd -> upstream fd
+    std::vector<std::pair<int, short> > _pollChanges;
+    std::vector<ProxyEvent>             _events;
+
+    HttpProxyPool(const HttpProxyPool&);
+    HttpProxyPool& operator=(const HttpProxyPool&);
+
+    void dispatch();
+    bool assign(Job& job);
+    int  openConn(const Job& job);
+    void startRequest(Conn& c, const Job& job);
+    bool parseResponse(Conn& c);
+    bool parseHead(Conn& c);
+    bool parseChunked(Conn& c);
+    bool finishRequest(Conn& c);
+    void closeConn(int fd, bool failed);
+    void updateInterest(Conn& c);
+    void emit(int clientFd, ProxyEvent::Kind kind, const std::string& data);
+};
+
+#endif
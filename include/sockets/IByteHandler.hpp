@@ -14,13 +14,32 @@
 #define IBYTEHANDLER_HPP
 
 #include <string>
+#include <vector>
+#include "../HTTP/SharedBuffer.hpp"
+#include "../HTTP/BodyPart.hpp"
+
+// where a request was routed (server_name, location path), for the metrics;
+// empty when it never got that far
+struct RouteLabel {
+    std::string server;
+    std::string location;
+    int         slowMs;     // the location's slow_request_log
+    std::string accessLog;  // the server's access_log file, empty = none
+    bool        accessLogJson;
+
+    RouteLabel() : server(), location(), slowMs(0), accessLog(), accessLogJson(false) {}
+};
 
 struct ByteReply {
-    std::string bytes;
-    bool        closeAfterWrite;
+    std::string           bytes;
+    SharedBuffer          shared;   // prebuilt response, sent after bytes without copying
+    std::vector<BodyPart> parts;    // streamed body, sent after bytes/shared
+    bool                  closeAfterWrite;
+    RouteLabel            route;
 
-    ByteReply() : bytes(), closeAfterWrite(true) {}
-    ByteReply(const std::string& b, bool c) : bytes(b), closeAfterWrite(c) {}
+    ByteReply() : bytes(), shared(), parts(), closeAfterWrite(true), route() {}
+    ByteReply(const std::string& b, bool c) : bytes(b), shared(), parts(), closeAfterWrite(c), route() {}
+    ByteReply(const SharedBuffer& s, bool c) : bytes(), shared(s), parts(), closeAfterWrite(c), route() {}
 };
 
 class IByteHandler
@@ -14,7 +14,15 @@
 #define ICGIHANDLER_HPP
 
 #include <string>
+#include <vector>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include "../HTTP/SharedBuffer.hpp"
+#include "IByteHandler.hpp"
+
+// tryStartCgi() flags
+#define CGI_START_ADMITTED 1   // the reactor has a cgi_max_concurrent slot for it
+#define CGI_START_ALONE    2   // don't join a collapsed run (its answer could not be shared)
 
 struct CgiStartResult
 {
@@ -24,12 +32,54 @@ struct CgiStartResult
     int    fdIn;    // parent writes request body to CGI stdin
     int    fdOut;   // parent reads CGI stdout
     std::string body; // request body to feed
-    std::string errResponseBytes; // if ok==false, send this response
+    SharedBuffer errResponseBytes; // if ok==false, send this response (an error, or a cache hit)
     bool   closeAfterWrite;
 
+    std::string              fcgiPass;    // if set: no process, hand the request to this FastCGI upstream
+    std::vector<std::string> fcgiParams;  // "NAME=value" (CGI meta-variables)
+
+    std::string proxyAddress;     // if set: hand proxyRequest to this upstream (host:port)
+    struct sockaddr_storage proxyAddr;  // proxyAddress as resolved at config load
+    socklen_t   proxyAddrLen;
+    std::string proxyRequest;     // the whole HTTP/1.1 request, body included
+    int         proxyConnectTimeoutSec;
+
+    int         timeoutSec;       // cgi_timeout of the location
+    size_t      bufferSize;       // cgi_buffer_size of the location
+
+    // cgi_max_concurrent: nothing is started until the reactor has a slot
+    // (deferred); it then calls again with CGI_START_ADMITTED
+    bool        deferred;
+    std::string limitKey;         // the location the limit is counted on
+    size_t      maxConcurrent;
+    size_t      queueSize;
+    int         queueTimeoutSec;
+
+    // cgi_cache_stale: a stale hit was served and this script refreshes the
+    // entry in the background; its output goes to finishCgiRefresh()
+    int         refreshId;
+    pid_t       refreshPid;
+    int         refreshFdOut;
+
+    // cgi_collapse: the run this request leads (or, if joined, waits for);
+    // joined requests start nothing and get the leader's answer
+    std::string collapseKey;
+    bool        joined;
+
+    // cgi_body_file: nothing started; the reactor stores the body in a file
+    // and calls startCgiWithStdin() once all of it is in
+    bool        bodyFile;
+
+    RouteLabel  route;
+
     CgiStartResult()
     : isCgi(false), ok(false), pid(-1), fdIn(-1), fdOut(-1),
-      body(), errResponseBytes(), closeAfterWrite(true)
+      body(), errResponseBytes(), closeAfterWrite(true),
+      fcgiPass(), fcgiParams(), proxyAddress(), proxyAddr(), proxyAddrLen(0), proxyRequest(), proxyConnectTimeoutSec(0),
+      timeoutSec(30), bufferSize(0),
+      deferred(false), limitKey(), maxConcurrent(0), queueSize(0), queueTimeoutSec(0),
+      refreshId(0), refreshPid(-1), refreshFdOut(-1),
+      collapseKey(), joined(false), bodyFile(false), route()
     {}
 };
 
@@ -45,11 +95,55 @@ class ICgiHandler
 public:
     virtual ~ICgiHandler() {}
 
-    virtual CgiStartResult tryStartCgi(int acceptFd, const std::string& rawMessage) = 0;
+    // With headOnly, rawMessage ends at the blank line and the body is still
+    // arriving: the reactor pipes it to fdIn itself. Requests that can't be
+    // started that way (FastCGI) answer isCgi=false and come back complete.
+    // A location with cgi_max_concurrent answers deferred until the reactor
+    // has a slot for it and calls again with CGI_START_ADMITTED.
+    virtual CgiStartResult tryStartCgi(int acceptFd, int clientFd,
+                                       const std::string& rawMessage, bool headOnly,
+                                       int flags) = 0;
+
+    // bodyFile: the whole body is in stdinFd (the reactor closes it after
+    // this call); headMessage is the request up to the blank line
+    virtual CgiStartResult startCgiWithStdin(int acceptFd, int clientFd,
+                                             const std::string& headMessage,
+                                             int stdinFd) = 0;
 
     virtual CgiFinishResult finishCgi(int acceptFd,
                                       int clientFd,
                                       const std::string& cgiStdout) = 0;
+
+    // Called first once the script's header block is complete. True: the
+    // script only authorized the download (X-Accel-Redirect / X-Sendfile),
+    // `out` is the file served like a static one and its output is dropped.
+    virtual bool cgiDelegated(int acceptFd,
+                              int clientFd,
+                              const std::string& headerBlock,
+                              ByteReply& out) = 0;
+
+    // Streaming: called once the script's header block is complete. Fills the
+    // status line + headers to send now; false means "bad header block" (502).
+    virtual bool startCgiResponse(int acceptFd,
+                                  int clientFd,
+                                  const std::string& headerBlock,
+                                  std::string& outHead) = 0;
+
+    // Body bytes as they come out of the script. Returns false when they go to
+    // the client unchanged; otherwise `out` holds what to send instead.
+    // `last` is set once, at end of output, with no data.
+    virtual bool encodeCgiBody(int clientFd, const char* data, size_t len,
+                               bool last, std::string& out) = 0;
+
+    // the request is gone (client dropped, timeout): forget per-request state
+    virtual void abortCgi(int clientFd) = 0;
+
+    // the whole output of a background refresh run (abortCgi(refreshId) if it failed)
+    virtual void finishCgiRefresh(int refreshId, const std::string& cgiStdout) = 0;
+
+    // the leader of a collapsed run is done (or gone): its answer for the
+    // joined requests, false if there is none they may share
+    virtual bool takeCollapsed(const std::string& collapseKey, SharedBuffer& out) = 0;
 };
 
 #endif
@@ -17,13 +17,17 @@
 #include <deque>
 #include <ctime>
 #include <sys/types.h>
+#include <openssl/ssl.h>
+#include "../HTTP/SharedBuffer.hpp"
+#include "../HTTP/BodyPart.hpp"
 
 enum IoPhase
 {
     PHASE_RECV_HEADERS = 0,
     PHASE_RECV_BODY    = 1,
     PHASE_SEND         = 2,
-    PHASE_SHUTDOWN     = 3
+    PHASE_SHUTDOWN     = 3,
+    PHASE_TLS_HANDSHAKE = 4
 };
 
 struct CgiSession
@@ -35,16 +39,49 @@ struct CgiSession
 
     std::string inBody;
     size_t      inOff;
+    size_t      bodyLeft;  // request body bytes still to come from the client
 
-    std::string outBuf;
+    std::string outBuf;    // output until the header block is complete
+    size_t      hdrScan;   // outBuf bytes already searched for the blank line
+
+    bool        streaming; // headers sent, body goes straight to the client
+    bool        paused;    // fdOut taken out of the poll set: client is behind
 
     std::time_t startTs;
     int         timeoutSec;
 
+    bool        fcgi;      // served by the FastCGI pool: no pid, no pipes
+    bool        proxy;     // served by the proxy_pass pool: no pid, no pipes
+    bool        upstreamDone;  // END_REQUEST / end of the proxied response: no more output
+
+    std::string limitKey;  // cgi_max_concurrent location: holds a slot there...
+    bool        queued;    // ...or is still waiting for one, nothing started
+
+    std::string collapseKey;  // cgi_collapse: the run this request leads...
+    bool        joined;       // ...or waits for, nothing started
+
+    // cgi_buffer_size: once that much is waiting for the client, the rest of
+    // the output goes to an unlinked temp file and is sent from there
+    size_t      bufferSize;
+    int         spoolFd;
+    off_t       spoolLen;     // bytes written to the spool file
+    off_t       spoolQueued;  // bytes of it already in the send queue
+
+    // cgi_body_file: the body is stored in bodyFd as it arrives (bodyLeft
+    // more bytes to come), then the script starts with it as stdin
+    int         bodyFd;
+    std::string bodyHead;     // the request up to the blank line
+
     CgiSession()
     : active(false), pid(-1), fdIn(-1), fdOut(-1),
-      inBody(), inOff(0), outBuf(),
-      startTs(0), timeoutSec(30)
+      inBody(), inOff(0), bodyLeft(0), outBuf(), hdrScan(0),
+      streaming(false), paused(false),
+      startTs(0), timeoutSec(30),
+      fcgi(false), proxy(false), upstreamDone(false),
+      limitKey(), queued(false),
+      collapseKey(), joined(false),
+      bufferSize(0), spoolFd(-1), spoolLen(0), spoolQueued(0),
+      bodyFd(-1), bodyHead()
     {}
 };
 
@@ -59,24 +96,59 @@ public:
         size_t      dataStart;  // file bytes start offset in raw
         size_t      dataEnd;    // file bytes end offset in raw
         size_t      off;        // bytes already written
+        long long   startUs;    // for the metrics
 
         UploadSession()
-        : active(false), fd(-1), raw(), dataStart(0), dataEnd(0), off(0)
+        : active(false), fd(-1), raw(), dataStart(0), dataEnd(0), off(0), startUs(0)
         {}
     };
 
-    struct FileSendSession
+    // What the metrics know about the request on this channel. recvSome /
+    // sendSome / sendFile keep the byte counts, the first / last byte times
+    // and take the status from the first response line; the reactor marks
+    // the steps in between and accounts for it once it is over.
+    // Times are metrics_now_us() (monotonic), 0 = not reached.
+    struct RequestTrace
     {
-        bool        active;
-        int         fd;
-        std::string path;
-        size_t      off;
-
-        FileSendSession()
-        : active(false), fd(-1), path(), off(0)
+        bool        open;         // request bytes arrived, not accounted yet
+        long long   acceptUs;     // accepted (first byte for a reused connection)
+        long long   startUs;      // first request byte
+        long long   headersUs;    // header block complete
+        long long   bodyUs;       // body complete
+        long long   dispatchUs;   // handed to the Router / a script / an upload
+        long long   handledUs;    // handler returned, script exited, upload written
+        long long   firstByteUs;  // first response byte sent
+        long long   lastByteUs;   // last response byte sent
+        size_t      bytesIn;
+        size_t      bytesOut;
+        int         status;       // 0 until the status line went out
+        int         slowMs;       // slow_request_log of the location, 0 = off
+        std::string server;       // route labels from the handler
+        std::string location;
+        std::string requestLine;  // "GET /x HTTP/1.1", for the slow log and the access log
+        std::string referer;      // for the access log
+        std::string userAgent;
+        std::string accessLog;    // the server's access_log file, empty = none
+        bool        accessLogJson;
+
+        RequestTrace()
+        : open(false), acceptUs(0), startUs(0), headersUs(0), bodyUs(0), dispatchUs(0), handledUs(0),
+          firstByteUs(0), lastByteUs(0), bytesIn(0), bytesOut(0), status(0), slowMs(0), server(),
+          location(), requestLine(), referer(), userAgent(), accessLog(), accessLogJson(false)
         {}
     };
 
+    // queued after txBuffer: a shared buffer or a file span.
+    // File spans are opened lazily on first write and closed by popTx()/clearTx().
+    struct TxSegment
+    {
+        BodyPart part;
+        int      fd;
+        size_t   sent;
+
+        TxSegment() : part(), fd(-1), sent(0) {}
+    };
+
 public:
     NetChannel();
     NetChannel(int sockFd, int acceptFd);
@@ -87,6 +159,18 @@ public:
     std::string& rxBuffer();
     std::string& txBuffer();
 
+    // queued segments are sent after txBuffer, without copying
+    void       setTxShared(const SharedBuffer& b);
+    void       queueShared(const SharedBuffer& b);
+    void       queuePart(const BodyPart& p);
+    void       queueFileFd(int fd, off_t offset, size_t length);
+    bool       hasQueuedTx() const;
+    TxSegment& frontTx();
+    void       popTx();
+    void       clearTx();
+    bool       hasPendingTx() const;
+    size_t     pendingTxBytes() const;
+
     std::time_t lastSeen() const;
     void markSeen();
 
@@ -108,6 +192,7 @@ public:
     bool hasLen() const;
     void setHasLen(bool v);
 
+    // content-length; for a chunked body, the bytes decoded so far
     size_t len() const;
     void setLen(size_t n);
 
@@ -126,8 +211,27 @@ public:
 
     UploadSession& upload();
 
-    FileSendSession& file();
-    const FileSendSession& file() const;
+    RequestTrace& trace();
+
+    // client address ("-" when unknown: HTTP/2 streams)
+    const std::string& peerAddr() const;
+    void               setPeerAddr(const std::string& addr);
+
+    // TLS: the channel owns `ssl` from here on (dropTls frees it)
+    void setTls(SSL* ssl);
+    SSL* tls() const;
+    void dropTls();
+    bool tlsFailed() const;
+    // 1: done, 0: call again once `events` (POLLIN / POLLOUT) fire, -1: failed
+    int  continueHandshake(short& events);
+
+    // recv / send / sendfile on the socket, or through TLS when it has one.
+    // Same results as those calls: -1 with errno EAGAIN when nothing could be
+    // done yet, 0 from recvSome on a clean close. A TLS error also sets
+    // tlsFailed(): the socket itself is fine then, the channel is not.
+    ssize_t recvSome(char* buf, size_t len);
+    ssize_t sendSome(const char* buf, size_t len);
+    ssize_t sendFile(int fileFd, off_t offset, size_t len);
 
 private:
     int _sockFd;
@@ -136,6 +240,8 @@ private:
     std::string _rx;
     std::string _tx;
 
+    std::deque<TxSegment> _txQueue;
+
     std::time_t _lastSeen;
     std::time_t _phaseSince;
 
@@ -157,7 +263,15 @@ private:
 
     UploadSession _upload;
 
-    FileSendSession _file;
+    RequestTrace _trace;
+    std::string  _peer;
+
+    SSL* _ssl;
+    bool _tlsFailed;
+
+    ssize_t tlsResult(int ret);
+    ssize_t countIn(ssize_t n);
+    ssize_t countOut(const char* buf, size_t len, ssize_t n);
 };
 
 #endif
@@ -15,9 +15,24 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <sys/types.h>
 
-int  makeNonBlocking(int fd);
-void closeFd(int fd);
+int     makeNonBlocking(int fd);
+void    closeFd(int fd);
+ssize_t sendFileSpan(int sockFd, int fileFd, off_t offset, size_t len);
+int     openSpoolFile(const char* dir);
 bool parsePortsList(const char* s, std::vector<int>& outPorts);
 
+// header helpers shared by the router and the upstream pools; header maps
+// keep names as sent, `keyLower` is the lowercase name looked for
+std::string asciiLower(const std::string& s);
+std::string trimSpaces(const std::string& s);
+std::map<std::string, std::string>::iterator
+        findHeaderCI(std::map<std::string, std::string>& h, const std::string& keyLower);
+std::map<std::string, std::string>::const_iterator
+        findHeaderCI(const std::map<std::string, std::string>& h, const std::string& keyLower);
+bool    getHeaderCI(const std::map<std::string, std::string>& h, const std::string& keyLower,
+                    std::string& outVal);
+
 #endif
@@ -16,11 +16,17 @@
 #include "IByteHandler.hpp"
 #include "ICgiHandler.hpp"
 #include "NetChannel.hpp"
+#include "FastCgiPool.hpp"
+#include "HttpProxyPool.hpp"
+#include "Http2Mux.hpp"
+#include "TlsContexts.hpp"
 
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
 #include <string>
+#include <ctime>
 #include <poll.h>
 
 class PollReactor
@@ -37,6 +43,9 @@ public:
 
     ~PollReactor();
 
+    // `listen ... ssl` ports: connections accepted there start with a handshake
+    void enableTls(const TlsContexts& tls);
+
     void tickOnce();
 
 private:
@@ -50,19 +59,93 @@ private:
 
     void markDrop(int fd);
     void flushDrops();
+    void accountRequest(NetChannel& ch);
 
     void acceptBurst(int listenFd);
+    void continueTlsHandshake(NetChannel& ch);
+    void pumpTlsPending();
 
     void onPollEvent(size_t idx);
     void onReadable(int fd);
     void onWritable(int fd);
+    bool sendTxSegment(NetChannel& ch);
 
     void onCgiOutReadable(int fd);
     void onCgiInWritable(int fd);
 
+    void beginCgi(NetChannel& ch, CgiStartResult& st, size_t bodyLeft);
+    bool tryStartStreamedCgi(NetChannel& ch, size_t hdrEnd, size_t bodyLen);
+    void readCgiBody(NetChannel& ch);
+    void closeCgiIn(CgiSession& cg);
+    void setCgiClientMask(NetChannel& ch);
+
+    void feedCgiOutput(NetChannel& ch, const char* data, size_t len);
+    bool beginCgiBodyFile(NetChannel& ch, CgiStartResult& st, const std::string& head,
+                          const std::string& have, size_t bodyLen);
+    void readCgiBodyFile(NetChannel& ch);
+    void startCgiBodyFile(NetChannel& ch);
+    void queueCgiBody(NetChannel& ch, const char* data, size_t len, bool last);
+    bool spoolCgiBody(CgiSession& cg, const char* data, size_t len);
+    void feedCgiSpool(NetChannel& ch, bool all);
+    void closeCgiSpool(CgiSession& cg);
+    void finishCgiStream(NetChannel& ch);
+    void delegateCgi(NetChannel& ch, ByteReply& rep);
+
     void sweepTimeouts();
     void maybeFinalizeCgi(int clientFd);
 
+    struct CgiWaiter
+    {
+        int         clientFd;
+        std::string msg;
+        std::time_t deadline;   // 0: waits as long as the client does
+    };
+
+    // one per location with cgi_max_concurrent
+    struct CgiLimit
+    {
+        size_t                running;
+        size_t                max;
+        size_t                queueSize;
+        int                   queueTimeoutSec;
+        std::deque<CgiWaiter> waiting;
+
+        CgiLimit() : running(0), max(0), queueSize(0), queueTimeoutSec(0), waiting() {}
+    };
+
+    CgiLimit& cgiLimitFor(const CgiStartResult& st);
+    void admitCgi(NetChannel& ch, CgiStartResult& st, std::string& msg);
+    void startCgi(NetChannel& ch, CgiStartResult& st);
+    void claimCgiSlot(NetChannel& ch, const CgiStartResult& st);
+    void releaseCgiSlot(CgiSession& cg);
+    void dequeueCgiWaiter(NetChannel& ch);
+    void pumpCgiQueues();
+    void rejectBusy(NetChannel& ch, int retryAfter);
+    void replyNow(NetChannel& ch, const SharedBuffer& bytes);
+
+    void runCgiStart(NetChannel& ch, CgiStartResult& st, std::string& msg);
+    void joinCollapse(NetChannel& ch, CgiStartResult& st, std::string& msg);
+    void landCollapse(CgiSession& cg);
+    void leaveCollapse(NetChannel& ch);
+    SharedBuffer busyResponse(int retryAfter);
+
+    // cgi_cache_stale: scripts refreshing a cache entry, no client attached
+    struct CgiRefresh
+    {
+        int         id;
+        pid_t       pid;
+        std::string out;
+        std::time_t startTs;
+        int         timeoutSec;
+    };
+
+    void startCgiRefresh(const CgiStartResult& st);
+    void onCgiRefreshReadable(int fd);
+    void endCgiRefresh(int fd, bool ok);
+
+    void initChildWatch();
+    void onChildExit();
+
     std::string::size_type findHdrEnd(const std::string& buf);
 
     bool parseFramingHeaders(const std::string& headerBlock,
@@ -70,11 +153,23 @@ private:
                              bool& outHasLen,
                              size_t& outLen);
 
-    std::string minimalError(int code, const char* reason);
+    SharedBuffer minimalError(int code, const char* reason);
 
     void dispatchIfIdle(NetChannel& ch);
+    void serveMessage(NetChannel& ch, std::string& msg);
 
     void cleanupCgiForClient(NetChannel& ch);
+    void failCgi(NetChannel& ch, int code, const char* reason);
+
+    void syncFastCgiPoll();
+    void drainFastCgiEvents();
+    void syncProxyPoll();
+    void drainProxyEvents();
+    void applyPoolPollChanges(const std::vector<std::pair<int, short> >& changes);
+
+    bool tryHttp2Preface(NetChannel& ch);
+    bool tryHttp2Upgrade(NetChannel& ch, const std::string& headerBlock, size_t hdrEnd);
+    void syncHttp2();
 
     bool tryStartAsyncUpload(NetChannel& ch, std::string& msg);
     void pumpAsyncUploads();
@@ -84,6 +179,8 @@ private:
     std::vector<int> _listenSockets;
     int _backlog;
 
+    std::map<int, SSL_CTX*> _tlsByListen;   // listen fd -> its port's context
+
     int _idleTimeoutSec;
     int _headerTimeoutSec;
     int _bodyTimeoutSec;
@@ -97,6 +194,23 @@ private:
 
     std::map<int, int> _cgiOutToClient;
     std::map<int, int> _cgiInToClient;
+    std::map<pid_t, int> _cgiPidToClient;
+
+    int _childFd;       // readable when a child exited (signalfd, or a self-pipe)
+    int _childWakeFd;   // write end of the self-pipe, -1 with signalfd
+
+    std::map<int, SharedBuffer> _canned;   // minimalError() responses, built once per code
+    std::map<int, SharedBuffer> _busy;     // 503s, built once per Retry-After value
+
+    std::map<std::string, CgiLimit> _cgiLimits;   // by CgiStartResult::limitKey
+    std::map<int, CgiRefresh>       _cgiRefresh;  // by the script's stdout
+
+    std::map<std::string, std::deque<CgiWaiter> > _cgiJoined;  // by collapse key
+    std::deque<CgiWaiter>                         _cgiRetry;   // leader had nothing to share
+
+    FastCgiPool _fcgi;
+    HttpProxyPool _proxy;
+    Http2Mux _h2;
 
     IByteHandler* _handler;
 };
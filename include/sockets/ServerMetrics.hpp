@@ -0,0 +1,148 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   ServerMetrics.hpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 18:20:03 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 18:20:03 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef SERVERMETRICS_HPP
+#define SERVERMETRICS_HPP
+
+#include <string>
+#include <map>
+#include <ctime>
+
+// request duration buckets: 250us, 500us, 1ms, ... 131s (x2 each), then +Inf
+#define METRICS_LATENCY_BUCKETS 20
+#define METRICS_LATENCY_FIRST_US 250
+
+// one per IoPhase value
+#define METRICS_PHASES 5
+
+// HDR-style buckets: 16 linear ones per power of two (a percentile is off
+// by 1/16 at most), from 1us up to 2^38us (~76h)
+#define HDR_SUB_BITS 4
+#define HDR_SUB_COUNT (1 << HDR_SUB_BITS)
+#define HDR_MAX_BIT 37
+#define HDR_BUCKETS (HDR_SUB_COUNT + (HDR_MAX_BIT - HDR_SUB_BITS + 1) * HDR_SUB_COUNT)
+
+enum MetricsCache
+{
+    METRICS_CACHE_FILE_META = 0,
+    METRICS_CACHE_COMPRESS,
+    METRICS_CACHE_DIR_LISTING,
+    METRICS_CACHE_CGI,
+    METRICS_CACHE_COUNT
+};
+
+// Where a request spends its time, between two marks of its channel:
+// accept -> headers -> body -> dispatch -> handler done -> first byte -> last byte.
+// A phase that overlaps the previous one (a script started while its body
+// still streams in, a response sent while the script runs) counts toward
+// the earlier one, so the phases always add up to the whole request.
+enum RequestPhase
+{
+    REQ_PHASE_HEADERS = 0,   // accept (or first byte on a reused connection) to end of headers
+    REQ_PHASE_BODY,          // reading the body
+    REQ_PHASE_QUEUE,         // waiting to run (CGI slot, collapsed run)
+    REQ_PHASE_HANDLER,       // Router / upload / script until it is done
+    REQ_PHASE_FIRST_BYTE,    // done to the first response byte on the wire
+    REQ_PHASE_SEND,          // first to last response byte
+    REQ_PHASES
+};
+
+const char* request_phase_name(int phase);
+
+// CLOCK_MONOTONIC in microseconds
+long long metrics_now_us();
+
+struct LatencyHistogram
+{
+    unsigned long buckets[METRICS_LATENCY_BUCKETS + 1];   // not cumulative; last = +Inf
+    unsigned long count;
+    long long     sumUs;
+
+    LatencyHistogram();
+    void add(long long us);
+};
+
+// percentiles without keeping samples: fixed memory, O(1) add
+struct HdrHistogram
+{
+    unsigned long counts[HDR_BUCKETS];
+    unsigned long count;
+    long long     sumUs;
+    long long     maxUs;
+
+    HdrHistogram();
+    void      add(long long us);
+    long long percentile(double q) const;   // highest value of the bucket holding it
+};
+
+// Counters for the `metrics on` location (Prometheus text or JSON).
+//
+// Everything here is touched by the reactor's one thread only (scripts are
+// separate processes), so the counters are plain integers: no locks, no
+// atomics, an increment where the thing happens. Requests are counted per
+// server_name + location path, the labels coming from the config, so the
+// number of series stays bounded whatever the clients ask for.
+class ServerMetrics
+{
+public:
+    struct Route
+    {
+        std::string      server;
+        std::string      location;
+        unsigned long    byClass[5];   // 1xx .. 5xx
+        unsigned long    bytesIn;
+        unsigned long    bytesOut;
+        LatencyHistogram latency;      // first request byte to last response byte
+        HdrHistogram     phases[REQ_PHASES];
+
+        Route();
+    };
+
+    ServerMetrics();
+
+    unsigned long connections;            // accepted
+    unsigned long tlsHandshakeFailures;
+    unsigned long cgiSpawns;              // scripts started (fork + exec)
+    unsigned long cgiTimeouts;            // cgi_timeout hit: 504
+    unsigned long fastcgiRequests;
+    unsigned long proxyRequests;
+    unsigned long uploads;                // streamed to disk (big bodies)
+    unsigned long uploadBytes;
+    long long     uploadUs;               // time spent writing them
+    unsigned long accessLogDropped;       // access log lines that did not fit in the buffer
+    unsigned long cacheHits[METRICS_CACHE_COUNT];
+    unsigned long cacheMisses[METRICS_CACHE_COUNT];
+
+    // gauges, set by the reactor on every sweep over its channels
+    unsigned long channels[METRICS_PHASES];
+    unsigned long cgiRunning;
+
+    // status 499: the client went away before an answer
+    void recordRequest(const std::string& server, const std::string& location, int status,
+                       size_t bytesIn, size_t bytesOut, long long us, const long long* phaseUs);
+    void cacheLookup(MetricsCache cache, bool hit);
+
+    void renderPrometheus(std::string& out) const;
+    void renderJson(std::string& out) const;
+
+private:
+    std::map<std::string, Route> _routes;   // by server + '\n' + location
+    std::time_t                  _started;
+
+    ServerMetrics(const ServerMetrics&);
+    ServerMetrics& operator=(const ServerMetrics&);
+};
+
+// the process-wide instance
+ServerMetrics& server_metrics();
+
+#endif
@@ -0,0 +1,73 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   TlsContexts.hpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 17:12:40 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 17:12:40 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef TLSCONTEXTS_HPP
+#define TLSCONTEXTS_HPP
+
+#include <openssl/ssl.h>
+#include <string>
+#include <vector>
+#include <map>
+
+// what one `listen ... ssl` server block asks for
+struct TlsSettings
+{
+    std::string certificate;
+    std::string certificateKey;
+    size_t      sessionCache;     // entries, 0 = no server-side cache
+    int         sessionTimeout;   // seconds
+    bool        sessionTickets;
+
+    TlsSettings() : certificate(), certificateKey(), sessionCache(0), sessionTimeout(300),
+                    sessionTickets(true) {}
+};
+
+// One SSL_CTX per TLS port, plus one per other server_name on it, picked by
+// SNI. The first server block on a port is its default (like Host matching),
+// and its session cache, timeout and tickets apply to every name there:
+// resumption always goes through the context the handshake started on.
+//
+// Every context sets SSL_OP_ENABLE_KTLS: when the kernel takes over record
+// encryption, file spans still go out with sendfile (SSL_sendfile).
+class TlsContexts
+{
+public:
+    TlsContexts();
+    ~TlsContexts();
+
+    // false (`err` set): the certificate or key could not be loaded
+    bool addServer(int port, const std::string& serverName, const TlsSettings& s, std::string& err);
+
+    // NULL: plain HTTP on that port
+    SSL_CTX* forPort(int port) const;
+    bool     empty() const;
+
+private:
+    struct PortContexts
+    {
+        SSL_CTX*                        def;
+        std::map<std::string, SSL_CTX*> byName;
+
+        PortContexts() : def(NULL), byName() {}
+    };
+
+    std::map<int, PortContexts> _ports;
+    std::vector<SSL_CTX*>       _all;
+
+    TlsContexts(const TlsContexts&);
+    TlsContexts& operator=(const TlsContexts&);
+
+    SSL_CTX* build(const TlsSettings& s, std::string& err);
+    static int onServerName(SSL* ssl, int* alert, void* arg);
+};
+
+#endif
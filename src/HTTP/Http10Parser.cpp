@@ -160,135 +160,154 @@ static bool parse_http10_request_line(const std::string& headersPart, HTTPReques
     return true;
 }
 
-namespace http10
+// request line + header fields; also validates the body framing headers
+static bool parse_head(const std::string& headersPart, int listenPort, HTTPRequest& outReq,
+                       int& outErrCode, bool& hasCL, size_t& contentLen)
 {
-    bool parseRequest(const std::string& raw, int listenPort, HTTPRequest& outReq, int& outErrCode)
-    {
-        outErrCode = 400;
+    outReq.headers.clear();
+    outReq.body.clear();
+    outReq.host = "";
+    outReq.port = listenPort;
+    outReq.keepAlive = false;
 
-        size_t he = raw.find("\r\n\r\n");
-        size_t delimLen = 4;
-
-        if (he == std::string::npos)
-        {
-            he = raw.find("\n\n");
-            delimLen = 2;
-        }
-
-        std::string headersPart;
-        std::string bodyPart;
+    if (!parse_http10_request_line(headersPart, outReq, outErrCode))
+        return false;
 
-        if (he == std::string::npos)
-        {
-            headersPart = raw;
-            bodyPart = "";
-        }
-        else
+    size_t firstNL = headersPart.find('\n');
+    if (firstNL != std::string::npos)
+    {
+        size_t pos = firstNL + 1;
+        while (pos < headersPart.size())
         {
-            headersPart = raw.substr(0, he);
-            bodyPart = raw.substr(he + delimLen);
-        }
-
-        outReq.headers.clear();
-        outReq.body.clear();
-        outReq.host = "";
-        outReq.port = listenPort;
-        outReq.keepAlive = false;
-
-        if (!parse_http10_request_line(headersPart, outReq, outErrCode))
-            return false;
+            size_t eol = headersPart.find('\n', pos);
+            std::string line;
 
-        size_t firstNL = headersPart.find('\n');
-        if (firstNL != std::string::npos)
-        {
-            size_t pos = firstNL + 1;
-            while (pos < headersPart.size())
+            if (eol == std::string::npos)
             {
-                size_t eol = headersPart.find('\n', pos);
-                std::string line;
-
-                if (eol == std::string::npos)
-                {
-                    line = headersPart.substr(pos);
-                    pos = headersPart.size();
-                }
-                else
-                {
-                    line = headersPart.substr(pos, eol - pos);
-                    pos = eol + 1;
-                }
+                line = headersPart.substr(pos);
+                pos = headersPart.size();
+            }
+            else
+            {
+                line = headersPart.substr(pos, eol - pos);
+                pos = eol + 1;
+            }
 
-                if (!line.empty() && line[line.size() - 1] == '\r')
-                    line.erase(line.size() - 1);
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
 
-                if (line.empty())
-                    break;
+            if (line.empty())
+                break;
 
-                size_t c = line.find(':');
-                if (c == std::string::npos)
-                {
-                    outErrCode = 400;
-                    return false;
-                }
+            size_t c = line.find(':');
+            if (c == std::string::npos)
+            {
+                outErrCode = 400;
+                return false;
+            }
 
-                std::string key = trim(line.substr(0, c));
-                std::string val = trim(line.substr(c + 1));
+            std::string key = trim(line.substr(0, c));
+            std::string val = trim(line.substr(c + 1));
 
-                if (key.empty())
+            if (key.empty())
+            {
+                outErrCode = 400;
+                return false;
+            }
+            std::string keyLower = to_lower(key);
+            for (std::map<std::string, std::string>::const_iterator it = outReq.headers.begin();
+                 it != outReq.headers.end(); ++it)
+            {
+                if (to_lower(it->first) == keyLower)
                 {
                     outErrCode = 400;
                     return false;
                 }
-                std::string keyLower = to_lower(key);
-                for (std::map<std::string, std::string>::const_iterator it = outReq.headers.begin();
-                     it != outReq.headers.end(); ++it)
-                {
-                    if (to_lower(it->first) == keyLower)
-                    {
-                        outErrCode = 400;
-                        return false;
-                    }
-                }
+            }
 
-                outReq.headers[key] = val;
+            outReq.headers[key] = val;
 
-                if (keyLower == "host")
-                    parse_host_header_value(val, outReq.host, outReq.port);
-            }
+            if (keyLower == "host")
+                parse_host_header_value(val, outReq.host, outReq.port);
         }
+    }
 
-        bool hasCL = false;
-        size_t contentLen = 0;
+    hasCL = false;
+    contentLen = 0;
 
-        for (std::map<std::string, std::string>::const_iterator it = outReq.headers.begin();
-             it != outReq.headers.end(); ++it)
+    for (std::map<std::string, std::string>::const_iterator it = outReq.headers.begin();
+         it != outReq.headers.end(); ++it)
+    {
+        std::string k = to_lower(it->first);
+        if (k == "transfer-encoding")
+        {
+            outErrCode = 505;
+            return false;
+        }
+        else if (k == "content-length")
         {
-            std::string k = to_lower(it->first);
-            if (k == "transfer-encoding")
+            if (hasCL)
             {
-                outErrCode = 505;
+                outErrCode = 400;
                 return false;
             }
-            else if (k == "content-length")
+            if (!parse_content_length_value(it->second, contentLen))
             {
-                if (hasCL)
-                {
-                    outErrCode = 400;
-                    return false;
-                }
-                if (!parse_content_length_value(it->second, contentLen))
-                {
-                    outErrCode = 400;
-                    return false;
-                }
-                hasCL = true;
+                outErrCode = 400;
+                return false;
             }
+            hasCL = true;
+        }
+    }
+    if (!hasCL && outReq.method == HTTP_POST)
+    {
+        outErrCode = 411;
+        return false;
+    }
+    return true;
+}
+
+static size_t split_head(const std::string& raw, size_t& delimLen)
+{
+    size_t he = raw.find("\r\n\r\n");
+    delimLen = 4;
+
+    if (he == std::string::npos)
+    {
+        he = raw.find("\n\n");
+        delimLen = 2;
+    }
+    return he;
+}
+
+namespace http10
+{
+    bool parseRequest(const std::string& raw, int listenPort, HTTPRequest& outReq, int& outErrCode)
+    {
+        outErrCode = 400;
+
+        size_t delimLen = 4;
+        size_t he = split_head(raw, delimLen);
+
+        std::string headersPart;
+        std::string bodyPart;
+
+        if (he == std::string::npos)
+        {
+            headersPart = raw;
+            bodyPart = "";
         }
-        if (!hasCL && outReq.method == HTTP_POST)
+        else
         {
-            outErrCode = 411;
-            return false;
+            headersPart = raw.substr(0, he);
+            bodyPart = raw.substr(he + delimLen);
         }
+
+        bool hasCL = false;
+        size_t contentLen = 0;
+        if (!parse_head(headersPart, listenPort, outReq, outErrCode, hasCL, contentLen))
+            return false;
+
         if (!hasCL)
         {
             if (!bodyPart.empty())
@@ -308,4 +327,20 @@ namespace http10
         outReq.body.assign(bodyPart.begin(), bodyPart.end());
         return true;
     }
+
+    // Only the head of a request whose body is still on its way: anything
+    // after the blank line is ignored and outReq.body stays empty.
+    bool parseRequestHead(const std::string& raw, int listenPort, HTTPRequest& outReq,
+                          int& outErrCode, size_t& outContentLen)
+    {
+        outErrCode = 400;
+
+        size_t delimLen = 4;
+        size_t he = split_head(raw, delimLen);
+        std::string headersPart = (he == std::string::npos) ? raw : raw.substr(0, he);
+
+        bool hasCL = false;
+        outContentLen = 0;
+        return parse_head(headersPart, listenPort, outReq, outErrCode, hasCL, outContentLen);
+    }
 }
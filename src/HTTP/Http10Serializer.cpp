@@ -24,9 +24,18 @@ static std::string to_dec(size_t v)
 
 namespace http10
 {
-    std::string makeError(int code, const char* msg)
+    // Canned error responses are built once per (code, message) and then
+    // handed out as shared buffers, so error storms never re-serialize.
+    SharedBuffer makeError(int code, const char* msg)
     {
+        static std::map<std::pair<int, std::string>, SharedBuffer> canned;
+
         std::string body(msg ? msg : "");
+        std::pair<int, std::string> key(code, body);
+        std::map<std::pair<int, std::string>, SharedBuffer>::const_iterator it = canned.find(key);
+        if (it != canned.end())
+            return it->second;
+
         if (body.empty() || body[body.size() - 1] != '\n')
             body += "\n";
 
@@ -46,19 +55,26 @@ namespace http10
         oss << "Connection: close\r\n";
         oss << "\r\n";
         oss << body;
-        return oss.str();
+
+        SharedBuffer out(oss.str());
+        canned[key] = out;
+        return out;
     }
 
-    std::string serializeClose(const HTTPResponse& res)
+    static std::string status_and_headers(const HTTPResponse& res, bool fillLength)
     {
         std::map<std::string, std::string> headers = res.headers;
         headers["Connection"] = "close";
         
-        if (headers.find("Content-Length") == headers.end())
-            headers["Content-Length"] = to_dec(res.body.size());
-        
-        if (headers.find("Content-Type") == headers.end())
-            headers["Content-Type"] = "text/plain";
+        // a 304 carries no body, so no entity headers are made up for it
+        if (res.status_code != 304)
+        {
+            if (fillLength && headers.find("Content-Length") == headers.end())
+                headers["Content-Length"] = to_dec(res.body.size());
+
+            if (headers.find("Content-Type") == headers.end())
+                headers["Content-Type"] = "text/plain";
+        }
 
         int code = res.status_code;
         std::string reason = res.reason_phrase;
@@ -67,14 +83,17 @@ namespace http10
             if (code == 200) reason = "OK";
             else if (code == 201) reason = "Created";
             else if (code == 204) reason = "No Content";
+            else if (code == 206) reason = "Partial Content";
             else if (code == 301) reason = "Moved Permanently";
             else if (code == 302) reason = "Found";
+            else if (code == 304) reason = "Not Modified";
             else if (code == 400) reason = "Bad Request";
             else if (code == 403) reason = "Forbidden";
             else if (code == 404) reason = "Not Found";
             else if (code == 405) reason = "Method Not Allowed";
             else if (code == 411) reason = "Length Required";
             else if (code == 413) reason = "Payload Too Large";
+            else if (code == 416) reason = "Range Not Satisfiable";
             else if (code == 500) reason = "Internal Server Error";
             else if (code == 505) reason = "HTTP Version Not Supported";
             else reason = "OK";
@@ -86,10 +105,21 @@ namespace http10
              it != headers.end(); ++it)
             oss << it->first << ": " << it->second << "\r\n";
         oss << "\r\n";
+        return oss.str();
+    }
 
-        std::string out = oss.str();
+    std::string serializeClose(const HTTPResponse& res)
+    {
+        std::string out = status_and_headers(res, true);
         if (!res.body.empty())
             out.append(&res.body[0], res.body.size());
         return out;
     }
+
+    // status line and headers only, for a body that is streamed afterwards.
+    // Without a Content-Length the body simply ends when the connection closes.
+    std::string serializeHeadClose(const HTTPResponse& res)
+    {
+        return status_and_headers(res, false);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,127 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Http2Frames.cpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 15:42:06 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 15:42:06 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/HTTP/http2/Http2Frames.hpp"
+
+static void put_u32(std::string& out, unsigned int v)
+{
+    out += (char)((v >> 24) & 0xff);
+    out += (char)((v >> 16) & 0xff);
+    out += (char)((v >> 8) & 0xff);
+    out += (char)(v & 0xff);
+}
+
+namespace http2
+{
+
+unsigned int readU32(const char* p)
+{
+    const unsigned char* u = (const unsigned char*)p;
+    return ((unsigned int)u[0] << 24) | ((unsigned int)u[1] << 16)
+         | ((unsigned int)u[2] << 8) | (unsigned int)u[3];
+}
+
+void parseFrameHeader(const char* p, FrameHeader& out)
+{
+    const unsigned char* u = (const unsigned char*)p;
+    out.length = ((size_t)u[0] << 16) | ((size_t)u[1] << 8) | (size_t)u[2];
+    out.type = u[3];
+    out.flags = u[4];
+    out.streamId = readU32(p + 5) & 0x7fffffffu;
+}
+
+bool parseSettings(const std::string& payload, Settings& out)
+{
+    if (payload.size() % 6)
+        return false;
+    for (size_t i = 0; i < payload.size(); i += 6)
+    {
+        int id = ((unsigned char)payload[i] << 8) | (unsigned char)payload[i + 1];
+        out.push_back(std::make_pair(id, readU32(payload.data() + i + 2)));
+    }
+    return true;
+}
+
+void appendFrameHeader(std::string& out, size_t length, int type, int flags, unsigned int streamId)
+{
+    out += (char)((length >> 16) & 0xff);
+    out += (char)((length >> 8) & 0xff);
+    out += (char)(length & 0xff);
+    out += (char)type;
+    out += (char)flags;
+    put_u32(out, streamId & 0x7fffffffu);
+}
+
+void appendSettings(std::string& out, const Settings& s)
+{
+    appendFrameHeader(out, s.size() * 6, H2_SETTINGS, 0, 0);
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        out += (char)((s[i].first >> 8) & 0xff);
+        out += (char)(s[i].first & 0xff);
+        put_u32(out, s[i].second);
+    }
+}
+
+void appendSettingsAck(std::string& out)
+{
+    appendFrameHeader(out, 0, H2_SETTINGS, H2_FLAG_ACK, 0);
+}
+
+void appendWindowUpdate(std::string& out, unsigned int streamId, unsigned int increment)
+{
+    appendFrameHeader(out, 4, H2_WINDOW_UPDATE, 0, streamId);
+    put_u32(out, increment & 0x7fffffffu);
+}
+
+void appendRstStream(std::string& out, unsigned int streamId, unsigned int code)
+{
+    appendFrameHeader(out, 4, H2_RST_STREAM, 0, streamId);
+    put_u32(out, code);
+}
+
+void appendGoaway(std::string& out, unsigned int lastStreamId, unsigned int code)
+{
+    appendFrameHeader(out, 8, H2_GOAWAY, 0, 0);
+    put_u32(out, lastStreamId & 0x7fffffffu);
+    put_u32(out, code);
+}
+
+void appendPingAck(std::string& out, const std::string& opaque)
+{
+    appendFrameHeader(out, 8, H2_PING, H2_FLAG_ACK, 0);
+    out += opaque;
+}
+
+void appendHeaders(std::string& out, unsigned int streamId, const std::string& block,
+                   bool endStream, size_t maxFrame)
+{
+    size_t off = 0;
+    int    type = H2_HEADERS;
+    do
+    {
+        size_t n = block.size() - off;
+        if (n > maxFrame)
+            n = maxFrame;
+        int flags = 0;
+        if (type == H2_HEADERS && endStream)
+            flags |= H2_FLAG_END_STREAM;
+        if (off + n == block.size())
+            flags |= H2_FLAG_END_HEADERS;
+        appendFrameHeader(out, n, type, flags, streamId);
+        out.append(block, off, n);
+        off += n;
+        type = H2_CONTINUATION;
+    } while (off < block.size());
+}
+
+}
@@ -0,0 +1,516 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Http2Hpack.cpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 15:10:24 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 15:10:24 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/HTTP/http2/Http2Hpack.hpp"
+
+#define HPACK_ENTRY_OVERHEAD 32
+
+// RFC 7541 Appendix A
+static const char* const STATIC_TABLE[][2] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""}
+};
+
+#define STATIC_COUNT (sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]))
+
+// RFC 7541 Appendix B: code (right-aligned) and its length in bits, by symbol;
+// 256 is EOS
+static const struct { unsigned int code; unsigned char bits; } HUFFMAN[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+    {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+    {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+    {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+    {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+    {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+    {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+    {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+    {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+    {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+    {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+    {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+    {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+    {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+    {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},
+};
+
+// ---- integers and strings (RFC 7541 5.1, 5.2) ----
+
+static bool decode_int(const std::string& b, size_t& pos, int prefix, size_t& out)
+{
+    if (pos >= b.size())
+        return false;
+    const size_t max = (1u << prefix) - 1;
+    size_t v = (unsigned char)b[pos++] & max;
+    if (v < max)
+    {
+        out = v;
+        return true;
+    }
+    unsigned int shift = 0;
+    while (pos < b.size())
+    {
+        unsigned char c = (unsigned char)b[pos++];
+        if (shift > 28)
+            return false;
+        v += (size_t)(c & 0x7f) << shift;
+        shift += 7;
+        if (!(c & 0x80))
+        {
+            out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void encode_int(std::string& out, unsigned char first, int prefix, size_t v)
+{
+    const size_t max = (1u << prefix) - 1;
+    if (v < max)
+    {
+        out += (char)(first | v);
+        return;
+    }
+    out += (char)(first | max);
+    v -= max;
+    while (v >= 128)
+    {
+        out += (char)((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+static bool decode_string(const std::string& b, size_t& pos, std::string& out)
+{
+    if (pos >= b.size())
+        return false;
+    const bool huff = ((unsigned char)b[pos] & 0x80) != 0;
+    size_t len = 0;
+    if (!decode_int(b, pos, 7, len) || len > b.size() - pos)
+        return false;
+    std::string raw = b.substr(pos, len);
+    pos += len;
+    if (!huff)
+    {
+        out.swap(raw);
+        return true;
+    }
+    out.clear();
+    return http2::huffmanDecode(raw, out);
+}
+
+static void encode_string(std::string& out, const std::string& s)
+{
+    size_t hlen = http2::huffmanLength(s);
+    if (hlen < s.size())
+    {
+        encode_int(out, 0x80, 7, hlen);
+        http2::huffmanEncode(s, out);
+        return;
+    }
+    encode_int(out, 0x00, 7, s.size());
+    out += s;
+}
+
+// ---- Huffman ----
+
+// decoding tree, built on first use: node 0 is the root, leaves hold symbol + 1
+static int  g_child[2 * 257][2];
+static int  g_leaf[2 * 257];
+static bool g_treeReady = false;
+
+static void build_tree()
+{
+    int nodes = 1;
+    for (int s = 0; s < 257; ++s)
+    {
+        int n = 0;
+        for (int i = HUFFMAN[s].bits - 1; i >= 0; --i)
+        {
+            int bit = (HUFFMAN[s].code >> i) & 1;
+            if (!g_child[n][bit])
+                g_child[n][bit] = nodes++;
+            n = g_child[n][bit];
+        }
+        g_leaf[n] = s + 1;
+    }
+    g_treeReady = true;
+}
+
+namespace http2
+{
+
+bool huffmanDecode(const std::string& in, std::string& out)
+{
+    if (!g_treeReady)
+        build_tree();
+
+    int  n = 0;
+    int  depth = 0;        // bits since the last symbol
+    bool ones = true;      // ...all of them 1 (valid padding so far)
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        unsigned char c = (unsigned char)in[i];
+        for (int b = 7; b >= 0; --b)
+        {
+            int bit = (c >> b) & 1;
+            n = g_child[n][bit];
+            if (!n)
+                return false;
+            depth++;
+            ones = ones && bit;
+            if (g_leaf[n])
+            {
+                if (g_leaf[n] == 257)
+                    return false;     // EOS inside a string
+                out += (char)(g_leaf[n] - 1);
+                n = 0;
+                depth = 0;
+                ones = true;
+            }
+        }
+    }
+    // padding: the start of EOS, at most 7 bits
+    return depth < 8 && ones;
+}
+
+size_t huffmanLength(const std::string& in)
+{
+    size_t bits = 0;
+    for (size_t i = 0; i < in.size(); ++i)
+        bits += HUFFMAN[(unsigned char)in[i]].bits;
+    return (bits + 7) / 8;
+}
+
+void huffmanEncode(const std::string& in, std::string& out)
+{
+    unsigned long long acc = 0;
+    int                have = 0;
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        const unsigned char s = (unsigned char)in[i];
+        acc = (acc << HUFFMAN[s].bits) | HUFFMAN[s].code;
+        have += HUFFMAN[s].bits;
+        while (have >= 8)
+        {
+            have -= 8;
+            out += (char)((acc >> have) & 0xff);
+        }
+    }
+    if (have > 0)
+        out += (char)(((acc << (8 - have)) | (0xff >> have)) & 0xff);
+}
+
+// ---- tables ----
+
+HpackTable::HpackTable()
+: _entries()
+, _size(0)
+, _maxSize(HPACK_TABLE_SIZE)
+{}
+
+void HpackTable::setMaxSize(size_t n)
+{
+    _maxSize = n;
+    evict(_maxSize);
+}
+
+size_t HpackTable::maxSize() const
+{
+    return _maxSize;
+}
+
+void HpackTable::evict(size_t limit)
+{
+    while (_size > limit && !_entries.empty())
+    {
+        _size -= _entries.back().first.size() + _entries.back().second.size() + HPACK_ENTRY_OVERHEAD;
+        _entries.pop_back();
+    }
+}
+
+// an entry bigger than the whole table just empties it
+void HpackTable::add(const std::string& name, const std::string& value)
+{
+    size_t cost = name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+    if (cost > _maxSize)
+    {
+        evict(0);
+        return;
+    }
+    evict(_maxSize - cost);
+    _entries.push_front(HeaderField(name, value));
+    _size += cost;
+}
+
+bool HpackTable::get(size_t index, HeaderField& out) const
+{
+    if (index == 0)
+        return false;
+    if (index <= STATIC_COUNT)
+    {
+        out.first = STATIC_TABLE[index - 1][0];
+        out.second = STATIC_TABLE[index - 1][1];
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if (index >= _entries.size())
+        return false;
+    out = _entries[index];
+    return true;
+}
+
+size_t HpackTable::find(const std::string& name, const std::string& value, bool& nameOnly) const
+{
+    size_t byName = 0;
+    for (size_t i = 0; i < STATIC_COUNT; ++i)
+    {
+        if (name != STATIC_TABLE[i][0])
+            continue;
+        if (value == STATIC_TABLE[i][1])
+        {
+            nameOnly = false;
+            return i + 1;
+        }
+        if (!byName)
+            byName = i + 1;
+    }
+    for (size_t i = 0; i < _entries.size(); ++i)
+    {
+        if (_entries[i].first != name)
+            continue;
+        if (_entries[i].second == value)
+        {
+            nameOnly = false;
+            return STATIC_COUNT + 1 + i;
+        }
+        if (!byName)
+            byName = STATIC_COUNT + 1 + i;
+    }
+    nameOnly = true;
+    return byName;
+}
+
+// ---- decoder ----
+
+HpackDecoder::HpackDecoder()
+: _table()
+{}
+
+// a few bytes of indexed fields can name the same big table entry over and
+// over: the list is measured as it grows, not after
+static bool add_field(std::vector<HeaderField>& out, const HeaderField& f, size_t& listSize,
+                      size_t maxListSize)
+{
+    listSize += f.first.size() + f.second.size() + 32;
+    if (listSize > maxListSize)
+        return false;
+    out.push_back(f);
+    return true;
+}
+
+bool HpackDecoder::decode(const std::string& block, std::vector<HeaderField>& out, size_t maxListSize)
+{
+    size_t pos = 0;
+    size_t listSize = 0;
+    while (pos < block.size())
+    {
+        const unsigned char c = (unsigned char)block[pos];
+        size_t index = 0;
+        HeaderField f;
+
+        if (c & 0x80)
+        {
+            // indexed header field
+            if (!decode_int(block, pos, 7, index) || !_table.get(index, f)
+                || !add_field(out, f, listSize, maxListSize))
+                return false;
+            continue;
+        }
+        if ((c & 0xe0) == 0x20)
+        {
+            // dynamic table size update, up to what our SETTINGS allow
+            if (!decode_int(block, pos, 5, index) || index > HPACK_TABLE_SIZE)
+                return false;
+            _table.setMaxSize(index);
+            continue;
+        }
+
+        // literal: with incremental indexing (01), without / never indexed (0000 / 0001)
+        const bool indexing = (c & 0xc0) == 0x40;
+        if (!decode_int(block, pos, indexing ? 6 : 4, index))
+            return false;
+        if (index)
+        {
+            if (!_table.get(index, f))
+                return false;
+        }
+        else if (!decode_string(block, pos, f.first))
+            return false;
+        if (!decode_string(block, pos, f.second))
+            return false;
+        if (indexing)
+            _table.add(f.first, f.second);
+        if (!add_field(out, f, listSize, maxListSize))
+            return false;
+    }
+    return true;
+}
+
+// ---- encoder ----
+
+HpackEncoder::HpackEncoder()
+: _table()
+, _sizeChanged(false)
+{}
+
+void HpackEncoder::setPeerMaxSize(size_t n)
+{
+    if (n > HPACK_TABLE_SIZE)
+        n = HPACK_TABLE_SIZE;
+    if (n == _table.maxSize())
+        return;
+    _table.setMaxSize(n);
+    _sizeChanged = true;
+}
+
+// values that change with every response: not worth a table slot
+static bool not_worth_indexing(const std::string& name)
+{
+    return name == "content-length" || name == "date" || name == "etag"
+        || name == "last-modified" || name == "set-cookie" || name == "content-range"
+        || name == "location";
+}
+
+void HpackEncoder::encode(const std::vector<HeaderField>& fields, std::string& out)
+{
+    if (_sizeChanged)
+    {
+        encode_int(out, 0x20, 5, _table.maxSize());
+        _sizeChanged = false;
+    }
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        const std::string& name = fields[i].first;
+        const std::string& value = fields[i].second;
+
+        bool nameOnly = true;
+        size_t index = _table.find(name, value, nameOnly);
+        if (index && !nameOnly)
+        {
+            encode_int(out, 0x80, 7, index);
+            continue;
+        }
+
+        bool indexing = !not_worth_indexing(name)
+            && name.size() + value.size() + HPACK_ENTRY_OVERHEAD <= _table.maxSize();
+        if (indexing)
+            encode_int(out, 0x40, 6, index);
+        else
+            encode_int(out, 0x00, 4, index);
+        if (!index)
+            encode_string(out, name);
+        encode_string(out, value);
+        if (indexing)
+            _table.add(name, value);
+    }
+}
+
+}
@@ -0,0 +1,80 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   SharedBuffer.cpp                                   :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/10 10:12:10 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/10 10:12:10 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/HTTP/SharedBuffer.hpp"
+
+static const std::string g_empty;
+
+SharedBuffer::SharedBuffer() : _blk(NULL) {}
+
+SharedBuffer::SharedBuffer(const std::string& bytes) : _blk(new Block)
+{
+    _blk->bytes = bytes;
+    _blk->refs = 1;
+}
+
+SharedBuffer::SharedBuffer(const char* data, size_t len) : _blk(new Block)
+{
+    _blk->bytes.assign(data, len);
+    _blk->refs = 1;
+}
+
+SharedBuffer::SharedBuffer(const SharedBuffer& other) : _blk(other._blk)
+{
+    if (_blk)
+        _blk->refs++;
+}
+
+SharedBuffer& SharedBuffer::operator=(const SharedBuffer& other)
+{
+    if (_blk == other._blk)
+        return *this;
+    if (other._blk)
+        other._blk->refs++;
+    release();
+    _blk = other._blk;
+    return *this;
+}
+
+SharedBuffer::~SharedBuffer()
+{
+    release();
+}
+
+void SharedBuffer::release()
+{
+    if (!_blk)
+        return;
+    if (--_blk->refs == 0)
+        delete _blk;
+    _blk = NULL;
+}
+
+const char* SharedBuffer::data() const
+{
+    return _blk ? _blk->bytes.data() : g_empty.data();
+}
+
+size_t SharedBuffer::size() const
+{
+    return _blk ? _blk->bytes.size() : 0;
+}
+
+bool SharedBuffer::empty() const
+{
+    return size() == 0;
+}
+
+const std::string& SharedBuffer::str() const
+{
+    return _blk ? _blk->bytes : g_empty;
+}
@@ -17,7 +17,14 @@
 #include <sys/stat.h>
 #include <cstring>
 
-Router::Router(const Config& config) : _config(config) {}
+Router::Router(const Config& config)
+: _config(config), _errorPages(), _mimeTypes(), _meta(1, 4096), _gzipCache(),
+  _listings(32 * 1024 * 1024)
+{
+    preload_error_pages();
+    build_mime_types();
+    build_compress_caches();
+}
 Router::~Router() {}
 
 
@@ -186,7 +193,19 @@ const ServerConfig &Router::find_server_config(const HTTPRequest& request) const
 
     return *candidates[0];
 }
-HTTPResponse Router::handle_route_Request(const HTTPRequest& request) const
+HTTPResponse Router::handle_route_Request(const HTTPRequest& request, RouteLabel* route) const
+{
+    return route_request(request, false, route);
+}
+
+// X-Accel-Redirect / X-Sendfile from a CGI: same as a client request, but
+// only `internal` locations may be reached
+HTTPResponse Router::handle_internal_request(const HTTPRequest& request) const
+{
+    return route_request(request, true, NULL);
+}
+
+HTTPResponse Router::route_request(const HTTPRequest& request, bool internal, RouteLabel* route) const
 {
     HTTPResponse response;
 
@@ -204,6 +223,12 @@ HTTPResponse Router::handle_route_Request(const HTTPRequest& request) const
     }
 
     const ServerConfig& server = find_server_config(request);
+    if (route)
+    {
+        route->server = server.server_name;
+        route->accessLog = server.accessLog;
+        route->accessLogJson = server.accessLogJson;
+    }
 
     std::string decoded;
     if (!url_decode_path(request.uri, decoded))
@@ -226,7 +251,7 @@ HTTPResponse Router::handle_route_Request(const HTTPRequest& request) const
         return apply_error_page(server, 403, response);
     }
     const LocationConfig* loc = find_location_config(norm, server);
-    if (!loc)
+    if (!loc || loc->internal != internal)
     {
         response.status_code = 404;
         response.reason_phrase = "Not Found";
@@ -235,6 +260,11 @@ HTTPResponse Router::handle_route_Request(const HTTPRequest& request) const
         response.headers["Content-Length"] = to_string(response.body.size());
         return apply_error_page(server, 404, response);
     }
+    if (route)
+    {
+        route->location = loc->path;
+        route->slowMs = loc->slowRequestLog;
+    }
     if (loc->returnCode != 0)
     {
         response.status_code = loc->returnCode;
@@ -263,6 +293,8 @@ HTTPResponse Router::handle_route_Request(const HTTPRequest& request) const
         response.headers["Content-Length"] = to_string(response.body.size());
         return apply_error_page(server, 405, response);
     }
+    if (loc->metrics)
+        return metrics_response(request);
 
     std::string fullpath = final_path(server, *loc, norm);
 
@@ -327,12 +359,15 @@ HTTPResponse Router::handle_route_Request(const HTTPRequest& request) const
     if (S_ISDIR(st.st_mode))
     {
         if (loc->autoindex)
-            response = generate_autoindex_response(fullpath);
+        {
+            response = generate_autoindex_response(*loc, fullpath, st, request.uri);
+            compress_response(*loc, negotiate_compression(*loc, request), response);
+        }
         else
         {
             std::string index = fullpath + "/" + server.index;
             if (stat(index.c_str(), &st) == 0)
-                response = serve_static_file(index);
+                response = serve_static_file(server, *loc, request, index, st);
             else
             {
                 response.status_code = 404;
@@ -346,14 +381,13 @@ HTTPResponse Router::handle_route_Request(const HTTPRequest& request) const
     }
     else
     {
-        response = serve_static_file(fullpath);
+        response = serve_static_file(server, *loc, request, fullpath, st);
     }
 
     if (isHead)
     {
-        std::string len = response.headers["Content-Length"];
         response.body.clear();
-        response.headers["Content-Length"] = len;
+        response.parts.clear();
     }
 
     return response;
@@ -19,8 +19,12 @@
 #include "../../include/HTTP/http10/Http10Parser.hpp"
 #include "../../include/HTTP/http10/Http10Serializer.hpp"
 #include "../../include/sockets/ListenPort.hpp"
+#include "../../include/sockets/NetUtil.hpp"
 
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <ctime>
@@ -28,7 +32,16 @@
 #include <sstream>
 #include <stdexcept>
 #include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <vector>
+#include <iostream>
+
+// cgi_cache budget for all entries and their variants; bigger answers are not stored
+#define CGI_CACHE_MAX_BYTES (64 * 1024 * 1024)
+#define CGI_CACHE_MAX_BODY  (1024 * 1024)
+// cgi_body_file: where the body files live (unlinked right away)
+#define CGI_BODY_FILE_DIR "/tmp"
 
 static bool url_decode_path(const std::string& in, std::string& out)
 {
@@ -106,9 +119,161 @@ static bool normalize_uri_path(const std::string& rawUri, std::string& out)
     return true;
 }
 
-RouterByteHandler::RouterByteHandler(const std::string& configPath)
-: _cfg()
-, _router(NULL)
+// "name=N" inside a lowercased Cache-Control value
+static bool cache_control_seconds(const std::string& cc, const std::string& name, int& out)
+{
+    size_t pos = 0;
+    while ((pos = cc.find(name, pos)) != std::string::npos)
+    {
+        size_t end = pos + name.size();
+        bool start = (pos == 0 || cc[pos - 1] == ' ' || cc[pos - 1] == ',');
+        if (start && end < cc.size() && cc[end] == '=')
+        {
+            out = std::atoi(cc.c_str() + end + 1);
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
+
+// The cache key is only the URL, so an answer that varies on anything but
+// the coding (handled per variant) cannot be shared: Vary: * or Cookie, say.
+static bool vary_only_on_coding(const std::string& vary)
+{
+    size_t pos = 0;
+    while (pos <= vary.size())
+    {
+        size_t comma = vary.find(',', pos);
+        if (comma == std::string::npos)
+            comma = vary.size();
+        std::string field = asciiLower(trimSpaces(vary.substr(pos, comma - pos)));
+        pos = comma + 1;
+        if (!field.empty() && field != "accept-encoding")
+            return false;
+    }
+    return true;
+}
+
+// May this CGI answer be shared (cached, or handed to collapsed requests), and
+// for how long may it be cached? The location's cgi_cache / cgi_cache_stale
+// are the defaults, the script's Cache-Control overrides them.
+static bool cgi_shareable(const HTTPResponse& head, int& ttl, int& stale)
+{
+    if (head.status_code != 200)
+        return false;
+
+    for (std::map<std::string, std::string>::const_iterator it = head.headers.begin();
+         it != head.headers.end(); ++it)
+    {
+        std::string name = asciiLower(it->first);
+        if (name == "set-cookie")
+            return false;
+        if (name == "vary" && !vary_only_on_coding(it->second))
+            return false;
+        if (name != "cache-control")
+            continue;
+
+        std::string cc = asciiLower(it->second);
+        if (cc.find("no-store") != std::string::npos || cc.find("no-cache") != std::string::npos ||
+            cc.find("private") != std::string::npos)
+            return false;
+        if (!cache_control_seconds(cc, "s-maxage", ttl))
+            cache_control_seconds(cc, "max-age", ttl);
+        cache_control_seconds(cc, "stale-while-revalidate", stale);
+    }
+    if (stale < 0)
+        stale = 0;
+    return true;
+}
+
+static bool write_all(int fd, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static std::string peer_address(int fd)
+{
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    char buf[INET6_ADDRSTRLEN];
+    if (getpeername(fd, (struct sockaddr*)&ss, &len) != 0)
+        return "";
+    if (ss.ss_family == AF_INET)
+        return inet_ntop(AF_INET, &((struct sockaddr_in*)&ss)->sin_addr, buf, sizeof(buf)) ? buf : "";
+    if (ss.ss_family == AF_INET6)
+        return inet_ntop(AF_INET6, &((struct sockaddr_in6*)&ss)->sin6_addr, buf, sizeof(buf)) ? buf : "";
+    return "";
+}
+
+// request headers that only describe the client's hop (or that we set again)
+static bool proxy_skips_header(const std::string& lname)
+{
+    return lname == "connection" || lname == "keep-alive" || lname == "proxy-connection"
+        || lname == "te" || lname == "trailer" || lname == "upgrade"
+        || lname == "transfer-encoding" || lname == "content-length" || lname == "expect"
+        || lname == "x-forwarded-for" || lname == "x-forwarded-proto";
+}
+
+// The request as the upstream gets it: the location prefix is swapped for the
+// proxy_pass path (if it has one), the client's own headers are kept, and the
+// connection is asked to stay open for the next request.
+static std::string proxy_request(const HTTPRequest& req, const std::string& method,
+                                 const LocationConfig& loc, const std::string& address,
+                                 const std::string& upPath, const std::string& clientIp,
+                                 bool https)
+{
+    std::string uri = req.uri;
+    if (!upPath.empty() && uri.compare(0, loc.path.size(), loc.path) == 0)
+    {
+        std::string rest = uri.substr(loc.path.size());
+        if (!rest.empty() && rest[0] == '/' && upPath[upPath.size() - 1] == '/')
+            rest.erase(0, 1);
+        uri = upPath + rest;
+    }
+
+    std::ostringstream out;
+    out << method << " " << uri << " HTTP/1.1\r\n";
+    bool hasHost = false;
+    std::string forwarded;
+    for (std::map<std::string, std::string>::const_iterator it = req.headers.begin();
+         it != req.headers.end(); ++it)
+    {
+        std::string lname = asciiLower(it->first);
+        if (lname == "x-forwarded-for")
+            forwarded = it->second;
+        if (proxy_skips_header(lname))
+            continue;
+        if (lname == "host")
+            hasHost = true;
+        out << it->first << ": " << it->second << "\r\n";
+    }
+    if (!hasHost)
+        out << "Host: " << address << "\r\n";
+    if (!clientIp.empty())
+        out << "X-Forwarded-For: " << (forwarded.empty() ? clientIp : forwarded + ", " + clientIp) << "\r\n";
+    out << "X-Forwarded-Proto: " << (https ? "https" : "http") << "\r\n";
+    if (!req.body.empty() || req.method == HTTP_POST)
+        out << "Content-Length: " << req.body.size() << "\r\n";
+    out << "Connection: keep-alive\r\n\r\n";
+
+    std::string bytes = out.str();
+    if (!req.body.empty())
+        bytes.append(&req.body[0], req.body.size());
+    return bytes;
+}
+
+static bool load_config_file(const std::string& configPath, Config& outCfg)
 {
     std::ifstream file(configPath.c_str());
     if (!file)
@@ -121,17 +286,56 @@ RouterByteHandler::RouterByteHandler(const std::string& configPath)
     std::vector<Token> tokens = tokenizer.tokenize();
 
     Parser parser(tokens);
-    _cfg = parser.parse();
+    outCfg = parser.parse();
+    return !parser.hasFatalError() && !outCfg.servers.empty();
+}
 
+RouterByteHandler::RouterByteHandler(const std::string& configPath)
+: _cfg()
+, _router(NULL)
+, _configPath(configPath)
+, _cgiEncode()
+, _cgiCapture()
+, _cgiCache()
+, _refreshSeq(0)
+{
+    load_config_file(_configPath, _cfg);
     _router = new Router(_cfg);
+    _cgiCache.setLimit(CGI_CACHE_MAX_BYTES);
 }
 
 RouterByteHandler::~RouterByteHandler()
 {
+    while (!_cgiEncode.empty())
+        dropCgiEncode(_cgiEncode.begin()->first);
+    _cgiCapture.clear();
     delete _router;
     _router = NULL;
 }
 
+// Re-reads the config file and rebuilds the router (and with it the preloaded
+// error pages). Listening sockets are not touched. On error the old config stays.
+bool RouterByteHandler::reloadConfig()
+{
+    Config fresh;
+    try
+    {
+        if (!load_config_file(_configPath, fresh))
+            return false;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Reload failed: " << e.what() << std::endl;
+        return false;
+    }
+
+    delete _router;
+    _cfg = fresh;
+    _router = new Router(_cfg);
+    _cgiCache.clear();
+    return true;
+}
+
 ByteReply RouterByteHandler::handleBytes(int acceptFd, const std::string& rawMessage)
 {
     HTTPRequest req;
@@ -149,19 +353,54 @@ ByteReply RouterByteHandler::handleBytes(int acceptFd, const std::string& rawMes
         return ByteReply(http10::makeError(err, "Bad Request"), true);
     }
 
-    HTTPResponse res = _router->handle_route_Request(req);
-    return ByteReply(http10::serializeClose(res), true);
+    RouteLabel route;
+    HTTPResponse res = _router->handle_route_Request(req, &route);
+    if (!res.prebuilt.empty())
+    {
+        ByteReply pre(res.prebuilt, true);
+        pre.route = route;
+        return pre;
+    }
+    ByteReply rep(http10::serializeClose(res), true);
+    rep.parts.swap(res.parts);
+    rep.route = route;
+    return rep;
 }
 
-CgiStartResult RouterByteHandler::tryStartCgi(int acceptFd, const std::string& rawMessage)
+CgiStartResult RouterByteHandler::tryStartCgi(int acceptFd, int clientFd,
+                                              const std::string& rawMessage, bool headOnly,
+                                              int flags)
+{
+    return startCgiRun(acceptFd, clientFd, rawMessage, headOnly, flags, -1);
+}
+
+// the slot (if any) was claimed when the body started to arrive
+CgiStartResult RouterByteHandler::startCgiWithStdin(int acceptFd, int clientFd,
+                                                    const std::string& headMessage, int stdinFd)
+{
+    return startCgiRun(acceptFd, clientFd, headMessage, true, CGI_START_ADMITTED, stdinFd);
+}
+
+CgiStartResult RouterByteHandler::startCgiRun(int acceptFd, int clientFd,
+                                              const std::string& rawMessage, bool headOnly,
+                                              int flags, int stdinFd)
 {
     CgiStartResult out;
+    dropCgiEncode(clientFd);
+    dropCgiCapture(clientFd);
+    _cgiRequests.erase(clientFd);
 
     HTTPRequest req;
     int err = 400;
     int listenPort = get_listen_port(acceptFd);
+    size_t contentLen = 0;
 
-    if (!http10::parseRequest(rawMessage, listenPort, req, err))
+    if (headOnly)
+    {
+        if (!http10::parseRequestHead(rawMessage, listenPort, req, err, contentLen))
+            return out;
+    }
+    else if (!http10::parseRequest(rawMessage, listenPort, req, err))
         return out;
     std::string decoded;
     if (!url_decode_path(req.uri, decoded))
@@ -175,10 +414,19 @@ CgiStartResult RouterByteHandler::tryStartCgi(int acceptFd, const std::string& r
     const LocationConfig* loc = _router->find_location_config(norm, srv);
     if (!loc)
         return out;
+    out.route.server = srv.server_name;
+    out.route.accessLog = srv.accessLog;
+    out.route.accessLogJson = srv.accessLogJson;
+    out.route.location = loc->path;
+    out.route.slowMs = loc->slowRequestLog;
 
     std::string fullpath = _router->final_path(srv, *loc, norm);
 
-    if (!_router->is_cgi_request(*loc, fullpath))
+    bool fastcgi = !loc->fastcgiPass.empty();
+    bool proxy = !loc->proxyPass.empty();
+    if (!fastcgi && !proxy && !_router->is_cgi_request(*loc, fullpath))
+        return out;
+    if ((fastcgi || proxy) && headOnly)
         return out;
 
     out.isCgi = true;
@@ -190,9 +438,184 @@ CgiStartResult RouterByteHandler::tryStartCgi(int acceptFd, const std::string& r
         return out;
     }
 
+    out.timeoutSec = proxy ? loc->proxyReadTimeout : loc->cgiTimeout;
+    out.bufferSize = loc->cgiBufferSize;
+
+    // cgi_cache / cgi_collapse: GETs of the same URL share answers; cache hits
+    // and requests joining a run already in flight skip the limits below
+    bool        capture = false;
+    bool        refresh = false;
+    std::string cacheKey;
+    std::string coding;
+    std::string flightKey;
+    // a request with credentials may get an answer made for that user
+    std::string ignored;
+    if ((loc->cgiCache > 0 || loc->cgiCollapse) && req.method == HTTP_GET && !headOnly &&
+        !getHeaderCI(req.headers, "authorization", ignored) &&
+        (loc->cgiCacheCookies || !getHeaderCI(req.headers, "cookie", ignored)))
+    {
+        std::string::size_type q = req.uri.find('?');
+        cacheKey = _router->to_string(srv.port) + " " + srv.server_name + " " + norm;
+        if (q != std::string::npos)
+            cacheKey += req.uri.substr(q);
+        coding = loc->gzip ? _router->negotiate_compression(*loc, req) : "";
+        capture = true;
+    }
+
+    if (capture && loc->cgiCache > 0)
+    {
+        CgiCache::Entry* hit = NULL;
+        CgiCache::Lookup state = _cgiCache.lookup(cacheKey, std::time(NULL), hit);
+        if (state == CgiCache::FRESH || state == CgiCache::STALE ||
+            (state == CgiCache::REFRESH && !fastcgi && !proxy))
+        {
+            out.errResponseBytes = cachedCgiReply(*hit, coding);
+            out.closeAfterWrite = true;
+            if (state != CgiCache::REFRESH)
+                return out;
+
+            // served stale; one run in the background brings the entry up to date
+            Router::CgiSpawn sp;
+            if (!_router->spawn_cgi(req, fullpath, *loc, -1, sp))
+            {
+                _cgiCache.refreshFailed(cacheKey);
+                return out;
+            }
+            close(sp.fdIn);
+            if (++_refreshSeq <= 0)
+                _refreshSeq = 1;
+            CgiCapture& cap = _cgiCapture[-_refreshSeq];
+            cap.key = cacheKey;
+            cap.loc = *loc;
+            cap.refresh = true;
+            out.refreshId = -_refreshSeq;
+            out.refreshPid = sp.pid;
+            out.refreshFdOut = sp.fdOut;
+            return out;
+        }
+        // FastCGI / proxy_pass have no background runs: this request refreshes in the foreground
+        refresh = (state == CgiCache::REFRESH);
+    }
+
+    // the leader's answer is encoded for its own Accept-Encoding, so only
+    // requests asking for the same coding can share it
+    if (capture && loc->cgiCollapse)
+    {
+        std::string key = cacheKey + " " + coding;
+        std::map<std::string, int>::iterator flight = _cgiFlights.find(key);
+        if (flight == _cgiFlights.end())
+            flightKey = key;
+        else if (!(flags & CGI_START_ALONE) && flight->second != clientFd)
+        {
+            if (refresh)
+                _cgiCache.refreshFailed(cacheKey);
+            out.collapseKey = key;
+            out.joined = true;
+            return out;
+        }
+    }
+
+    if (loc->cgiMaxConcurrent > 0)
+    {
+        out.limitKey = _router->to_string(srv.port) + " " + srv.server_name + " " + loc->path;
+        out.maxConcurrent = loc->cgiMaxConcurrent;
+        out.queueSize = loc->cgiQueueSize;
+        out.queueTimeoutSec = loc->cgiQueueTimeout;
+        if (!(flags & CGI_START_ADMITTED))
+        {
+            // nothing runs yet; the admitted call looks the entry up again
+            if (refresh)
+                _cgiCache.refreshFailed(cacheKey);
+            out.deferred = true;
+            return out;
+        }
+    }
+
+    if (headOnly && stdinFd < 0 && !fastcgi && loc->cgiBodyFile > 0 && contentLen >= loc->cgiBodyFile)
+    {
+        out.bodyFile = true;
+        return out;
+    }
+
+    if (capture)
+    {
+        CgiCapture& cap = _cgiCapture[clientFd];
+        cap.key = cacheKey;
+        cap.loc = *loc;
+        cap.refresh = refresh;
+        cap.coding = coding;
+        cap.flightKey = flightKey;
+        if (!flightKey.empty())
+        {
+            _cgiFlights[flightKey] = clientFd;
+            out.collapseKey = flightKey;
+        }
+    }
+
+    if (loc->gzip)
+    {
+        CgiEncode& enc = _cgiEncode[clientFd];
+        enc.loc = *loc;
+        enc.coding = _router->negotiate_compression(*loc, req);
+        enc.stream = NULL;
+    }
+
+    if (!req.body.empty())
+        out.body.assign(&req.body[0], req.body.size());
+    out.closeAfterWrite = true;
+
+    HTTPRequest& kept = _cgiRequests[clientFd];
+    kept = req;
+    kept.body.clear();
+
+    // FastCGI: the reactor's pool talks to the long-running worker, no process here
+    if (fastcgi)
+    {
+        out.ok = true;
+        out.fcgiPass = loc->fastcgiPass;
+        out.fcgiParams = _router->build_cgi_environment(req, fullpath);
+        return out;
+    }
+
+    // proxy_pass: the reactor's pool sends it over a keep-alive connection
+    if (proxy)
+    {
+        out.ok = true;
+        out.proxyAddress = loc->proxyAddress;
+        out.proxyAddr = loc->proxyAddr;
+        out.proxyAddrLen = loc->proxyAddrLen;
+        out.proxyRequest = proxy_request(req, _router->method_to_string(req.method), *loc,
+                                         loc->proxyAddress, loc->proxyPath, peer_address(clientFd), srv.ssl);
+        out.proxyConnectTimeoutSec = loc->proxyConnectTimeout;
+        out.body.clear();
+        return out;
+    }
+
+    // a complete body past cgi_body_file goes the same way: one write to a
+    // file here instead of a pipe the reactor has to feed
+    int bodyFd = -1;
+    if (stdinFd < 0 && loc->cgiBodyFile > 0 && req.body.size() >= loc->cgiBodyFile)
+    {
+        bodyFd = openSpoolFile(CGI_BODY_FILE_DIR);
+        if (bodyFd >= 0 && write_all(bodyFd, out.body.data(), out.body.size()))
+        {
+            stdinFd = bodyFd;
+            out.body.clear();
+        }
+    }
+
     Router::CgiSpawn sp;
-    if (!_router->spawn_cgi(req, fullpath, *loc, sp))
+    bool spawned = _router->spawn_cgi(req, fullpath, *loc, stdinFd, sp);
+    closeFd(bodyFd);
+    if (!spawned)
     {
+        dropCgiCapture(clientFd);
+        _cgiRequests.erase(clientFd);
+        if (!out.collapseKey.empty())
+        {
+            _cgiFlights.erase(out.collapseKey);
+            out.collapseKey.clear();
+        }
         out.ok = false;
         out.errResponseBytes = http10::makeError(502, "Bad Gateway");
         out.closeAfterWrite = true;
@@ -203,33 +626,296 @@ CgiStartResult RouterByteHandler::tryStartCgi(int acceptFd, const std::string& r
     out.pid = sp.pid;
     out.fdIn = sp.fdIn;
     out.fdOut = sp.fdOut;
-
-    if (!req.body.empty())
-        out.body.assign(&req.body[0], req.body.size());
-
-    out.closeAfterWrite = true;
     return out;
 }
 
-CgiFinishResult RouterByteHandler::finishCgi(int acceptFd, int /*clientFd*/, const std::string& cgiStdout)
+CgiFinishResult RouterByteHandler::finishCgi(int acceptFd, int clientFd, const std::string& cgiStdout)
 {
     CgiFinishResult r;
     (void)acceptFd;
 
     HTTPResponse res = _router->parse_cgi_response(cgiStdout);
+    storeCgiCapture(clientFd, res);
+    _cgiRequests.erase(clientFd);
+
+    std::map<int, CgiEncode>::iterator enc = _cgiEncode.find(clientFd);
+    if (enc != _cgiEncode.end())
+    {
+        _router->compress_response(enc->second.loc, enc->second.coding, res);
+        dropCgiEncode(clientFd);
+    }
 
     r.responseBytes = http10::serializeClose(res);
     r.closeAfterWrite = true;
     return r;
 }
+
+// headers of the script's answer that still apply to the file it hands over
+static const char* const g_delegatedHeaders[] = {
+    "content-disposition", "set-cookie", "cache-control", "expires", "content-type", NULL
+};
+
+bool RouterByteHandler::cgiDelegated(int acceptFd, int clientFd,
+                                     const std::string& headerBlock, ByteReply& out)
+{
+    std::string low = "\n" + asciiLower(headerBlock);
+    bool accel = (low.find("\nx-accel-redirect:") != std::string::npos);
+    if (!accel && low.find("\nx-sendfile:") == std::string::npos)
+        return false;
+
+    std::map<int, HTTPRequest>::iterator orig = _cgiRequests.find(clientFd);
+    if (orig == _cgiRequests.end())
+        return false;
+    HTTPRequest req = orig->second;
+    (void)acceptFd;
+
+    HTTPResponse head;
+    _router->parse_cgi_headers(headerBlock, head);
+
+    std::string target;
+    for (std::map<std::string, std::string>::iterator it = head.headers.begin();
+         it != head.headers.end(); ++it)
+    {
+        if (asciiLower(it->first) == (accel ? "x-accel-redirect" : "x-sendfile"))
+            target = it->second;
+    }
+
+    HTTPResponse res;
+    std::string uri = target;
+    if (!accel && !_router->internal_uri_for_file(_router->find_server_config(req), target, uri))
+        uri.clear();
+    if (uri.empty() || uri[0] != '/')
+    {
+        res.status_code = 404;
+        res.reason_phrase = "Not Found";
+        res.set_body("404 Not Found");
+        res.headers["Content-Type"] = "text/plain";
+        res.headers["Content-Length"] = _router->to_string(res.body.size());
+    }
+    else
+    {
+        req.uri = uri;
+        if (req.method != HTTP_HEAD)
+            req.method = HTTP_GET;
+        res = _router->handle_internal_request(req);
+    }
+
+    // what the script said about the download still holds (name, cookies, ...)
+    if (res.status_code == 200 || res.status_code == 206 || res.status_code == 304)
+    {
+        bool scriptType = (low.find("\ncontent-type:") != std::string::npos);
+        for (std::map<std::string, std::string>::iterator it = head.headers.begin();
+             it != head.headers.end(); ++it)
+        {
+            std::string name = asciiLower(it->first);
+            for (size_t i = 0; g_delegatedHeaders[i]; ++i)
+            {
+                if (name != g_delegatedHeaders[i] || (name == "content-type" && !scriptType))
+                    continue;
+                std::map<std::string, std::string>::iterator h = res.headers.begin();
+                while (h != res.headers.end())
+                {
+                    if (asciiLower(h->first) == name)
+                        res.headers.erase(h++);
+                    else
+                        ++h;
+                }
+                res.headers[it->first] = it->second;
+            }
+        }
+    }
+
+    dropCgiEncode(clientFd);
+    dropCgiCapture(clientFd);
+    _cgiRequests.erase(orig);
+
+    if (!res.prebuilt.empty())
+        out = ByteReply(res.prebuilt, true);
+    else
+    {
+        out = ByteReply(http10::serializeClose(res), true);
+        out.parts.swap(res.parts);
+    }
+    return true;
+}
+
+bool RouterByteHandler::startCgiResponse(int acceptFd, int clientFd,
+                                         const std::string& headerBlock, std::string& outHead)
+{
+    (void)acceptFd;
+
+    _cgiRequests.erase(clientFd);
+
+    HTTPResponse head;
+    _router->parse_cgi_headers(headerBlock, head);
+
+    std::map<int, CgiCapture>::iterator cap = _cgiCapture.find(clientFd);
+    if (cap != _cgiCapture.end())
+    {
+        int ttl = cap->second.loc.cgiCache;
+        int stale = cap->second.loc.cgiCacheStale;
+        if (cgi_shareable(head, ttl, stale))
+            cap->second.head = head;
+        else
+            dropCgiCapture(clientFd);
+    }
+
+    std::map<int, CgiEncode>::iterator enc = _cgiEncode.find(clientFd);
+    if (enc != _cgiEncode.end())
+    {
+        if (_router->compress_stream_head(enc->second.loc, enc->second.coding, head))
+        {
+            enc->second.stream = new DeflateStream();
+            if (!enc->second.stream->begin(enc->second.coding, enc->second.loc.gzipCompLevel))
+            {
+                dropCgiEncode(clientFd);
+                return false;
+            }
+        }
+        else
+            dropCgiEncode(clientFd);
+    }
+
+    outHead = http10::serializeHeadClose(head);
+    return true;
+}
+
+bool RouterByteHandler::encodeCgiBody(int clientFd, const char* data, size_t len,
+                                      bool last, std::string& out)
+{
+    std::map<int, CgiCapture>::iterator cap = _cgiCapture.find(clientFd);
+    if (cap != _cgiCapture.end())
+    {
+        if (cap->second.body.size() + len > CGI_CACHE_MAX_BODY)
+            dropCgiCapture(clientFd);
+        else
+        {
+            if (len > 0)
+                cap->second.body.append(data, len);
+            if (last)
+            {
+                HTTPResponse res = cap->second.head;
+                res.set_body(cap->second.body);
+                storeCgiCapture(clientFd, res);
+            }
+        }
+    }
+
+    std::map<int, CgiEncode>::iterator enc = _cgiEncode.find(clientFd);
+    if (enc == _cgiEncode.end() || !enc->second.stream)
+        return false;
+
+    enc->second.stream->push(data, len, last, out);
+    if (last)
+        dropCgiEncode(clientFd);
+    return true;
+}
+
+void RouterByteHandler::abortCgi(int clientFd)
+{
+    dropCgiEncode(clientFd);
+    dropCgiCapture(clientFd);
+    _cgiRequests.erase(clientFd);
+}
+
+void RouterByteHandler::finishCgiRefresh(int refreshId, const std::string& cgiStdout)
+{
+    if (_cgiCapture.find(refreshId) == _cgiCapture.end())
+        return;
+    HTTPResponse res = _router->parse_cgi_response(cgiStdout);
+    storeCgiCapture(refreshId, res);
+}
+
+void RouterByteHandler::dropCgiCapture(int id)
+{
+    std::map<int, CgiCapture>::iterator cap = _cgiCapture.find(id);
+    if (cap == _cgiCapture.end())
+        return;
+    if (cap->second.refresh)
+        _cgiCache.refreshFailed(cap->second.key);
+    _cgiCapture.erase(cap);
+}
+
+// a run of a cgi_cache / cgi_collapse location is complete: keep its answer
+// for the cache and for the requests waiting on it, if it may be shared
+void RouterByteHandler::storeCgiCapture(int id, HTTPResponse& res)
+{
+    std::map<int, CgiCapture>::iterator cap = _cgiCapture.find(id);
+    if (cap == _cgiCapture.end())
+        return;
+
+    int ttl = cap->second.loc.cgiCache;
+    int stale = cap->second.loc.cgiCacheStale;
+    if (!cgi_shareable(res, ttl, stale) || res.body.size() > CGI_CACHE_MAX_BODY)
+    {
+        dropCgiCapture(id);
+        return;
+    }
+    std::map<std::string, std::string>::iterator h = res.headers.begin();
+    while (h != res.headers.end())
+    {
+        if (asciiLower(h->first) == "content-length")
+            res.headers.erase(h++);
+        else
+            ++h;
+    }
+    res.headers["Content-Length"] = _router->to_string(res.body.size());
+
+    if (!cap->second.flightKey.empty())
+    {
+        HTTPResponse shared = res;
+        _router->compress_response(cap->second.loc, cap->second.coding, shared);
+        _cgiLanded[cap->second.flightKey] = SharedBuffer(http10::serializeClose(shared));
+    }
+    if (cap->second.loc.cgiCache > 0 && ttl > 0)
+        _cgiCache.put(cap->second.key, res, cap->second.loc, ttl, stale, std::time(NULL));
+    else if (cap->second.refresh)
+        _cgiCache.refreshFailed(cap->second.key);
+    _cgiCapture.erase(cap);
+}
+
+bool RouterByteHandler::takeCollapsed(const std::string& collapseKey, SharedBuffer& out)
+{
+    _cgiFlights.erase(collapseKey);
+    std::map<std::string, SharedBuffer>::iterator it = _cgiLanded.find(collapseKey);
+    if (it == _cgiLanded.end())
+        return false;
+    out = it->second;
+    _cgiLanded.erase(it);
+    return true;
+}
+
+// serialized once per content coding, then shared by every hit
+SharedBuffer RouterByteHandler::cachedCgiReply(CgiCache::Entry& e, const std::string& coding)
+{
+    std::map<std::string, SharedBuffer>::const_iterator v = e.variants.find(coding);
+    if (v != e.variants.end())
+        return v->second;
+
+    HTTPResponse res = e.res;
+    _router->compress_response(e.loc, coding, res);
+    SharedBuffer out(http10::serializeClose(res));
+    _cgiCache.addVariant(e, coding, out);
+    return out;
+}
+
+void RouterByteHandler::dropCgiEncode(int clientFd)
+{
+    std::map<int, CgiEncode>::iterator enc = _cgiEncode.find(clientFd);
+    if (enc == _cgiEncode.end())
+        return;
+    delete enc->second.stream;
+    _cgiEncode.erase(enc);
+}
 bool RouterByteHandler::planUploadFd(int acceptFd,
                                     const std::string& uri,
                                     const std::string& mpFilename,
                                     int& outFd,
-                                    std::string& outErrBytes)
+                                    SharedBuffer& outErrBytes,
+                                    RouteLabel& outRoute)
 {
     outFd = -1;
-    outErrBytes.clear();
+    outErrBytes = SharedBuffer();
 
     HTTPRequest req;
     req.uri = uri;
@@ -256,6 +942,11 @@ bool RouterByteHandler::planUploadFd(int acceptFd,
     const LocationConfig* loc = _router->find_location_config(norm, srv);
     if (!loc)
         return false;
+    outRoute.server = srv.server_name;
+    outRoute.accessLog = srv.accessLog;
+    outRoute.accessLogJson = srv.accessLogJson;
+    outRoute.location = loc->path;
+    outRoute.slowMs = loc->slowRequestLog;
 
     if (loc->uploadEnable == false)
     {
@@ -294,7 +985,7 @@ bool RouterByteHandler::planUploadFd(int acceptFd,
 
     std::string final_upload_path = upload_path + filename;
 
-    int fd = open(final_upload_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int fd = open(final_upload_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
     if (fd < 0)
     {
         outErrBytes = http10::makeError(500, "Internal Server Error");
@@ -11,24 +11,83 @@
 /* ************************************************************************** */
 
 #include "../../include/Router_headers/Router.hpp"
+#include <cstdlib>
 
-HTTPResponse Router::generate_autoindex_response(const std::string& path) const
+// rendered pages are handed to the reactor in pieces of this size
+#define AUTOINDEX_CHUNK        65536
+// also the page size of a bigger directory listed with autoindex_per_page 0
+#define AUTOINDEX_MAX_PER_PAGE 10000
+// rendered pages kept per directory (each sort/order/per_page/page is one)
+#define AUTOINDEX_MAX_VIEWS    16
+
+typedef DirListingCache::Item DirItem;
+
+static std::string html_escape(const std::string& s)
 {
-    DIR *dir = opendir(path.c_str());
-    if (!dir)
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i)
     {
-        HTTPResponse response;
-        response.status_code = 500;
-        response.reason_phrase = "Internal Server Error";
-        response.set_body("500 Internal Server Error: Unable to open directory.");
-        response.headers["Content-Length"] = to_string(response.body.size());
-        response.headers["Content-Type"] = "text/plain";
-        return response;
+        if (s[i] == '&') out += "&amp;";
+        else if (s[i] == '<') out += "&lt;";
+        else if (s[i] == '>') out += "&gt;";
+        else if (s[i] == '"') out += "&quot;";
+        else out += s[i];
     }
+    return out;
+}
 
-    std::string html;
-    html += "<html>\n<head><title>Index of " + path + "</title></head>\n<body>\n";
-    html += "<h1>Index of " + path + "</h1>\n<hr>\n<ul>\n";
+static std::string href_escape(const std::string& s)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+            out += static_cast<char>(c);
+        else
+        {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+    return out;
+}
+
+static std::string query_param(const std::string& uri, const std::string& key)
+{
+    size_t q = uri.find('?');
+    if (q == std::string::npos)
+        return "";
+    std::string query = uri.substr(q + 1);
+    size_t pos = 0;
+    while (pos < query.size())
+    {
+        size_t amp = query.find('&', pos);
+        if (amp == std::string::npos)
+            amp = query.size();
+        std::string pair = query.substr(pos, amp - pos);
+        size_t eq = pair.find('=');
+        if (pair.substr(0, eq) == key)
+            return (eq == std::string::npos) ? "" : pair.substr(eq + 1);
+        pos = amp + 1;
+    }
+    return "";
+}
+
+// d_type answers "is it a directory" for free on most filesystems;
+// stat() is only needed when the filesystem doesn't fill it in, or for symlinks
+static bool scan_dir(const std::string& path, std::vector<DirItem>& out)
+{
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+        return false;
+
+    std::string prefix = path;
+    if (!prefix.empty() && prefix[prefix.size() - 1] != '/')
+        prefix += "/";
 
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL)
@@ -37,39 +96,201 @@ HTTPResponse Router::generate_autoindex_response(const std::string& path) const
         if (name == "." || name == "..")
             continue;
 
-        std::string fullEntryPath = path;
-        if (!fullEntryPath.empty() && fullEntryPath[fullEntryPath.size() - 1] != '/')
-            fullEntryPath += "/";
-        fullEntryPath += name;
-
-        struct stat st;
-        if (stat(fullEntryPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+        DirItem item;
+        item.name = name;
+        if (entry->d_type == DT_DIR)
+            item.isDir = true;
+        else if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
         {
-            html += "<li><a href=\"";
-            html += name + "/";
-            html += "\">";
-            html += name + "/";
-            html += "</a></li>\n";
+            struct stat st;
+            if (stat((prefix + name).c_str(), &st) == 0)
+            {
+                item.isDir = S_ISDIR(st.st_mode);
+                item.statted = true;
+                item.size = st.st_size;
+                item.mtime = st.st_mtime;
+            }
         }
-        else
+        out.push_back(item);
+    }
+    closedir(dir);
+    return true;
+}
+
+struct ByName
+{
+    bool operator()(const DirItem& a, const DirItem& b) const { return a.name < b.name; }
+};
+
+// orders indices into the (name sorted) item list
+struct ByKey
+{
+    const std::vector<DirItem>* items;
+    std::string                 key;
+    bool                        desc;
+
+    bool operator()(size_t ia, size_t ib) const
+    {
+        const DirItem& a = (*items)[desc ? ib : ia];
+        const DirItem& b = (*items)[desc ? ia : ib];
+        if (key == "size" && a.size != b.size)
+            return a.size < b.size;
+        if (key == "mtime" && a.mtime != b.mtime)
+            return a.mtime < b.mtime;
+        if (key == "name")
+            return a.name < b.name;
+        return desc ? ib < ia : ia < ib;
+    }
+};
+
+static void flush_chunk(std::string& html, std::vector<SharedBuffer>& chunks, bool force)
+{
+    if (html.empty() || (!force && html.size() < AUTOINDEX_CHUNK))
+        return;
+    chunks.push_back(SharedBuffer(html));
+    html.clear();
+}
+
+// Listing pages come from the per-directory cache (invalidated by the directory
+// mtime) and are sent as a list of shared chunks, never as one big string.
+// Query: ?sort=name|size|mtime&order=asc|desc&page=N&per_page=M
+HTTPResponse Router::generate_autoindex_response(const LocationConfig& location_config,
+                                                 const std::string& path,
+                                                 const struct stat& dirSt,
+                                                 const std::string& uri) const
+{
+    std::string sort = query_param(uri, "sort");
+    if (sort != "size" && sort != "mtime")
+        sort = "name";
+    bool desc = (query_param(uri, "order") == "desc");
+
+    long perPage = std::atol(query_param(uri, "per_page").c_str());
+    if (perPage <= 0)
+        perPage = (long)location_config.autoindexPerPage;
+    if (perPage > AUTOINDEX_MAX_PER_PAGE)
+        perPage = AUTOINDEX_MAX_PER_PAGE;
+    long page = std::atol(query_param(uri, "page").c_str());
+    if (page < 1)
+        page = 1;
+
+    DirListingCache::Listing& listing = _listings.get(path, dirSt);
+    if (!listing.scanned)
+    {
+        if (!scan_dir(path, listing.items))
         {
-            html += "<li><a href=\"";
-            html += name;
-            html += "\">";
-            html += name;
-            html += "</a></li>\n";
+            listing.items.clear();
+            HTTPResponse response;
+            response.status_code = 500;
+            response.reason_phrase = "Internal Server Error";
+            response.set_body("500 Internal Server Error: Unable to open directory.");
+            response.headers["Content-Length"] = to_string(response.body.size());
+            response.headers["Content-Type"] = "text/plain";
+            return response;
         }
+        std::sort(listing.items.begin(), listing.items.end(), ByName());
+        listing.scanned = true;
     }
 
-    closedir(dir);
+    // "all on one page" holds up to a page's worth: a huge directory is
+    // still paginated, so no rendered page is ever unbounded
+    if (perPage <= 0 && listing.items.size() > AUTOINDEX_MAX_PER_PAGE)
+        perPage = AUTOINDEX_MAX_PER_PAGE;
+    if (perPage <= 0)
+        page = 1;
+
+    std::string view = "sort=" + sort + "&amp;order=" + (desc ? "desc" : "asc")
+                     + "&amp;per_page=" + to_string((size_t)perPage);
+    std::string viewKey = view + "&amp;page=" + to_string((size_t)page);
+
+    std::map<std::string, std::vector<SharedBuffer> >::iterator hit = listing.views.find(viewKey);
+    std::vector<SharedBuffer> chunks;
+    if (hit != listing.views.end())
+        chunks = hit->second;
+    else
+    {
+        std::vector<DirItem>& items = listing.items;
+        std::string prefix = path;
+        if (!prefix.empty() && prefix[prefix.size() - 1] != '/')
+            prefix += "/";
+        if (sort != "name")
+        {
+            for (size_t i = 0; i < items.size(); ++i)
+            {
+                struct stat st;
+                if (!items[i].statted && stat((prefix + items[i].name).c_str(), &st) == 0)
+                {
+                    items[i].size = st.st_size;
+                    items[i].mtime = st.st_mtime;
+                }
+                items[i].statted = true;
+            }
+        }
 
-    html += "</ul>\n<hr>\n</body>\n</html>";
+        std::vector<size_t> order(items.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        if (sort != "name" || desc)
+        {
+            ByKey cmp;
+            cmp.items = &items;
+            cmp.key = sort;
+            cmp.desc = desc;
+            std::stable_sort(order.begin(), order.end(), cmp);
+        }
+
+        size_t first = 0;
+        size_t last = order.size();
+        size_t pages = 1;
+        if (perPage > 0)
+        {
+            pages = (order.size() + (size_t)perPage - 1) / (size_t)perPage;
+            if (pages == 0)
+                pages = 1;
+            first = std::min(order.size(), (size_t)(page - 1) * (size_t)perPage);
+            last = std::min(order.size(), first + (size_t)perPage);
+        }
+
+        std::string html;
+        html += "<html>\n<head><title>Index of " + html_escape(path) + "</title></head>\n<body>\n";
+        html += "<h1>Index of " + html_escape(path) + "</h1>\n<hr>\n<ul>\n";
+        for (size_t i = first; i < last; ++i)
+        {
+            const DirItem& it = items[order[i]];
+            std::string slash = it.isDir ? "/" : "";
+            html += "<li><a href=\"" + href_escape(it.name) + slash + "\">";
+            html += html_escape(it.name) + slash + "</a></li>\n";
+            flush_chunk(html, chunks, false);
+        }
+        html += "</ul>\n<hr>\n";
+        if (perPage > 0)
+        {
+            html += "<p>";
+            if (page > 1)
+                html += "<a href=\"?" + view + "&amp;page=" + to_string((size_t)(page - 1)) + "\">prev</a> ";
+            html += "page " + to_string((size_t)page) + " of " + to_string(pages);
+            if ((size_t)page < pages)
+                html += " <a href=\"?" + view + "&amp;page=" + to_string((size_t)(page + 1)) + "\">next</a>";
+            html += "</p>\n";
+        }
+        html += "</body>\n</html>";
+        flush_chunk(html, chunks, true);
+
+        if (listing.views.size() >= AUTOINDEX_MAX_VIEWS)
+            listing.views.erase(listing.views.begin());
+        listing.views[viewKey] = chunks;
+    }
+    _listings.account(path);
 
     HTTPResponse response;
     response.status_code = 200;
     response.reason_phrase = "OK";
-    response.set_body(html);
+    size_t total = 0;
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        response.parts.push_back(BodyPart::fromShared(chunks[i]));
+        total += chunks[i].size();
+    }
     response.headers["Content-Type"] = "text/html";
-    response.headers["Content-Length"] = to_string(response.body.size());
+    response.headers["Content-Length"] = to_string(total);
     return response;
-}
\ No newline at end of file
+}
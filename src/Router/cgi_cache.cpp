@@ -0,0 +1,117 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   cgi_cache.cpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 10:12:58 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 10:12:58 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/Router_headers/CgiCache.hpp"
+#include "../../include/sockets/ServerMetrics.hpp"
+
+CgiCache::CgiCache()
+: _entries()
+, _lru()
+, _bytes(0)
+, _maxBytes(0)
+{}
+
+void CgiCache::setLimit(size_t maxBytes)
+{
+    _maxBytes = maxBytes;
+    while (_bytes > _maxBytes && !_lru.empty())
+        erase(_entries.find(_lru.back()));
+}
+
+CgiCache::Lookup CgiCache::lookup(const std::string& key, std::time_t now, Entry*& out)
+{
+    out = NULL;
+    std::map<std::string, Entry>::iterator it = _entries.find(key);
+    if (it == _entries.end())
+    {
+        server_metrics().cacheLookup(METRICS_CACHE_CGI, false);
+        return MISS;
+    }
+
+    Entry& e = it->second;
+    if (now >= e.staleUntil && now >= e.expires)
+    {
+        // too old to serve; a refresh still running will put it back
+        if (!e.refreshing)
+            erase(it);
+        server_metrics().cacheLookup(METRICS_CACHE_CGI, false);
+        return MISS;
+    }
+    server_metrics().cacheLookup(METRICS_CACHE_CGI, true);
+
+    _lru.splice(_lru.begin(), _lru, e.lru);
+    out = &e;
+    if (now < e.expires)
+        return FRESH;
+    if (e.refreshing)
+        return STALE;
+    e.refreshing = true;
+    return REFRESH;
+}
+
+void CgiCache::put(const std::string& key, const HTTPResponse& res, const LocationConfig& loc,
+                   int ttlSec, int staleSec, std::time_t now)
+{
+    std::map<std::string, Entry>::iterator old = _entries.find(key);
+    if (old != _entries.end())
+        erase(old);
+
+    size_t size = res.body.size();
+    if (size > _maxBytes / 4)
+        return;
+    while (_bytes + size > _maxBytes && !_lru.empty())
+        erase(_entries.find(_lru.back()));
+
+    _lru.push_front(key);
+    Entry& e = _entries[key];
+    e.res = res;
+    e.loc = loc;
+    e.expires = now + ttlSec;
+    e.staleUntil = e.expires + staleSec;
+    e.refreshing = false;
+    e.bytes = size;
+    e.lru = _lru.begin();
+    _bytes += size;
+}
+
+void CgiCache::addVariant(Entry& e, const std::string& coding, const SharedBuffer& bytes)
+{
+    e.variants[coding] = bytes;
+    e.bytes += bytes.size();
+    _bytes += bytes.size();
+    // e was just looked up, so it sits at the front and goes last
+    while (_bytes > _maxBytes && _lru.size() > 1)
+        erase(_entries.find(_lru.back()));
+}
+
+// the refresh run failed or its answer may not be cached: let the next
+// stale hit try again
+void CgiCache::refreshFailed(const std::string& key)
+{
+    std::map<std::string, Entry>::iterator it = _entries.find(key);
+    if (it != _entries.end())
+        it->second.refreshing = false;
+}
+
+void CgiCache::clear()
+{
+    _entries.clear();
+    _lru.clear();
+    _bytes = 0;
+}
+
+void CgiCache::erase(std::map<std::string, Entry>::iterator it)
+{
+    _bytes -= it->second.bytes;
+    _lru.erase(it->second.lru);
+    _entries.erase(it);
+}
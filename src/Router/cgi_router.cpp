@@ -13,18 +13,28 @@
 #include "../../include/Router_headers/Router.hpp"
 
 #include <signal.h>
+#include <spawn.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <cerrno>
+#include <cstring>
+#include <iostream>
 
 #include <sstream>
 #include <vector>
 #include <map>
 #include <string>
 #include <cstdlib>
-#include <dirent.h>
+
+// glibc >= 2.34 can close every inherited fd in the child in one close_range();
+// elsewhere we rely on every server fd being O_CLOEXEC
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+# define CGI_HAVE_CLOSEFROM 1
+#endif
 
 static bool set_nonblocking(int fd)
 {
@@ -36,6 +46,14 @@ static bool set_nonblocking(int fd)
     return true;
 }
 
+static void close_pair(int p[2])
+{
+    if (p[0] >= 0)
+        close(p[0]);
+    if (p[1] >= 0)
+        close(p[1]);
+}
+
 static void set_cloexec(int fd)
 {
     int flags = fcntl(fd, F_GETFD);
@@ -44,67 +62,178 @@ static void set_cloexec(int fd)
     fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
 }
 
-static void close_fds_from(int start_fd)
+// what the child of spawn_with_limits() reports on its status pipe
+#define CGI_LIMIT_CPU    0
+#define CGI_LIMIT_MEMORY 1
+#define CGI_LIMIT_NICE   2
+#define CGI_LIMIT_CGROUP 3
+#define CGI_LIMIT_EXEC   4
+
+static bool has_cgi_limits(const LocationConfig& loc)
 {
-    DIR* d = opendir("/proc/self/fd");
-    if (!d)
+    return loc.cgiCpuLimit > 0 || loc.cgiMemoryLimit > 0 || loc.cgiNice > 0 || !loc.cgiCgroup.empty();
+}
+
+// a limit that is configured but not in force is said once per kind, not per request
+static void warn_limit_once(int kind, int err)
+{
+    static bool warned[CGI_LIMIT_EXEC] = { false, false, false, false };
+    static const char* names[CGI_LIMIT_EXEC] = { "cgi_cpu_limit", "cgi_memory_limit", "cgi_nice", "cgi_cgroup" };
+    if (kind < 0 || kind >= CGI_LIMIT_EXEC || warned[kind])
         return;
-    std::vector<int> fds_to_close;
-    
-    for (;;)
+    warned[kind] = true;
+    std::cerr << "Warning: " << names[kind] << " not applied to CGI scripts: "
+              << std::strerror(err) << std::endl;
+}
+
+// only async-signal-safe calls from here on: the child of a vfork, running on
+// the server's memory until it execs
+static void report_from_child(int fd, int kind)
+{
+    int msg[2];
+    msg[0] = kind;
+    msg[1] = errno;
+    ssize_t w = write(fd, msg, sizeof(msg));
+    (void)w;
+}
+
+static void run_limited_child(const char* path, char* const argv[], char* const envp[],
+                              int inFd, int outFd, int cgroupFd, int reportFd,
+                              const LocationConfig& loc)
+{
+    if (dup2(inFd, STDIN_FILENO) < 0 || dup2(outFd, STDOUT_FILENO) < 0)
     {
-        errno = 0;
-        struct dirent* ent = readdir(d);
-        if (!ent)
-            break;
-        const char* name = ent->d_name;
-        if (name[0] < '0' || name[0] > '9')
-            continue;
-        int fd = std::atoi(name);
-        if (fd < start_fd)
-            continue;
-        fds_to_close.push_back(fd);
+        report_from_child(reportFd, CGI_LIMIT_EXEC);
+        _exit(127);
     }
-    
-    int dir_fd = -1;
-    DIR* d2 = opendir("/proc/self/fd");
-    if (d2)
+
+    // the server's handlers would run here on its memory: back to the defaults
+    // (SIGPIPE too, the server ignores it) before anything is unblocked
+    for (int sig = 1; sig < NSIG; ++sig)
     {
-        for (;;)
+        struct sigaction sa;
+        if (sigaction(sig, NULL, &sa) < 0)
+            continue;
+        if (sig == SIGPIPE || (sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN))
         {
-            errno = 0;
-            struct dirent* ent = readdir(d2);
-            if (!ent)
-                break;
-            const char* name = ent->d_name;
-            if (name[0] < '0' || name[0] > '9')
-                continue;
-            int fd = std::atoi(name);
-            bool found = false;
-            for (size_t i = 0; i < fds_to_close.size(); ++i)
-            {
-                if (fds_to_close[i] == fd)
-                {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found && fd >= start_fd)
-            {
-                dir_fd = fd;
-                break;
-            }
+            sa.sa_handler = SIG_DFL;
+            sa.sa_flags = 0;
+            sigaction(sig, &sa, NULL);
         }
-        closedir(d2);
     }
-    
-    closedir(d);
-    
-    for (size_t i = 0; i < fds_to_close.size(); ++i)
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    // "0" is the writing process itself
+    if (cgroupFd >= 0 && write(cgroupFd, "0", 1) != 1)
+        report_from_child(reportFd, CGI_LIMIT_CGROUP);
+    if (loc.cgiCpuLimit > 0)
+    {
+        // SIGXCPU at the soft limit, SIGKILL a second later
+        struct rlimit rl;
+        rl.rlim_cur = (rlim_t)loc.cgiCpuLimit;
+        rl.rlim_max = (rlim_t)loc.cgiCpuLimit + 1;
+        if (setrlimit(RLIMIT_CPU, &rl) < 0)
+            report_from_child(reportFd, CGI_LIMIT_CPU);
+    }
+    if (loc.cgiMemoryLimit > 0)
     {
-        if (fds_to_close[i] != dir_fd)
-            close(fds_to_close[i]);
+        struct rlimit rl;
+        rl.rlim_cur = (rlim_t)loc.cgiMemoryLimit;
+        rl.rlim_max = (rlim_t)loc.cgiMemoryLimit;
+        if (setrlimit(RLIMIT_AS, &rl) < 0)
+            report_from_child(reportFd, CGI_LIMIT_MEMORY);
     }
+    if (loc.cgiNice > 0 && setpriority(PRIO_PROCESS, 0, loc.cgiNice) < 0)
+        report_from_child(reportFd, CGI_LIMIT_NICE);
+
+#ifdef CGI_HAVE_CLOSEFROM
+    // the status pipe stays open (close-on-exec) as fd 3
+    if (reportFd != 3)
+    {
+        if (dup2(reportFd, 3) < 0)
+            _exit(127);
+        fcntl(3, F_SETFD, FD_CLOEXEC);
+        reportFd = 3;
+    }
+    closefrom(4);
+#endif
+
+    execve(path, argv, envp);
+    report_from_child(reportFd, CGI_LIMIT_EXEC);
+    _exit(127);
+}
+
+// cgi_cpu_limit / cgi_memory_limit / cgi_nice / cgi_cgroup have to be in force
+// before the script runs its first instruction (a fork bomb forks at once), so
+// such locations vfork, apply them in the child and execve: posix_spawn has no
+// hook for them. Like posix_spawn there is no page table copy, and the server
+// is suspended only until the exec. The child reports what it could not apply
+// on a close-on-exec pipe; by the time vfork returns the child has exec'd or
+// exited, so reading the pipe to its end never waits.
+static bool spawn_with_limits(const char* path, char* const argv[], char* const envp[],
+                             int inFd, int outFd, const LocationConfig& loc, pid_t& outPid)
+{
+    int cgroupFd = -1;
+    if (!loc.cgiCgroup.empty())
+    {
+        std::string procs = loc.cgiCgroup + "/cgroup.procs";
+        cgroupFd = open(procs.c_str(), O_WRONLY | O_CLOEXEC);
+        if (cgroupFd < 0)
+            warn_limit_once(CGI_LIMIT_CGROUP, errno);
+    }
+
+    int report[2];
+    if (pipe(report) < 0)
+    {
+        if (cgroupFd >= 0)
+            close(cgroupFd);
+        return false;
+    }
+    set_cloexec(report[0]);
+    set_cloexec(report[1]);
+
+    // no signal may reach the child before its handlers are reset
+    sigset_t all;
+    sigset_t saved;
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &saved);
+    pid_t pid = vfork();
+    if (pid == 0)
+        run_limited_child(path, argv, envp, inFd, outFd, cgroupFd, report[1], loc);
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+
+    close(report[1]);
+    if (cgroupFd >= 0)
+        close(cgroupFd);
+    if (pid < 0)
+    {
+        close(report[0]);
+        return false;
+    }
+
+    bool execFailed = false;
+    for (;;)
+    {
+        int msg[2];
+        ssize_t n = read(report[0], msg, sizeof(msg));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n != (ssize_t)sizeof(msg))
+            break;
+        if (msg[0] == CGI_LIMIT_EXEC)
+            execFailed = true;
+        else
+            warn_limit_once(msg[0], msg[1]);
+    }
+    close(report[0]);
+
+    // an exec that failed exits 127; the reactor reaps it with the others
+    if (execFailed)
+        return false;
+    outPid = pid;
+    return true;
 }
 
 bool Router::is_cgi_request(const LocationConfig& location_config, const std::string& fullpath) const
@@ -142,11 +271,27 @@ std::vector<std::string> Router::build_cgi_environment(const HTTPRequest& reques
     }
 
     env.push_back("QUERY_STRING=" + query_string);
+    env.push_back("REQUEST_URI=" + uri);
 
+    // a body that is streamed to the script is not in `request`: its
+    // length comes from the header then
+    std::string content_length;
     if (!request.body.empty())
-        env.push_back("CONTENT_LENGTH=" + to_string(request.body.size()));
+        content_length = to_string(request.body.size());
     else
-        env.push_back("CONTENT_LENGTH=");
+    {
+        for (std::map<std::string, std::string>::const_iterator it = request.headers.begin();
+             it != request.headers.end(); ++it)
+        {
+            std::string key = it->first;
+            for (std::string::size_type i = 0; i < key.size(); ++i)
+                if (key[i] >= 'A' && key[i] <= 'Z')
+                    key[i] += 32;
+            if (key == "content-length" && it->second != "0")
+                content_length = it->second;
+        }
+    }
+    env.push_back("CONTENT_LENGTH=" + content_length);
 
     env.push_back("SCRIPT_FILENAME=" + fullpath);
     env.push_back("SCRIPT_NAME=" + script_name_only);
@@ -156,6 +301,13 @@ std::vector<std::string> Router::build_cgi_environment(const HTTPRequest& reques
     env.push_back("SERVER_PROTOCOL=" + request.version);
     env.push_back("GATEWAY_INTERFACE=CGI/1.1");
     env.push_back("SERVER_SOFTWARE=Webserv/1.0");
+    if (find_server_config(request).ssl)
+    {
+        env.push_back("HTTPS=on");
+        env.push_back("REQUEST_SCHEME=https");
+    }
+    else
+        env.push_back("REQUEST_SCHEME=http");
 
     for (std::map<std::string, std::string>::const_iterator it = request.headers.begin();
          it != request.headers.end(); ++it)
@@ -168,49 +320,21 @@ std::vector<std::string> Router::build_cgi_environment(const HTTPRequest& reques
             else if (key[i] == '-')
                 key[i] = '_';
         }
+        if (key == "CONTENT_TYPE")
+            env.push_back("CONTENT_TYPE=" + it->second);
         env.push_back("HTTP_" + key + "=" + it->second);
     }
 
     return env;
 }
 
-HTTPResponse Router::parse_cgi_response(const std::string& cgi_output) const
+// Status/header lines of a CGI response (RFC 3875 6.2) into `response`.
+// Used on its own when the body is streamed to the client as it is produced.
+void Router::parse_cgi_headers(const std::string& header_section, HTTPResponse& response) const
 {
-    HTTPResponse response;
-
-    if (cgi_output.empty())
-    {
-        response.status_code = 500;
-        response.reason_phrase = "Internal Server Error";
-        response.set_body("500 Internal Server Error: CGI execution failed.");
-        response.headers["Content-Type"] = "text/plain";
-        response.headers["Content-Length"] = to_string(response.body.size());
-        return response;
-    }
-
     response.status_code = 200;
     response.reason_phrase = "OK";
 
-    std::string::size_type header_end = cgi_output.find("\r\n\r\n");
-    std::string::size_type separator_length = 4;
-
-    if (header_end == std::string::npos)
-    {
-        header_end = cgi_output.find("\n\n");
-        separator_length = 2;
-    }
-
-    std::string header_section;
-    std::string body_section;
-
-    if (header_end != std::string::npos)
-    {
-        header_section = cgi_output.substr(0, header_end);
-        body_section = cgi_output.substr(header_end + separator_length);
-    }
-    else
-        body_section = cgi_output;
-
     std::map<std::string, std::string> headers;
 
     if (!header_section.empty())
@@ -264,6 +388,43 @@ HTTPResponse Router::parse_cgi_response(const std::string& cgi_output) const
 
     if (response.headers.find("Content-Type") == response.headers.end())
         response.headers["Content-Type"] = "text/html";
+}
+
+HTTPResponse Router::parse_cgi_response(const std::string& cgi_output) const
+{
+    HTTPResponse response;
+
+    if (cgi_output.empty())
+    {
+        response.status_code = 500;
+        response.reason_phrase = "Internal Server Error";
+        response.set_body("500 Internal Server Error: CGI execution failed.");
+        response.headers["Content-Type"] = "text/plain";
+        response.headers["Content-Length"] = to_string(response.body.size());
+        return response;
+    }
+
+    std::string::size_type header_end = cgi_output.find("\r\n\r\n");
+    std::string::size_type separator_length = 4;
+
+    if (header_end == std::string::npos)
+    {
+        header_end = cgi_output.find("\n\n");
+        separator_length = 2;
+    }
+
+    std::string header_section;
+    std::string body_section;
+
+    if (header_end != std::string::npos)
+    {
+        header_section = cgi_output.substr(0, header_end);
+        body_section = cgi_output.substr(header_end + separator_length);
+    }
+    else
+        body_section = cgi_output;
+
+    parse_cgi_headers(header_section, response);
 
     response.set_body(body_section);
     response.headers["Content-Length"] = to_string(response.body.size());
@@ -271,9 +432,12 @@ HTTPResponse Router::parse_cgi_response(const std::string& cgi_output) const
 }
 
 
+// stdinFd >= 0: the script reads its body from that file (from the start)
+// instead of from a pipe, and outSpawn.fdIn stays -1
 bool Router::spawn_cgi(const HTTPRequest& request,
                        const std::string& fullpath,
                        const LocationConfig& location_config,
+                       int stdinFd,
                        CgiSpawn& outSpawn) const
 {
     outSpawn = CgiSpawn();
@@ -300,48 +464,86 @@ bool Router::spawn_cgi(const HTTPRequest& request,
         envp.push_back(const_cast<char*>(env_vars[i].c_str()));
     envp.push_back(NULL);
 
-    int pipe_to_cgi[2];
+    int pipe_to_cgi[2] = { -1, -1 };
     int pipe_from_cgi[2];
 
-    if (pipe(pipe_to_cgi) == -1 || pipe(pipe_from_cgi) == -1)
+    if (stdinFd >= 0)
+    {
+        if (lseek(stdinFd, 0, SEEK_SET) < 0)
+            return false;
+    }
+    else if (pipe(pipe_to_cgi) == -1)
+        return false;
+    if (pipe(pipe_from_cgi) == -1)
+    {
+        close_pair(pipe_to_cgi);
         return false;
+    }
 
     set_cloexec(pipe_to_cgi[0]);
     set_cloexec(pipe_to_cgi[1]);
     set_cloexec(pipe_from_cgi[0]);
     set_cloexec(pipe_from_cgi[1]);
 
-    pid_t pid = fork();
-    if (pid < 0)
+    int childIn = stdinFd >= 0 ? stdinFd : pipe_to_cgi[0];
+    pid_t pid = -1;
+    int rc = 0;
+    if (has_cgi_limits(location_config))
     {
-        close(pipe_to_cgi[0]); close(pipe_to_cgi[1]);
-        close(pipe_from_cgi[0]); close(pipe_from_cgi[1]);
-        return false;
+        if (!spawn_with_limits(interpreter.c_str(), &args[0], &envp[0], childIn, pipe_from_cgi[1],
+                              location_config, pid))
+            rc = -1;
     }
-    else if (pid == 0)
+    else
     {
-        if (dup2(pipe_to_cgi[0], STDIN_FILENO) == -1)
-            _exit(1);
-        if (dup2(pipe_from_cgi[1], STDOUT_FILENO) == -1)
-            _exit(1);
-
-        close(pipe_to_cgi[0]); close(pipe_to_cgi[1]);
-        close(pipe_from_cgi[0]); close(pipe_from_cgi[1]);
-
-        close_fds_from(3);
+        // posix_spawn is vfork-like (clone(CLONE_VM|CLONE_VFORK) on glibc): no page
+        // table copy of a server holding big buffers, and no code runs in the child
+        // besides the file actions below.
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attr;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawnattr_init(&attr);
+
+        posix_spawn_file_actions_adddup2(&actions, childIn, STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, pipe_from_cgi[1], STDOUT_FILENO);
+#ifdef CGI_HAVE_CLOSEFROM
+        posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
+
+        // the server ignores SIGPIPE and blocks SIGCHLD (the reactor reads it from
+        // a signalfd); the script should inherit neither
+        sigset_t def;
+        sigemptyset(&def);
+        sigaddset(&def, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attr, &def);
+        sigset_t none;
+        sigemptyset(&none);
+        posix_spawnattr_setsigmask(&attr, &none);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+        rc = posix_spawn(&pid, interpreter.c_str(), &actions, &attr, &args[0], &envp[0]);
+
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+    }
 
-        execve(interpreter.c_str(), &args[0], &envp[0]);
-        _exit(1);
+    if (rc != 0)
+    {
+        close_pair(pipe_to_cgi);
+        close_pair(pipe_from_cgi);
+        return false;
     }
-    close(pipe_to_cgi[0]);
+    if (pipe_to_cgi[0] >= 0)
+        close(pipe_to_cgi[0]);
     close(pipe_from_cgi[1]);
 
-    if (!set_nonblocking(pipe_to_cgi[1]) || !set_nonblocking(pipe_from_cgi[0]))
+    if ((pipe_to_cgi[1] >= 0 && !set_nonblocking(pipe_to_cgi[1])) || !set_nonblocking(pipe_from_cgi[0]))
     {
-        close(pipe_to_cgi[1]);
+        if (pipe_to_cgi[1] >= 0)
+            close(pipe_to_cgi[1]);
         close(pipe_from_cgi[0]);
+        // the reactor reaps it along with every other exited child
         kill(pid, SIGKILL);
-        waitpid(pid, NULL, 0);
         return false;
     }
 
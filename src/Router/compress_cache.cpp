@@ -0,0 +1,96 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   compress_cache.cpp                                 :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/12 10:04:52 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/12 10:04:52 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/Router_headers/CompressCache.hpp"
+#include "../../include/sockets/ServerMetrics.hpp"
+
+CompressCache::CompressCache()
+: _entries()
+, _lru()
+, _bytes(0)
+, _maxBytes(0)
+{}
+
+void CompressCache::setLimit(size_t maxBytes)
+{
+    _maxBytes = maxBytes;
+    while (_bytes > _maxBytes && !_lru.empty())
+        erase(_entries.find(_lru.back()));
+}
+
+bool CompressCache::get(const std::string& coding, int level, const std::string& path,
+                        const struct stat& st, SharedBuffer& out)
+{
+    std::map<std::string, Entry>::iterator it = _entries.find(coding + ":" + path);
+    if (it == _entries.end())
+    {
+        server_metrics().cacheLookup(METRICS_CACHE_COMPRESS, false);
+        return false;
+    }
+
+    Entry& e = it->second;
+    if (e.ino != st.st_ino || e.size != st.st_size || e.mtime != st.st_mtime || e.level != level)
+    {
+        erase(it);
+        server_metrics().cacheLookup(METRICS_CACHE_COMPRESS, false);
+        return false;
+    }
+    server_metrics().cacheLookup(METRICS_CACHE_COMPRESS, true);
+    _lru.splice(_lru.begin(), _lru, e.lru);
+    out = e.data;
+    return true;
+}
+
+// one variant bigger than a quarter of the budget would just churn the rest
+bool CompressCache::fits(size_t bytes) const
+{
+    return bytes <= _maxBytes / 4;
+}
+
+void CompressCache::put(const std::string& coding, int level, const std::string& path,
+                        const struct stat& st, const SharedBuffer& data)
+{
+    if (!fits(data.size()))
+        return;
+
+    std::string key = coding + ":" + path;
+    std::map<std::string, Entry>::iterator old = _entries.find(key);
+    if (old != _entries.end())
+        erase(old);
+
+    while (_bytes + data.size() > _maxBytes && !_lru.empty())
+        erase(_entries.find(_lru.back()));
+
+    _lru.push_front(key);
+    Entry& e = _entries[key];
+    e.data = data;
+    e.ino = st.st_ino;
+    e.size = st.st_size;
+    e.mtime = st.st_mtime;
+    e.level = level;
+    e.lru = _lru.begin();
+    _bytes += data.size();
+}
+
+void CompressCache::clear()
+{
+    _entries.clear();
+    _lru.clear();
+    _bytes = 0;
+}
+
+void CompressCache::erase(std::map<std::string, Entry>::iterator it)
+{
+    _bytes -= it->second.data.size();
+    _lru.erase(it->second.lru);
+    _entries.erase(it);
+}
@@ -0,0 +1,274 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   compression.cpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/12 10:21:15 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/12 10:21:15 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/Router_headers/Router.hpp"
+#include "../../include/sockets/NetUtil.hpp"
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+
+// gzip = deflate stream in a gzip wrapper, "deflate" = zlib wrapper (RFC 9110)
+static bool deflate_bytes(const char* data, size_t len, const std::string& coding,
+                          int level, std::string& out)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    int windowBits = (coding == "gzip") ? 15 + 16 : 15;
+    if (deflateInit2(&zs, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(deflateBound(&zs, (uLong)len));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs.avail_in = (uInt)len;
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = (uInt)out.size();
+
+    int rc = deflate(&zs, Z_FINISH);
+    size_t produced = zs.total_out;
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END)
+        return false;
+    out.resize(produced);
+    return true;
+}
+
+static bool read_whole_file(const std::string& path, size_t expected, std::string& out)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    out.resize(expected);
+    size_t got = 0;
+    while (got < expected)
+    {
+        ssize_t n = read(fd, &out[got], expected - got);
+        if (n <= 0)
+            break;
+        got += (size_t)n;
+    }
+    close(fd);
+    return got == expected;
+}
+
+void Router::build_compress_caches()
+{
+    for (std::vector<ServerConfig>::const_iterator it = _config.servers.begin();
+         it != _config.servers.end(); ++it)
+        _gzipCache[&(*it)].setLimit(it->gzipCacheSize);
+}
+
+// q-value the client gives `coding` in Accept-Encoding (0 = not acceptable)
+float Router::accept_encoding_q(const HTTPRequest& request, const std::string& coding) const
+{
+    std::map<std::string, std::string>::const_iterator h = findHeaderCI(request.headers, "accept-encoding");
+    if (h == request.headers.end())
+        return 0.0f;
+    const std::string& acceptEncoding = h->second;
+
+    float star = 0.0f;
+    bool  hasStar = false;
+    size_t pos = 0;
+    while (pos <= acceptEncoding.size())
+    {
+        size_t comma = acceptEncoding.find(',', pos);
+        if (comma == std::string::npos)
+            comma = acceptEncoding.size();
+        std::string item = trimSpaces(acceptEncoding.substr(pos, comma - pos));
+        pos = comma + 1;
+
+        float q = 1.0f;
+        size_t semi = item.find(';');
+        if (semi != std::string::npos)
+        {
+            std::string param = trimSpaces(item.substr(semi + 1));
+            item = trimSpaces(item.substr(0, semi));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                q = (float)std::atof(param.c_str() + 2);
+        }
+        item = asciiLower(item);
+
+        if (item == coding)
+            return q;
+        if (item == "*")
+        {
+            star = q;
+            hasStar = true;
+        }
+    }
+    return hasStar ? star : 0.0f;
+}
+
+// "gzip", "deflate" or "" when the location has gzip off or the client takes neither
+std::string Router::negotiate_compression(const LocationConfig& location_config,
+                                          const HTTPRequest& request) const
+{
+    if (!location_config.gzip)
+        return "";
+    float qGz = accept_encoding_q(request, "gzip");
+    float qDf = accept_encoding_q(request, "deflate");
+    if (qGz <= 0.0f && qDf <= 0.0f)
+        return "";
+    return (qDf > qGz) ? "deflate" : "gzip";
+}
+
+bool Router::compressible_type(const LocationConfig& location_config, const std::string& contentType) const
+{
+    std::string base = asciiLower(trimSpaces(contentType.substr(0, contentType.find(';'))));
+    if (base == "text/html")
+        return true;
+    for (size_t i = 0; i < location_config.gzipTypes.size(); ++i)
+    {
+        const std::string& t = location_config.gzipTypes[i];
+        if (t == "*" || asciiLower(t) == base)
+            return true;
+    }
+    return false;
+}
+
+// Compressed variant of a static file: made once per (file version, coding, level),
+// then handed out from the per-server cache as a shared buffer.
+bool Router::compress_static_file(const ServerConfig& server_config,
+                                  const LocationConfig& location_config,
+                                  const std::string& coding,
+                                  const std::string& path,
+                                  const struct stat& st,
+                                  SharedBuffer& out) const
+{
+    if (cached_static_variant(server_config, location_config, coding, path, st, out))
+        return true;
+    if (!static_variant_fits(server_config, (size_t)st.st_size))
+        return false;
+
+    int level = location_config.gzipCompLevel;
+    std::string raw;
+    if (!read_whole_file(path, (size_t)st.st_size, raw))
+        return false;
+    std::string packed;
+    if (!deflate_bytes(raw.data(), raw.size(), coding, level, packed))
+        return false;
+
+    out = SharedBuffer(packed);
+    _gzipCache[&server_config].put(coding, level, path, st, out);
+    return true;
+}
+
+// A variant the cache would not keep is never built: it would be read and
+// deflated again on every GET. Such files go out as they are (sendfile).
+// The bound is zlib's worst case plus the gzip header and trailer.
+bool Router::static_variant_fits(const ServerConfig& server_config, size_t fileSize) const
+{
+    return _gzipCache[&server_config].fits((size_t)compressBound((uLong)fileSize) + 18);
+}
+
+// The variant only if it is already built: nothing is read or compressed.
+bool Router::cached_static_variant(const ServerConfig& server_config,
+                                   const LocationConfig& location_config,
+                                   const std::string& coding,
+                                   const std::string& path,
+                                   const struct stat& st,
+                                   SharedBuffer& out) const
+{
+    return _gzipCache[&server_config].get(coding, location_config.gzipCompLevel, path, st, out);
+}
+
+// In-memory bodies (autoindex pages, CGI output) are compressed per response.
+void Router::compress_response(const LocationConfig& location_config,
+                               const std::string& coding,
+                               HTTPResponse& response) const
+{
+    if (!location_config.gzip || response.status_code != 200)
+        return;
+
+    // shared chunks (cached autoindex pages) are fine, file spans are not
+    size_t partBytes = 0;
+    for (size_t i = 0; i < response.parts.size(); ++i)
+    {
+        if (response.parts[i].isFile())
+            return;
+        partBytes += response.parts[i].size();
+    }
+
+    std::map<std::string, std::string>::iterator ct = findHeaderCI(response.headers, "content-type");
+    if (ct == response.headers.end() || !compressible_type(location_config, ct->second))
+        return;
+    if (findHeaderCI(response.headers, "content-encoding") != response.headers.end())
+        return;
+
+    std::map<std::string, std::string>::iterator vary = findHeaderCI(response.headers, "vary");
+    if (vary == response.headers.end())
+        response.headers["Vary"] = "Accept-Encoding";
+    else if (asciiLower(vary->second).find("accept-encoding") == std::string::npos)
+        vary->second += ", Accept-Encoding";
+
+    size_t total = response.body.size() + partBytes;
+    if (coding.empty() ||
+        total < location_config.gzipMinLength ||
+        total > location_config.gzipMaxLength)
+        return;
+
+    for (size_t i = 0; i < response.parts.size(); ++i)
+        response.body.insert(response.body.end(), response.parts[i].bytes.data(),
+                             response.parts[i].bytes.data() + response.parts[i].size());
+    response.parts.clear();
+
+    std::string packed;
+    if (!deflate_bytes(response.body.empty() ? "" : &response.body[0], response.body.size(),
+                       coding, location_config.gzipCompLevel, packed))
+        return;
+
+    std::map<std::string, std::string>::iterator cl;
+    while ((cl = findHeaderCI(response.headers, "content-length")) != response.headers.end())
+        response.headers.erase(cl);
+
+    response.body.assign(packed.begin(), packed.end());
+    response.headers["Content-Encoding"] = coding;
+    response.headers["Content-Length"] = to_string(response.body.size());
+}
+
+// Streaming variant of compress_response, decided from the headers alone:
+// true if the body that follows should go through a DeflateStream. The
+// Content-Length (if the script sent one) no longer applies and is dropped.
+bool Router::compress_stream_head(const LocationConfig& location_config,
+                                  const std::string& coding,
+                                  HTTPResponse& head) const
+{
+    if (!location_config.gzip || head.status_code != 200)
+        return false;
+
+    std::map<std::string, std::string>::iterator ct = findHeaderCI(head.headers, "content-type");
+    if (ct == head.headers.end() || !compressible_type(location_config, ct->second))
+        return false;
+    if (findHeaderCI(head.headers, "content-encoding") != head.headers.end())
+        return false;
+
+    std::map<std::string, std::string>::iterator vary = findHeaderCI(head.headers, "vary");
+    if (vary == head.headers.end())
+        head.headers["Vary"] = "Accept-Encoding";
+    else if (asciiLower(vary->second).find("accept-encoding") == std::string::npos)
+        vary->second += ", Accept-Encoding";
+
+    if (coding.empty())
+        return false;
+
+    std::map<std::string, std::string>::iterator cl = findHeaderCI(head.headers, "content-length");
+    if (cl != head.headers.end())
+    {
+        size_t total = std::strtoul(cl->second.c_str(), NULL, 10);
+        if (total < location_config.gzipMinLength || total > location_config.gzipMaxLength)
+            return false;
+    }
+    while ((cl = findHeaderCI(head.headers, "content-length")) != head.headers.end())
+        head.headers.erase(cl);
+
+    head.headers["Content-Encoding"] = coding;
+    return true;
+}
@@ -0,0 +1,66 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   deflate_stream.cpp                                 :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/15 14:07:10 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/15 14:07:10 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/Router_headers/DeflateStream.hpp"
+#include <cstring>
+
+DeflateStream::DeflateStream() : _open(false)
+{
+    std::memset(&_zs, 0, sizeof(_zs));
+}
+
+DeflateStream::~DeflateStream()
+{
+    if (_open)
+        deflateEnd(&_zs);
+}
+
+// same wrappers as the one-shot encoder: gzip header for "gzip", zlib for "deflate"
+bool DeflateStream::begin(const std::string& coding, int level)
+{
+    if (_open)
+        return false;
+    int windowBits = (coding == "gzip") ? 15 + 16 : 15;
+    _open = (deflateInit2(&_zs, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    return _open;
+}
+
+// appends the compressed form of `data` to `out`; `last` writes the trailer
+bool DeflateStream::push(const char* data, size_t len, bool last, std::string& out)
+{
+    if (!_open)
+        return false;
+
+    _zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    _zs.avail_in = (uInt)len;
+
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    char buf[16384];
+    for (;;)
+    {
+        _zs.next_out = reinterpret_cast<Bytef*>(buf);
+        _zs.avail_out = sizeof(buf);
+        int rc = deflate(&_zs, flush);
+        if (rc == Z_STREAM_ERROR)
+            return false;
+        out.append(buf, sizeof(buf) - _zs.avail_out);
+        if (rc == Z_STREAM_END || (_zs.avail_in == 0 && _zs.avail_out != 0))
+            break;
+    }
+
+    if (last)
+    {
+        deflateEnd(&_zs);
+        _open = false;
+    }
+    return true;
+}
@@ -0,0 +1,88 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   dir_listing_cache.cpp                              :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/13 09:12:58 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/13 09:12:58 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/Router_headers/DirListingCache.hpp"
+#include "../../include/sockets/ServerMetrics.hpp"
+
+DirListingCache::DirListingCache(size_t maxBytes)
+: _dirs()
+, _lru()
+, _bytes(0)
+, _maxBytes(maxBytes)
+{}
+
+// Listing for `dir`, emptied first if the directory changed since it was cached.
+DirListingCache::Listing& DirListingCache::get(const std::string& dir, const struct stat& st)
+{
+    std::map<std::string, Listing>::iterator it = _dirs.find(dir);
+    if (it != _dirs.end())
+    {
+        Listing& l = it->second;
+        if (l.mtimeSec == st.st_mtim.tv_sec && l.mtimeNsec == st.st_mtim.tv_nsec)
+        {
+            _lru.splice(_lru.begin(), _lru, l.lru);
+            server_metrics().cacheLookup(METRICS_CACHE_DIR_LISTING, true);
+            return l;
+        }
+        erase(it);
+    }
+    server_metrics().cacheLookup(METRICS_CACHE_DIR_LISTING, false);
+
+    _lru.push_front(dir);
+    Listing& l = _dirs[dir];
+    l.mtimeSec = st.st_mtim.tv_sec;
+    l.mtimeNsec = st.st_mtim.tv_nsec;
+    l.scanned = false;
+    l.lru = _lru.begin();
+    l.bytes = 0;
+    return l;
+}
+
+// Re-measures `dir` after it was filled and evicts to stay under the cap.
+// A listing bigger than the whole cap is dropped too: callers hold their own
+// references to the rendered buffers, so nothing they send goes away.
+void DirListingCache::account(const std::string& dir)
+{
+    std::map<std::string, Listing>::iterator it = _dirs.find(dir);
+    if (it == _dirs.end())
+        return;
+
+    Listing& l = it->second;
+    size_t now = 0;
+    for (size_t i = 0; i < l.items.size(); ++i)
+        now += sizeof(Item) + l.items[i].name.size();
+    for (std::map<std::string, std::vector<SharedBuffer> >::const_iterator v = l.views.begin();
+         v != l.views.end(); ++v)
+        for (size_t i = 0; i < v->second.size(); ++i)
+            now += v->second[i].size();
+    _bytes = _bytes - l.bytes + now;
+    l.bytes = now;
+
+    while (_bytes > _maxBytes && _lru.size() > 1 && _lru.back() != dir)
+        erase(_dirs.find(_lru.back()));
+    if (_bytes > _maxBytes)
+        erase(it);
+}
+
+void DirListingCache::clear()
+{
+    _dirs.clear();
+    _lru.clear();
+    _bytes = 0;
+}
+
+void DirListingCache::erase(std::map<std::string, Listing>::iterator it)
+{
+    _bytes -= it->second.bytes;
+    _lru.erase(it->second.lru);
+    _dirs.erase(it);
+}
@@ -56,6 +56,7 @@
 // </html>
 
 #include "../../include/Router_headers/Router.hpp"
+#include "../../include/HTTP/http10/Http10Serializer.hpp"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -72,39 +73,82 @@ static std::string reasonFromCode(int code)
     return "Error";
 }
 
-HTTPResponse Router::apply_error_page(const ServerConfig& server_config,
-                                     int status_code,
-                                     HTTPResponse response) const
+static bool read_whole_file(const std::string& path, std::vector<char>& out)
 {
-    if (response.status_code != status_code)
-        return response;
-
-    std::map<int, std::string>::const_iterator it =
-        server_config.error_Pages.find(status_code);
-    if (it == server_config.error_Pages.end())
-        return response;
-
-    std::string path = server_config.root + it->second;
-
     int fd = open(path.c_str(), O_RDONLY);
     if (fd < 0)
-        return response;
+        return false;
 
-    std::vector<char> body;
     char buf[8192];
     ssize_t n;
     while ((n = read(fd, buf, sizeof(buf))) > 0)
-        body.insert(body.end(), buf, buf + n);
+        out.insert(out.end(), buf, buf + n);
 
     close(fd);
+    return n == 0;
+}
 
-    if (n < 0)
+// Called once from the constructor: every error_page file is read into memory
+// and its complete response is serialized, so serving an error never touches disk.
+// A missing/unreadable file keeps the default plain-text error (same as before).
+void Router::preload_error_pages()
+{
+    _errorPages.clear();
+    for (std::vector<ServerConfig>::const_iterator srv = _config.servers.begin();
+         srv != _config.servers.end(); ++srv)
+    {
+        std::map<int, ErrorPage>& pages = _errorPages[&*srv];
+        for (std::map<int, std::string>::const_iterator it = srv->error_Pages.begin();
+             it != srv->error_Pages.end(); ++it)
+        {
+            ErrorPage page;
+            if (!read_whole_file(srv->root + it->second, page.body))
+            {
+                std::cerr << "Warning: cannot load error_page " << it->first
+                          << " (" << srv->root + it->second << ")" << std::endl;
+                continue;
+            }
+
+            HTTPResponse res;
+            res.status_code = it->first;
+            res.reason_phrase = reasonFromCode(it->first);
+            res.set_body(page.body);
+            res.headers["Content-Type"] = "text/html";
+            res.headers["Content-Length"] = to_string(res.body.size());
+            page.headers = res.headers;
+            page.prebuilt = SharedBuffer(http10::serializeClose(res));
+
+            pages[it->first] = page;
+        }
+    }
+}
+
+HTTPResponse Router::apply_error_page(const ServerConfig& server_config,
+                                     int status_code,
+                                     HTTPResponse response) const
+{
+    if (response.status_code != status_code)
         return response;
+
+    std::map<const ServerConfig*, std::map<int, ErrorPage> >::const_iterator srv =
+        _errorPages.find(&server_config);
+    if (srv == _errorPages.end())
+        return response;
+
+    std::map<int, ErrorPage>::const_iterator it = srv->second.find(status_code);
+    if (it == srv->second.end())
+        return response;
+
     response.status_code = status_code;
     response.reason_phrase = reasonFromCode(status_code);
 
-    response.set_body(body);
+    response.set_body(it->second.body);
     response.headers["Content-Type"] = "text/html";
     response.headers["Content-Length"] = to_string(response.body.size());
+
+    // the prebuilt bytes are exact only when the headers are the ones they
+    // were built with (a 405 carries Allow and is serialized normally)
+    if (response.headers == it->second.headers)
+        response.prebuilt = it->second.prebuilt;
     return response;
 }
@@ -0,0 +1,70 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   file_meta_cache.cpp                                :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/11 15:21:02 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/11 15:21:02 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/Router_headers/FileMetaCache.hpp"
+#include "../../include/sockets/ServerMetrics.hpp"
+
+FileMetaCache::FileMetaCache(int validSec, size_t maxEntries)
+: _entries()
+, _validSec(validSec)
+, _maxEntries(maxEntries)
+{}
+
+// same answer as stat(path) == 0, but served from the cache while fresh
+bool FileMetaCache::lookup(const std::string& path, struct stat& out)
+{
+    std::time_t now = std::time(NULL);
+
+    std::map<std::string, Entry>::iterator it = _entries.find(path);
+    if (it != _entries.end() && (now - it->second.checked) < _validSec)
+    {
+        server_metrics().cacheLookup(METRICS_CACHE_FILE_META, true);
+        if (it->second.exists)
+            out = it->second.st;
+        return it->second.exists;
+    }
+
+    if (it == _entries.end())
+    {
+        if (_entries.size() >= _maxEntries)
+            prune(now);
+        it = _entries.insert(std::make_pair(path, Entry())).first;
+    }
+
+    server_metrics().cacheLookup(METRICS_CACHE_FILE_META, false);
+    Entry& e = it->second;
+    e.exists = (stat(path.c_str(), &e.st) == 0);
+    e.checked = now;
+    if (e.exists)
+        out = e.st;
+    return e.exists;
+}
+
+void FileMetaCache::clear()
+{
+    _entries.clear();
+}
+
+// drop stale entries; if everything is fresh, start over rather than grow
+void FileMetaCache::prune(std::time_t now)
+{
+    std::map<std::string, Entry>::iterator it = _entries.begin();
+    while (it != _entries.end())
+    {
+        if ((now - it->second.checked) >= _validSec)
+            _entries.erase(it++);
+        else
+            ++it;
+    }
+    if (_entries.size() >= _maxEntries)
+        _entries.clear();
+}
@@ -11,79 +11,449 @@
 /* ************************************************************************** */
 
 #include "../../include/Router_headers/Router.hpp"
+#include "../../include/sockets/NetUtil.hpp"
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <ctime>
+#include <cstring>
+#include <cstdlib>
 
-std::string Router::get_mime_type(const std::string& filepath) const
+static std::string http_date(time_t t)
 {
-    std::string::size_type dot_pos = filepath.find_last_of('.');
-    if (dot_pos == std::string::npos)
-        return "application/octet-stream";
-    
-    std::string extension = filepath.substr(dot_pos + 1);
-    
-    if (extension == "html" || extension == "htm")
-        return "text/html";
-    if (extension == "css")
-        return "text/css";
-    if (extension == "js")
-        return "application/javascript";
-    if (extension == "png")
-        return "image/png";
-    if (extension == "jpg" || extension == "jpeg")
-        return "image/jpeg";
-    if (extension == "gif")
-        return "image/gif";
-    if (extension == "txt")
-        return "text/plain";
-    if (extension == "pdf")
-        return "application/pdf";
-    
-    return "application/octet-stream";
+    struct tm g;
+    char buf[64];
+    gmtime_r(&t, &g);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &g);
+    return buf;
+}
+
+// IMF-fixdate, plus the two obsolete forms RFC 7231 still asks us to accept
+static bool parse_http_date(const std::string& v, time_t& out)
+{
+    static const char* formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",
+        "%A, %d-%b-%y %H:%M:%S GMT",
+        "%a %b %e %H:%M:%S %Y",
+        NULL
+    };
+    for (size_t i = 0; formats[i]; ++i)
+    {
+        struct tm tm;
+        std::memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(v.c_str(), formats[i], &tm);
+        if (end && *end == '\0')
+        {
+            out = timegm(&tm);
+            return true;
+        }
+    }
+    return false;
+}
+
+// weak validator from metadata only: W/"inode-size-mtime"
+static std::string make_etag(const struct stat& st)
+{
+    std::ostringstream os;
+    os << "W/\"" << std::hex << (unsigned long)st.st_ino << "-"
+       << (unsigned long long)st.st_size << "-" << (unsigned long)st.st_mtime << "\"";
+    return os.str();
+}
+
+static std::string strip_weak(const std::string& tag)
+{
+    if (tag.size() >= 2 && tag[0] == 'W' && tag[1] == '/')
+        return tag.substr(2);
+    return tag;
+}
+
+// If-None-Match uses the weak comparison: W/"x" matches "x"
+static bool etag_list_matches(const std::string& list, const std::string& etag)
+{
+    std::string mine = strip_weak(etag);
+    size_t pos = 0;
+    while (pos <= list.size())
+    {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos)
+            comma = list.size();
+        std::string one = trimSpaces(list.substr(pos, comma - pos));
+        if (one == "*" || (!one.empty() && strip_weak(one) == mine))
+            return true;
+        pos = comma + 1;
+    }
+    return false;
+}
+
+// true -> the client copy is still fresh, answer 304
+static bool not_modified(const HTTPRequest& request, const std::string& etag, time_t mtime)
+{
+    std::string v;
+    if (getHeaderCI(request.headers, "if-none-match", v))
+        return etag_list_matches(v, etag);
+
+    time_t since;
+    if (getHeaderCI(request.headers, "if-modified-since", v) && parse_http_date(trimSpaces(v), since))
+        return mtime <= since;
+    return false;
+}
+
+void Router::build_mime_types()
+{
+    _mimeTypes.clear();
+    for (std::vector<ServerConfig>::const_iterator srv = _config.servers.begin();
+         srv != _config.servers.end(); ++srv)
+        _mimeTypes[&*srv].build(srv->mimeTypes);
+}
+
+const std::string& Router::get_mime_type(const ServerConfig& server_config,
+                                         const std::string& filepath) const
+{
+    std::map<const ServerConfig*, MimeTypes>::const_iterator it = _mimeTypes.find(&server_config);
+    if (it == _mimeTypes.end())
+        return MimeTypes::defaultType();
+    return it->second.lookup(filepath);
+}
+
+struct ByteRange
+{
+    off_t first;
+    off_t last;   // inclusive
+};
+
+static bool range_less(const ByteRange& a, const ByteRange& b)
+{
+    return a.first < b.first;
+}
+
+static bool parse_off(const std::string& s, off_t& out)
+{
+    if (s.empty())
+        return false;
+    off_t v = 0;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+        off_t nv = v * 10 + (s[i] - '0');
+        if (nv < v)
+            return false;
+        v = nv;
+    }
+    out = v;
+    return true;
+}
+
+// "bytes=0-99, 200-, -50" against a file of `size` bytes.
+// false -> malformed / unsupported: ignore the header and send the whole file.
+// true  -> `out` holds the satisfiable ranges, sorted and merged (empty means 416).
+static bool parse_ranges(const std::string& value, off_t size, std::vector<ByteRange>& out)
+{
+    const size_t MAX_RANGES = 64;
+
+    std::string v = trimSpaces(value);
+    if (v.size() < 6)
+        return false;
+    std::string unit = v.substr(0, 6);
+    for (size_t i = 0; i < unit.size(); ++i)
+        if (unit[i] >= 'A' && unit[i] <= 'Z') unit[i] = char(unit[i] - 'A' + 'a');
+    if (unit != "bytes=")
+        return false;
+
+    std::vector<ByteRange> got;
+    size_t specs = 0;
+    size_t pos = 6;
+    while (pos <= v.size())
+    {
+        size_t comma = v.find(',', pos);
+        if (comma == std::string::npos)
+            comma = v.size();
+        std::string spec = trimSpaces(v.substr(pos, comma - pos));
+        pos = comma + 1;
+        if (spec.empty())
+            continue;
+        if (++specs > MAX_RANGES)
+            return false;
+
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos)
+            return false;
+        std::string a = spec.substr(0, dash);
+        std::string b = spec.substr(dash + 1);
+
+        ByteRange r;
+        if (a.empty())
+        {
+            off_t n;
+            if (!parse_off(b, n))
+                return false;
+            if (n == 0 || size == 0)
+                continue;
+            r.first = (n >= size) ? 0 : size - n;
+            r.last = size - 1;
+        }
+        else
+        {
+            if (!parse_off(a, r.first))
+                return false;
+            if (b.empty())
+                r.last = size - 1;
+            else
+            {
+                if (!parse_off(b, r.last) || r.last < r.first)
+                    return false;
+                if (r.last > size - 1)
+                    r.last = size - 1;
+            }
+            if (r.first >= size)
+                continue;
+        }
+        got.push_back(r);
+    }
+    if (specs == 0)
+        return false;
+
+    // overlapping/adjacent ranges are merged so a client can't make us send a file many times
+    std::sort(got.begin(), got.end(), range_less);
+    out.clear();
+    for (size_t i = 0; i < got.size(); ++i)
+    {
+        if (!out.empty() && got[i].first <= out.back().last + 1)
+        {
+            if (got[i].last > out.back().last)
+                out.back().last = got[i].last;
+        }
+        else
+            out.push_back(got[i]);
+    }
+    return true;
+}
+
+// If-Range: the range applies only if the validator still matches.
+// Entity tags need the strong comparison, which our weak ETags never pass.
+static bool if_range_allows(const HTTPRequest& request, const std::string& etag, time_t mtime)
+{
+    std::string v;
+    if (!getHeaderCI(request.headers, "if-range", v))
+        return true;
+    v = trimSpaces(v);
+    if (!v.empty() && (v[0] == '"' || v[0] == 'W'))
+        return etag.compare(0, 2, "W/") != 0 && v == etag;
+    time_t when;
+    return parse_http_date(v, when) && when == mtime;
+}
+
+static std::string content_range(const ByteRange& r, off_t size)
+{
+    std::ostringstream os;
+    os << "bytes " << (long long)r.first << "-" << (long long)r.last << "/" << (long long)size;
+    return os.str();
+}
+
+static std::string make_boundary(const struct stat& st)
+{
+    static unsigned long counter = 0;
+    std::ostringstream os;
+    os << "webserv_" << std::hex << (unsigned long)st.st_mtime << (unsigned long)st.st_ino << "_" << ++counter;
+    return os.str();
+}
+
+// gzip_static / br_static: swap in file.br or file.gz when the client accepts it.
+// Sidecar probes go through the stat cache; a sidecar older than the file is ignored.
+bool Router::pick_static_sidecar(const LocationConfig& location_config,
+                                 const HTTPRequest& request,
+                                 const std::string& fullpath,
+                                 const struct stat& st,
+                                 std::string& outPath,
+                                 struct stat& outSt,
+                                 std::string& outEncoding) const
+{
+    float qBr = location_config.brStatic ? accept_encoding_q(request, "br") : 0.0f;
+    float qGz = location_config.gzipStatic ? accept_encoding_q(request, "gzip") : 0.0f;
+
+    const char* order[2] = { "br", "gzip" };
+    if (qGz > qBr)
+    {
+        order[0] = "gzip";
+        order[1] = "br";
+    }
+    for (size_t i = 0; i < 2; ++i)
+    {
+        std::string coding = order[i];
+        if ((coding == "br" ? qBr : qGz) <= 0.0f)
+            continue;
+        std::string side = fullpath + (coding == "br" ? ".br" : ".gz");
+        struct stat sst;
+        if (_meta.lookup(side, sst) && S_ISREG(sst.st_mode) && sst.st_mtime >= st.st_mtime)
+        {
+            outPath = side;
+            outSt = sst;
+            outEncoding = coding;
+            return true;
+        }
+    }
+    return false;
 }
 
-HTTPResponse Router::serve_static_file(const std::string& fullpath) const
+// Validators, 304 and HEAD come straight from the stat() the router already did:
+// the file is only opened when its bytes are actually going to be sent (or, with
+// gzip on, the first time a GET builds its compressed variant).
+HTTPResponse Router::serve_static_file(const ServerConfig& server_config,
+                                       const LocationConfig& location_config,
+                                       const HTTPRequest& request,
+                                       const std::string& fullpath,
+                                       const struct stat& fileSt) const
 {
     HTTPResponse response;
-    
-    int fd = open(fullpath.c_str(), O_RDONLY);
-    if (fd < 0)
+
+    // the representation actually sent: the file itself, its precompressed
+    // sidecar, or (gzip on) a compressed copy kept in the variant cache
+    std::string path = fullpath;
+    struct stat st = fileSt;
+    std::string encoding;
+    if (S_ISREG(fileSt.st_mode) &&
+        (location_config.gzipStatic || location_config.brStatic || location_config.gzip))
     {
-        response.status_code = 404;
-        response.reason_phrase = "Not Found";
-        response.set_body("404 Not Found");
-        response.headers["Content-Type"] = "text/plain";
-        response.headers["Content-Length"] = to_string(response.body.size());
+        response.headers["Vary"] = "Accept-Encoding";
+        if (location_config.gzipStatic || location_config.brStatic)
+            pick_static_sidecar(location_config, request, fullpath, fileSt, path, st, encoding);
+    }
+
+    const std::string& mime = get_mime_type(server_config, fullpath);
+    std::string rangeHdr;
+    bool hasRange = getHeaderCI(request.headers, "range", rangeHdr);
+
+    // ranges are served from the identity file, never from a compressed copy;
+    // so is a file whose variant would not fit in the cache (HEAD and GET agree)
+    std::string dynCoding;
+    if (encoding.empty() && location_config.gzip && !hasRange && S_ISREG(st.st_mode) &&
+        (size_t)st.st_size >= location_config.gzipMinLength &&
+        (size_t)st.st_size <= location_config.gzipMaxLength &&
+        static_variant_fits(server_config, (size_t)st.st_size) &&
+        compressible_type(location_config, mime))
+        dynCoding = negotiate_compression(location_config, request);
+
+    std::string etag = make_etag(st);
+    if (!dynCoding.empty())
+        etag.insert(etag.size() - 1, dynCoding == "gzip" ? "-gz" : "-df");
+    std::string lastModified = http_date(st.st_mtime);
+
+    if (not_modified(request, etag, st.st_mtime))
+    {
+        response.status_code = 304;
+        response.reason_phrase = "Not Modified";
+        response.headers["ETag"] = etag;
+        response.headers["Last-Modified"] = lastModified;
         return response;
     }
-    
-    std::vector<char> body;
-    char buffer[8192];
-    ssize_t bytes_read;
-    
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0)
+
+    // HEAD takes a variant a GET already built, or answers for the identity file
+    SharedBuffer packed;
+    if (!dynCoding.empty())
     {
-        body.insert(body.end(), buffer, buffer + bytes_read);
+        bool ok = (request.method == HTTP_HEAD)
+            ? cached_static_variant(server_config, location_config, dynCoding, path, st, packed)
+            : compress_static_file(server_config, location_config, dynCoding, path, st, packed);
+        if (ok)
+            encoding = dynCoding;
+        else
+            etag = make_etag(st);
+    }
+
+    if (!encoding.empty())
+        response.headers["Content-Encoding"] = encoding;
+
+    if (request.method == HTTP_HEAD)
+    {
+        response.status_code = 200;
+        response.reason_phrase = "OK";
+        response.headers["Content-Type"] = mime;
+        response.headers["Content-Length"] = to_string(packed.empty() ? (size_t)st.st_size : packed.size());
+        response.headers["ETag"] = etag;
+        response.headers["Last-Modified"] = lastModified;
+        return response;
     }
     
-    close(fd);
-    
-    if (bytes_read < 0)
+    if (!S_ISREG(st.st_mode))
     {
-        response.status_code = 500;
-        response.reason_phrase = "Internal Server Error";
-        response.set_body("500 Internal Server Error");
+        response.status_code = 403;
+        response.reason_phrase = "Forbidden";
+        response.set_body("403 Forbidden");
         response.headers["Content-Type"] = "text/plain";
         response.headers["Content-Length"] = to_string(response.body.size());
         return response;
     }
-    
+
+    response.headers["Accept-Ranges"] = "bytes";
+    response.headers["ETag"] = etag;
+    response.headers["Last-Modified"] = lastModified;
+
+    if (!packed.empty())
+    {
+        response.status_code = 200;
+        response.reason_phrase = "OK";
+        response.headers["Content-Type"] = mime;
+        response.headers["Content-Length"] = to_string(packed.size());
+        response.parts.push_back(BodyPart::fromShared(packed));
+        return response;
+    }
+
+    std::vector<ByteRange> ranges;
+    if (request.method == HTTP_GET && hasRange &&
+        if_range_allows(request, etag, st.st_mtime) &&
+        parse_ranges(rangeHdr, st.st_size, ranges))
+    {
+        if (ranges.empty())
+        {
+            response.status_code = 416;
+            response.reason_phrase = "Range Not Satisfiable";
+            response.set_body("416 Range Not Satisfiable");
+            response.headers["Content-Type"] = "text/plain";
+            response.headers["Content-Length"] = to_string(response.body.size());
+            response.headers["Content-Range"] = "bytes */" + to_string((size_t)st.st_size);
+            return response;
+        }
+
+        response.status_code = 206;
+        response.reason_phrase = "Partial Content";
+
+        if (ranges.size() == 1)
+        {
+            size_t len = (size_t)(ranges[0].last - ranges[0].first + 1);
+            response.headers["Content-Type"] = mime;
+            response.headers["Content-Range"] = content_range(ranges[0], st.st_size);
+            response.headers["Content-Length"] = to_string(len);
+            response.parts.push_back(BodyPart::fromFile(path, ranges[0].first, len));
+            return response;
+        }
+
+        // multipart/byteranges: small in-memory part headers around file spans
+        std::string boundary = make_boundary(st);
+        size_t total = 0;
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            std::string head = "\r\n--" + boundary + "\r\n"
+                             + "Content-Type: " + mime + "\r\n"
+                             + "Content-Range: " + content_range(ranges[i], st.st_size) + "\r\n\r\n";
+            size_t len = (size_t)(ranges[i].last - ranges[i].first + 1);
+            response.parts.push_back(BodyPart::fromBytes(head));
+            response.parts.push_back(BodyPart::fromFile(path, ranges[i].first, len));
+            total += head.size() + len;
+        }
+        std::string tail = "\r\n--" + boundary + "--\r\n";
+        response.parts.push_back(BodyPart::fromBytes(tail));
+        total += tail.size();
+
+        response.headers["Content-Type"] = "multipart/byteranges; boundary=" + boundary;
+        response.headers["Content-Length"] = to_string(total);
+        return response;
+    }
+
+    // whole file: streamed by the reactor, never loaded here
     response.status_code = 200;
     response.reason_phrase = "OK";
-    response.body = body;
-    response.headers["Content-Type"] = get_mime_type(fullpath);
-    response.headers["Content-Length"] = to_string(response.body.size());
-    
+    response.headers["Content-Type"] = mime;
+    response.headers["Content-Length"] = to_string((size_t)st.st_size);
+    response.parts.push_back(BodyPart::fromFile(path, 0, (size_t)st.st_size));
     return response;
-}
\ No newline at end of file
+}
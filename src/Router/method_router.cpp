@@ -320,7 +320,7 @@ HTTPResponse Router::handle_post_request(const HTTPRequest& request,
 
     std::string final_upload_path = upload_path + filename;
 
-    int fd = open(final_upload_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int fd = open(final_upload_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
     if (fd < 0)
     {
         response.status_code = 500;
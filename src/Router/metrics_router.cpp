@@ -0,0 +1,56 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   metrics_router.cpp                                 :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 18:20:03 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 18:20:03 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/Router_headers/Router.hpp"
+#include "../../include/sockets/ServerMetrics.hpp"
+#include "../../include/sockets/NetUtil.hpp"
+
+// JSON when asked for with ?format=json or Accept: application/json,
+// Prometheus text otherwise
+static bool wants_json(const HTTPRequest& request)
+{
+    size_t q = request.uri.find('?');
+    if (q != std::string::npos && request.uri.find("format=json", q) != std::string::npos)
+        return true;
+    for (std::map<std::string, std::string>::const_iterator it = request.headers.begin();
+         it != request.headers.end(); ++it)
+    {
+        if (asciiLower(it->first) == "accept")
+            return asciiLower(it->second).find("application/json") != std::string::npos;
+    }
+    return false;
+}
+
+// `metrics on`: the server's counters instead of a file
+HTTPResponse Router::metrics_response(const HTTPRequest& request) const
+{
+    HTTPResponse response;
+    std::string body;
+
+    if (wants_json(request))
+    {
+        server_metrics().renderJson(body);
+        response.headers["Content-Type"] = "application/json";
+    }
+    else
+    {
+        server_metrics().renderPrometheus(body);
+        response.headers["Content-Type"] = "text/plain; version=0.0.4";
+    }
+    response.status_code = 200;
+    response.reason_phrase = "OK";
+    response.headers["Cache-Control"] = "no-store";
+    response.headers["Content-Length"] = to_string(body.size());
+    if (request.method != HTTP_HEAD)
+        response.set_body(body);
+    return response;
+}
@@ -0,0 +1,183 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   mime_types.cpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/10 14:02:30 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/10 14:02:30 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/Router_headers/MimeTypes.hpp"
+
+// longest extension we bother hashing; anything longer is "unknown"
+#define MIME_MAX_EXT 16
+
+struct MimeDefault
+{
+    const char* ext;
+    const char* type;
+};
+
+static const MimeDefault g_defaults[] = {
+    { "html",  "text/html" },
+    { "htm",   "text/html" },
+    { "shtml", "text/html" },
+    { "css",   "text/css" },
+    { "xml",   "text/xml" },
+    { "txt",   "text/plain" },
+    { "md",    "text/markdown" },
+    { "csv",   "text/csv" },
+    { "js",    "application/javascript" },
+    { "mjs",   "application/javascript" },
+    { "json",  "application/json" },
+    { "map",   "application/json" },
+    { "wasm",  "application/wasm" },
+    { "pdf",   "application/pdf" },
+    { "rss",   "application/rss+xml" },
+    { "atom",  "application/atom+xml" },
+    { "zip",   "application/zip" },
+    { "gz",    "application/gzip" },
+    { "tar",   "application/x-tar" },
+    { "bz2",   "application/x-bzip2" },
+    { "7z",    "application/x-7z-compressed" },
+    { "rar",   "application/vnd.rar" },
+    { "jar",   "application/java-archive" },
+    { "doc",   "application/msword" },
+    { "docx",  "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+    { "xls",   "application/vnd.ms-excel" },
+    { "xlsx",  "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet" },
+    { "ppt",   "application/vnd.ms-powerpoint" },
+    { "pptx",  "application/vnd.openxmlformats-officedocument.presentationml.presentation" },
+    { "rtf",   "application/rtf" },
+    { "epub",  "application/epub+zip" },
+    { "png",   "image/png" },
+    { "jpg",   "image/jpeg" },
+    { "jpeg",  "image/jpeg" },
+    { "gif",   "image/gif" },
+    { "svg",   "image/svg+xml" },
+    { "svgz",  "image/svg+xml" },
+    { "webp",  "image/webp" },
+    { "avif",  "image/avif" },
+    { "ico",   "image/x-icon" },
+    { "bmp",   "image/bmp" },
+    { "tif",   "image/tiff" },
+    { "tiff",  "image/tiff" },
+    { "woff",  "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf",   "font/ttf" },
+    { "otf",   "font/otf" },
+    { "eot",   "application/vnd.ms-fontobject" },
+    { "mp3",   "audio/mpeg" },
+    { "ogg",   "audio/ogg" },
+    { "oga",   "audio/ogg" },
+    { "m4a",   "audio/mp4" },
+    { "wav",   "audio/wav" },
+    { "flac",  "audio/flac" },
+    { "mp4",   "video/mp4" },
+    { "m4v",   "video/mp4" },
+    { "webm",  "video/webm" },
+    { "ogv",   "video/ogg" },
+    { "mov",   "video/quicktime" },
+    { "avi",   "video/x-msvideo" },
+    { "mkv",   "video/x-matroska" },
+    { "mpeg",  "video/mpeg" },
+    { "mpg",   "video/mpeg" },
+    { NULL, NULL }
+};
+
+static char lower_ascii(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return static_cast<char>(c - 'A' + 'a');
+    return c;
+}
+
+// FNV-1a over the already lowercased extension
+static size_t hash_ext(const char* s, size_t len)
+{
+    size_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= static_cast<unsigned char>(s[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+MimeTypes::MimeTypes() : _slots(), _mask(0) {}
+
+const std::string& MimeTypes::defaultType()
+{
+    static const std::string def("application/octet-stream");
+    return def;
+}
+
+void MimeTypes::insert(const std::string& ext, const std::string& type)
+{
+    size_t i = hash_ext(ext.data(), ext.size()) & _mask;
+    while (_slots[i].used && _slots[i].ext != ext)
+        i = (i + 1) & _mask;
+    _slots[i].used = true;
+    _slots[i].ext = ext;
+    _slots[i].type = type;
+}
+
+void MimeTypes::build(const std::map<std::string, std::string>& overrides)
+{
+    std::map<std::string, std::string> all;
+    for (size_t i = 0; g_defaults[i].ext; ++i)
+        all[g_defaults[i].ext] = g_defaults[i].type;
+    for (std::map<std::string, std::string>::const_iterator it = overrides.begin();
+         it != overrides.end(); ++it)
+    {
+        std::string ext;
+        for (size_t i = 0; i < it->first.size(); ++i)
+            ext += lower_ascii(it->first[i]);
+        if (!ext.empty() && ext.size() <= MIME_MAX_EXT)
+            all[ext] = it->second;
+    }
+
+    // load factor <= 0.5 keeps probe chains short
+    size_t cap = 16;
+    while (cap < all.size() * 2)
+        cap <<= 1;
+    _slots.assign(cap, Slot());
+    _mask = cap - 1;
+
+    for (std::map<std::string, std::string>::const_iterator it = all.begin(); it != all.end(); ++it)
+        insert(it->first, it->second);
+}
+
+const std::string& MimeTypes::lookupExt(const char* ext, size_t len) const
+{
+    if (_slots.empty() || len == 0 || len > MIME_MAX_EXT)
+        return defaultType();
+
+    char low[MIME_MAX_EXT];
+    for (size_t i = 0; i < len; ++i)
+        low[i] = lower_ascii(ext[i]);
+
+    size_t i = hash_ext(low, len) & _mask;
+    while (_slots[i].used)
+    {
+        const std::string& k = _slots[i].ext;
+        if (k.size() == len && k.compare(0, len, low, len) == 0)
+            return _slots[i].type;
+        i = (i + 1) & _mask;
+    }
+    return defaultType();
+}
+
+const std::string& MimeTypes::lookup(const std::string& filepath) const
+{
+    std::string::size_type dot = filepath.find_last_of('.');
+    if (dot == std::string::npos)
+        return defaultType();
+    std::string::size_type slash = filepath.find_last_of('/');
+    if (slash != std::string::npos && slash > dot)
+        return defaultType();
+    return lookupExt(filepath.data() + dot + 1, filepath.size() - dot - 1);
+}
@@ -11,6 +11,9 @@
 /* ************************************************************************** */
 
 #include "../../include/Router_headers/Router.hpp"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 
 std::string Router::final_path(const ServerConfig& server,
                                const LocationConfig& location,
@@ -39,6 +42,50 @@ std::string Router::final_path(const ServerConfig& server,
     return full;
 }
 
+// X-Sendfile names a file on disk; it is only served if it lies under an
+// `internal` location, reached through that location's URI
+bool Router::internal_uri_for_file(const ServerConfig& server,
+                                   const std::string& path,
+                                   std::string& outUri) const
+{
+    char realFile[PATH_MAX];
+    if (!realpath(path.c_str(), realFile))
+        return false;
+
+    for (size_t i = 0; i < server.locations.size(); ++i)
+    {
+        const LocationConfig& loc = server.locations[i];
+        if (!loc.internal)
+            continue;
+
+        char realDir[PATH_MAX];
+        if (!realpath(final_path(server, loc, loc.path).c_str(), realDir))
+            continue;
+        size_t n = std::strlen(realDir);
+        if (std::strncmp(realFile, realDir, n) != 0 || realFile[n] != '/')
+            continue;
+
+        outUri = loc.path;
+        if (outUri.empty() || outUri[outUri.size() - 1] != '/')
+            outUri += "/";
+        // the URI gets decoded again on the way in
+        for (const char* c = realFile + n + 1; *c; ++c)
+        {
+            if (*c == '%' || *c == '?' || *c == '#')
+            {
+                static const char hex[] = "0123456789ABCDEF";
+                outUri += '%';
+                outUri += hex[(static_cast<unsigned char>(*c) >> 4) & 0xF];
+                outUri += hex[static_cast<unsigned char>(*c) & 0xF];
+            }
+            else
+                outUri += *c;
+        }
+        return true;
+    }
+    return false;
+}
+
 std::string Router::to_string(int value) const
 {
     std::stringstream ss;
@@ -11,6 +11,8 @@
 /* ************************************************************************** */
 
 #include "Parser.hpp"
+#include <cstring>
+#include <netdb.h>
 
 int Parser::uploadEnable_and_autoindex_parse(int &_pos, LocationConfig &locConfig)
 {
@@ -30,6 +32,34 @@ int Parser::uploadEnable_and_autoindex_parse(int &_pos, LocationConfig &locConfi
             locConfig.autoindex = true;
         else if (_tokens[_pos].value == "off" && _tokens[_pos - 1].value == "autoindex")
             locConfig.autoindex = false;
+        else if (_tokens[_pos].value == "on" && _tokens[_pos - 1].value == "gzip_static")
+            locConfig.gzipStatic = true;
+        else if (_tokens[_pos].value == "off" && _tokens[_pos - 1].value == "gzip_static")
+            locConfig.gzipStatic = false;
+        else if (_tokens[_pos].value == "on" && _tokens[_pos - 1].value == "br_static")
+            locConfig.brStatic = true;
+        else if (_tokens[_pos].value == "off" && _tokens[_pos - 1].value == "br_static")
+            locConfig.brStatic = false;
+        else if (_tokens[_pos].value == "on" && _tokens[_pos - 1].value == "gzip")
+            locConfig.gzip = true;
+        else if (_tokens[_pos].value == "off" && _tokens[_pos - 1].value == "gzip")
+            locConfig.gzip = false;
+        else if (_tokens[_pos].value == "on" && _tokens[_pos - 1].value == "cgi_collapse")
+            locConfig.cgiCollapse = true;
+        else if (_tokens[_pos].value == "off" && _tokens[_pos - 1].value == "cgi_collapse")
+            locConfig.cgiCollapse = false;
+        else if (_tokens[_pos].value == "on" && _tokens[_pos - 1].value == "cgi_cache_cookies")
+            locConfig.cgiCacheCookies = true;
+        else if (_tokens[_pos].value == "off" && _tokens[_pos - 1].value == "cgi_cache_cookies")
+            locConfig.cgiCacheCookies = false;
+        else if (_tokens[_pos].value == "on" && _tokens[_pos - 1].value == "internal")
+            locConfig.internal = true;
+        else if (_tokens[_pos].value == "off" && _tokens[_pos - 1].value == "internal")
+            locConfig.internal = false;
+        else if (_tokens[_pos].value == "on" && _tokens[_pos - 1].value == "metrics")
+            locConfig.metrics = true;
+        else if (_tokens[_pos].value == "off" && _tokens[_pos - 1].value == "metrics")
+            locConfig.metrics = false;
         else
         {
             error_msg(4);
@@ -121,6 +151,115 @@ int Parser::allow_methods_parse(int &_pos, LocationConfig &locConfig)
     return 1;
 }
 
+int Parser::gzip_types_parse(int &_pos, LocationConfig &locConfig)
+{
+    if (_pos + 1 >= (int)_tokens.size())
+    {
+        error_msg(4);
+        return 0;
+    }
+    _pos++;
+    if (_tokens[_pos].type == WORD)
+    {
+        while (_tokens[_pos].type == WORD)
+        {
+            locConfig.gzipTypes.push_back(_tokens[_pos].value);
+            _pos++;
+        }
+        if (_tokens[_pos].type == SEMICOLON)
+            _pos++;
+        else
+        {
+            error_msg(2);
+            return 0;
+        }
+    }
+    else
+    {
+        error_msg(4);
+        return 0;
+    }
+    return 1;
+}
+
+int Parser::location_numbers_parse(int &_pos, LocationConfig &locConfig)
+{
+    if (_pos + 1 >= (int)_tokens.size())
+    {
+        error_msg(4);
+        return 0;
+    }
+    _pos++;
+    if (_tokens[_pos].type == WORD)
+    {
+        long value = atol(_tokens[_pos].value.c_str());
+        if (_tokens[_pos - 1].value == "gzip_comp_level")
+        {
+            if (value < 1 || value > 9)
+            {
+                error_msg(4);
+                return 0;
+            }
+            locConfig.gzipCompLevel = (int)value;
+        }
+        else if (_tokens[_pos - 1].value == "cgi_nice")
+        {
+            if (value < 0 || value > 19)
+            {
+                error_msg(4);
+                return 0;
+            }
+            locConfig.cgiNice = (int)value;
+        }
+        else if (_tokens[_pos - 1].value == "gzip_min_length" && value >= 0)
+            locConfig.gzipMinLength = (size_t)value;
+        else if (_tokens[_pos - 1].value == "gzip_max_length" && value >= 0)
+            locConfig.gzipMaxLength = (size_t)value;
+        else if (_tokens[_pos - 1].value == "autoindex_per_page" && value >= 0)
+            locConfig.autoindexPerPage = (size_t)value;
+        else if (_tokens[_pos - 1].value == "cgi_timeout" && value >= 0)
+            locConfig.cgiTimeout = (int)value;
+        else if (_tokens[_pos - 1].value == "cgi_max_concurrent" && value >= 0)
+            locConfig.cgiMaxConcurrent = (size_t)value;
+        else if (_tokens[_pos - 1].value == "cgi_queue_size" && value >= 0)
+            locConfig.cgiQueueSize = (size_t)value;
+        else if (_tokens[_pos - 1].value == "cgi_queue_timeout" && value >= 0)
+            locConfig.cgiQueueTimeout = (int)value;
+        else if (_tokens[_pos - 1].value == "cgi_cache" && value >= 0)
+            locConfig.cgiCache = (int)value;
+        else if (_tokens[_pos - 1].value == "cgi_cache_stale" && value >= 0)
+            locConfig.cgiCacheStale = (int)value;
+        else if (_tokens[_pos - 1].value == "cgi_buffer_size" && value >= 0)
+            locConfig.cgiBufferSize = (size_t)value;
+        else if (_tokens[_pos - 1].value == "cgi_body_file" && value >= 0)
+            locConfig.cgiBodyFile = (size_t)value;
+        else if (_tokens[_pos - 1].value == "cgi_cpu_limit" && value >= 0)
+            locConfig.cgiCpuLimit = (int)value;
+        else if (_tokens[_pos - 1].value == "cgi_memory_limit" && value >= 0)
+            locConfig.cgiMemoryLimit = (size_t)value;
+        else if (_tokens[_pos - 1].value == "proxy_connect_timeout" && value >= 0)
+            locConfig.proxyConnectTimeout = (int)value;
+        else if (_tokens[_pos - 1].value == "proxy_read_timeout" && value >= 0)
+            locConfig.proxyReadTimeout = (int)value;
+        else if (_tokens[_pos - 1].value == "slow_request_log" && value >= 0)
+            locConfig.slowRequestLog = (int)value;
+        _pos++;
+        if (_tokens[_pos].type == SEMICOLON)
+            _pos++;
+        else
+        {
+            error_msg(2);
+            return 0;
+        }
+    }
+    else
+    {
+        error_msg(4);
+        return 0;
+    }
+    return 1;
+}
+
 int Parser::upload_parse(int &_pos, LocationConfig &locConfig)
 {
     if (_pos + 1 >= (int)_tokens.size())
@@ -189,6 +328,138 @@ int Parser::cgi_extension_parse(int &_pos, LocationConfig &locConfig)
     return 1;
 }
 
+int Parser::fastcgi_pass_parse(int &_pos, LocationConfig &locConfig)
+{
+    if (_pos + 1 >= (int)_tokens.size())
+    {
+        error_msg(4);
+        return 0;
+    }
+    _pos++;
+    if (_tokens[_pos].type == WORD)
+    {
+        locConfig.fastcgiPass = _tokens[_pos].value;
+        _pos++;
+        if (_tokens[_pos].type == SEMICOLON)
+            _pos++;
+        else
+        {
+            error_msg(2);
+            return 0;
+        }
+    }
+    else
+    {
+        error_msg(4);
+        return 0;
+    }
+    return 1;
+}
+
+int Parser::cgi_cgroup_parse(int &_pos, LocationConfig &locConfig)
+{
+    if (_pos + 1 >= (int)_tokens.size())
+    {
+        error_msg(4);
+        return 0;
+    }
+    _pos++;
+    if (_tokens[_pos].type == WORD)
+    {
+        locConfig.cgiCgroup = _tokens[_pos].value;
+        _pos++;
+        if (_tokens[_pos].type == SEMICOLON)
+            _pos++;
+        else
+        {
+            error_msg(2);
+            return 0;
+        }
+    }
+    else
+    {
+        error_msg(4);
+        return 0;
+    }
+    return 1;
+}
+
+// http://host[:port][/path] -> "host:port" (port 80 if none), "/path", and the
+// address looked up once here so that no request waits on the resolver
+static bool resolve_proxy_pass(LocationConfig &locConfig)
+{
+    std::string rest = locConfig.proxyPass.substr(7);
+    std::string::size_type slash = rest.find('/');
+    std::string address = rest.substr(0, slash);
+    locConfig.proxyPath = (slash == std::string::npos) ? "" : rest.substr(slash);
+    std::string::size_type colon = address.rfind(':');
+    std::string::size_type bracket = address.rfind(']');
+    if (colon == std::string::npos || (bracket != std::string::npos && colon < bracket))
+    {
+        address += ":80";
+        colon = address.rfind(':');
+    }
+    locConfig.proxyAddress = address;
+
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+        host = host.substr(1, host.size() - 2);
+
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (rc != 0 || !res)
+    {
+        std::cerr << "Config Error: proxy_pass " << locConfig.proxyPass << ": "
+                  << (rc != 0 ? gai_strerror(rc) : "no address") << std::endl;
+        return false;
+    }
+    std::memcpy(&locConfig.proxyAddr, res->ai_addr, res->ai_addrlen);
+    locConfig.proxyAddrLen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+// only plain http:// upstreams (with a port, or 80)
+int Parser::proxy_pass_parse(int &_pos, LocationConfig &locConfig)
+{
+    if (_pos + 1 >= (int)_tokens.size())
+    {
+        error_msg(4);
+        return 0;
+    }
+    _pos++;
+    if (_tokens[_pos].type == WORD && _tokens[_pos].value.compare(0, 7, "http://") == 0
+        && _tokens[_pos].value.size() > 7)
+    {
+        locConfig.proxyPass = _tokens[_pos].value;
+        if (!resolve_proxy_pass(locConfig))
+        {
+            _fatal = true;
+            skip_directive(_pos);
+            return 0;
+        }
+        _pos++;
+        if (_tokens[_pos].type == SEMICOLON)
+            _pos++;
+        else
+        {
+            error_msg(2);
+            return 0;
+        }
+    }
+    else
+    {
+        error_msg(4);
+        return 0;
+    }
+    return 1;
+}
+
 int Parser::location_root_parse(int &_pos, LocationConfig &locConfig)
 {
     if (_pos + 1 >= (int)_tokens.size())
@@ -245,7 +516,9 @@ LocationConfig Parser::location_parse(int &_pos)
 
         const std::string &key = _tokens[_pos].value;
 
-        if (key == "autoindex" || key == "upload_enable")
+        if (key == "autoindex" || key == "upload_enable"
+            || key == "gzip_static" || key == "br_static" || key == "gzip" || key == "cgi_collapse"
+            || key == "cgi_cache_cookies" || key == "internal" || key == "metrics")
         {
             if (!uploadEnable_and_autoindex_parse(_pos, locConfig))
                 return locConfig;
@@ -270,11 +543,42 @@ LocationConfig Parser::location_parse(int &_pos)
             if (!cgi_extension_parse(_pos, locConfig))
                 return locConfig;
         }
+        else if (key == "fastcgi_pass")
+        {
+            if (!fastcgi_pass_parse(_pos, locConfig))
+                return locConfig;
+        }
+        else if (key == "cgi_cgroup")
+        {
+            if (!cgi_cgroup_parse(_pos, locConfig))
+                return locConfig;
+        }
+        else if (key == "proxy_pass")
+        {
+            if (!proxy_pass_parse(_pos, locConfig))
+                return locConfig;
+        }
         else if (key == "root")
         {
             if (!location_root_parse(_pos, locConfig))
                 return locConfig;
         }
+        else if (key == "gzip_types")
+        {
+            if (!gzip_types_parse(_pos, locConfig))
+                return locConfig;
+        }
+        else if (key == "gzip_comp_level" || key == "gzip_min_length" || key == "gzip_max_length"
+                 || key == "autoindex_per_page" || key == "cgi_timeout" || key == "cgi_max_concurrent"
+                 || key == "cgi_queue_size" || key == "cgi_queue_timeout" || key == "cgi_cache"
+                 || key == "cgi_cache_stale" || key == "cgi_buffer_size"
+                 || key == "cgi_body_file" || key == "cgi_cpu_limit" || key == "cgi_memory_limit"
+                 || key == "cgi_nice" || key == "proxy_connect_timeout" || key == "proxy_read_timeout"
+                 || key == "slow_request_log")
+        {
+            if (!location_numbers_parse(_pos, locConfig))
+                return locConfig;
+        }
         else
         {
             std::cerr << "Warning: Unknown location directive '" << key 
@@ -24,10 +24,27 @@ int Parser::port_and_clientMaxBodySize_parse(int &_pos, ServerConfig &serverConf
     {
         if (_tokens[_pos - 1].value == "client_max_body_size")
             serverConfig.client_Max_Body_Size = atoi(_tokens[_pos].value.c_str());
+        else if (_tokens[_pos - 1].value == "gzip_cache_size")
+            serverConfig.gzipCacheSize = (size_t)atol(_tokens[_pos].value.c_str());
+        else if (_tokens[_pos - 1].value == "ssl_session_cache")
+            serverConfig.sslSessionCache = (size_t)atol(_tokens[_pos].value.c_str());
+        else if (_tokens[_pos - 1].value == "ssl_session_timeout")
+            serverConfig.sslSessionTimeout = atoi(_tokens[_pos].value.c_str());
         else if (_tokens[_pos - 1].value == "listen")
         {
             serverConfig.port = atoi(_tokens[_pos].value.c_str());
             serverConfig.listen_line = _tokens[_pos].line;  // <-- add this
+            // listen 443 ssl;
+            if (_pos + 1 < (int)_tokens.size() && _tokens[_pos + 1].type == WORD)
+            {
+                if (_tokens[_pos + 1].value != "ssl")
+                {
+                    error_msg(4);
+                    return 0;
+                }
+                serverConfig.ssl = true;
+                _pos++;
+            }
         }
         _pos++;
         if (_tokens[_pos].type == SEMICOLON)
@@ -106,6 +123,85 @@ int Parser::server_name_parse(int &_pos, ServerConfig &serverConfig)
     return 1;
 }
 
+// ssl_certificate <pem>; ssl_certificate_key <pem>; ssl_session_tickets on|off;
+int Parser::ssl_parse(int &_pos, ServerConfig &serverConfig)
+{
+    if (_pos + 1 >= (int)_tokens.size())
+    {
+        error_msg(4);
+        return 0;
+    }
+    _pos++;
+    if (_tokens[_pos].type == WORD)
+    {
+        const std::string &key = _tokens[_pos - 1].value;
+        const std::string &value = _tokens[_pos].value;
+        if (key == "ssl_certificate")
+            serverConfig.sslCertificate = value;
+        else if (key == "ssl_certificate_key")
+            serverConfig.sslCertificateKey = value;
+        else if (value == "on" || value == "off")
+            serverConfig.sslSessionTickets = (value == "on");
+        else
+        {
+            error_msg(4);
+            return 0;
+        }
+        _pos++;
+        if (_tokens[_pos].type == SEMICOLON)
+            _pos++;
+        else
+        {
+            error_msg(2);
+            return 0;
+        }
+    }
+    else
+    {
+        error_msg(4);
+        return 0;
+    }
+    return 1;
+}
+
+// access_log <file> [combined|json]; access_log off;
+int Parser::access_log_parse(int &_pos, ServerConfig &serverConfig)
+{
+    if (_pos + 1 >= (int)_tokens.size())
+    {
+        error_msg(4);
+        return 0;
+    }
+    _pos++;
+    if (_tokens[_pos].type != WORD)
+    {
+        error_msg(4);
+        return 0;
+    }
+    serverConfig.accessLog = _tokens[_pos].value == "off" ? "" : _tokens[_pos].value;
+    serverConfig.accessLogJson = false;
+    _pos++;
+    if (_pos < (int)_tokens.size() && _tokens[_pos].type == WORD)
+    {
+        if (_tokens[_pos].value == "json")
+            serverConfig.accessLogJson = true;
+        else if (_tokens[_pos].value != "combined")
+        {
+            error_msg(4);
+            return 0;
+        }
+        _pos++;
+    }
+    if (_pos < (int)_tokens.size() && _tokens[_pos].type == SEMICOLON)
+        _pos++;
+    else
+    {
+        error_msg(2);
+        return 0;
+    }
+    return 1;
+}
+
 int Parser::error_page_parse(int &_pos, ServerConfig &serverConfig)
 {
     if (_pos + 1 >= (int)_tokens.size())
@@ -145,6 +241,58 @@ int Parser::error_page_parse(int &_pos, ServerConfig &serverConfig)
     return 1;
 }
 
+// types {
+//     image/svg+xml  svg svgz;
+//     font/woff2     woff2;
+// }
+int Parser::types_parse(int &_pos, ServerConfig &serverConfig)
+{
+    _pos++;
+    if (_pos >= (int)_tokens.size() || _tokens[_pos].type != L_BRACE)
+    {
+        error_msg(3);
+        return 0;
+    }
+    _pos++;
+    while (_pos < (int)_tokens.size() && _tokens[_pos].type != R_BRACE)
+    {
+        if (_tokens[_pos].type != WORD)
+        {
+            error_msg(4);
+            return 0;
+        }
+        std::string mime = _tokens[_pos].value;
+        _pos++;
+        if (_pos >= (int)_tokens.size() || _tokens[_pos].type != WORD)
+        {
+            error_msg(4);
+            return 0;
+        }
+        while (_pos < (int)_tokens.size() && _tokens[_pos].type == WORD)
+        {
+            std::string ext = _tokens[_pos].value;
+            if (!ext.empty() && ext[0] == '.')
+                ext.erase(0, 1);
+            serverConfig.mimeTypes[ext] = mime;
+            _pos++;
+        }
+        if (_pos < (int)_tokens.size() && _tokens[_pos].type == SEMICOLON)
+            _pos++;
+        else
+        {
+            error_msg(2);
+            return 0;
+        }
+    }
+    if (_pos >= (int)_tokens.size())
+    {
+        error_msg(3);
+        return 0;
+    }
+    _pos++;
+    return 1;
+}
+
 ServerConfig Parser::server_parse(int &_pos)
 {
     ServerConfig serverConfig;
@@ -174,7 +322,8 @@ ServerConfig Parser::server_parse(int &_pos)
             serverConfig.locations.push_back(loc);
             continue;
         }
-        else if (key == "listen" || key == "client_max_body_size")
+        else if (key == "listen" || key == "client_max_body_size" || key == "gzip_cache_size"
+                 || key == "ssl_session_cache" || key == "ssl_session_timeout")
         {
             if (!port_and_clientMaxBodySize_parse(_pos, serverConfig))
                 skip_directive(_pos);
@@ -189,11 +338,26 @@ ServerConfig Parser::server_parse(int &_pos)
             if (!server_name_parse(_pos, serverConfig))
                 skip_directive(_pos);
         }
+        else if (key == "ssl_certificate" || key == "ssl_certificate_key" || key == "ssl_session_tickets")
+        {
+            if (!ssl_parse(_pos, serverConfig))
+                skip_directive(_pos);
+        }
+        else if (key == "access_log")
+        {
+            if (!access_log_parse(_pos, serverConfig))
+                skip_directive(_pos);
+        }
         else if (key == "error_page")
         {
             if (!error_page_parse(_pos, serverConfig))
                 skip_directive(_pos);
         }
+        else if (key == "types")
+        {
+            if (!types_parse(_pos, serverConfig))
+                return serverConfig;
+        }
         else
         {
             std::cerr << "Warning: Unknown server directive '" << key
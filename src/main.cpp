@@ -18,6 +18,7 @@
 #include <fstream>
 #include <sstream>
 #include "sockets/PollReactor.hpp"
+#include "sockets/AccessLog.hpp"
 #include "RouterByteHandler.hpp"
 #include "config_headers/Tokenizer.hpp"
 #include "config_headers/Parser.hpp"
@@ -31,11 +32,21 @@
 #define DEFAULT_MAX_BODY_BYTES (1024ul * 1024ul * 1024ul + 1024ul * 1024ul)
 
 static volatile sig_atomic_t g_stop = 0;
+static volatile sig_atomic_t g_reload = 0;
+static volatile sig_atomic_t g_reopen = 0;
 
 static void onSignal(int) {
     g_stop = 1;
 }
 
+static void onReload(int) {
+    g_reload = 1;
+}
+
+static void onReopen(int) {
+    g_reopen = 1;
+}
+
 static size_t extractMaxBodyBytes(const Config& cfg) {
 
     size_t mx = DEFAULT_MAX_BODY_BYTES;
@@ -75,6 +86,34 @@ static std::string intToString(int n) {
     return ss.str();
 }
 
+// one context per `listen ... ssl` port (and server_name on it): a bad
+// certificate stops the start like a bad config does
+static void extractTls(const Config& cfg, TlsContexts& tls) {
+    for (size_t i = 0; i < cfg.servers.size(); ++i) {
+        const ServerConfig& srv = cfg.servers[i];
+        if (!srv.ssl) continue;
+        TlsSettings s;
+        s.certificate = srv.sslCertificate;
+        s.certificateKey = srv.sslCertificateKey;
+        s.sessionCache = srv.sslSessionCache;
+        s.sessionTimeout = srv.sslSessionTimeout;
+        s.sessionTickets = srv.sslSessionTickets;
+        std::string err;
+        if (!tls.addServer(srv.port, srv.server_name, s, err))
+            throw std::runtime_error("TLS on port " + intToString(srv.port) + ": " + err);
+    }
+}
+
+// access_log files are opened up front: one that cannot be written stops the start
+static void openAccessLogs(const Config& cfg) {
+    for (size_t i = 0; i < cfg.servers.size(); ++i) {
+        if (cfg.servers[i].accessLog.empty()) continue;
+        std::string err;
+        if (!access_log().open(cfg.servers[i].accessLog, err))
+            throw std::runtime_error("access_log " + err);
+    }
+}
+
 static std::vector<int> extractListenPorts(const Config& cfg) {
     std::set<int> uniq;
     for (size_t i = 0; i < cfg.servers.size(); ++i) {
@@ -90,6 +129,8 @@ int main(int ac, char** av) {
     signal(SIGPIPE, SIG_IGN);
     signal(SIGINT, onSignal);
     signal(SIGTERM, onSignal);
+    signal(SIGHUP, onReload);
+    signal(SIGUSR1, onReopen);
 
     const char* confPath = (ac >= 2) ? av[1] : "webserv.conf";
     if (ac > 2) {
@@ -105,10 +146,27 @@ int main(int ac, char** av) {
         std::vector<int> ports = extractListenPorts(cfg);
         RouterByteHandler handler(confPath);
         size_t maxBody = extractMaxBodyBytes(cfg);
+        TlsContexts tls;
+        extractTls(cfg, tls);
+        openAccessLogs(cfg);
 
         PollReactor reactor(ports, DEFAULT_BACKLOG, DEFAULT_IDLE_TIMEOUT, DEFAULT_HEADER_TIMEOUT, DEFAULT_BODY_TIMEOUT, DEFAULT_MAX_HEADER_BYTES, maxBody, &handler);
+        reactor.enableTls(tls);
         
-        while (!g_stop) reactor.tickOnce();
+        while (!g_stop) {
+            if (g_reload) {
+                g_reload = 0;
+                if (handler.reloadConfig()) std::cout << "Configuration reloaded\n";
+                else std::cerr << "Configuration reload failed, keeping previous config\n";
+            }
+            if (g_reopen) {
+                g_reopen = 0;
+                access_log().reopen();
+                std::cout << "Access logs reopened\n";
+            }
+            reactor.tickOnce();
+        }
+        access_log().flushAll();
     } catch (const std::exception& e) {
         std::cerr << "Fatal: " << e.what() << "\n";
         return 1;
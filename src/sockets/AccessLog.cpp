@@ -0,0 +1,323 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   AccessLog.cpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 19:05:27 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 19:05:27 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/sockets/AccessLog.hpp"
+#include "../../include/sockets/ServerMetrics.hpp"
+#include "../../include/sockets/NetUtil.hpp"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+
+static std::string secondsStr(long long us)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%lld.%03lld", us / 1000000LL, (us % 1000000LL) / 1000);
+    return buf;
+}
+
+// like nginx: quotes, backslashes and anything unprintable as \xHH
+static void appendCombined(std::string& out, const std::string& s)
+{
+    if (s.empty())
+    {
+        out += '-';
+        return;
+    }
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x7f)
+        {
+            char hex[8];
+            std::snprintf(hex, sizeof(hex), "\\x%02X", c);
+            out += hex;
+        }
+        else
+            out += (char)c;
+    }
+}
+
+// request lines and headers are not always UTF-8: anything past ASCII is
+// escaped too, so every line stays valid JSON
+static void appendJson(std::string& out, const std::string& s)
+{
+    out += '"';
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += (char)c;
+        }
+        else if (c < 0x20 || c >= 0x7f)
+        {
+            char hex[8];
+            std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+            out += hex;
+        }
+        else
+            out += (char)c;
+    }
+    out += '"';
+}
+
+AccessLog::AccessLog()
+: _sinks(), _dirty(false), _lastFlushUs(0), _stampSec(0), _stampLocal(), _stampIso()
+{}
+
+AccessLog::~AccessLog()
+{
+    flushAll();
+    for (std::map<std::string, Sink>::iterator it = _sinks.begin(); it != _sinks.end(); ++it)
+        closeFd(it->second.fd);
+}
+
+AccessLog& access_log()
+{
+    static AccessLog log;
+    return log;
+}
+
+bool AccessLog::open(const std::string& path, std::string& err)
+{
+    std::map<std::string, Sink>::iterator it = _sinks.find(path);
+    if (it != _sinks.end() && it->second.fd >= 0)
+        return true;
+    Sink& s = _sinks[path];
+    s.path = path;
+    s.ring.resize(ACCESS_LOG_BUFFER);
+    s.failed = true;    // reported by the caller, not here
+    if (openSink(s))
+        return true;
+    err = path + ": " + std::strerror(errno);
+    _sinks.erase(path);
+    return false;
+}
+
+// opened on first use (a path that only appears after a reload)
+AccessLog::Sink& AccessLog::sinkFor(const std::string& path)
+{
+    std::map<std::string, Sink>::iterator it = _sinks.find(path);
+    if (it != _sinks.end())
+        return it->second;
+    Sink& s = _sinks[path];
+    s.path = path;
+    s.ring.resize(ACCESS_LOG_BUFFER);
+    openSink(s);
+    return s;
+}
+
+// O_NONBLOCK at open so that a fifo without a reader fails instead of
+// hanging; it is only kept where writes honour it (a fifo, a socket)
+bool AccessLog::openSink(Sink& s)
+{
+    s.fd = ::open(s.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC, 0644);
+    if (s.fd >= 0)
+    {
+        struct stat st;
+        if (fstat(s.fd, &st) == 0 && S_ISREG(st.st_mode))
+            fcntl(s.fd, F_SETFL, fcntl(s.fd, F_GETFL) & ~O_NONBLOCK);
+        s.failed = false;
+        return true;
+    }
+    if (!s.failed)
+        std::cerr << "access_log " << s.path << ": " << std::strerror(errno) << std::endl;
+    s.failed = true;
+    return false;
+}
+
+void AccessLog::refreshStamps()
+{
+    std::time_t now = std::time(NULL);
+    if (now == _stampSec)
+        return;
+    _stampSec = now;
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char buf[64];
+    std::strftime(buf, sizeof(buf), "%d/%b/%Y:%H:%M:%S %z", &tm);
+    _stampLocal = buf;
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S%z", &tm);
+    _stampIso = buf;
+}
+
+void AccessLog::record(const NetChannel::RequestTrace& t, int status, long long totalUs,
+                       const long long* phaseUs, const std::string& peer)
+{
+    refreshStamps();
+    std::string line;
+    line.reserve(256 + t.requestLine.size() + t.userAgent.size());
+    char num[32];
+
+    if (t.accessLogJson)
+    {
+        line += "{\"time\":";
+        appendJson(line, _stampIso);
+        line += ",\"remote_addr\":";
+        appendJson(line, peer);
+        line += ",\"server\":";
+        appendJson(line, t.server);
+        line += ",\"location\":";
+        appendJson(line, t.location);
+        line += ",\"request\":";
+        appendJson(line, t.requestLine);
+        std::snprintf(num, sizeof(num), "%d", status);
+        line += ",\"status\":";
+        line += num;
+        std::snprintf(num, sizeof(num), "%lu", (unsigned long)t.bytesIn);
+        line += ",\"bytes_received\":";
+        line += num;
+        std::snprintf(num, sizeof(num), "%lu", (unsigned long)t.bytesOut);
+        line += ",\"bytes_sent\":";
+        line += num;
+        line += ",\"referer\":";
+        appendJson(line, t.referer);
+        line += ",\"user_agent\":";
+        appendJson(line, t.userAgent);
+        line += ",\"request_time\":";
+        line += secondsStr(totalUs);
+        line += ",\"phases\":{";
+        for (int i = 0; i < REQ_PHASES; ++i)
+        {
+            if (i)
+                line += ',';
+            line += '"';
+            line += request_phase_name(i);
+            line += "\":";
+            line += secondsStr(phaseUs[i]);
+        }
+        line += "}}\n";
+    }
+    else
+    {
+        line += peer;
+        line += " - - [";
+        line += _stampLocal;
+        line += "] \"";
+        appendCombined(line, t.requestLine);
+        std::snprintf(num, sizeof(num), "\" %d %lu \"", status, (unsigned long)t.bytesOut);
+        line += num;
+        appendCombined(line, t.referer);
+        line += "\" \"";
+        appendCombined(line, t.userAgent);
+        line += "\" rt=";
+        line += secondsStr(totalUs);
+        for (int i = 0; i < REQ_PHASES; ++i)
+        {
+            line += ' ';
+            line += request_phase_name(i);
+            line += '=';
+            line += secondsStr(phaseUs[i]);
+        }
+        line += '\n';
+    }
+
+    Sink& s = sinkFor(t.accessLog);
+    append(s, line);
+    if (s.used >= s.ring.size() / 2)
+        flush(s);
+}
+
+void AccessLog::append(Sink& s, const std::string& line)
+{
+    size_t cap = s.ring.size();
+    if (line.size() > cap - s.used)
+    {
+        ++server_metrics().accessLogDropped;
+        return;
+    }
+    size_t tail = (s.head + s.used) % cap;
+    size_t first = line.size() < cap - tail ? line.size() : cap - tail;
+    std::memcpy(&s.ring[tail], line.data(), first);
+    if (first < line.size())
+        std::memcpy(&s.ring[0], line.data() + first, line.size() - first);
+    s.used += line.size();
+    _dirty = true;
+}
+
+// one writev of everything buffered; what it does not take (a full disk, a
+// fifo nobody reads) waits for the next one. On a regular file this waits
+// for the disk, on the reactor thread.
+void AccessLog::flush(Sink& s)
+{
+    if (s.used == 0)
+        return;
+    if (s.fd < 0 && !openSink(s))
+        return;
+
+    size_t cap = s.ring.size();
+    size_t first = s.used < cap - s.head ? s.used : cap - s.head;
+    struct iovec iov[2];
+    iov[0].iov_base = &s.ring[s.head];
+    iov[0].iov_len = first;
+    iov[1].iov_base = &s.ring[0];
+    iov[1].iov_len = s.used - first;
+
+    ssize_t n = writev(s.fd, iov, iov[1].iov_len ? 2 : 1);
+    if (n > 0)
+    {
+        s.head = (s.head + (size_t)n) % cap;
+        s.used -= (size_t)n;
+        if (s.used == 0)
+            s.head = 0;
+        s.failed = false;
+        return;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && !s.failed)
+    {
+        std::cerr << "access_log " << s.path << ": " << std::strerror(errno) << std::endl;
+        s.failed = true;
+    }
+}
+
+void AccessLog::pump()
+{
+    if (!_dirty)
+        return;
+    long long now = metrics_now_us();
+    if (now - _lastFlushUs < ACCESS_LOG_FLUSH_MS * 1000LL)
+        return;
+    _lastFlushUs = now;
+    flushAll();
+}
+
+void AccessLog::flushAll()
+{
+    _dirty = false;
+    for (std::map<std::string, Sink>::iterator it = _sinks.begin(); it != _sinks.end(); ++it)
+    {
+        flush(it->second);
+        if (it->second.used > 0)
+            _dirty = true;
+    }
+}
+
+// the old files were renamed away: what is buffered still goes to them,
+// the next lines to new files under the configured names
+void AccessLog::reopen()
+{
+    for (std::map<std::string, Sink>::iterator it = _sinks.begin(); it != _sinks.end(); ++it)
+    {
+        Sink& s = it->second;
+        flush(s);
+        closeFd(s.fd);
+        s.fd = -1;
+        s.failed = false;
+        openSink(s);
+    }
+}
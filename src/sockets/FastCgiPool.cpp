@@ -0,0 +1,546 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FastCgiPool.cpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/02/14 11:03:41 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/02/14 11:03:41 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/sockets/FastCgiPool.hpp"
+#include "../../include/sockets/NetUtil.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// record types (FastCGI 1.0)
+#define FCGI_BEGIN_REQUEST      1
+#define FCGI_ABORT_REQUEST      2
+#define FCGI_END_REQUEST        3
+#define FCGI_PARAMS             4
+#define FCGI_STDIN              5
+#define FCGI_STDOUT             6
+#define FCGI_STDERR             7
+#define FCGI_GET_VALUES         9
+#define FCGI_GET_VALUES_RESULT  10
+
+#define FCGI_RESPONDER          1
+#define FCGI_KEEP_CONN          1
+#define FCGI_CANT_MPX_CONN      1
+
+#define FCGI_HEADER_LEN         8
+#define FCGI_STREAM_CHUNK       32768
+
+static void put_record(std::string& out, unsigned char type, unsigned short id,
+                       const char* data, size_t len)
+{
+    unsigned char pad = (unsigned char)((8 - (len % 8)) % 8);
+    char h[FCGI_HEADER_LEN];
+    h[0] = 1;
+    h[1] = (char)type;
+    h[2] = (char)(id >> 8);
+    h[3] = (char)(id & 0xff);
+    h[4] = (char)((len >> 8) & 0xff);
+    h[5] = (char)(len & 0xff);
+    h[6] = (char)pad;
+    h[7] = 0;
+    out.append(h, FCGI_HEADER_LEN);
+    if (len)
+        out.append(data, len);
+    out.append((size_t)pad, '\0');
+}
+
+// a stream is any number of records, closed by an empty one
+static void put_stream(std::string& out, unsigned char type, unsigned short id, const std::string& data)
+{
+    for (size_t off = 0; off < data.size(); off += FCGI_STREAM_CHUNK)
+    {
+        size_t len = data.size() - off;
+        if (len > FCGI_STREAM_CHUNK)
+            len = FCGI_STREAM_CHUNK;
+        put_record(out, type, id, data.data() + off, len);
+    }
+    put_record(out, type, id, NULL, 0);
+}
+
+static void put_length(std::string& out, size_t len)
+{
+    if (len < 128)
+    {
+        out += (char)len;
+        return;
+    }
+    out += (char)(((len >> 24) & 0x7f) | 0x80);
+    out += (char)((len >> 16) & 0xff);
+    out += (char)((len >> 8) & 0xff);
+    out += (char)(len & 0xff);
+}
+
+static void put_pair(std::string& out, const std::string& name, const std::string& value)
+{
+    put_length(out, name.size());
+    put_length(out, value.size());
+    out += name;
+    out += value;
+}
+
+static bool get_length(const std::string& in, size_t& pos, size_t& len)
+{
+    if (pos >= in.size())
+        return false;
+    unsigned char b = (unsigned char)in[pos];
+    if (b < 128)
+    {
+        len = b;
+        pos += 1;
+        return true;
+    }
+    if (pos + 4 > in.size())
+        return false;
+    len = ((size_t)(b & 0x7f) << 24) | ((size_t)(unsigned char)in[pos + 1] << 16)
+        | ((size_t)(unsigned char)in[pos + 2] << 8) | (size_t)(unsigned char)in[pos + 3];
+    pos += 4;
+    return true;
+}
+
+FastCgiPool::FastCgiPool()
+: _conns()
+, _pending()
+, _byClient()
+, _pollChanges()
+, _events()
+{}
+
+FastCgiPool::~FastCgiPool()
+{
+    for (std::map<int, Conn>::iterator it = _conns.begin(); it != _conns.end(); ++it)
+        closeFd(it->first);
+}
+
+void FastCgiPool::submit(int clientFd,
+                         const std::string& address,
+                         const std::vector<std::string>& params,
+                         const std::string& body)
+{
+    if (_pending.size() >= FCGI_MAX_PENDING)
+    {
+        emit(clientFd, FcgiEvent::BUSY, "");
+        return;
+    }
+
+    Job job;
+    job.clientFd = clientFd;
+    job.address = address;
+    job.body = body;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        std::string::size_type eq = params[i].find('=');
+        if (eq == std::string::npos)
+            put_pair(job.params, params[i], "");
+        else
+            put_pair(job.params, params[i].substr(0, eq), params[i].substr(eq + 1));
+    }
+    _pending.push_back(job);
+    dispatch();
+}
+
+// The request id stays busy until the app confirms with END_REQUEST;
+// anything it still sends for that id is dropped.
+void FastCgiPool::abort(int clientFd)
+{
+    for (std::deque<Job>::iterator it = _pending.begin(); it != _pending.end(); ++it)
+    {
+        if (it->clientFd == clientFd)
+        {
+            _pending.erase(it);
+            return;
+        }
+    }
+
+    std::map<int, std::pair<int, unsigned short> >::iterator b = _byClient.find(clientFd);
+    if (b == _byClient.end())
+        return;
+    std::map<int, Conn>::iterator c = _conns.find(b->second.first);
+    if (c != _conns.end())
+    {
+        std::map<unsigned short, Job>::iterator r = c->second.reqs.find(b->second.second);
+        if (r != c->second.reqs.end())
+        {
+            r->second.orphan = true;
+            put_record(c->second.wbuf, FCGI_ABORT_REQUEST, r->first, NULL, 0);
+            updateInterest(c->second);
+        }
+    }
+    _byClient.erase(b);
+}
+
+void FastCgiPool::pause(int clientFd, bool paused)
+{
+    std::map<int, std::pair<int, unsigned short> >::iterator b = _byClient.find(clientFd);
+    if (b == _byClient.end())
+        return;
+    std::map<int, Conn>::iterator c = _conns.find(b->second.first);
+    if (c == _conns.end())
+        return;
+    std::map<unsigned short, Job>::iterator r = c->second.reqs.find(b->second.second);
+    if (r == c->second.reqs.end())
+        return;
+    r->second.paused = paused;
+    updateInterest(c->second);
+}
+
+bool FastCgiPool::owns(int fd) const
+{
+    return _conns.find(fd) != _conns.end();
+}
+
+void FastCgiPool::takePollChanges(std::vector<std::pair<int, short> >& out)
+{
+    out.swap(_pollChanges);
+    _pollChanges.clear();
+}
+
+void FastCgiPool::takeEvents(std::vector<FcgiEvent>& out)
+{
+    out.swap(_events);
+    _events.clear();
+}
+
+void FastCgiPool::emit(int clientFd, FcgiEvent::Kind kind, const std::string& data)
+{
+    if (kind == FcgiEvent::DATA && !_events.empty() &&
+        _events.back().clientFd == clientFd && _events.back().kind == FcgiEvent::DATA)
+    {
+        _events.back().data += data;
+        return;
+    }
+    FcgiEvent ev;
+    ev.clientFd = clientFd;
+    ev.kind = kind;
+    ev.data = data;
+    _events.push_back(ev);
+}
+
+// queued jobs go out in arrival order as connections free up
+void FastCgiPool::dispatch()
+{
+    size_t n = _pending.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        Job job = _pending.front();
+        _pending.pop_front();
+        if (!assign(job))
+            _pending.push_back(job);
+    }
+}
+
+// least loaded connection with room, else a new one while under the cap
+bool FastCgiPool::assign(Job& job)
+{
+    Conn*  best = NULL;
+    size_t count = 0;
+    for (std::map<int, Conn>::iterator it = _conns.begin(); it != _conns.end(); ++it)
+    {
+        Conn& c = it->second;
+        if (c.address != job.address)
+            continue;
+        count++;
+        if (c.reqs.size() >= c.maxReqs)
+            continue;
+        if (!best || c.reqs.size() < best->reqs.size())
+            best = &c;
+    }
+    if (best)
+    {
+        startRequest(*best, job);
+        return true;
+    }
+    if (count >= FCGI_MAX_CONNS)
+        return false;
+
+    int fd = openConn(job.address);
+    if (fd < 0)
+    {
+        emit(job.clientFd, FcgiEvent::FAIL, "");
+        return true;
+    }
+    startRequest(_conns[fd], job);
+    return true;
+}
+
+int FastCgiPool::openConn(const std::string& address)
+{
+    int fd = -1;
+    int rc = -1;
+
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        struct sockaddr_un sun;
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(sun.sun_path))
+            return -1;
+        std::memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        std::memcpy(sun.sun_path, path.c_str(), path.size());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        makeNonBlocking(fd);
+        rc = connect(fd, (struct sockaddr*)&sun, sizeof(sun));
+    }
+    else
+    {
+        std::string::size_type colon = address.rfind(':');
+        if (colon == std::string::npos || colon == 0)
+            return -1;
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+
+        struct addrinfo hints;
+        struct addrinfo* res = NULL;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res)
+            return -1;
+        fd = socket(res->ai_family, SOCK_STREAM, 0);
+        if (fd >= 0)
+        {
+            makeNonBlocking(fd);
+            rc = connect(fd, res->ai_addr, res->ai_addrlen);
+        }
+        freeaddrinfo(res);
+        if (fd < 0)
+            return -1;
+    }
+
+    if (rc < 0 && errno != EINPROGRESS)
+    {
+        closeFd(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    Conn& c = _conns[fd];
+    c.fd = fd;
+    c.address = address;
+    c.connecting = (rc < 0);
+
+    // ask whether the app multiplexes; until it answers, one request at a time
+    std::string q;
+    put_pair(q, "FCGI_MPXS_CONNS", "");
+    put_record(c.wbuf, FCGI_GET_VALUES, 0, q.data(), q.size());
+    updateInterest(c);
+    return fd;
+}
+
+void FastCgiPool::startRequest(Conn& c, const Job& job)
+{
+    unsigned short id = c.nextId;
+    while (id == 0 || c.reqs.find(id) != c.reqs.end())
+        id++;
+    c.nextId = (unsigned short)(id + 1);
+
+    c.reqs[id] = job;
+    _byClient[job.clientFd] = std::make_pair(c.fd, id);
+
+    char begin[8];
+    std::memset(begin, 0, sizeof(begin));
+    begin[1] = FCGI_RESPONDER;
+    begin[2] = FCGI_KEEP_CONN;
+    put_record(c.wbuf, FCGI_BEGIN_REQUEST, id, begin, sizeof(begin));
+    put_stream(c.wbuf, FCGI_PARAMS, id, job.params);
+    put_stream(c.wbuf, FCGI_STDIN, id, job.body);
+    updateInterest(c);
+}
+
+void FastCgiPool::parseRecords(Conn& c)
+{
+    size_t pos = 0;
+    while (c.rbuf.size() - pos >= FCGI_HEADER_LEN)
+    {
+        const unsigned char* h = (const unsigned char*)c.rbuf.data() + pos;
+        unsigned char  type = h[1];
+        unsigned short id = (unsigned short)((h[2] << 8) | h[3]);
+        size_t         len = ((size_t)h[4] << 8) | h[5];
+        size_t         total = FCGI_HEADER_LEN + len + h[6];
+        if (c.rbuf.size() - pos < total)
+            break;
+        std::string content = c.rbuf.substr(pos + FCGI_HEADER_LEN, len);
+        pos += total;
+
+        if (type == FCGI_GET_VALUES_RESULT)
+        {
+            size_t p = 0;
+            size_t nl, vl;
+            while (get_length(content, p, nl) && get_length(content, p, vl) && p + nl + vl <= content.size())
+            {
+                if (content.compare(p, nl, "FCGI_MPXS_CONNS") == 0 && content.compare(p + nl, vl, "1") == 0)
+                    c.maxReqs = FCGI_MAX_REQS_PER_CONN;
+                p += nl + vl;
+            }
+            continue;
+        }
+
+        std::map<unsigned short, Job>::iterator r = c.reqs.find(id);
+        if (r == c.reqs.end())
+            continue;
+        Job& job = r->second;
+
+        if (type == FCGI_STDOUT && !content.empty())
+        {
+            job.gotOutput = true;
+            if (!job.orphan)
+                emit(job.clientFd, FcgiEvent::DATA, content);
+        }
+        else if (type == FCGI_STDERR && !content.empty())
+            std::cerr << "fastcgi: " << content;
+        else if (type == FCGI_END_REQUEST)
+        {
+            unsigned char protocolStatus = (content.size() >= 5) ? (unsigned char)content[4] : 0;
+            if (!job.orphan)
+            {
+                _byClient.erase(job.clientFd);
+                if (protocolStatus == FCGI_CANT_MPX_CONN && !job.gotOutput)
+                {
+                    c.maxReqs = 1;
+                    _pending.push_front(job);
+                }
+                else if (protocolStatus != 0)
+                    emit(job.clientFd, FcgiEvent::FAIL, "");
+                else
+                    emit(job.clientFd, FcgiEvent::END, "");
+            }
+            c.reqs.erase(r);
+            c.reused = true;
+        }
+    }
+    c.rbuf.erase(0, pos);
+}
+
+// A connection that dies under requests fails them, except requests that got
+// no output yet on a reused connection: the app most likely closed it while
+// idle, so they are replayed once on a fresh one.
+void FastCgiPool::closeConn(int fd, bool failed)
+{
+    std::map<int, Conn>::iterator it = _conns.find(fd);
+    if (it == _conns.end())
+        return;
+    Conn& c = it->second;
+
+    for (std::map<unsigned short, Job>::iterator r = c.reqs.begin(); r != c.reqs.end(); ++r)
+    {
+        Job& job = r->second;
+        if (job.orphan)
+            continue;
+        _byClient.erase(job.clientFd);
+        if (failed && c.reused && !job.gotOutput && !job.retried)
+        {
+            job.retried = true;
+            _pending.push_front(job);
+        }
+        else
+            emit(job.clientFd, FcgiEvent::FAIL, "");
+    }
+
+    _pollChanges.push_back(std::make_pair(fd, (short)-1));
+    closeFd(fd);
+    _conns.erase(it);
+}
+
+void FastCgiPool::updateInterest(Conn& c)
+{
+    short want = POLLIN;
+    for (std::map<unsigned short, Job>::const_iterator r = c.reqs.begin(); r != c.reqs.end(); ++r)
+        if (r->second.paused && !r->second.orphan)
+            want = 0;
+    if (c.connecting || c.woff < c.wbuf.size())
+        want |= POLLOUT;
+    if (want != c.interest)
+    {
+        c.interest = want;
+        _pollChanges.push_back(std::make_pair(c.fd, want));
+    }
+}
+
+// a wakeup with nothing to read or no room to write: the connection is fine
+static bool retry_later(int err)
+{
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
+
+void FastCgiPool::onEvent(int fd, short revents)
+{
+    std::map<int, Conn>::iterator it = _conns.find(fd);
+    if (it == _conns.end())
+        return;
+
+    if (it->second.connecting)
+    {
+        if (!(revents & (POLLOUT | POLLERR | POLLHUP)))
+            return;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        {
+            closeConn(fd, false);
+            dispatch();
+            return;
+        }
+        it->second.connecting = false;
+    }
+
+    // a paused connection is still read on hangup/error, to fail its requests
+    if ((revents & (POLLHUP | POLLERR | POLLNVAL)) || ((it->second.interest & POLLIN) && (revents & POLLIN)))
+    {
+        char buf[65536];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0 || (n < 0 && !retry_later(errno)))
+        {
+            closeConn(fd, true);
+            dispatch();
+            return;
+        }
+        if (n > 0)
+        {
+            it->second.rbuf.append(buf, (size_t)n);
+            parseRecords(it->second);
+        }
+    }
+
+    Conn& c = it->second;
+    if ((revents & POLLOUT) && c.woff < c.wbuf.size())
+    {
+        ssize_t n = send(fd, c.wbuf.data() + c.woff, c.wbuf.size() - c.woff, 0);
+        if (n < 0 && !retry_later(errno))
+        {
+            closeConn(fd, true);
+            dispatch();
+            return;
+        }
+        if (n > 0)
+            c.woff += (size_t)n;
+        if (c.woff == c.wbuf.size())
+        {
+            c.wbuf.clear();
+            c.woff = 0;
+        }
+        else if (c.woff > 65536 && c.woff > c.wbuf.size() / 2)
+        {
+            c.wbuf.erase(0, c.woff);
+            c.woff = 0;
+        }
+    }
+    updateInterest(c);
+    dispatch();
+}
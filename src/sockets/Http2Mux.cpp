@@ -0,0 +1,1047 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Http2Mux.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 16:05:51 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 16:05:51 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/sockets/Http2Mux.hpp"
+#include "../../include/sockets/NetUtil.hpp"
+
+#include <sstream>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define H2_READ_CHUNK       16384
+#define H2_MAX_FRAME_SENT   65536               // DATA frame size we use at most
+#define H2_MAX_HEADER_BLOCK (256 * 1024)        // HEADERS + CONTINUATION
+
+#define H2_UPGRADE_REPLY "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n"
+
+static void setCloExec(int fd)
+{
+    int flags = fcntl(fd, F_GETFD);
+    if (flags >= 0)
+        fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+// "1a2b\r\n": the line in front of a chunk
+static std::string chunk_line(size_t n)
+{
+    std::ostringstream ss;
+    ss << std::hex << n << "\r\n";
+    return ss.str();
+}
+
+// hop-by-hop headers: meaningless (or forbidden) on the other side
+static bool connection_specific(const std::string& lname)
+{
+    return lname == "connection" || lname == "keep-alive" || lname == "proxy-connection"
+        || lname == "transfer-encoding" || lname == "upgrade" || lname == "te"
+        || lname == "http2-settings";
+}
+
+// no CR / LF / NUL may reach the HTTP/1 side
+static bool clean_field(const std::string& s)
+{
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '\r' || s[i] == '\n' || s[i] == '\0')
+            return false;
+    }
+    return true;
+}
+
+static bool base64url_decode(const std::string& in, std::string& out)
+{
+    unsigned int acc = 0;
+    int          bits = 0;
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        char c = in[i];
+        int v;
+        if (c >= 'A' && c <= 'Z')       v = c - 'A';
+        else if (c >= 'a' && c <= 'z')  v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')  v = c - '0' + 52;
+        else if (c == '-' || c == '+')  v = 62;
+        else if (c == '_' || c == '/')  v = 63;
+        else if (c == '=')              break;
+        else                            return false;
+        acc = (acc << 6) | (unsigned int)v;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out += (char)((acc >> bits) & 0xff);
+        }
+    }
+    return true;
+}
+
+Http2Mux::Http2Mux(size_t maxHeaderBytes, int idleTimeoutSec)
+: _conns()
+, _byStream()
+, _pollChanges()
+, _newStreams()
+, _maxHeaderBytes(maxHeaderBytes)
+, _idleTimeoutSec(idleTimeoutSec)
+{}
+
+Http2Mux::~Http2Mux()
+{
+    for (std::map<int, std::pair<int, unsigned int> >::iterator it = _byStream.begin(); it != _byStream.end(); ++it)
+        closeFd(it->first);
+    for (std::map<int, Conn>::iterator it = _conns.begin(); it != _conns.end(); ++it)
+        closeFd(it->first);
+}
+
+bool Http2Mux::owns(int fd) const
+{
+    return _conns.find(fd) != _conns.end() || _byStream.find(fd) != _byStream.end();
+}
+
+void Http2Mux::takePollChanges(std::vector<std::pair<int, short> >& out)
+{
+    out.swap(_pollChanges);
+    _pollChanges.clear();
+}
+
+void Http2Mux::takeStreams(std::vector<std::pair<int, int> >& out)
+{
+    out.swap(_newStreams);
+    _newStreams.clear();
+}
+
+// our SETTINGS and the connection window go out first
+Http2Mux::Conn& Http2Mux::open(int clientFd, int acceptFd)
+{
+    Conn& c = _conns[clientFd];
+    c.fd = clientFd;
+    c.acceptFd = acceptFd;
+    c.lastSeen = std::time(NULL);
+    c.interest = POLLIN;   // what the reactor had for it
+
+    http2::Settings s;
+    s.push_back(std::make_pair(H2_SET_MAX_CONCURRENT_STREAMS, (unsigned int)H2_MAX_STREAMS));
+    s.push_back(std::make_pair(H2_SET_INITIAL_WINDOW_SIZE, (unsigned int)H2_STREAM_WINDOW));
+    s.push_back(std::make_pair(H2_SET_MAX_HEADER_LIST_SIZE, (unsigned int)_maxHeaderBytes));
+    http2::appendSettings(c.wbuf, s);
+    http2::appendWindowUpdate(c.wbuf, 0, H2_CONN_WINDOW - H2_DEFAULT_WINDOW);
+    return c;
+}
+
+void Http2Mux::adopt(int clientFd, int acceptFd, const std::string& rx)
+{
+    Conn& c = open(clientFd, acceptFd);
+    c.rbuf = rx;
+    parseFrames(c);
+    if (writeConn(c))
+        updateInterest(c);
+}
+
+void Http2Mux::adoptUpgrade(int clientFd, int acceptFd, const std::string& request,
+                            const std::string& settings, const std::string& rx)
+{
+    Conn& c = open(clientFd, acceptFd);
+    c.wbuf.insert(0, H2_UPGRADE_REPLY);
+
+    // HTTP2-Settings: a SETTINGS payload, acknowledged by the 101 itself
+    std::string payload;
+    if (!base64url_decode(settings, payload) || !applySettings(c, payload))
+    {
+        closeConn(clientFd);
+        return;
+    }
+
+    // the request itself is stream 1, already complete, minus the upgrade headers
+    std::string head;
+    size_t pos = 0;
+    while (pos < request.size())
+    {
+        size_t eol = request.find("\r\n", pos);
+        if (eol == std::string::npos || eol == pos)
+            break;
+        std::string line = request.substr(pos, eol - pos);
+        pos = eol + 2;
+        size_t colon = line.find(':');
+        if (colon != std::string::npos && !head.empty()
+            && connection_specific(asciiLower(trimSpaces(line.substr(0, colon)))))
+            continue;
+        head += line + "\r\n";
+    }
+    c.lastStream = 1;
+    openStream(c, 1, head, request.compare(0, 5, "HEAD ") == 0, true, true);
+
+    c.rbuf = rx;
+    parseFrames(c);
+    if (writeConn(c))
+        updateInterest(c);
+}
+
+void Http2Mux::onEvent(int fd, short revents)
+{
+    std::map<int, Conn>::iterator it = _conns.find(fd);
+    if (it != _conns.end())
+    {
+        Conn& c = it->second;
+        if (revents & (POLLERR | POLLNVAL))
+        {
+            closeConn(fd);
+            return;
+        }
+        if ((revents & (POLLIN | POLLHUP)) && !readConn(c))
+            return;
+        if (writeConn(c))
+            updateInterest(c);
+        return;
+    }
+
+    std::map<int, std::pair<int, unsigned int> >::iterator st = _byStream.find(fd);
+    if (st == _byStream.end())
+        return;
+    Conn& c = _conns[st->second.first];
+    std::map<unsigned int, Stream>::iterator sit = c.streams.find(st->second.second);
+    if (sit == c.streams.end())
+        return;
+
+    if (revents & POLLOUT)
+        writeStream(c, sit->second);
+    if (revents & (POLLIN | POLLHUP | POLLERR))
+        readStream(c, sit->second);   // may close the stream
+    if (writeConn(c))
+        updateInterest(c);
+}
+
+// idle connections get a GOAWAY; one whose client stopped reading is dropped
+void Http2Mux::sweep(std::time_t now)
+{
+    if (_idleTimeoutSec <= 0)
+        return;
+    std::vector<int> late;
+    for (std::map<int, Conn>::iterator it = _conns.begin(); it != _conns.end(); ++it)
+    {
+        const Conn& c = it->second;
+        if ((now - c.lastSeen) <= _idleTimeoutSec)
+            continue;
+        if (c.streams.empty() || c.woff < c.wbuf.size())
+            late.push_back(it->first);
+    }
+    for (size_t i = 0; i < late.size(); ++i)
+    {
+        Conn& c = _conns[late[i]];
+        if (c.woff >= c.wbuf.size())
+        {
+            http2::appendGoaway(c.wbuf, c.lastStream, H2_NO_ERROR);
+            send(c.fd, c.wbuf.data() + c.woff, c.wbuf.size() - c.woff, 0);
+        }
+        closeConn(late[i]);
+    }
+}
+
+// ---- the client connection ----
+
+bool Http2Mux::readConn(Conn& c)
+{
+    char buf[H2_READ_CHUNK];
+    for (int i = 0; i < 4 && !c.goaway; ++i)
+    {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0)
+        {
+            c.rbuf.append(buf, n);
+            c.lastSeen = std::time(NULL);
+            if ((size_t)n < sizeof(buf))
+                break;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+        closeConn(c.fd);
+        return false;
+    }
+    parseFrames(c);
+    return true;
+}
+
+bool Http2Mux::writeConn(Conn& c)
+{
+    while (c.woff < c.wbuf.size())
+    {
+        ssize_t n = send(c.fd, c.wbuf.data() + c.woff, c.wbuf.size() - c.woff, 0);
+        if (n > 0)
+        {
+            c.woff += (size_t)n;
+            c.lastSeen = std::time(NULL);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+        closeConn(c.fd);
+        return false;
+    }
+    if (c.woff >= c.wbuf.size())
+    {
+        c.wbuf.clear();
+        c.woff = 0;
+        if (c.goaway || (c.peerGoaway && c.streams.empty()))
+        {
+            closeConn(c.fd);
+            return false;
+        }
+    }
+    else if (c.woff > H2_TX_HIGH_WATER)
+    {
+        c.wbuf.erase(0, c.woff);
+        c.woff = 0;
+    }
+    return true;
+}
+
+// false: the connection is in error (GOAWAY queued)
+bool Http2Mux::parseFrames(Conn& c)
+{
+    if (!c.preface)
+    {
+        size_t n = c.rbuf.size() < H2_PREFACE_LEN ? c.rbuf.size() : H2_PREFACE_LEN;
+        if (c.rbuf.compare(0, n, H2_PREFACE, n) != 0)
+        {
+            connError(c, H2_PROTOCOL_ERROR);
+            return false;
+        }
+        if (n < H2_PREFACE_LEN)
+            return true;
+        c.preface = true;
+        c.rbuf.erase(0, H2_PREFACE_LEN);
+    }
+
+    size_t pos = 0;
+    bool   ok = true;
+    while (ok && c.rbuf.size() - pos >= H2_FRAME_HEADER_LEN)
+    {
+        http2::FrameHeader h;
+        http2::parseFrameHeader(c.rbuf.data() + pos, h);
+        if (h.length > H2_DEFAULT_FRAME)
+        {
+            connError(c, H2_FRAME_SIZE_ERROR);
+            return false;
+        }
+        if (c.rbuf.size() - pos < H2_FRAME_HEADER_LEN + h.length)
+            break;
+        std::string payload = c.rbuf.substr(pos + H2_FRAME_HEADER_LEN, h.length);
+        pos += H2_FRAME_HEADER_LEN + h.length;
+        ok = onFrame(c, h, payload);
+    }
+    if (!ok)
+        return false;
+    c.rbuf.erase(0, pos);
+    return true;
+}
+
+void Http2Mux::connError(Conn& c, unsigned int code)
+{
+    if (c.goaway)
+        return;
+    http2::appendGoaway(c.wbuf, c.lastStream, code);
+    c.goaway = true;
+    c.rbuf.clear();
+    std::vector<unsigned int> ids;
+    for (std::map<unsigned int, Stream>::iterator it = c.streams.begin(); it != c.streams.end(); ++it)
+        ids.push_back(it->first);
+    for (size_t i = 0; i < ids.size(); ++i)
+        closeStream(c, ids[i]);
+}
+
+bool Http2Mux::onFrame(Conn& c, const http2::FrameHeader& h, const std::string& payload)
+{
+    if (c.hdrStream && (h.type != H2_CONTINUATION || h.streamId != c.hdrStream))
+    {
+        connError(c, H2_PROTOCOL_ERROR);
+        return false;
+    }
+
+    switch (h.type)
+    {
+    case H2_DATA:
+        return onData(c, h, payload);
+
+    case H2_HEADERS:
+    {
+        size_t off = 0;
+        size_t pad = 0;
+        if (h.flags & H2_FLAG_PADDED)
+        {
+            if (payload.empty())
+                break;
+            pad = (unsigned char)payload[0];
+            off = 1;
+        }
+        if (h.flags & H2_FLAG_PRIORITY)
+            off += 5;
+        if (h.streamId == 0 || off + pad > payload.size())
+            break;
+        c.hdrBlock.assign(payload, off, payload.size() - off - pad);
+        if (h.flags & H2_FLAG_END_HEADERS)
+            return onHeaderBlock(c, h.streamId, (h.flags & H2_FLAG_END_STREAM) != 0);
+        c.hdrStream = h.streamId;
+        c.hdrEndStream = (h.flags & H2_FLAG_END_STREAM) != 0;
+        return true;
+    }
+
+    case H2_CONTINUATION:
+        if (!c.hdrStream)
+            break;
+        c.hdrBlock += payload;
+        if (c.hdrBlock.size() > H2_MAX_HEADER_BLOCK)
+            break;
+        if (h.flags & H2_FLAG_END_HEADERS)
+        {
+            unsigned int id = c.hdrStream;
+            c.hdrStream = 0;
+            return onHeaderBlock(c, id, c.hdrEndStream);
+        }
+        return true;
+
+    case H2_RST_STREAM:
+        if (h.streamId == 0 || payload.size() != 4)
+            break;
+        closeStream(c, h.streamId);
+        return true;
+
+    case H2_SETTINGS:
+        if (h.streamId != 0)
+            break;
+        if (h.flags & H2_FLAG_ACK)
+            return true;
+        if (!applySettings(c, payload))
+            return false;
+        http2::appendSettingsAck(c.wbuf);
+        return true;
+
+    case H2_PING:
+        if (h.streamId != 0 || payload.size() != 8)
+            break;
+        if (!(h.flags & H2_FLAG_ACK))
+            http2::appendPingAck(c.wbuf, payload);
+        return true;
+
+    case H2_GOAWAY:
+        c.peerGoaway = true;
+        return true;
+
+    case H2_WINDOW_UPDATE:
+        return onWindowUpdate(c, h.streamId, payload);
+
+    case H2_PUSH_PROMISE:
+        break;
+
+    default:
+        // PRIORITY and unknown frame types are ignored
+        return true;
+    }
+    connError(c, H2_PROTOCOL_ERROR);
+    return false;
+}
+
+bool Http2Mux::applySettings(Conn& c, const std::string& payload)
+{
+    http2::Settings s;
+    if (!http2::parseSettings(payload, s))
+    {
+        connError(c, H2_FRAME_SIZE_ERROR);
+        return false;
+    }
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned int v = s[i].second;
+        switch (s[i].first)
+        {
+        case H2_SET_HEADER_TABLE_SIZE:
+            c.enc.setPeerMaxSize(v);
+            break;
+        case H2_SET_INITIAL_WINDOW_SIZE:
+        {
+            if ((long)v > H2_MAX_WINDOW)
+            {
+                connError(c, H2_FLOW_CONTROL_ERROR);
+                return false;
+            }
+            // applies to the streams already open too
+            long delta = (long)v - c.peerWindow;
+            for (std::map<unsigned int, Stream>::iterator it = c.streams.begin(); it != c.streams.end(); ++it)
+                it->second.window += delta;
+            c.peerWindow = (long)v;
+            break;
+        }
+        case H2_SET_MAX_FRAME_SIZE:
+            if (v < H2_DEFAULT_FRAME || v > 0xffffff)
+            {
+                connError(c, H2_PROTOCOL_ERROR);
+                return false;
+            }
+            c.peerFrame = v < H2_MAX_FRAME_SENT ? v : H2_MAX_FRAME_SENT;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool Http2Mux::onWindowUpdate(Conn& c, unsigned int id, const std::string& payload)
+{
+    if (payload.size() != 4)
+    {
+        connError(c, H2_FRAME_SIZE_ERROR);
+        return false;
+    }
+    long inc = (long)(http2::readU32(payload.data()) & 0x7fffffffu);
+    if (id == 0)
+    {
+        c.window += inc;
+        if (inc == 0 || c.window > H2_MAX_WINDOW)
+        {
+            connError(c, inc ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+            return false;
+        }
+        return true;
+    }
+    std::map<unsigned int, Stream>::iterator it = c.streams.find(id);
+    if (it == c.streams.end())
+        return true;
+    it->second.window += inc;
+    if (inc == 0)
+        resetStream(c, it->second, H2_PROTOCOL_ERROR);
+    else if (it->second.window > H2_MAX_WINDOW)
+        resetStream(c, it->second, H2_FLOW_CONTROL_ERROR);
+    return true;
+}
+
+// ---- requests ----
+
+// a complete header block: a new request, or trailers (ignored)
+bool Http2Mux::onHeaderBlock(Conn& c, unsigned int id, bool endStream)
+{
+    std::vector<http2::HeaderField> fields;
+    std::string block;
+    block.swap(c.hdrBlock);
+    if (!c.dec.decode(block, fields, _maxHeaderBytes))
+    {
+        connError(c, H2_COMPRESSION_ERROR);
+        return false;
+    }
+
+    std::map<unsigned int, Stream>::iterator existing = c.streams.find(id);
+    if (existing != c.streams.end())
+    {
+        if (endStream)
+            endRequestBody(existing->second);
+        writeStream(c, existing->second);
+        return true;
+    }
+    if (id <= c.lastStream || (id % 2) == 0)
+    {
+        if (id > c.lastStream)
+        {
+            connError(c, H2_PROTOCOL_ERROR);
+            return false;
+        }
+        return true;   // a stream we closed already
+    }
+    c.lastStream = id;
+    if (c.goaway || c.peerGoaway)
+        return true;
+
+    if (c.streams.size() >= H2_MAX_STREAMS)
+    {
+        http2::appendRstStream(c.wbuf, id, H2_REFUSED_STREAM);
+        return true;
+    }
+
+    std::string method, path, authority, cookies, headers;
+    bool        bodyKnown = false;
+    bool        valid = true;
+    for (size_t i = 0; i < fields.size() && valid; ++i)
+    {
+        const std::string& name = fields[i].first;
+        const std::string& value = fields[i].second;
+        valid = clean_field(name) && clean_field(value) && !name.empty();
+        if (!valid)
+            break;
+        if (name[0] == ':')
+        {
+            if (name == ":method")
+                method = value;
+            else if (name == ":path")
+                path = value;
+            else if (name == ":authority")
+                authority = value;
+            else if (name != ":scheme")
+                valid = false;
+            continue;
+        }
+        if (connection_specific(name) || (name == "host" && !authority.empty()))
+            continue;
+        if (name == "cookie")
+        {
+            // split into several fields by the client (RFC 9113 8.2.3)
+            cookies += (cookies.empty() ? "" : "; ") + value;
+            continue;
+        }
+        if (name == "content-length")
+            bodyKnown = true;
+        headers += name + ": " + value + "\r\n";
+    }
+    if (!valid || method.empty() || path.empty() || method == "CONNECT")
+    {
+        http2::appendRstStream(c.wbuf, id, H2_PROTOCOL_ERROR);
+        return true;
+    }
+
+    std::string head = method + " " + path + " HTTP/1.1\r\n";
+    if (!authority.empty())
+        head += "host: " + authority + "\r\n";
+    head += headers;
+    if (!cookies.empty())
+        head += "cookie: " + cookies + "\r\n";
+    openStream(c, id, head, method == "HEAD", bodyKnown, endStream);
+    return true;
+}
+
+// `request`: the head without its blank line. A body of unknown length goes
+// to the reactor as chunked, so it is passed on (and given back as window)
+// as it comes instead of being held here until END_STREAM.
+bool Http2Mux::openStream(Conn& c, unsigned int id, const std::string& request, bool headOnly,
+                          bool bodyKnown, bool endStream)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        http2::appendRstStream(c.wbuf, id, H2_REFUSED_STREAM);
+        return false;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        setCloExec(sv[i]);
+        makeNonBlocking(sv[i]);
+    }
+
+    Stream& s = c.streams[id];
+    s.id = id;
+    s.fd = sv[0];
+    s.headOnly = headOnly;
+    s.window = c.peerWindow;
+    s.out = request;
+    if (bodyKnown)
+        s.out += "\r\n";
+    else if (endStream)
+        s.out += "content-length: 0\r\n\r\n";
+    else
+    {
+        s.out += "transfer-encoding: chunked\r\n\r\n";
+        s.chunked = true;
+    }
+    s.framingLeft = s.out.size();
+
+    _byStream[sv[0]] = std::make_pair(c.fd, id);
+    _newStreams.push_back(std::make_pair(sv[1], c.acceptFd));
+
+    if (endStream)
+        endRequestBody(s);
+    updateStreamInterest(c, s);
+    return true;
+}
+
+void Http2Mux::endRequestBody(Stream& s)
+{
+    s.remoteDone = true;
+    if (!s.chunked)
+        return;
+    s.out += "0\r\n\r\n";
+    s.framingLeft += 5;
+}
+
+bool Http2Mux::onData(Conn& c, const http2::FrameHeader& h, const std::string& payload)
+{
+    if (h.streamId == 0)
+    {
+        connError(c, H2_PROTOCOL_ERROR);
+        return false;
+    }
+
+    // the whole frame counts against the connection window, given back in batches
+    if ((long)h.length > c.recvWindow)
+    {
+        connError(c, H2_FLOW_CONTROL_ERROR);
+        return false;
+    }
+    c.recvWindow -= (long)h.length;
+    c.unacked += h.length;
+    if (c.unacked >= H2_CONN_WINDOW / 2)
+    {
+        http2::appendWindowUpdate(c.wbuf, 0, (unsigned int)c.unacked);
+        c.recvWindow += (long)c.unacked;
+        c.unacked = 0;
+    }
+
+    size_t off = 0;
+    size_t pad = 0;
+    if (h.flags & H2_FLAG_PADDED)
+    {
+        if (payload.empty() || (size_t)(unsigned char)payload[0] >= payload.size())
+        {
+            connError(c, H2_PROTOCOL_ERROR);
+            return false;
+        }
+        pad = (unsigned char)payload[0];
+        off = 1;
+    }
+
+    std::map<unsigned int, Stream>::iterator it = c.streams.find(h.streamId);
+    if (it == c.streams.end())
+    {
+        if (h.streamId > c.lastStream)
+        {
+            connError(c, H2_PROTOCOL_ERROR);
+            return false;
+        }
+        return true;   // reset or finished already
+    }
+    Stream& s = it->second;
+    if (s.remoteDone)
+    {
+        resetStream(c, s, H2_STREAM_CLOSED);
+        return true;
+    }
+    if ((long)h.length > s.recvWindow)
+    {
+        resetStream(c, s, H2_FLOW_CONTROL_ERROR);
+        return true;
+    }
+    s.recvWindow -= (long)h.length;
+
+    const size_t len = payload.size() - off - pad;
+    s.unacked += off + pad;
+    if (s.chunked && len > 0)
+    {
+        std::string line = chunk_line(len);
+        s.out += line;
+        s.out.append(payload, off, len);
+        s.out += "\r\n";
+        s.framingLeft += line.size() + 2;
+    }
+    else
+        s.out.append(payload, off, len);
+    if (h.flags & H2_FLAG_END_STREAM)
+        endRequestBody(s);
+    writeStream(c, s);
+    return true;
+}
+
+// ---- the stream sockets ----
+
+void Http2Mux::writeStream(Conn& c, Stream& s)
+{
+    while (s.outOff < s.out.size())
+    {
+        ssize_t n = send(s.fd, s.out.data() + s.outOff, s.out.size() - s.outOff, 0);
+        if (n > 0)
+        {
+            // framing is never given back as window, only what the client sent
+            size_t f = (size_t)n < s.framingLeft ? (size_t)n : s.framingLeft;
+            s.framingLeft -= f;
+            s.unacked += (size_t)n - f;
+            s.outOff += (size_t)n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+        // the server answered without reading it all (413...): drop the rest
+        s.out.clear();
+        s.outOff = 0;
+        s.framingLeft = 0;
+        break;
+    }
+    if (s.outOff >= s.out.size())
+    {
+        s.out.clear();
+        s.outOff = 0;
+    }
+    else if (s.outOff > H2_STREAM_WINDOW)
+    {
+        s.out.erase(0, s.outOff);
+        s.outOff = 0;
+    }
+    creditStream(c, s);
+}
+
+void Http2Mux::creditStream(Conn& c, Stream& s)
+{
+    if (s.remoteDone || s.unacked < H2_STREAM_WINDOW / 2)
+        return;
+    http2::appendWindowUpdate(c.wbuf, s.id, (unsigned int)s.unacked);
+    s.recvWindow += (long)s.unacked;
+    s.unacked = 0;
+}
+
+size_t Http2Mux::sendable(const Conn& c, const Stream& s) const
+{
+    if (c.wbuf.size() - c.woff >= H2_TX_HIGH_WATER)
+        return 0;
+    long n = c.window < s.window ? c.window : s.window;
+    return n > 0 ? (size_t)n : 0;
+}
+
+void Http2Mux::readStream(Conn& c, Stream& s)
+{
+    char buf[H2_READ_CHUNK];
+
+    if (!s.headSent)
+    {
+        ssize_t n = read(s.fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return;
+        if (n <= 0)
+        {
+            resetStream(c, s, H2_INTERNAL_ERROR);
+            return;
+        }
+        s.head.append(buf, n);
+        if (s.head.find("\r\n\r\n") == std::string::npos)
+        {
+            if (s.head.size() > H2_MAX_RESP_HEAD)
+                resetStream(c, s, H2_INTERNAL_ERROR);
+            return;
+        }
+        if (!sendHead(c, s))
+            return;
+    }
+
+    if (!flushHeld(c, s))
+        return;
+    while (s.head.empty())
+    {
+        size_t room = sendable(c, s);
+        if (room == 0)
+            return;
+        if (room > sizeof(buf))
+            room = sizeof(buf);
+        ssize_t n = read(s.fd, buf, room);
+        if (n > 0)
+        {
+            if (sendData(c, s, buf, (size_t)n, false))
+            {
+                closeStream(c, s.id);
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return;
+        // the reactor closed its end: the response is over, unless it was cut short
+        if (n < 0 || (s.hasLen && s.left > 0))
+            resetStream(c, s, H2_INTERNAL_ERROR);
+        else
+        {
+            sendData(c, s, "", 0, true);
+            closeStream(c, s.id);
+        }
+        return;
+    }
+}
+
+// body bytes read together with the head wait in `head` for window;
+// false: the stream is finished and gone
+bool Http2Mux::flushHeld(Conn& c, Stream& s)
+{
+    while (!s.head.empty())
+    {
+        size_t room = sendable(c, s);
+        if (room == 0)
+            return true;
+        if (room > s.head.size())
+            room = s.head.size();
+        bool end = sendData(c, s, s.head.data(), room, false);
+        s.head.erase(0, room);
+        if (end)
+        {
+            closeStream(c, s.id);
+            return false;
+        }
+    }
+    return true;
+}
+
+// the HTTP/1.0 status line and headers become a HEADERS block;
+// false: the stream is finished and gone
+bool Http2Mux::sendHead(Conn& c, Stream& s)
+{
+    size_t he = s.head.find("\r\n\r\n");
+    std::string block = s.head.substr(0, he + 2);
+    s.head.erase(0, he + 4);
+
+    size_t eol = block.find("\r\n");
+    std::string status = block.substr(0, eol);
+    size_t sp = status.find(' ');
+    if (sp == std::string::npos || status.size() < sp + 4)
+    {
+        resetStream(c, s, H2_INTERNAL_ERROR);
+        return false;
+    }
+    std::string code = status.substr(sp + 1, 3);
+
+    std::vector<http2::HeaderField> fields;
+    fields.push_back(http2::HeaderField(":status", code));
+    size_t pos = eol + 2;
+    while (pos < block.size())
+    {
+        size_t e = block.find("\r\n", pos);
+        if (e == std::string::npos)
+            break;
+        std::string line = block.substr(pos, e - pos);
+        pos = e + 2;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = asciiLower(trimSpaces(line.substr(0, colon)));
+        std::string value = trimSpaces(line.substr(colon + 1));
+        if (name.empty() || connection_specific(name))
+            continue;
+        if (name == "content-length")
+        {
+            s.hasLen = true;
+            s.left = (size_t)std::strtoul(value.c_str(), NULL, 10);
+        }
+        fields.push_back(http2::HeaderField(name, value));
+    }
+
+    std::string hb;
+    c.enc.encode(fields, hb);
+    const bool end = s.headOnly || code == "204" || code == "304" || (s.hasLen && s.left == 0);
+    http2::appendHeaders(c.wbuf, s.id, hb, end, c.peerFrame);
+    s.headSent = true;
+    if (end)
+    {
+        closeStream(c, s.id);
+        return false;
+    }
+    return true;
+}
+
+// true: that was the last of it (END_STREAM sent)
+bool Http2Mux::sendData(Conn& c, Stream& s, const char* data, size_t len, bool end)
+{
+    if (s.hasLen)
+    {
+        if (len > s.left)
+            len = s.left;
+        s.left -= len;
+        end = end || s.left == 0;
+    }
+    c.window -= (long)len;
+    s.window -= (long)len;
+
+    size_t off = 0;
+    do
+    {
+        size_t n = len - off;
+        if (n > c.peerFrame)
+            n = c.peerFrame;
+        const bool last = (off + n == len);
+        http2::appendFrameHeader(c.wbuf, n, H2_DATA, (last && end) ? H2_FLAG_END_STREAM : 0, s.id);
+        c.wbuf.append(data + off, n);
+        off += n;
+    } while (off < len);
+    return end;
+}
+
+void Http2Mux::resetStream(Conn& c, Stream& s, unsigned int code)
+{
+    http2::appendRstStream(c.wbuf, s.id, code);
+    closeStream(c, s.id);
+}
+
+// closing our end tells the reactor's side the client is gone
+void Http2Mux::closeStream(Conn& c, unsigned int id)
+{
+    std::map<unsigned int, Stream>::iterator it = c.streams.find(id);
+    if (it == c.streams.end())
+        return;
+    int fd = it->second.fd;
+    if (fd >= 0)
+    {
+        _byStream.erase(fd);
+        _pollChanges.push_back(std::make_pair(fd, (short)-1));
+        closeFd(fd);
+    }
+    c.streams.erase(it);
+}
+
+void Http2Mux::closeConn(int fd)
+{
+    std::map<int, Conn>::iterator it = _conns.find(fd);
+    if (it == _conns.end())
+        return;
+    Conn& c = it->second;
+    std::vector<unsigned int> ids;
+    for (std::map<unsigned int, Stream>::iterator s = c.streams.begin(); s != c.streams.end(); ++s)
+        ids.push_back(s->first);
+    for (size_t i = 0; i < ids.size(); ++i)
+        closeStream(c, ids[i]);
+    _pollChanges.push_back(std::make_pair(fd, (short)-1));
+    closeFd(fd);
+    _conns.erase(it);
+}
+
+// ---- poll interest ----
+
+void Http2Mux::updateInterest(Conn& c)
+{
+    // window opened or frames drained: held body bytes may go now
+    std::vector<unsigned int> held;
+    for (std::map<unsigned int, Stream>::iterator it = c.streams.begin(); it != c.streams.end(); ++it)
+    {
+        if (it->second.headSent && !it->second.head.empty() && sendable(c, it->second) > 0)
+            held.push_back(it->first);
+    }
+    for (size_t i = 0; i < held.size(); ++i)
+    {
+        std::map<unsigned int, Stream>::iterator it = c.streams.find(held[i]);
+        if (it != c.streams.end())
+            flushHeld(c, it->second);
+    }
+
+    short want = c.goaway ? 0 : POLLIN;
+    if (c.woff < c.wbuf.size())
+        want |= POLLOUT;
+    if (want != c.interest)
+    {
+        c.interest = want;
+        _pollChanges.push_back(std::make_pair(c.fd, want));
+    }
+    for (std::map<unsigned int, Stream>::iterator it = c.streams.begin(); it != c.streams.end(); ++it)
+        updateStreamInterest(c, it->second);
+}
+
+void Http2Mux::updateStreamInterest(Conn& c, Stream& s)
+{
+    short want = 0;
+    if (s.outOff < s.out.size())
+        want |= POLLOUT;
+    if (!s.headSent || (s.head.empty() && sendable(c, s) > 0))
+        want |= POLLIN;
+    if (want != s.interest)
+    {
+        s.interest = want;
+        _pollChanges.push_back(std::make_pair(s.fd, want));
+    }
+}
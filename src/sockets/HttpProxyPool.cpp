@@ -0,0 +1,612 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   HttpProxyPool.cpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 14:02:34 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 14:02:34 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/sockets/HttpProxyPool.hpp"
+#include "../../include/sockets/NetUtil.hpp"
+
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+// a response head bigger than this is treated as a broken upstream
+#define PROXY_MAX_HEADER_BYTES (64 * 1024)
+// longest chunk-size / trailer line we wait for
+#define PROXY_MAX_LINE 4096
+
+// connection-level headers: they describe our hop, not the response
+static bool hop_by_hop(const std::string& lname)
+{
+    return lname == "connection" || lname == "keep-alive" || lname == "proxy-connection"
+        || lname == "te" || lname == "trailer" || lname == "upgrade"
+        || lname == "transfer-encoding";
+}
+
+HttpProxyPool::HttpProxyPool()
+: _conns()
+, _pending()
+, _byClient()
+, _pollChanges()
+, _events()
+{}
+
+HttpProxyPool::~HttpProxyPool()
+{
+    for (std::map<int, Conn>::iterator it = _conns.begin(); it != _conns.end(); ++it)
+        closeFd(it->first);
+}
+
+void HttpProxyPool::submit(int clientFd, const std::string& address,
+                           const struct sockaddr_storage& addr, socklen_t addrLen,
+                           const std::string& request, int connectTimeoutSec)
+{
+    Job job;
+    job.clientFd = clientFd;
+    job.address = address;
+    job.addr = addr;
+    job.addrLen = addrLen;
+    job.request = request;
+    job.connectTimeoutSec = connectTimeoutSec;
+    job.noBody = (request.compare(0, 5, "HEAD ") == 0);
+    job.retryable = (request.compare(0, 5, "POST ") != 0);
+    _pending.push_back(job);
+    dispatch();
+}
+
+// a connection in the middle of a response can't be reused: it is closed
+void HttpProxyPool::abort(int clientFd)
+{
+    for (std::deque<Job>::iterator it = _pending.begin(); it != _pending.end(); ++it)
+    {
+        if (it->clientFd == clientFd)
+        {
+            _pending.erase(it);
+            return;
+        }
+    }
+
+    std::map<int, int>::iterator b = _byClient.find(clientFd);
+    if (b == _byClient.end())
+        return;
+    int fd = b->second;
+    _byClient.erase(b);
+    std::map<int, Conn>::iterator c = _conns.find(fd);
+    if (c != _conns.end())
+    {
+        c->second.busy = false;
+        closeConn(fd, false);
+    }
+    dispatch();
+}
+
+void HttpProxyPool::pause(int clientFd, bool paused)
+{
+    std::map<int, int>::iterator b = _byClient.find(clientFd);
+    if (b == _byClient.end())
+        return;
+    std::map<int, Conn>::iterator c = _conns.find(b->second);
+    if (c == _conns.end())
+        return;
+    c->second.paused = paused;
+    updateInterest(c->second);
+}
+
+bool HttpProxyPool::owns(int fd) const
+{
+    return _conns.find(fd) != _conns.end();
+}
+
+void HttpProxyPool::takePollChanges(std::vector<std::pair<int, short> >& out)
+{
+    out.swap(_pollChanges);
+    _pollChanges.clear();
+}
+
+void HttpProxyPool::takeEvents(std::vector<ProxyEvent>& out)
+{
+    out.swap(_events);
+    _events.clear();
+}
+
+void HttpProxyPool::emit(int clientFd, ProxyEvent::Kind kind, const std::string& data)
+{
+    if (kind == ProxyEvent::DATA && !_events.empty() &&
+        _events.back().clientFd == clientFd && _events.back().kind == ProxyEvent::DATA)
+    {
+        _events.back().data += data;
+        return;
+    }
+    ProxyEvent ev;
+    ev.clientFd = clientFd;
+    ev.kind = kind;
+    ev.data = data;
+    _events.push_back(ev);
+}
+
+// connects that take too long fail their request; idle connections expire
+void HttpProxyPool::sweep(std::time_t now)
+{
+    std::vector<int> late;
+    std::vector<int> stale;
+    for (std::map<int, Conn>::iterator it = _conns.begin(); it != _conns.end(); ++it)
+    {
+        const Conn& c = it->second;
+        if (c.connecting && c.job.connectTimeoutSec > 0 && now - c.since >= c.job.connectTimeoutSec)
+            late.push_back(it->first);
+        else if (!c.busy && now - c.since >= PROXY_IDLE_TIMEOUT)
+            stale.push_back(it->first);
+    }
+    for (size_t i = 0; i < late.size(); ++i)
+        closeConn(late[i], false);
+    for (size_t i = 0; i < stale.size(); ++i)
+        closeConn(stale[i], false);
+    if (!late.empty() || !stale.empty())
+        dispatch();
+}
+
+// queued jobs go out in arrival order as connections free up
+void HttpProxyPool::dispatch()
+{
+    size_t n = _pending.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        Job job = _pending.front();
+        _pending.pop_front();
+        if (!assign(job))
+            _pending.push_back(job);
+    }
+}
+
+// an idle connection to the address, else a new one while under the cap
+bool HttpProxyPool::assign(Job& job)
+{
+    Conn*  idle = NULL;
+    size_t count = 0;
+    for (std::map<int, Conn>::iterator it = _conns.begin(); it != _conns.end(); ++it)
+    {
+        Conn& c = it->second;
+        if (c.address != job.address)
+            continue;
+        count++;
+        if (!idle && !c.busy)
+            idle = &c;
+    }
+    if (idle)
+    {
+        startRequest(*idle, job);
+        return true;
+    }
+    if (count >= PROXY_MAX_CONNS)
+        return false;
+
+    int fd = openConn(job);
+    if (fd < 0)
+    {
+        emit(job.clientFd, ProxyEvent::FAIL, "");
+        return true;
+    }
+    startRequest(_conns[fd], job);
+    return true;
+}
+
+// no lookup here: the address was resolved when the config was loaded
+int HttpProxyPool::openConn(const Job& job)
+{
+    if (job.addrLen == 0)
+        return -1;
+    int fd = socket(job.addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    makeNonBlocking(fd);
+    int rc = connect(fd, (const struct sockaddr*)&job.addr, job.addrLen);
+    if (rc < 0 && errno != EINPROGRESS)
+    {
+        closeFd(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    Conn& c = _conns[fd];
+    c.fd = fd;
+    c.address = job.address;
+    c.connecting = (rc < 0);
+    c.since = std::time(NULL);
+    return fd;
+}
+
+void HttpProxyPool::startRequest(Conn& c, const Job& job)
+{
+    c.busy = true;
+    c.job = job;
+    c.wbuf = job.request;
+    c.woff = 0;
+    c.rbuf.clear();
+    c.phase = HEAD;
+    c.chunk = CHUNK_SIZE;
+    c.left = 0;
+    c.keepAlive = false;
+    c.gotOutput = false;
+    c.paused = false;
+    _byClient[job.clientFd] = c.fd;
+    updateInterest(c);
+}
+
+// Status line and headers -> "Status: ..." + end-to-end headers. Interim
+// 1xx responses are skipped. False: the connection is gone.
+bool HttpProxyPool::parseHead(Conn& c)
+{
+    for (;;)
+    {
+        std::string::size_type end = c.rbuf.find("\r\n\r\n");
+        if (end == std::string::npos)
+        {
+            if (c.rbuf.size() > PROXY_MAX_HEADER_BYTES)
+            {
+                closeConn(c.fd, false);
+                return false;
+            }
+            return true;
+        }
+        std::string head = c.rbuf.substr(0, end + 2);
+        c.rbuf.erase(0, end + 4);
+
+        std::string::size_type eol = head.find("\r\n");
+        std::string status = head.substr(0, eol);
+        if (status.compare(0, 5, "HTTP/") != 0 || status.size() < 12 || status[8] != ' ')
+        {
+            closeConn(c.fd, false);
+            return false;
+        }
+        int code = std::atoi(status.c_str() + 9);
+        if (code < 100 || code > 999)
+        {
+            closeConn(c.fd, false);
+            return false;
+        }
+        if (code < 200)
+            continue;
+        std::string reason = (status.size() > 13) ? status.substr(13) : "";
+
+        bool   chunked = false;
+        bool   hasLen = false;
+        size_t len = 0;
+        c.keepAlive = (status.compare(5, 3, "1.1") == 0);
+
+        std::ostringstream cgi;
+        cgi << "Status: " << code << " " << reason << "\r\n";
+        std::string::size_type pos = eol + 2;
+        while (pos < head.size())
+        {
+            std::string::size_type next = head.find("\r\n", pos);
+            std::string line = head.substr(pos, next - pos);
+            pos = next + 2;
+            std::string::size_type colon = line.find(':');
+            if (colon == std::string::npos || colon == 0)
+                continue;
+            std::string name = line.substr(0, colon);
+            std::string value = trimSpaces(line.substr(colon + 1));
+            std::string lname = asciiLower(name);
+
+            if (lname == "connection")
+            {
+                std::string v = asciiLower(value);
+                if (v.find("close") != std::string::npos)
+                    c.keepAlive = false;
+                else if (v.find("keep-alive") != std::string::npos)
+                    c.keepAlive = true;
+                continue;
+            }
+            if (lname == "transfer-encoding")
+                chunked = (asciiLower(value).find("chunked") != std::string::npos);
+            if (hop_by_hop(lname))
+                continue;
+            if (lname == "content-length")
+            {
+                hasLen = true;
+                len = (size_t)std::strtoul(value.c_str(), NULL, 10);
+                continue;
+            }
+            cgi << name << ": " << value << "\r\n";
+        }
+        if (hasLen && !chunked)
+            cgi << "Content-Length: " << len << "\r\n";
+        cgi << "\r\n";
+
+        c.gotOutput = true;
+        emit(c.job.clientFd, ProxyEvent::DATA, cgi.str());
+
+        if (c.job.noBody || code == 204 || code == 304)
+            return finishRequest(c);
+        if (chunked)
+        {
+            c.phase = BODY_CHUNKED;
+            c.chunk = CHUNK_SIZE;
+        }
+        else if (hasLen)
+        {
+            c.phase = BODY_LENGTH;
+            c.left = len;
+            if (len == 0)
+                return finishRequest(c);
+        }
+        else
+        {
+            // body ends when the upstream closes
+            c.phase = BODY_CLOSE;
+            c.keepAlive = false;
+        }
+        return true;
+    }
+}
+
+// chunk framing is removed here; the client gets the plain body
+bool HttpProxyPool::parseChunked(Conn& c)
+{
+    for (;;)
+    {
+        if (c.chunk == CHUNK_DATA)
+        {
+            size_t n = c.rbuf.size() < c.left ? c.rbuf.size() : c.left;
+            if (n == 0)
+                return true;
+            emit(c.job.clientFd, ProxyEvent::DATA, c.rbuf.substr(0, n));
+            c.rbuf.erase(0, n);
+            c.left -= n;
+            if (c.left == 0)
+                c.chunk = CHUNK_CRLF;
+            continue;
+        }
+        if (c.chunk == CHUNK_CRLF)
+        {
+            if (c.rbuf.size() < 2)
+                return true;
+            if (c.rbuf.compare(0, 2, "\r\n") != 0)
+            {
+                closeConn(c.fd, false);
+                return false;
+            }
+            c.rbuf.erase(0, 2);
+            c.chunk = CHUNK_SIZE;
+            continue;
+        }
+
+        std::string::size_type eol = c.rbuf.find("\r\n");
+        if (eol == std::string::npos)
+        {
+            if (c.rbuf.size() > PROXY_MAX_LINE)
+            {
+                closeConn(c.fd, false);
+                return false;
+            }
+            return true;
+        }
+        std::string line = c.rbuf.substr(0, eol);
+        c.rbuf.erase(0, eol + 2);
+
+        if (c.chunk == CHUNK_TRAILER)
+        {
+            if (line.empty())
+                return finishRequest(c);
+            continue;
+        }
+
+        char* end = NULL;
+        unsigned long size = std::strtoul(line.c_str(), &end, 16);
+        if (end == line.c_str())
+        {
+            closeConn(c.fd, false);
+            return false;
+        }
+        if (size == 0)
+            c.chunk = CHUNK_TRAILER;
+        else
+        {
+            c.left = (size_t)size;
+            c.chunk = CHUNK_DATA;
+        }
+    }
+}
+
+// Whatever the head said the body is: hands the bytes in rbuf on.
+// False: the connection is gone (error, or closed after the response).
+bool HttpProxyPool::parseResponse(Conn& c)
+{
+    if (c.phase == HEAD && !parseHead(c))
+        return false;
+
+    if (c.phase == BODY_LENGTH)
+    {
+        size_t n = c.rbuf.size() < c.left ? c.rbuf.size() : c.left;
+        if (n > 0)
+        {
+            emit(c.job.clientFd, ProxyEvent::DATA, c.rbuf.substr(0, n));
+            c.rbuf.erase(0, n);
+            c.left -= n;
+        }
+        if (c.left == 0)
+            return finishRequest(c);
+    }
+    else if (c.phase == BODY_CHUNKED)
+        return parseChunked(c);
+    else if (c.phase == BODY_CLOSE && !c.rbuf.empty())
+    {
+        emit(c.job.clientFd, ProxyEvent::DATA, c.rbuf);
+        c.rbuf.clear();
+    }
+    return true;
+}
+
+// Response complete: the connection goes back to the idle list if the
+// upstream allows it and nothing is left over on it. False: it was closed.
+bool HttpProxyPool::finishRequest(Conn& c)
+{
+    emit(c.job.clientFd, ProxyEvent::END, "");
+    _byClient.erase(c.job.clientFd);
+    c.busy = false;
+    c.job = Job();
+    c.phase = IDLE;
+    c.reused = true;
+    c.paused = false;
+    c.since = std::time(NULL);
+
+    size_t idle = 0;
+    for (std::map<int, Conn>::iterator it = _conns.begin(); it != _conns.end(); ++it)
+    {
+        if (it->second.address == c.address && !it->second.busy && it->first != c.fd)
+            idle++;
+    }
+    if (!c.keepAlive || !c.rbuf.empty() || c.woff < c.wbuf.size() || idle >= PROXY_MAX_IDLE)
+    {
+        closeConn(c.fd, false);
+        return false;
+    }
+    c.wbuf.clear();
+    c.woff = 0;
+    updateInterest(c);
+    return true;
+}
+
+// A connection that dies under a request fails it, except a request that got
+// no answer yet on a reused connection: the upstream most likely closed it
+// while idle, so it is replayed once on a fresh one (not a POST).
+void HttpProxyPool::closeConn(int fd, bool failed)
+{
+    std::map<int, Conn>::iterator it = _conns.find(fd);
+    if (it == _conns.end())
+        return;
+    Conn& c = it->second;
+
+    if (c.busy)
+    {
+        Job& job = c.job;
+        _byClient.erase(job.clientFd);
+        if (failed && c.reused && !c.gotOutput && job.retryable && !job.retried)
+        {
+            job.retried = true;
+            _pending.push_front(job);
+        }
+        else
+            emit(job.clientFd, ProxyEvent::FAIL, "");
+    }
+
+    _pollChanges.push_back(std::make_pair(fd, (short)-1));
+    closeFd(fd);
+    _conns.erase(it);
+}
+
+void HttpProxyPool::updateInterest(Conn& c)
+{
+    short want = 0;
+    if (c.connecting || c.woff < c.wbuf.size())
+        want |= POLLOUT;
+    if (!c.connecting && !c.paused)
+        want |= POLLIN;
+    if (want != c.interest)
+    {
+        c.interest = want;
+        _pollChanges.push_back(std::make_pair(c.fd, want));
+    }
+}
+
+void HttpProxyPool::onEvent(int fd, short revents)
+{
+    std::map<int, Conn>::iterator it = _conns.find(fd);
+    if (it == _conns.end())
+        return;
+    Conn& c = it->second;
+
+    if (c.connecting)
+    {
+        if (!(revents & (POLLOUT | POLLERR | POLLHUP)))
+            return;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        {
+            closeConn(fd, false);
+            dispatch();
+            return;
+        }
+        c.connecting = false;
+    }
+
+    // idle: readable means the upstream closed it (or sent garbage)
+    if (!c.busy)
+    {
+        if (revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+        {
+            closeConn(fd, false);
+            dispatch();
+        }
+        return;
+    }
+
+    if ((revents & POLLOUT) && c.woff < c.wbuf.size())
+    {
+        ssize_t n = send(fd, c.wbuf.data() + c.woff, c.wbuf.size() - c.woff, 0);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            closeConn(fd, true);
+            dispatch();
+            return;
+        }
+        if (n > 0)
+            c.woff += (size_t)n;
+        if (c.woff == c.wbuf.size())
+        {
+            c.wbuf.clear();
+            c.woff = 0;
+        }
+        else if (c.woff > 65536 && c.woff > c.wbuf.size() / 2)
+        {
+            c.wbuf.erase(0, c.woff);
+            c.woff = 0;
+        }
+    }
+
+    if (!c.paused && (revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)))
+    {
+        char buf[65536];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0 && c.phase == BODY_CLOSE)
+        {
+            emit(c.job.clientFd, ProxyEvent::END, "");
+            _byClient.erase(c.job.clientFd);
+            c.busy = false;
+            closeConn(fd, false);
+            dispatch();
+            return;
+        }
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            closeConn(fd, true);
+            dispatch();
+            return;
+        }
+        if (n > 0)
+        {
+            c.rbuf.append(buf, (size_t)n);
+            if (!parseResponse(c))
+            {
+                dispatch();
+                return;
+            }
+        }
+    }
+
+    updateInterest(c);
+    dispatch();
+}
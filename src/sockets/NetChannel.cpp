@@ -11,12 +11,26 @@
 /* ************************************************************************** */
 
 #include "../../include/sockets/NetChannel.hpp"
+#include "../../include/sockets/NetUtil.hpp"
+#include "../../include/sockets/ServerMetrics.hpp"
+#include <openssl/err.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <poll.h>
+#include <sys/socket.h>
+
+// a TLS record holds at most this much: reading a whole one at a time leaves
+// nothing decrypted inside OpenSSL that poll() could not see
+#define TLS_RECORD_BYTES (16 * 1024)
 
 NetChannel::NetChannel()
 : _sockFd(-1)
 , _acceptFd(-1)
 , _rx()
 , _tx()
+, _txQueue()
 , _lastSeen(0)
 , _phaseSince(0)
 , _phase(PHASE_RECV_HEADERS)
@@ -30,6 +44,10 @@ NetChannel::NetChannel()
 , _inFlight(false)
 , _cgi()
 , _upload()
+, _trace()
+, _peer("-")
+, _ssl(NULL)
+, _tlsFailed(false)
 {
     markSeen();
     markPhaseSince();
@@ -40,6 +58,7 @@ NetChannel::NetChannel(int sockFd, int acceptFd)
 , _acceptFd(acceptFd)
 , _rx()
 , _tx()
+, _txQueue()
 , _lastSeen(0)
 , _phaseSince(0)
 , _phase(PHASE_RECV_HEADERS)
@@ -53,9 +72,14 @@ NetChannel::NetChannel(int sockFd, int acceptFd)
 , _inFlight(false)
 , _cgi()
 , _upload()
+, _trace()
+, _peer("-")
+, _ssl(NULL)
+, _tlsFailed(false)
 {
     markSeen();
     markPhaseSince();
+    _trace.acceptUs = metrics_now_us();
 }
 
 int NetChannel::sockFd() const { return _sockFd; }
@@ -64,6 +88,74 @@ int NetChannel::acceptFd() const { return _acceptFd; }
 std::string& NetChannel::rxBuffer() { return _rx; }
 std::string& NetChannel::txBuffer() { return _tx; }
 
+void NetChannel::setTxShared(const SharedBuffer& b)
+{
+    _tx.clear();
+    clearTx();
+    queueShared(b);
+}
+
+void NetChannel::queueShared(const SharedBuffer& b)
+{
+    if (!b.empty())
+    {
+        _txQueue.push_back(TxSegment());
+        _txQueue.back().part.bytes = b;
+    }
+}
+
+void NetChannel::queuePart(const BodyPart& p)
+{
+    if (p.size() == 0)
+        return;
+    _txQueue.push_back(TxSegment());
+    _txQueue.back().part = p;
+}
+
+// a span of a file that is already open (and has no path): takes over fd
+void NetChannel::queueFileFd(int fd, off_t offset, size_t length)
+{
+    if (length == 0)
+    {
+        close(fd);
+        return;
+    }
+    _txQueue.push_back(TxSegment());
+    _txQueue.back().part = BodyPart::fromFile("(spool)", offset, length);
+    _txQueue.back().fd = fd;
+}
+
+bool NetChannel::hasQueuedTx() const { return !_txQueue.empty(); }
+NetChannel::TxSegment& NetChannel::frontTx() { return _txQueue.front(); }
+
+void NetChannel::popTx()
+{
+    if (_txQueue.empty())
+        return;
+    if (_txQueue.front().fd >= 0)
+        close(_txQueue.front().fd);
+    _txQueue.pop_front();
+}
+
+void NetChannel::clearTx()
+{
+    while (!_txQueue.empty())
+        popTx();
+}
+
+bool NetChannel::hasPendingTx() const
+{
+    return !_tx.empty() || !_txQueue.empty();
+}
+
+size_t NetChannel::pendingTxBytes() const
+{
+    size_t n = _tx.size();
+    for (std::deque<TxSegment>::const_iterator it = _txQueue.begin(); it != _txQueue.end(); ++it)
+        n += it->part.size() - it->sent;
+    return n;
+}
+
 std::time_t NetChannel::lastSeen() const { return _lastSeen; }
 void NetChannel::markSeen() { _lastSeen = std::time(NULL); }
 
@@ -134,6 +226,163 @@ void NetChannel::setInFlight(bool v) { _inFlight = v; markPhaseSince(); }
 
 CgiSession& NetChannel::cgi() { return _cgi; }
 NetChannel::UploadSession& NetChannel::upload() { return _upload; }
+NetChannel::RequestTrace& NetChannel::trace() { return _trace; }
 
-NetChannel::FileSendSession& NetChannel::file() { return _file; }
-const NetChannel::FileSendSession& NetChannel::file() const { return _file; }
+const std::string& NetChannel::peerAddr() const { return _peer; }
+void NetChannel::setPeerAddr(const std::string& addr) { _peer = addr; }
+
+ssize_t NetChannel::countIn(ssize_t n)
+{
+    if (n > 0)
+    {
+        if (!_trace.open)
+        {
+            _trace.open = true;
+            _trace.startUs = metrics_now_us();
+            if (_trace.acceptUs == 0)
+                _trace.acceptUs = _trace.startUs;
+        }
+        _trace.bytesIn += (size_t)n;
+    }
+    return n;
+}
+
+// every response starts with "HTTP/1.x NNN": the first bytes of it give the status
+ssize_t NetChannel::countOut(const char* buf, size_t len, ssize_t n)
+{
+    if (n <= 0)
+        return n;
+    if (_trace.status == 0 && _trace.bytesOut == 0 && len >= 12 && std::memcmp(buf, "HTTP/", 5) == 0
+        && buf[9] >= '1' && buf[9] <= '5' && std::isdigit((unsigned char)buf[10])
+        && std::isdigit((unsigned char)buf[11]))
+        _trace.status = (buf[9] - '0') * 100 + (buf[10] - '0') * 10 + (buf[11] - '0');
+    _trace.lastByteUs = metrics_now_us();
+    if (_trace.bytesOut == 0)
+        _trace.firstByteUs = _trace.lastByteUs;
+    _trace.bytesOut += (size_t)n;
+    return n;
+}
+
+void NetChannel::setTls(SSL* ssl)
+{
+    _ssl = ssl;
+    _tlsFailed = false;
+}
+
+SSL* NetChannel::tls() const { return _ssl; }
+bool NetChannel::tlsFailed() const { return _tlsFailed; }
+
+// close_notify is best effort: the socket is closed right after anyway
+void NetChannel::dropTls()
+{
+    if (!_ssl)
+        return;
+    if (!_tlsFailed && SSL_is_init_finished(_ssl))
+    {
+        ERR_clear_error();
+        SSL_shutdown(_ssl);
+    }
+    SSL_free(_ssl);
+    ERR_clear_error();
+    _ssl = NULL;
+}
+
+int NetChannel::continueHandshake(short& events)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(_ssl);
+    if (ret == 1)
+        return 1;
+    int err = SSL_get_error(_ssl, ret);
+    if (err == SSL_ERROR_WANT_READ)
+        events = POLLIN;
+    else if (err == SSL_ERROR_WANT_WRITE)
+        events = POLLOUT;
+    else
+    {
+        _tlsFailed = true;
+        ERR_clear_error();
+        return -1;
+    }
+    return 0;
+}
+
+// SSL_read / SSL_write result as recv / send would have given it
+ssize_t NetChannel::tlsResult(int ret)
+{
+    if (ret > 0)
+        return ret;
+    int err = SSL_get_error(_ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    // close_notify, or the peer just went away
+    if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && errno == 0))
+        return 0;
+    _tlsFailed = true;
+    ERR_clear_error();
+    return -1;
+}
+
+ssize_t NetChannel::recvSome(char* buf, size_t len)
+{
+    if (!_ssl)
+        return countIn(recv(_sockFd, buf, len, 0));
+    ERR_clear_error();
+    errno = 0;
+    return countIn(tlsResult(SSL_read(_ssl, buf, (int)len)));
+}
+
+ssize_t NetChannel::sendSome(const char* buf, size_t len)
+{
+    if (!_ssl)
+        return countOut(buf, len, send(_sockFd, buf, len, 0));
+    ERR_clear_error();
+    errno = 0;
+    ssize_t n = tlsResult(SSL_write(_ssl, buf, (int)len));
+    // a write never ends with 0: that would read as "file shrank" / closed
+    if (n == 0)
+    {
+        _tlsFailed = true;
+        return -1;
+    }
+    return countOut(buf, len, n);
+}
+
+// With kTLS the kernel encrypts: sendfile still works (SSL_sendfile).
+// Otherwise one record's worth is read and written; a retry after EAGAIN
+// comes back for the same offset and length, as SSL_write wants.
+ssize_t NetChannel::sendFile(int fileFd, off_t offset, size_t len)
+{
+    if (!_ssl)
+        return countOut(NULL, 0, sendFileSpan(_sockFd, fileFd, offset, len));
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+    if (BIO_get_ktls_send(SSL_get_wbio(_ssl)))
+    {
+        ERR_clear_error();
+        errno = 0;
+        ossl_ssize_t n = SSL_sendfile(_ssl, fileFd, offset, len, 0);
+        if (n > 0)
+            return countOut(NULL, 0, (ssize_t)n);
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        _tlsFailed = true;
+        ERR_clear_error();
+        return -1;
+    }
+#endif
+
+    char buf[TLS_RECORD_BYTES];
+    if (len > sizeof(buf))
+        len = sizeof(buf);
+    ssize_t r = pread(fileFd, buf, len, offset);
+    if (r <= 0)
+        return r;
+    return sendSome(buf, (size_t)r);
+}
@@ -16,6 +16,11 @@
 #include <fcntl.h>
 #include <cstdlib>
 #include <cctype>
+#include <string>
+#include <sys/socket.h>
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
 
 int makeNonBlocking(int fd)
 {
@@ -31,6 +36,44 @@ void closeFd(int fd)
         close(fd);
 }
 
+// Sends up to len bytes of fileFd starting at offset, without touching the file position.
+// Linux: sendfile() (no copy through user space). Elsewhere: pread() + send().
+ssize_t sendFileSpan(int sockFd, int fileFd, off_t offset, size_t len)
+{
+#ifdef __linux__
+    off_t off = offset;
+    return sendfile(sockFd, fileFd, &off, len);
+#else
+    char buf[65536];
+    if (len > sizeof(buf))
+        len = sizeof(buf);
+    ssize_t r = pread(fileFd, buf, len, offset);
+    if (r <= 0)
+        return r;
+    return send(sockFd, buf, (size_t)r, 0);
+#endif
+}
+
+// Anonymous read/write file in dir: it has no name, so it goes away with its
+// last descriptor. Linux: O_TMPFILE. Elsewhere (or on filesystems without
+// it): mkstemp() + unlink().
+int openSpoolFile(const char* dir)
+{
+    int fd = -1;
+#ifdef O_TMPFILE
+    fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        return fd;
+#endif
+    std::string tmpl = std::string(dir) + "/webserv-spool-XXXXXX";
+    fd = mkstemp(&tmpl[0]);
+    if (fd < 0)
+        return -1;
+    unlink(tmpl.c_str());
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
 static bool parsePortInt(const char* s, int& out)
 {
     if (!s || !*s) return false;
@@ -74,3 +117,53 @@ bool parsePortsList(const char* s, std::vector<int>& outPorts)
     }
     return !outPorts.empty();
 }
+
+std::string asciiLower(const std::string& s)
+{
+    std::string r = s;
+    for (size_t i = 0; i < r.size(); ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(r[i]);
+        if (c >= 'A' && c <= 'Z')
+            r[i] = static_cast<char>(c - 'A' + 'a');
+    }
+    return r;
+}
+
+// spaces and tabs, plus the CR of a line split on LF
+std::string trimSpaces(const std::string& s)
+{
+    size_t a = 0;
+    while (a < s.size() && (s[a] == ' ' || s[a] == '\t')) a++;
+    size_t b = s.size();
+    while (b > a && (s[b - 1] == ' ' || s[b - 1] == '\t' || s[b - 1] == '\r')) b--;
+    return s.substr(a, b - a);
+}
+
+std::map<std::string, std::string>::iterator
+findHeaderCI(std::map<std::string, std::string>& h, const std::string& keyLower)
+{
+    for (std::map<std::string, std::string>::iterator it = h.begin(); it != h.end(); ++it)
+        if (asciiLower(it->first) == keyLower)
+            return it;
+    return h.end();
+}
+
+std::map<std::string, std::string>::const_iterator
+findHeaderCI(const std::map<std::string, std::string>& h, const std::string& keyLower)
+{
+    for (std::map<std::string, std::string>::const_iterator it = h.begin(); it != h.end(); ++it)
+        if (asciiLower(it->first) == keyLower)
+            return it;
+    return h.end();
+}
+
+bool getHeaderCI(const std::map<std::string, std::string>& h, const std::string& keyLower,
+                 std::string& outVal)
+{
+    std::map<std::string, std::string>::const_iterator it = findHeaderCI(h, keyLower);
+    if (it == h.end())
+        return false;
+    outVal = it->second;
+    return true;
+}
@@ -12,19 +12,58 @@
 
 #include "../../include/sockets/PollReactor.hpp"
 #include "../../include/sockets/NetUtil.hpp"
+#include "../../include/sockets/ListenPort.hpp"
+#include "../../include/sockets/ServerMetrics.hpp"
+#include "../../include/sockets/AccessLog.hpp"
 #include "../../include/RouterByteHandler.hpp"
 #include <sstream>
 #include <iostream>
 #include <stdexcept>
 #include <cstring>
+#include <strings.h>
 #include <cerrno>
 #include <cstdio>
+#include <cctype>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <signal.h>
+#ifdef __linux__
+# include <sys/signalfd.h>
+#endif
+
+// a CGI header block bigger than this is treated as a broken script
+#define CGI_MAX_HEADER_BYTES (64 * 1024)
+// streamed CGI output: stop reading the script above HIGH bytes waiting for
+// the client, start again once it is down to LOW
+#define CGI_TX_HIGH_WATER (256 * 1024)
+#define CGI_TX_LOW_WATER  (64 * 1024)
+// request body bytes read from the client but not yet taken by the script
+#define CGI_STDIN_WINDOW  (64 * 1024)
+// cgi_buffer_size: where the spool files live (unlinked right away)
+#define CGI_SPOOL_DIR "/tmp"
+// output of a background cache refresh, headers included; more is not cacheable anyway
+#define CGI_REFRESH_MAX_BYTES (2 * 1024 * 1024)
+// request line kept for the slow request log
+#define TRACE_LINE_MAX 256
+
+#ifndef __linux__
+// no signalfd: the handler only pokes the reactor through a pipe
+static int g_childWake = -1;
+
+static void onChildSignal(int)
+{
+    if (g_childWake >= 0)
+    {
+        char c = 0;
+        ssize_t r = write(g_childWake, &c, 1);
+        (void)r;
+    }
+}
+#endif
 
 static void setCloExec(int fd)
 {
@@ -42,16 +81,53 @@ static bool socket_has_fatal_error(int fd)
     return (err != 0);
 }
 
-static std::string asciiLower(const std::string& s)
+// a TLS error leaves the socket itself without one
+static bool channel_failed(const NetChannel& ch)
 {
-    std::string r = s;
-    for (size_t i = 0; i < r.size(); ++i)
-    {
-        unsigned char c = static_cast<unsigned char>(r[i]);
-        if (c >= 'A' && c <= 'Z')
-            r[i] = static_cast<char>(c - 'A' + 'a');
-    }
-    return r;
+    return ch.tlsFailed() || socket_has_fatal_error(ch.sockFd());
+}
+
+// the handler's route for the request, kept for the metrics
+static void set_route(NetChannel& ch, const RouteLabel& route)
+{
+    if (route.server.empty())
+        return;
+    ch.trace().server = route.server;
+    ch.trace().location = route.location;
+    ch.trace().slowMs = route.slowMs;
+    ch.trace().accessLog = route.accessLog;
+    ch.trace().accessLogJson = route.accessLogJson;
+}
+
+// a step of the request trace; the first time it is reached counts
+static void mark_once(long long& at)
+{
+    if (at == 0)
+        at = metrics_now_us();
+}
+
+static std::string msStr(long long us)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%lld.%lldms", us / 1000, (us % 1000) / 100);
+    return buf;
+}
+
+// one line on stderr: what the request was and where its time went
+static void log_slow_request(const NetChannel::RequestTrace& t, int status, long long totalUs,
+                             const long long* phaseUs)
+{
+    std::string line = t.requestLine;
+    for (size_t i = 0; i < line.size(); ++i)
+        if ((unsigned char)line[i] < 0x20 || (unsigned char)line[i] == 0x7f)
+            line[i] = '?';
+
+    std::ostringstream os;
+    os << "slow request: " << msStr(totalUs) << " " << t.server << " " << t.location
+       << " \"" << line << "\" " << status;
+    for (int i = 0; i < REQ_PHASES; ++i)
+        os << " " << request_phase_name(i) << "=" << msStr(phaseUs[i]);
+    std::cerr << os.str() << std::endl;
 }
 
 static bool parseDecSizeT(const std::string& s, size_t& out)
@@ -71,6 +147,81 @@ static bool parseDecSizeT(const std::string& s, size_t& out)
     return true;
 }
 
+// longest chunk-size line (with extensions) or trailer section we wait for
+#define CHUNK_LINE_MAX 4096
+
+enum ChunkState { CHUNKS_MORE, CHUNKS_DONE, CHUNKS_BAD, CHUNKS_TOO_BIG };
+
+// A chunked request body is decoded in place as it arrives: rx holds the
+// head, the `decoded` body bytes so far, then what is not decoded yet. Only
+// that undecoded tail moves when the framing is cut out.
+static ChunkState decode_chunks(std::string& rx, size_t bodyStart, size_t& decoded, size_t maxBody)
+{
+    for (;;)
+    {
+        size_t p = bodyStart + decoded;
+        size_t eol = rx.find("\r\n", p);
+        if (eol == std::string::npos)
+            return (rx.size() - p > CHUNK_LINE_MAX) ? CHUNKS_BAD : CHUNKS_MORE;
+        if (eol - p > CHUNK_LINE_MAX)
+            return CHUNKS_BAD;
+
+        size_t size = 0;
+        size_t i = p;
+        for (; i < eol && std::isxdigit((unsigned char)rx[i]); ++i)
+        {
+            if (size > (~(size_t)0 >> 4))
+                return CHUNKS_BAD;
+            char c = rx[i];
+            size = size * 16 + (size_t)(c <= '9' ? c - '0' : (std::tolower(c) - 'a' + 10));
+        }
+        if (i == p || (i < eol && rx[i] != ';'))
+            return CHUNKS_BAD;
+
+        if (size == 0)
+        {
+            // trailers are dropped; the blank line ends the body
+            size_t end = rx.find("\r\n\r\n", eol);
+            if (end == std::string::npos)
+                return (rx.size() - eol > CHUNK_LINE_MAX) ? CHUNKS_BAD : CHUNKS_MORE;
+            if (end + 4 != rx.size())
+                return CHUNKS_BAD;
+            rx.erase(p);
+            return CHUNKS_DONE;
+        }
+        if (maxBody != 0 && size > maxBody - decoded)
+            return CHUNKS_TOO_BIG;
+        if (rx.size() - (eol + 2) < size + 2)
+            return CHUNKS_MORE;
+        if (rx.compare(eol + 2 + size, 2, "\r\n") != 0)
+            return CHUNKS_BAD;
+        rx.erase(eol + 2 + size, 2);
+        rx.erase(p, eol + 2 - p);
+        decoded += size;
+    }
+}
+
+// the head of a decoded chunked request: Transfer-Encoding becomes a length
+static std::string dechunked_head(const std::string& headerBlock, size_t bodyLen)
+{
+    std::string out;
+    size_t pos = 0;
+    while (pos < headerBlock.size())
+    {
+        size_t eol = headerBlock.find("\r\n", pos);
+        if (eol == std::string::npos)
+            eol = headerBlock.size();
+        std::string line = headerBlock.substr(pos, eol - pos);
+        pos = eol + 2;
+        if (asciiLower(line).compare(0, 18, "transfer-encoding:") == 0)
+            continue;
+        out += line + "\r\n";
+    }
+    std::ostringstream len;
+    len << bodyLen;
+    return out + "Content-Length: " + len.str() + "\r\n\r\n";
+}
+
 static size_t find_mem(const char* hay, size_t hayLen,
                        const char* needle, size_t needleLen,
                        size_t start)
@@ -87,15 +238,6 @@ static size_t find_mem(const char* hay, size_t hayLen,
     return (size_t)-1;
 }
 
-static std::string trimSpaces(const std::string& s)
-{
-    size_t a = 0;
-    while (a < s.size() && (s[a] == ' ' || s[a] == '\t')) a++;
-    size_t b = s.size();
-    while (b > a && (s[b - 1] == ' ' || s[b - 1] == '\t')) b--;
-    return s.substr(a, b - a);
-}
-
 static bool headerValueCI(const std::string& headerBlock,
                           const std::string& keyLower,
                           std::string& outVal)
@@ -127,6 +269,58 @@ static bool headerValueCI(const std::string& headerBlock,
     return false;
 }
 
+// value of a header line "Name: value" if it is `name` (lowercase), capped
+static bool header_line_value(const std::string& block, size_t pos, size_t eol, const char* name,
+                              std::string& out)
+{
+    size_t n = std::strlen(name);
+    if (eol - pos <= n || block[pos + n] != ':' || strncasecmp(block.c_str() + pos, name, n) != 0)
+        return false;
+    size_t v = pos + n + 1;
+    while (v < eol && (block[v] == ' ' || block[v] == '\t'))
+        ++v;
+    size_t len = eol - v < TRACE_LINE_MAX ? eol - v : TRACE_LINE_MAX;
+    out.assign(block, v, len);
+    return true;
+}
+
+// the header block is in: keep its request line for the slow log, and
+// what the access log shows of the headers (one pass, no copies of the rest)
+static void mark_headers(NetChannel& ch, const std::string& headerBlock)
+{
+    NetChannel::RequestTrace& t = ch.trace();
+    mark_once(t.headersUs);
+    if (!t.requestLine.empty())
+        return;
+    size_t eol = headerBlock.find("\r\n");
+    if (eol == std::string::npos)
+        eol = headerBlock.size();
+    t.requestLine.assign(headerBlock, 0, eol < TRACE_LINE_MAX ? eol : TRACE_LINE_MAX);
+    size_t pos = eol + 2;
+    while (pos < headerBlock.size())
+    {
+        eol = headerBlock.find("\r\n", pos);
+        if (eol == std::string::npos)
+            eol = headerBlock.size();
+        if (!header_line_value(headerBlock, pos, eol, "referer", t.referer))
+            header_line_value(headerBlock, pos, eol, "user-agent", t.userAgent);
+        pos = eol + 2;
+    }
+}
+
+// the client's address as the access log shows it
+static std::string peer_string(const struct sockaddr_storage& ss)
+{
+    char buf[INET6_ADDRSTRLEN];
+    if (ss.ss_family == AF_INET
+        && inet_ntop(AF_INET, &((const struct sockaddr_in*)&ss)->sin_addr, buf, sizeof(buf)))
+        return buf;
+    if (ss.ss_family == AF_INET6
+        && inet_ntop(AF_INET6, &((const struct sockaddr_in6*)&ss)->sin6_addr, buf, sizeof(buf)))
+        return buf;
+    return "-";
+}
+
 static bool extractBoundary(const std::string& contentType, std::string& outBoundary)
 {
     std::string low = asciiLower(contentType);
@@ -179,10 +373,34 @@ static bool parseFilenameFromDisposition(const std::string& disp, std::string& o
     return !outName.empty();
 }
 
+// end of the CGI header block: the first empty line, "\n\n" or "\n\r\n".
+// Returns the header length and sets bodyStart, or npos while incomplete.
+static std::string::size_type cgiHeaderEnd(const std::string& buf, size_t from, size_t& bodyStart)
+{
+    std::string::size_type nl = buf.find('\n', from);
+    while (nl != std::string::npos)
+    {
+        if (nl + 1 < buf.size() && buf[nl + 1] == '\n')
+        {
+            bodyStart = nl + 2;
+            return nl;
+        }
+        if (nl + 2 < buf.size() && buf[nl + 1] == '\r' && buf[nl + 2] == '\n')
+        {
+            bodyStart = nl + 3;
+            return nl;
+        }
+        nl = buf.find('\n', nl + 1);
+    }
+    return std::string::npos;
+}
+
 static bool cgiTimedOut(const CgiSession& cg)
 {
     if (!cg.active) return false;
     if (cg.timeoutSec <= 0) return false;
+    // waiting on a slow client, not on the script: the idle timeout applies
+    if (cg.paused) return false;
     std::time_t now = std::time(NULL);
     return (now - cg.startTs) >= cg.timeoutSec;
 }
@@ -197,6 +415,7 @@ PollReactor::PollReactor(const std::vector<int>& ports,
                          IByteHandler* handler)
 : _listenSockets()
 , _backlog(backlog)
+, _tlsByListen()
 , _idleTimeoutSec(idleTimeoutSec)
 , _headerTimeoutSec(headerTimeoutSec)
 , _bodyTimeoutSec(bodyTimeoutSec)
@@ -207,6 +426,13 @@ PollReactor::PollReactor(const std::vector<int>& ports,
 , _toDrop()
 , _cgiOutToClient()
 , _cgiInToClient()
+, _cgiPidToClient()
+, _childFd(-1)
+, _childWakeFd(-1)
+, _canned()
+, _fcgi()
+, _proxy()
+, _h2(maxHeaderBytes, idleTimeoutSec)
 , _handler(handler)
 {
     if (!_handler)
@@ -216,6 +442,9 @@ PollReactor::PollReactor(const std::vector<int>& ports,
 
     for (size_t i = 0; i < _listenSockets.size(); ++i)
         addPollItem(_listenSockets[i], POLLIN);
+
+    initChildWatch();
+    addPollItem(_childFd, POLLIN);
 }
 
 PollReactor::~PollReactor()
@@ -224,6 +453,8 @@ PollReactor::~PollReactor()
     {
         cleanupCgiForClient(it->second);
         cleanupUploadForClient(it->second);
+        it->second.clearTx();
+        it->second.dropTls();
         closeFd(it->first);
     }
     _channels.clear();
@@ -236,9 +467,94 @@ PollReactor::~PollReactor()
     _cgiOutToClient.clear();
     _cgiInToClient.clear();
 
+    for (std::map<int, CgiRefresh>::iterator it = _cgiRefresh.begin(); it != _cgiRefresh.end(); ++it)
+    {
+        kill(it->second.pid, SIGKILL);
+        closeFd(it->first);
+    }
+    _cgiRefresh.clear();
+
     for (size_t i = 0; i < _listenSockets.size(); ++i)
         closeFd(_listenSockets[i]);
     _listenSockets.clear();
+
+    if (_childFd >= 0)
+        closeFd(_childFd);
+    if (_childWakeFd >= 0)
+        closeFd(_childWakeFd);
+}
+
+// CGI children are reaped when they exit, not polled for: SIGCHLD is turned
+// into a readable fd in the poll set. The mask is inherited by everything we
+// spawn, which is why spawn_cgi resets it for the script.
+void PollReactor::initChildWatch()
+{
+#ifdef __linux__
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        throw std::runtime_error("sigprocmask(SIGCHLD) failed");
+    _childFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (_childFd < 0)
+        throw std::runtime_error("signalfd() failed");
+#else
+    int p[2];
+    if (pipe(p) < 0)
+        throw std::runtime_error("pipe() failed");
+    for (int i = 0; i < 2; ++i)
+    {
+        setCloExec(p[i]);
+        makeNonBlocking(p[i]);
+    }
+    _childFd = p[0];
+    _childWakeFd = p[1];
+    g_childWake = p[1];
+
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onChildSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    if (sigaction(SIGCHLD, &sa, NULL) < 0)
+        throw std::runtime_error("sigaction(SIGCHLD) failed");
+#endif
+}
+
+// Signals coalesce, so one wakeup may stand for several children: reap until
+// waitpid has nothing left. Children of aborted requests (already SIGKILLed and
+// forgotten in cleanupCgiForClient) are reaped here too.
+void PollReactor::onChildExit()
+{
+#ifdef __linux__
+    struct signalfd_siginfo si;
+    while (read(_childFd, &si, sizeof(si)) == (ssize_t)sizeof(si))
+        ;
+#else
+    char buf[64];
+    while (read(_childFd, buf, sizeof(buf)) > 0)
+        ;
+#endif
+
+    for (;;)
+    {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid <= 0)
+            break;
+
+        std::map<pid_t, int>::iterator it = _cgiPidToClient.find(pid);
+        if (it == _cgiPidToClient.end())
+            continue;
+        int clientFd = it->second;
+        _cgiPidToClient.erase(it);
+
+        std::map<int, NetChannel>::iterator chIt = _channels.find(clientFd);
+        if (chIt == _channels.end() || chIt->second.cgi().pid != pid)
+            continue;
+        chIt->second.cgi().pid = -1;
+        maybeFinalizeCgi(clientFd);
+    }
 }
 
 void PollReactor::initListeners(const std::vector<int>& ports)
@@ -339,9 +655,28 @@ void PollReactor::markDrop(int fd)
 void PollReactor::cleanupCgiForClient(NetChannel& ch)
 {
     CgiSession& cg = ch.cgi();
+    releaseCgiSlot(cg);
+    landCollapse(cg);
+    closeCgiSpool(cg);
+    closeFd(cg.bodyFd);
+    cg.bodyFd = -1;
+    cg.bodyHead.clear();
     if (!cg.active)
         return;
 
+    if (cg.fcgi)
+    {
+        _fcgi.abort(ch.sockFd());
+        cg.fcgi = false;
+        cg.upstreamDone = false;
+    }
+    if (cg.proxy)
+    {
+        _proxy.abort(ch.sockFd());
+        cg.proxy = false;
+        cg.upstreamDone = false;
+    }
+
     if (cg.fdOut >= 0)
     {
         removePollItem(cg.fdOut);
@@ -357,15 +692,206 @@ void PollReactor::cleanupCgiForClient(NetChannel& ch)
         cg.fdIn = -1;
     }
 
+    // reaped by onChildExit() once it is gone; never wait for it here
     if (cg.pid > 0)
     {
         kill(cg.pid, SIGKILL);
-        waitpid(cg.pid, NULL, 0);
+        _cgiPidToClient.erase(cg.pid);
         cg.pid = -1;
     }
+
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+    if (cgiH)
+        cgiH->abortCgi(ch.sockFd());
+
+    cg.inBody.clear();
+    cg.inOff = 0;
+    cg.bodyLeft = 0;
+    cg.outBuf.clear();
+    cg.streaming = false;
+    cg.paused = false;
     cg.active = false;
 }
 
+void PollReactor::failCgi(NetChannel& ch, int code, const char* reason)
+{
+    // part of the response is already out: all we can do is cut it short
+    bool streaming = ch.cgi().streaming;
+    mark_once(ch.trace().handledUs);
+    cleanupCgiForClient(ch);
+    ch.setInFlight(false);
+    if (streaming)
+    {
+        markDrop(ch.sockFd());
+        return;
+    }
+
+    ch.setTxShared(minimalError(code, reason));
+    ch.setCloseOnDone(true);
+    ch.setPhase(PHASE_SEND);
+    setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+}
+
+// applies the pool's poll interest changes to our poll set
+void PollReactor::syncFastCgiPoll()
+{
+    std::vector<std::pair<int, short> > changes;
+    _fcgi.takePollChanges(changes);
+    applyPoolPollChanges(changes);
+}
+
+void PollReactor::syncProxyPoll()
+{
+    std::vector<std::pair<int, short> > changes;
+    _proxy.takePollChanges(changes);
+    applyPoolPollChanges(changes);
+}
+
+void PollReactor::applyPoolPollChanges(const std::vector<std::pair<int, short> >& changes)
+{
+    for (size_t i = 0; i < changes.size(); ++i)
+    {
+        int fd = changes[i].first;
+        short events = changes[i].second;
+        if (events < 0)
+        {
+            removePollItem(fd);
+            continue;
+        }
+        bool found = false;
+        for (size_t j = 0; j < _pollSet.size() && !found; ++j)
+            found = (_pollSet[j].fd == fd);
+        if (found)
+            setPollMask(fd, events);
+        else
+            addPollItem(fd, events);
+    }
+}
+
+// FastCGI output takes the same path as a CGI child's stdout
+void PollReactor::drainFastCgiEvents()
+{
+    std::vector<FcgiEvent> events;
+    _fcgi.takeEvents(events);
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        std::map<int, NetChannel>::iterator it = _channels.find(events[i].clientFd);
+        if (it == _channels.end())
+            continue;
+        NetChannel& ch = it->second;
+        CgiSession& cg = ch.cgi();
+        if (!cg.active || !cg.fcgi)
+            continue;
+
+        if (events[i].kind == FcgiEvent::DATA)
+            feedCgiOutput(ch, events[i].data.data(), events[i].data.size());
+        else if (events[i].kind == FcgiEvent::END)
+        {
+            cg.upstreamDone = true;
+            maybeFinalizeCgi(ch.sockFd());
+        }
+        else if (events[i].kind == FcgiEvent::BUSY)
+            failCgi(ch, 503, "Service Unavailable");
+        else
+            failCgi(ch, 502, "Bad Gateway");
+    }
+    syncFastCgiPoll();
+}
+
+// a proxied response is CGI output too (the pool turns it into that)
+void PollReactor::drainProxyEvents()
+{
+    std::vector<ProxyEvent> events;
+    _proxy.takeEvents(events);
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        std::map<int, NetChannel>::iterator it = _channels.find(events[i].clientFd);
+        if (it == _channels.end())
+            continue;
+        NetChannel& ch = it->second;
+        CgiSession& cg = ch.cgi();
+        if (!cg.active || !cg.proxy)
+            continue;
+
+        if (events[i].kind == ProxyEvent::DATA)
+            feedCgiOutput(ch, events[i].data.data(), events[i].data.size());
+        else if (events[i].kind == ProxyEvent::END)
+        {
+            cg.upstreamDone = true;
+            maybeFinalizeCgi(ch.sockFd());
+        }
+        else
+            failCgi(ch, 502, "Bad Gateway");
+    }
+    syncProxyPoll();
+}
+
+// prior knowledge: the connection starts with the HTTP/2 preface
+bool PollReactor::tryHttp2Preface(NetChannel& ch)
+{
+    if (ch.tls())
+        return false;
+    const std::string& rx = ch.rxBuffer();
+    size_t n = rx.size() < H2_PREFACE_LEN ? rx.size() : H2_PREFACE_LEN;
+    if (rx.compare(0, n, H2_PREFACE, n) != 0)
+        return false;
+    if (n < H2_PREFACE_LEN)
+        return true;   // wait for the rest of it
+
+    const int fd = ch.sockFd();
+    const int acceptFd = ch.acceptFd();
+    std::string have;
+    have.swap(ch.rxBuffer());
+    _channels.erase(fd);
+    _h2.adopt(fd, acceptFd, have);
+    return true;
+}
+
+// `Upgrade: h2c` on a request without a body: the mux answers 101 and
+// serves this request as stream 1
+bool PollReactor::tryHttp2Upgrade(NetChannel& ch, const std::string& headerBlock, size_t hdrEnd)
+{
+    std::string upgrade, settings;
+    if (ch.tls())
+        return false;
+    if (!headerValueCI(headerBlock, "upgrade", upgrade) || !headerValueCI(headerBlock, "http2-settings", settings))
+        return false;
+    upgrade = asciiLower(upgrade);
+    if (upgrade != "h2c" && upgrade.find("h2c,") == std::string::npos
+        && upgrade.find(", h2c") == std::string::npos)
+        return false;
+    if (ch.hasReadyMsg())
+        return false;
+
+    const int fd = ch.sockFd();
+    const int acceptFd = ch.acceptFd();
+    std::string request = ch.rxBuffer().substr(0, hdrEnd + 4);
+    std::string rest = ch.rxBuffer().substr(hdrEnd + 4);
+    _channels.erase(fd);
+    _h2.adoptUpgrade(fd, acceptFd, request, settings, rest);
+    return true;
+}
+
+// the mux's poll changes, and its new stream sockets served as HTTP/1 clients
+void PollReactor::syncHttp2()
+{
+    std::vector<std::pair<int, short> > changes;
+    _h2.takePollChanges(changes);
+    applyPoolPollChanges(changes);
+
+    std::vector<std::pair<int, int> > streams;
+    _h2.takeStreams(streams);
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        int fd = streams[i].first;
+        _channels.insert(std::make_pair(fd, NetChannel(fd, streams[i].second)));
+        NetChannel& ch = _channels[fd];
+        ch.setPhase(PHASE_RECV_HEADERS);
+        ch.markSeen();
+        addPollItem(fd, POLLIN);
+    }
+}
+
 void PollReactor::cleanupUploadForClient(NetChannel& ch)
 {
     NetChannel::UploadSession& up = ch.upload();
@@ -384,6 +910,42 @@ void PollReactor::cleanupUploadForClient(NetChannel& ch)
     up.off = 0;
 }
 
+// the request on `ch` is over (answered, or the client is gone: 499)
+void PollReactor::accountRequest(NetChannel& ch)
+{
+    NetChannel::RequestTrace& t = ch.trace();
+    if (!t.open)
+        return;
+    long long now = metrics_now_us();
+    int status = t.status ? t.status : 499;
+
+    // a step never reached (no body, nothing sent...) takes the time of the
+    // next one; one reached before the previous step counts as that step
+    long long marks[REQ_PHASES + 1] = { t.acceptUs, t.headersUs, t.bodyUs, t.dispatchUs,
+                                        t.handledUs, t.firstByteUs, t.lastByteUs };
+    if (marks[REQ_PHASES] == 0)
+        marks[REQ_PHASES] = now;
+    for (int i = REQ_PHASES - 1; i >= 0; --i)
+        if (marks[i] == 0)
+            marks[i] = marks[i + 1];
+    long long phaseUs[REQ_PHASES];
+    for (int i = 0; i < REQ_PHASES; ++i)
+    {
+        if (marks[i + 1] < marks[i])
+            marks[i + 1] = marks[i];
+        phaseUs[i] = marks[i + 1] - marks[i];
+    }
+
+    server_metrics().recordRequest(t.server, t.location, status, t.bytesIn, t.bytesOut,
+                                   now - t.startUs, phaseUs);
+    long long totalUs = marks[REQ_PHASES] - marks[0];
+    if (t.slowMs > 0 && totalUs >= (long long)t.slowMs * 1000)
+        log_slow_request(t, status, totalUs, phaseUs);
+    if (!t.accessLog.empty())
+        access_log().record(t, status, totalUs, phaseUs, ch.peerAddr());
+    t = NetChannel::RequestTrace();
+}
+
 void PollReactor::flushDrops()
 {
     for (std::set<int>::iterator it = _toDrop.begin(); it != _toDrop.end(); ++it)
@@ -397,8 +959,13 @@ void PollReactor::flushDrops()
           
 
             
+            accountRequest(chIt->second);
+            dequeueCgiWaiter(chIt->second);
+            leaveCollapse(chIt->second);
             cleanupCgiForClient(chIt->second);
             cleanupUploadForClient(chIt->second);
+            chIt->second.clearTx();
+            chIt->second.dropTls();
         }
 
         removePollItem(fd);
@@ -412,7 +979,9 @@ void PollReactor::acceptBurst(int listenFd)
 {
     while (true)
     {
-        int clientFd = accept(listenFd, 0, 0);
+        struct sockaddr_storage peer;
+        socklen_t peerLen = sizeof(peer);
+        int clientFd = accept(listenFd, (struct sockaddr*)&peer, &peerLen);
         if (clientFd < 0)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -431,10 +1000,89 @@ void PollReactor::acceptBurst(int listenFd)
         NetChannel& ch = _channels[clientFd];
         ch.setPhase(PHASE_RECV_HEADERS);
         ch.markSeen();
+        ch.setPeerAddr(peer_string(peer));
+        ++server_metrics().connections;
+
+        std::map<int, SSL_CTX*>::const_iterator tls = _tlsByListen.find(listenFd);
+        if (tls != _tlsByListen.end())
+        {
+            SSL* ssl = SSL_new(tls->second);
+            if (!ssl || SSL_set_fd(ssl, clientFd) != 1)
+            {
+                if (ssl)
+                    SSL_free(ssl);
+                _channels.erase(clientFd);
+                closeFd(clientFd);
+                continue;
+            }
+            SSL_set_accept_state(ssl);
+            ch.setTls(ssl);
+            ch.setPhase(PHASE_TLS_HANDSHAKE);
+        }
         addPollItem(clientFd, POLLIN);
     }
 }
 
+void PollReactor::enableTls(const TlsContexts& tls)
+{
+    for (size_t i = 0; i < _listenSockets.size(); ++i)
+    {
+        SSL_CTX* ctx = tls.forPort(get_listen_port(_listenSockets[i]));
+        if (ctx)
+            _tlsByListen[_listenSockets[i]] = ctx;
+    }
+}
+
+// the handshake runs on the channel's own poll events; once it is done the
+// channel reads its request like any other
+void PollReactor::continueTlsHandshake(NetChannel& ch)
+{
+    short events = 0;
+    int r = ch.continueHandshake(events);
+    if (r < 0)
+    {
+        ++server_metrics().tlsHandshakeFailures;
+        markDrop(ch.sockFd());
+        return;
+    }
+    ch.markSeen();
+    if (r == 0)
+    {
+        setPollMask(ch.sockFd(), events);
+        return;
+    }
+    ch.setPhase(PHASE_RECV_HEADERS);
+    setPollMask(ch.sockFd(), POLLIN);
+}
+
+// Bytes OpenSSL already decrypted are not seen by poll(). Reads take a whole
+// record at a time so there are rarely any, but a read capped by the CGI
+// stdin window can leave some: those channels are read again here.
+void PollReactor::pumpTlsPending()
+{
+    std::vector<int> ready;
+    for (std::map<int, NetChannel>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+    {
+        SSL* ssl = it->second.tls();
+        if (ssl && it->second.phase() != PHASE_TLS_HANDSHAKE && SSL_pending(ssl) > 0)
+            ready.push_back(it->first);
+    }
+    for (size_t i = 0; i < ready.size(); ++i)
+    {
+        if (_toDrop.count(ready[i]))
+            continue;
+        for (size_t j = 0; j < _pollSet.size(); ++j)
+        {
+            if (_pollSet[j].fd == ready[i])
+            {
+                if (_pollSet[j].events & POLLIN)
+                    onReadable(ready[i]);
+                break;
+            }
+        }
+    }
+}
+
 std::string::size_type PollReactor::findHdrEnd(const std::string& buf)
 {
     return buf.find("\r\n\r\n");
@@ -487,14 +1135,19 @@ bool PollReactor::parseFramingHeaders(const std::string& headerBlock,
         }
     }
 
-    if (outChunked)
+    // both: a smuggling attempt, or a broken client
+    if (outChunked && outHasLen)
         return false;
 
     return true;
 }
 
-std::string PollReactor::minimalError(int code, const char* reason)
+SharedBuffer PollReactor::minimalError(int code, const char* reason)
 {
+    std::map<int, SharedBuffer>::const_iterator it = _canned.find(code);
+    if (it != _canned.end())
+        return it->second;
+
     std::string body = reason;
     body += "\n";
     
@@ -511,7 +1164,10 @@ std::string PollReactor::minimalError(int code, const char* reason)
     r += "Connection: close\r\n";
     r += "\r\n";
     r += body;
-    return r;
+
+    SharedBuffer out(r);
+    _canned[code] = out;
+    return out;
 }
 
 bool PollReactor::tryStartAsyncUpload(NetChannel& ch, std::string& msg)
@@ -609,15 +1265,17 @@ bool PollReactor::tryStartAsyncUpload(NetChannel& ch, std::string& msg)
         return false;
 
     int outFd = -1;
-    std::string errBytes;
-    if (!rb->planUploadFd(ch.acceptFd(), uri, mpFilename, outFd, errBytes))
+    SharedBuffer errBytes;
+    RouteLabel route;
+    if (!rb->planUploadFd(ch.acceptFd(), uri, mpFilename, outFd, errBytes, route))
         return false;
+    set_route(ch, route);
 
     if (outFd < 0)
     {
-        ch.txBuffer() = errBytes.empty()
+        ch.setTxShared(errBytes.empty()
             ? minimalError(500, "Internal Server Error")
-            : errBytes;
+            : errBytes);
         ch.setCloseOnDone(true);
         ch.setPhase(PHASE_SEND);
         setPollMask(ch.sockFd(), POLLIN | POLLOUT);
@@ -631,6 +1289,7 @@ bool PollReactor::tryStartAsyncUpload(NetChannel& ch, std::string& msg)
     up.dataStart = dataStart;
     up.dataEnd = dataEnd;
     up.off = 0;
+    up.startUs = metrics_now_us();
 
     ch.setInFlight(true);
 
@@ -651,6 +1310,11 @@ void PollReactor::pumpAsyncUploads()
         size_t total = (up.dataEnd > up.dataStart) ? (up.dataEnd - up.dataStart) : 0;
         if (up.off >= total)
         {
+            ServerMetrics& m = server_metrics();
+            ++m.uploads;
+            m.uploadBytes += total;
+            m.uploadUs += metrics_now_us() - up.startUs;
+            mark_once(ch.trace().handledUs);
             closeFd(up.fd);
             up.fd = -1;
             up.active = false;
@@ -685,7 +1349,7 @@ void PollReactor::pumpAsyncUploads()
         up.active = false;
         up.raw.clear();
         ch.setInFlight(false);
-        ch.txBuffer() = minimalError(500, "Internal Server Error");
+        ch.setTxShared(minimalError(500, "Internal Server Error"));
         ch.setCloseOnDone(true);
         ch.setPhase(PHASE_SEND);
         setPollMask(ch.sockFd(), POLLIN | POLLOUT);
@@ -694,77 +1358,781 @@ void PollReactor::pumpAsyncUploads()
 
 
 
-void PollReactor::dispatchIfIdle(NetChannel& ch)
+// Wires a spawned script into the poll set. `st.body` is what we already
+// have of the request body; `bodyLeft` more bytes are still to be read from
+// the client and go to the script's stdin as they arrive (readCgiBody).
+void PollReactor::beginCgi(NetChannel& ch, CgiStartResult& st, size_t bodyLeft)
 {
-    if (ch.inFlight())
-        return;
-    if (ch.phase() == PHASE_SEND || !ch.txBuffer().empty())
-        return;
-    if (!ch.hasReadyMsg())
-        return;
+    if (bodyLeft == 0)
+        mark_once(ch.trace().bodyUs);
+    mark_once(ch.trace().dispatchUs);
 
-    std::string msg = ch.popReadyMsg();
+    CgiSession& cg = ch.cgi();
+    cg.active = true;
+    cg.pid = st.pid;
+    cg.fdIn = st.fdIn;
+    cg.fdOut = st.fdOut;
+    cg.inBody.swap(st.body);
+    cg.inOff = 0;
+    cg.bodyLeft = bodyLeft;
+    cg.outBuf.clear();
+    cg.hdrScan = 0;
+    cg.streaming = false;
+    cg.paused = false;
+    cg.startTs = std::time(NULL);
+    cg.timeoutSec = st.timeoutSec;
+    cg.bufferSize = st.bufferSize;
+
+    _cgiOutToClient[cg.fdOut] = ch.sockFd();
+    if (cg.fdIn >= 0)
+        _cgiInToClient[cg.fdIn] = ch.sockFd();
+    _cgiPidToClient[cg.pid] = ch.sockFd();
+    ++server_metrics().cgiSpawns;
+
+    addPollItem(cg.fdOut, POLLIN | POLLHUP);
+    if (cg.fdIn < 0)
+        ;   // stdin is a file (cgi_body_file)
+    else if (!cg.inBody.empty())
+        addPollItem(cg.fdIn, POLLOUT);
+    else if (cg.bodyLeft > 0)
+        addPollItem(cg.fdIn, 0);
+    else
+        closeCgiIn(cg);
 
-    // Try async CGI first
-    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
-    if (cgiH)
-    {
-        CgiStartResult st = cgiH->tryStartCgi(ch.acceptFd(), msg);
-        if (st.isCgi)
-        {
-            if (!st.ok)
-            {
-                ch.txBuffer() = st.errResponseBytes;
-                ch.setCloseOnDone(true);
-                ch.setPhase(PHASE_SEND);
-                setPollMask(ch.sockFd(), POLLIN | POLLOUT);
-                return;
-            }
+    ch.setInFlight(true);
+    setCgiClientMask(ch);
+}
 
-            CgiSession& cg = ch.cgi();
-            cg.active = true;
-            cg.pid = st.pid;
-            cg.fdIn = st.fdIn;
-            cg.fdOut = st.fdOut;
-            cg.inBody = st.body;
-            cg.inOff = 0;
-            cg.outBuf.clear();
-            cg.startTs = std::time(NULL);
-            cg.timeoutSec = 30;
+// Called as soon as the headers of a request with a body are in. A CGI
+// request is routed and spawned right away and its body piped through
+// instead of being collected in rxBuffer first. False: handle it as before.
+bool PollReactor::tryStartStreamedCgi(NetChannel& ch, size_t hdrEnd, size_t bodyLen)
+{
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+    if (!cgiH)
+        return false;
+    if (ch.inFlight() || ch.hasReadyMsg() || ch.hasPendingTx())
+        return false;
+    if (_maxBodyBytes != 0 && bodyLen > _maxBodyBytes)
+        return false;
 
-            _cgiOutToClient[cg.fdOut] = ch.sockFd();
-            _cgiInToClient[cg.fdIn] = ch.sockFd();
+    std::string& rx = ch.rxBuffer();
+    size_t bodyStart = hdrEnd + 4;
+    if (rx.size() > bodyStart + bodyLen)
+        return false;
 
-            addPollItem(cg.fdOut, POLLIN | POLLHUP);
-            if (!cg.inBody.empty())
-                addPollItem(cg.fdIn, POLLOUT);
-            else
+    CgiStartResult st = cgiH->tryStartCgi(ch.acceptFd(), ch.sockFd(), rx.substr(0, bodyStart), true, 0);
+    if (!st.isCgi)
+        return false;
+    set_route(ch, st.route);
+    if (st.deferred)
+    {
+        // no free slot: collect the body and let dispatchIfIdle() queue it
+        CgiLimit& lim = cgiLimitFor(st);
+        if (lim.running >= lim.max || !lim.waiting.empty())
+            return false;
+        st = cgiH->tryStartCgi(ch.acceptFd(), ch.sockFd(), rx.substr(0, bodyStart), true, CGI_START_ADMITTED);
+        if (!st.isCgi)
+            return false;
+    }
+
+    if (st.bodyFile)
+    {
+        if (!beginCgiBodyFile(ch, st, rx.substr(0, bodyStart), rx.substr(bodyStart), bodyLen))
+            return false;
+        ch.resetFraming();
+        rx.clear();
+        return true;
+    }
+
+    ch.resetFraming();
+    if (!st.ok)
+    {
+        rx.clear();
+        ch.setTxShared(st.errResponseBytes);
+        ch.setCloseOnDone(true);
+        ch.setPhase(PHASE_SEND);
+        setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+        return true;
+    }
+
+    st.body.assign(rx, bodyStart, std::string::npos);
+    rx.clear();
+    claimCgiSlot(ch, st);
+    beginCgi(ch, st, bodyLen - st.body.size());
+    return true;
+}
+
+// more of a streamed request body; at most CGI_STDIN_WINDOW bytes wait for the script
+void PollReactor::readCgiBody(NetChannel& ch)
+{
+    CgiSession& cg = ch.cgi();
+    const int fd = ch.sockFd();
+
+    if (cg.bodyFd >= 0)
+    {
+        readCgiBodyFile(ch);
+        return;
+    }
+
+    size_t queued = cg.inBody.size() - cg.inOff;
+    if (queued >= CGI_STDIN_WINDOW)
+    {
+        setCgiClientMask(ch);
+        return;
+    }
+    size_t want = CGI_STDIN_WINDOW - queued;
+    if (want > cg.bodyLeft)
+        want = cg.bodyLeft;
+
+    char buf[CGI_STDIN_WINDOW];
+    ssize_t n = ch.recvSome(buf, want);
+    if (n > 0)
+    {
+        ch.markSeen();
+        cg.startTs = std::time(NULL);
+        cg.bodyLeft -= (size_t)n;
+        if (cg.bodyLeft == 0)
+            mark_once(ch.trace().bodyUs);
+
+        // stdin already closed by the script: the rest is read and dropped
+        if (cg.fdIn >= 0)
+        {
+            if (cg.inOff > 0)
             {
-                removePollItem(cg.fdIn);
-                _cgiInToClient.erase(cg.fdIn);
-                closeFd(cg.fdIn);
-                cg.fdIn = -1;
+                cg.inBody.erase(0, cg.inOff);
+                cg.inOff = 0;
             }
+            cg.inBody.append(buf, (size_t)n);
+            setPollMask(cg.fdIn, POLLOUT);
+        }
+        setCgiClientMask(ch);
+        return;
+    }
+
+    if (n == 0)
+    {
+        markDrop(fd);
+        return;
+    }
+
+    if (channel_failed(ch))
+        markDrop(fd);
+}
+
+// cgi_body_file: the body goes to an unlinked temp file while it arrives and
+// the script is only started once all of it is there, with that file as its
+// stdin. False (nothing changed): the body takes the usual way.
+bool PollReactor::beginCgiBodyFile(NetChannel& ch, CgiStartResult& st, const std::string& head,
+                                   const std::string& have, size_t bodyLen)
+{
+    int fd = openSpoolFile(CGI_SPOOL_DIR);
+    if (fd < 0)
+        return false;
+    if (!have.empty() && write(fd, have.data(), have.size()) != (ssize_t)have.size())
+    {
+        closeFd(fd);
+        return false;
+    }
+
+    claimCgiSlot(ch, st);
+    CgiSession& cg = ch.cgi();
+    cg.active = true;
+    cg.pid = -1;
+    cg.fdIn = -1;
+    cg.fdOut = -1;
+    cg.inBody.clear();
+    cg.inOff = 0;
+    cg.bodyLeft = bodyLen - have.size();
+    cg.outBuf.clear();
+    cg.hdrScan = 0;
+    cg.streaming = false;
+    cg.paused = false;
+    cg.startTs = std::time(NULL);
+    cg.timeoutSec = st.timeoutSec;
+    cg.bodyFd = fd;
+    cg.bodyHead = head;
+
+    ch.setInFlight(true);
+    if (cg.bodyLeft == 0)
+        startCgiBodyFile(ch);
+    else
+        setCgiClientMask(ch);
+    return true;
+}
+
+void PollReactor::readCgiBodyFile(NetChannel& ch)
+{
+    CgiSession& cg = ch.cgi();
+    const int fd = ch.sockFd();
 
-            ch.setInFlight(true);
-            setPollMask(ch.sockFd(), POLLIN);
+    char buf[CGI_STDIN_WINDOW];
+    size_t want = sizeof(buf);
+    if (want > cg.bodyLeft)
+        want = cg.bodyLeft;
+
+    ssize_t n = ch.recvSome(buf, want);
+    if (n > 0)
+    {
+        ch.markSeen();
+        cg.startTs = std::time(NULL);
+        if (write(cg.bodyFd, buf, (size_t)n) != n)
+        {
+            failCgi(ch, 500, "Internal Server Error");
             return;
         }
+        cg.bodyLeft -= (size_t)n;
+        if (cg.bodyLeft == 0)
+            startCgiBodyFile(ch);
+        return;
     }
 
+    if (n == 0)
+    {
+        markDrop(fd);
+        return;
+    }
+
+    if (channel_failed(ch))
+        markDrop(fd);
+}
+
+void PollReactor::startCgiBodyFile(NetChannel& ch)
+{
+    CgiSession& cg = ch.cgi();
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+    if (!cgiH)
+    {
+        failCgi(ch, 500, "Internal Server Error");
+        return;
+    }
+
+    CgiStartResult st = cgiH->startCgiWithStdin(ch.acceptFd(), ch.sockFd(), cg.bodyHead, cg.bodyFd);
+    closeFd(cg.bodyFd);
+    cg.bodyFd = -1;
+    cg.bodyHead.clear();
+    if (!st.ok)
+    {
+        failCgi(ch, 502, "Bad Gateway");
+        return;
+    }
+    beginCgi(ch, st, 0);
+}
+
+void PollReactor::closeCgiIn(CgiSession& cg)
+{
+    if (cg.fdIn < 0)
+        return;
+    removePollItem(cg.fdIn);
+    _cgiInToClient.erase(cg.fdIn);
+    closeFd(cg.fdIn);
+    cg.fdIn = -1;
+    cg.inBody.clear();
+    cg.inOff = 0;
+}
+
+// client interest while a script runs: read while the body window has room
+// (or to notice a hangup once the body is in), write while output is queued
+void PollReactor::setCgiClientMask(NetChannel& ch)
+{
+    CgiSession& cg = ch.cgi();
+    short ev = 0;
+    if (cg.bodyLeft == 0 || cg.inBody.size() - cg.inOff < CGI_STDIN_WINDOW)
+        ev |= POLLIN;
+    if (ch.hasPendingTx())
+        ev |= POLLOUT;
+    setPollMask(ch.sockFd(), ev);
+}
+
+void PollReactor::dispatchIfIdle(NetChannel& ch)
+{
+    if (ch.inFlight())
+        return;
+    if (ch.phase() == PHASE_SEND || ch.hasPendingTx())
+        return;
+    if (!ch.hasReadyMsg())
+        return;
+
+    std::string msg = ch.popReadyMsg();
+
+    // Try async CGI first
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+    if (cgiH)
+    {
+        CgiStartResult st = cgiH->tryStartCgi(ch.acceptFd(), ch.sockFd(), msg, false, 0);
+        if (st.isCgi)
+        {
+            set_route(ch, st.route);
+            runCgiStart(ch, st, msg);
+            return;
+        }
+    }
+
+    serveMessage(ch, msg);
+}
+
+// everything that is not a CGI: async upload, or the synchronous handler
+void PollReactor::serveMessage(NetChannel& ch, std::string& msg)
+{
+    mark_once(ch.trace().dispatchUs);
     if (tryStartAsyncUpload(ch, msg))
         return;
 
-    ch.setInFlight(true);
-    ByteReply rep = _handler->handleBytes(ch.acceptFd(), msg);
-    ch.setInFlight(false);
+    ch.setInFlight(true);
+    ByteReply rep = _handler->handleBytes(ch.acceptFd(), msg);
+    ch.setInFlight(false);
+    mark_once(ch.trace().handledUs);
+    set_route(ch, rep.route);
+
+    ch.txBuffer() = rep.bytes;
+    ch.queueShared(rep.shared);
+    for (size_t i = 0; i < rep.parts.size(); ++i)
+        ch.queuePart(rep.parts[i]);
+    ch.setCloseOnDone(rep.closeAfterWrite);
+    ch.setPhase(PHASE_SEND);
+    setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+}
+
+void PollReactor::runCgiStart(NetChannel& ch, CgiStartResult& st, std::string& msg)
+{
+    if (st.joined)
+        joinCollapse(ch, st, msg);
+    else if (st.deferred)
+        admitCgi(ch, st, msg);
+    else
+        startCgi(ch, st);
+}
+
+void PollReactor::startCgi(NetChannel& ch, CgiStartResult& st)
+{
+    mark_once(ch.trace().dispatchUs);
+    if (!st.ok)
+    {
+        if (st.refreshFdOut >= 0)
+            startCgiRefresh(st);
+        ch.setTxShared(st.errResponseBytes);
+        ch.setCloseOnDone(true);
+        ch.setPhase(PHASE_SEND);
+        setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+        return;
+    }
+
+    claimCgiSlot(ch, st);
+    ch.cgi().collapseKey = st.collapseKey;
+
+    if (!st.fcgiPass.empty())
+    {
+        CgiSession& cg = ch.cgi();
+        cg.active = true;
+        cg.fcgi = true;
+        cg.upstreamDone = false;
+        cg.pid = -1;
+        cg.fdIn = -1;
+        cg.fdOut = -1;
+        cg.outBuf.clear();
+        cg.hdrScan = 0;
+        cg.streaming = false;
+        cg.paused = false;
+        cg.startTs = std::time(NULL);
+        cg.timeoutSec = st.timeoutSec;
+        cg.bufferSize = st.bufferSize;
+
+        ch.setInFlight(true);
+        setPollMask(ch.sockFd(), POLLIN);
+        ++server_metrics().fastcgiRequests;
+
+        _fcgi.submit(ch.sockFd(), st.fcgiPass, st.fcgiParams, st.body);
+        drainFastCgiEvents();
+        return;
+    }
+
+    if (!st.proxyAddress.empty())
+    {
+        CgiSession& cg = ch.cgi();
+        cg.active = true;
+        cg.proxy = true;
+        cg.upstreamDone = false;
+        cg.pid = -1;
+        cg.fdIn = -1;
+        cg.fdOut = -1;
+        cg.outBuf.clear();
+        cg.hdrScan = 0;
+        cg.streaming = false;
+        cg.paused = false;
+        cg.startTs = std::time(NULL);
+        cg.timeoutSec = st.timeoutSec;
+        cg.bufferSize = st.bufferSize;
+
+        ch.setInFlight(true);
+        setPollMask(ch.sockFd(), POLLIN);
+        ++server_metrics().proxyRequests;
+
+        _proxy.submit(ch.sockFd(), st.proxyAddress, st.proxyAddr, st.proxyAddrLen,
+                      st.proxyRequest, st.proxyConnectTimeoutSec);
+        drainProxyEvents();
+        return;
+    }
+
+    beginCgi(ch, st, 0);
+}
+
+// limits of a location, refreshed from its config on every request
+PollReactor::CgiLimit& PollReactor::cgiLimitFor(const CgiStartResult& st)
+{
+    CgiLimit& lim = _cgiLimits[st.limitKey];
+    lim.max = st.maxConcurrent;
+    lim.queueSize = st.queueSize;
+    lim.queueTimeoutSec = st.queueTimeoutSec;
+    return lim;
+}
+
+static int retry_after(int queueTimeoutSec)
+{
+    return queueTimeoutSec > 0 ? queueTimeoutSec : 1;
+}
+
+// cgi_max_concurrent: start now if the location has a free slot and nobody
+// is ahead in its queue; else wait in the queue (cgi_queue_size entries,
+// cgi_queue_timeout seconds); else 503 straight away.
+void PollReactor::admitCgi(NetChannel& ch, CgiStartResult& st, std::string& msg)
+{
+    CgiLimit& lim = cgiLimitFor(st);
+
+    if (lim.running < lim.max && lim.waiting.empty())
+    {
+        ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+        CgiStartResult go = cgiH->tryStartCgi(ch.acceptFd(), ch.sockFd(), msg, false, CGI_START_ADMITTED);
+        if (go.isCgi)
+            runCgiStart(ch, go, msg);
+        else
+            serveMessage(ch, msg);
+        return;
+    }
+
+    if (lim.waiting.size() >= lim.queueSize)
+    {
+        rejectBusy(ch, retry_after(lim.queueTimeoutSec));
+        return;
+    }
+
+    CgiWaiter w;
+    w.clientFd = ch.sockFd();
+    w.msg.swap(msg);
+    w.deadline = 0;
+    if (lim.queueTimeoutSec > 0)
+        w.deadline = std::time(NULL) + lim.queueTimeoutSec;
+    lim.waiting.push_back(w);
+
+    CgiSession& cg = ch.cgi();
+    cg.limitKey = st.limitKey;
+    cg.queued = true;
+
+    // keep reading only to notice a hangup
+    ch.setInFlight(true);
+    setPollMask(ch.sockFd(), POLLIN);
+}
+
+void PollReactor::claimCgiSlot(NetChannel& ch, const CgiStartResult& st)
+{
+    if (st.limitKey.empty())
+        return;
+    ch.cgi().limitKey = st.limitKey;
+    cgiLimitFor(st).running++;
+}
+
+// the script is done or gone; its slot goes to the queue on the next pump
+void PollReactor::releaseCgiSlot(CgiSession& cg)
+{
+    if (cg.limitKey.empty() || cg.queued)
+        return;
+    std::map<std::string, CgiLimit>::iterator it = _cgiLimits.find(cg.limitKey);
+    if (it != _cgiLimits.end() && it->second.running > 0)
+        it->second.running--;
+    cg.limitKey.clear();
+}
+
+void PollReactor::dequeueCgiWaiter(NetChannel& ch)
+{
+    CgiSession& cg = ch.cgi();
+    if (!cg.queued)
+        return;
+
+    std::map<std::string, CgiLimit>::iterator it = _cgiLimits.find(cg.limitKey);
+    if (it != _cgiLimits.end())
+    {
+        std::deque<CgiWaiter>& q = it->second.waiting;
+        for (std::deque<CgiWaiter>::iterator w = q.begin(); w != q.end(); ++w)
+        {
+            if (w->clientFd == ch.sockFd())
+            {
+                q.erase(w);
+                break;
+            }
+        }
+    }
+    cg.queued = false;
+    cg.limitKey.clear();
+}
+
+// expires queued requests past cgi_queue_timeout (503), then hands free
+// slots to the oldest waiters
+void PollReactor::pumpCgiQueues()
+{
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+    if (!cgiH)
+        return;
+
+    // joined a run whose answer could not be shared: each runs its own
+    while (!_cgiRetry.empty())
+    {
+        CgiWaiter next;
+        next.clientFd = _cgiRetry.front().clientFd;
+        next.msg.swap(_cgiRetry.front().msg);
+        _cgiRetry.pop_front();
+
+        std::map<int, NetChannel>::iterator chIt = _channels.find(next.clientFd);
+        if (chIt == _channels.end())
+            continue;
+        NetChannel& ch = chIt->second;
+        ch.cgi().joined = false;
+        ch.cgi().collapseKey.clear();
+        ch.setInFlight(false);
+        if (_toDrop.count(next.clientFd))
+            continue;
+
+        CgiStartResult st = cgiH->tryStartCgi(ch.acceptFd(), ch.sockFd(), next.msg, false, CGI_START_ALONE);
+        if (st.isCgi)
+            runCgiStart(ch, st, next.msg);
+        else
+            serveMessage(ch, next.msg);
+    }
+
+    const std::time_t now = std::time(NULL);
+
+    for (std::map<std::string, CgiLimit>::iterator it = _cgiLimits.begin(); it != _cgiLimits.end(); ++it)
+    {
+        CgiLimit& lim = it->second;
+
+        std::deque<CgiWaiter>::iterator w = lim.waiting.begin();
+        while (w != lim.waiting.end())
+        {
+            if (w->deadline == 0 || now < w->deadline)
+            {
+                ++w;
+                continue;
+            }
+            std::map<int, NetChannel>::iterator chIt = _channels.find(w->clientFd);
+            w = lim.waiting.erase(w);
+            if (chIt == _channels.end())
+                continue;
+            chIt->second.cgi().queued = false;
+            chIt->second.cgi().limitKey.clear();
+            rejectBusy(chIt->second, retry_after(lim.queueTimeoutSec));
+        }
+
+        while (lim.running < lim.max && !lim.waiting.empty())
+        {
+            CgiWaiter next;
+            next.clientFd = lim.waiting.front().clientFd;
+            next.msg.swap(lim.waiting.front().msg);
+            lim.waiting.pop_front();
+
+            std::map<int, NetChannel>::iterator chIt = _channels.find(next.clientFd);
+            if (chIt == _channels.end())
+                continue;
+            NetChannel& ch = chIt->second;
+            ch.cgi().queued = false;
+            ch.cgi().limitKey.clear();
+            ch.setInFlight(false);
+            if (_toDrop.count(next.clientFd))
+                continue;
+
+            CgiStartResult st = cgiH->tryStartCgi(ch.acceptFd(), ch.sockFd(), next.msg, false, CGI_START_ADMITTED);
+            if (st.isCgi)
+                runCgiStart(ch, st, next.msg);
+            else
+                serveMessage(ch, next.msg);
+        }
+    }
+}
+
+// cgi_collapse: an identical GET is already running; wait for its answer
+void PollReactor::joinCollapse(NetChannel& ch, CgiStartResult& st, std::string& msg)
+{
+    CgiWaiter w;
+    w.clientFd = ch.sockFd();
+    w.msg.swap(msg);
+    w.deadline = 0;
+    _cgiJoined[st.collapseKey].push_back(w);
+
+    CgiSession& cg = ch.cgi();
+    cg.collapseKey = st.collapseKey;
+    cg.joined = true;
+
+    ch.setInFlight(true);
+    setPollMask(ch.sockFd(), POLLIN);
+}
+
+// the leader is done or gone: everyone who joined gets its answer, or runs
+// on its own (next pump) if there is nothing they may share
+void PollReactor::landCollapse(CgiSession& cg)
+{
+    if (cg.collapseKey.empty() || cg.joined)
+        return;
+    std::string key;
+    key.swap(cg.collapseKey);
+
+    SharedBuffer reply;
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+    bool ok = cgiH && cgiH->takeCollapsed(key, reply);
+
+    std::map<std::string, std::deque<CgiWaiter> >::iterator it = _cgiJoined.find(key);
+    if (it == _cgiJoined.end())
+        return;
+    std::deque<CgiWaiter> waiters;
+    waiters.swap(it->second);
+    _cgiJoined.erase(it);
+
+    for (size_t i = 0; i < waiters.size(); ++i)
+    {
+        std::map<int, NetChannel>::iterator chIt = _channels.find(waiters[i].clientFd);
+        if (chIt == _channels.end())
+            continue;
+        if (!ok)
+        {
+            // still joined until the pump runs it, so a drop can take it back out
+            _cgiRetry.push_back(waiters[i]);
+            continue;
+        }
+        chIt->second.cgi().joined = false;
+        chIt->second.cgi().collapseKey.clear();
+        replyNow(chIt->second, reply);
+    }
+}
+
+void PollReactor::leaveCollapse(NetChannel& ch)
+{
+    CgiSession& cg = ch.cgi();
+    if (!cg.joined)
+        return;
+
+    std::map<std::string, std::deque<CgiWaiter> >::iterator it = _cgiJoined.find(cg.collapseKey);
+    if (it != _cgiJoined.end())
+    {
+        for (std::deque<CgiWaiter>::iterator w = it->second.begin(); w != it->second.end(); ++w)
+        {
+            if (w->clientFd == ch.sockFd())
+            {
+                it->second.erase(w);
+                break;
+            }
+        }
+    }
+    for (std::deque<CgiWaiter>::iterator w = _cgiRetry.begin(); w != _cgiRetry.end(); ++w)
+    {
+        if (w->clientFd == ch.sockFd())
+        {
+            _cgiRetry.erase(w);
+            break;
+        }
+    }
+    cg.joined = false;
+    cg.collapseKey.clear();
+}
+
+void PollReactor::startCgiRefresh(const CgiStartResult& st)
+{
+    CgiRefresh& r = _cgiRefresh[st.refreshFdOut];
+    r.id = st.refreshId;
+    r.pid = st.refreshPid;
+    r.out.clear();
+    r.startTs = std::time(NULL);
+    r.timeoutSec = st.timeoutSec;
+    addPollItem(st.refreshFdOut, POLLIN);
+}
+
+void PollReactor::onCgiRefreshReadable(int fd)
+{
+    CgiRefresh& r = _cgiRefresh[fd];
+    char buf[65536];
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0)
+        {
+            if (r.out.size() + (size_t)n > CGI_REFRESH_MAX_BYTES)
+            {
+                endCgiRefresh(fd, false);
+                return;
+            }
+            r.out.append(buf, (size_t)n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        endCgiRefresh(fd, n == 0);
+        return;
+    }
+}
+
+// the child itself is reaped by onChildExit() like any other
+void PollReactor::endCgiRefresh(int fd, bool ok)
+{
+    std::map<int, CgiRefresh>::iterator it = _cgiRefresh.find(fd);
+    if (it == _cgiRefresh.end())
+        return;
+    CgiRefresh r = it->second;
+    _cgiRefresh.erase(it);
+    removePollItem(fd);
+    closeFd(fd);
+    if (!ok)
+        kill(r.pid, SIGKILL);
+
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+    if (!cgiH)
+        return;
+    if (ok)
+        cgiH->finishCgiRefresh(r.id, r.out);
+    else
+        cgiH->abortCgi(r.id);
+}
+
+void PollReactor::rejectBusy(NetChannel& ch, int retryAfter)
+{
+    replyNow(ch, busyResponse(retryAfter));
+}
 
-    ch.txBuffer() = rep.bytes;
-    ch.setCloseOnDone(rep.closeAfterWrite);
+void PollReactor::replyNow(NetChannel& ch, const SharedBuffer& bytes)
+{
+    ch.setInFlight(false);
+    ch.setTxShared(bytes);
+    ch.setCloseOnDone(true);
     ch.setPhase(PHASE_SEND);
     setPollMask(ch.sockFd(), POLLIN | POLLOUT);
 }
 
+SharedBuffer PollReactor::busyResponse(int retryAfter)
+{
+    std::map<int, SharedBuffer>::const_iterator it = _busy.find(retryAfter);
+    if (it != _busy.end())
+        return it->second;
+
+    std::string body = "Service Unavailable\n";
+
+    std::ostringstream r;
+    r << "HTTP/1.0 503 Service Unavailable\r\n"
+      << "Content-Type: text/plain\r\n"
+      << "Content-Length: " << body.size() << "\r\n"
+      << "Retry-After: " << retryAfter << "\r\n"
+      << "Connection: close\r\n"
+      << "\r\n"
+      << body;
+
+    SharedBuffer out(r.str());
+    _busy[retryAfter] = out;
+    return out;
+}
+
 void PollReactor::onReadable(int fd)
 {
     std::map<int, NetChannel>::iterator it = _channels.find(fd);
@@ -777,6 +2145,11 @@ void PollReactor::onReadable(int fd)
         return;
     if (ch.cgi().active)
     {
+        if (ch.cgi().bodyLeft > 0)
+        {
+            readCgiBody(ch);
+            return;
+        }
         char tmp[1];
         ssize_t n = recv(fd, tmp, sizeof(tmp), MSG_PEEK);
         if (n == 0)
@@ -787,8 +2160,8 @@ void PollReactor::onReadable(int fd)
     if (!(ch.phase() == PHASE_RECV_HEADERS || ch.phase() == PHASE_RECV_BODY))
         return;
 
-    char buf[4096];
-    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    char buf[16384];
+    ssize_t n = ch.recvSome(buf, sizeof(buf));
 
     if (n > 0)
     {
@@ -797,9 +2170,12 @@ void PollReactor::onReadable(int fd)
         if (ch.phase() == PHASE_RECV_BODY)
             ch.markPhaseSince();
 
+        if (ch.phase() == PHASE_RECV_HEADERS && tryHttp2Preface(ch))
+            return;
+
         if (ch.phase() == PHASE_RECV_HEADERS && ch.rxBuffer().size() > _maxHeaderBytes)
         {
-            ch.txBuffer() = minimalError(431, "Request Header Fields Too Large");
+            ch.setTxShared(minimalError(431, "Request Header Fields Too Large"));
             ch.setCloseOnDone(true);
             ch.setPhase(PHASE_SEND);
             setPollMask(fd, POLLIN | POLLOUT);
@@ -816,13 +2192,14 @@ void PollReactor::onReadable(int fd)
 
                 ch.setHdrEnd(static_cast<size_t>(he));
                 std::string headerBlock = ch.rxBuffer().substr(0, he + 2);
+                mark_headers(ch, headerBlock);
 
                 bool chunked = false;
                 bool hasLen = false;
                 size_t len = 0;
                 if (!parseFramingHeaders(headerBlock, chunked, hasLen, len))
                 {
-                    ch.txBuffer() = minimalError(400, "Bad Request");
+                    ch.setTxShared(minimalError(400, "Bad Request"));
                     ch.setCloseOnDone(true);
                     ch.setPhase(PHASE_SEND);
                     setPollMask(fd, POLLIN | POLLOUT);
@@ -834,11 +2211,19 @@ void PollReactor::onReadable(int fd)
                 ch.setLen(len);
 
                 if (chunked || (hasLen && len > 0))
+                {
                     ch.setPhase(PHASE_RECV_BODY);
+                    if (hasLen && tryStartStreamedCgi(ch, he, len))
+                        return;
+                }
                 else
                 {
+                    if (tryHttp2Upgrade(ch, headerBlock, he))
+                        return;
+
                     std::string full = ch.rxBuffer().substr(0, he + 4);
                     ch.rxBuffer().erase(0, he + 4);
+                    mark_once(ch.trace().bodyUs);
 
                     ch.resetFraming();
                     ch.pushReadyMsg(full);
@@ -851,9 +2236,37 @@ void PollReactor::onReadable(int fd)
                 size_t he = ch.hdrEnd();
                 size_t bodyStart = he + 4;
 
+                if (ch.isChunked())
+                {
+                    size_t decoded = ch.len();
+                    ChunkState cs = decode_chunks(ch.rxBuffer(), bodyStart, decoded, _maxBodyBytes);
+                    ch.setLen(decoded);
+                    if (cs == CHUNKS_MORE)
+                        break;
+                    if (cs != CHUNKS_DONE)
+                    {
+                        ch.setTxShared(cs == CHUNKS_TOO_BIG ? minimalError(413, "Payload Too Large")
+                                                            : minimalError(400, "Bad Request"));
+                        ch.setCloseOnDone(true);
+                        ch.setPhase(PHASE_SEND);
+                        setPollMask(fd, POLLIN | POLLOUT);
+                        return;
+                    }
+
+                    std::string full = dechunked_head(ch.rxBuffer().substr(0, he + 2), decoded);
+                    full.append(ch.rxBuffer(), bodyStart, std::string::npos);
+                    ch.rxBuffer().clear();
+                    mark_once(ch.trace().bodyUs);
+
+                    ch.resetFraming();
+                    ch.setPhase(PHASE_RECV_HEADERS);
+                    ch.pushReadyMsg(full);
+                    continue;
+                }
+
                 if (ch.hasLen() && _maxBodyBytes != 0 && ch.len() > _maxBodyBytes)
                 {
-                    ch.txBuffer() = minimalError(413, "Payload Too Large");
+                    ch.setTxShared(minimalError(413, "Payload Too Large"));
                     ch.setCloseOnDone(true);
                     ch.setPhase(PHASE_SEND);
                     setPollMask(fd, POLLIN | POLLOUT);
@@ -865,7 +2278,7 @@ void PollReactor::onReadable(int fd)
                     break;
                 if (ch.rxBuffer().size() > need)
                 {
-                    ch.txBuffer() = minimalError(400, "Bad Request");
+                    ch.setTxShared(minimalError(400, "Bad Request"));
                     ch.setCloseOnDone(true);
                     ch.setPhase(PHASE_SEND);
                     setPollMask(fd, POLLIN | POLLOUT);
@@ -874,6 +2287,7 @@ void PollReactor::onReadable(int fd)
 
                 std::string full;
                 full.swap(ch.rxBuffer());
+                mark_once(ch.trace().bodyUs);
 
                 ch.resetFraming();
                 ch.setPhase(PHASE_RECV_HEADERS);
@@ -894,61 +2308,78 @@ void PollReactor::onReadable(int fd)
         return;
     }
 
-    if (socket_has_fatal_error(fd))
+    if (channel_failed(ch))
         markDrop(fd);
 }
 
-void PollReactor::onWritable(int fd)
+// Sends (part of) the front queued segment. Shared buffers go out with send(),
+// file spans with sendfile() from their offset (both through TLS when the
+// channel has it). Returns false if the channel is dropped.
+bool PollReactor::sendTxSegment(NetChannel& ch)
 {
-    std::map<int, NetChannel>::iterator it = _channels.find(fd);
-    if (it == _channels.end())
-        return;
-
-    NetChannel& ch = it->second;
+    const size_t CHUNK = 1024 * 1024;
+    const int fd = ch.sockFd();
+    NetChannel::TxSegment& seg = ch.frontTx();
+    const BodyPart& part = seg.part;
 
-    if (ch.phase() != PHASE_SEND)
-        return;
-    NetChannel::FileSendSession& fs = ch.file();
-    if (fs.active)
+    ssize_t n;
+    if (!part.isFile())
+        n = ch.sendSome(part.bytes.data() + seg.sent, part.bytes.size() - seg.sent);
+    else
     {
-        if (fs.fd < 0)
+        if (seg.fd < 0)
         {
-            fs.fd = open(fs.path.c_str(), O_RDONLY);
-            if (fs.fd < 0)
+            seg.fd = open(part.path.c_str(), O_RDONLY);
+            if (seg.fd < 0)
             {
-                ch.txBuffer() = minimalError(500, "Internal Server Error");
-                ch.setCloseOnDone(true);
-                fs.active = false;
+                // headers are already out: nothing sane to send any more
+                markDrop(fd);
+                return false;
             }
+            setCloExec(seg.fd);
         }
-
-        if (fs.active && fs.fd >= 0)
+        size_t left = part.length - seg.sent;
+        if (left > CHUNK)
+            left = CHUNK;
+        n = ch.sendFile(seg.fd, part.offset + (off_t)seg.sent, left);
+        if (n == 0)
         {
-            char buf[8192];
-            ssize_t nread = read(fs.fd, buf, sizeof(buf));
-
-            if (nread > 0)
-            {
-                ssize_t nsent = send(fd, buf, (size_t)nread, 0);
-                if (nsent < 0)
-                {
-                    if (socket_has_fatal_error(fd))
-                        markDrop(fd);
-                    return;
-                }
-                return;
-            }
-            closeFd(fs.fd);
-            fs.fd = -1;
-            fs.active = false;
-
-            ch.setCloseOnDone(true);
+            // file shrank under us: the promised Content-Length can't be met
+            markDrop(fd);
+            return false;
         }
     }
+
+    if (n > 0)
+    {
+        seg.sent += (size_t)n;
+        ch.markSeen();
+        if (seg.sent >= part.size())
+            ch.popTx();
+        return true;
+    }
+    if (channel_failed(ch))
+    {
+        markDrop(fd);
+        return false;
+    }
+    return true;
+}
+
+void PollReactor::onWritable(int fd)
+{
+    std::map<int, NetChannel>::iterator it = _channels.find(fd);
+    if (it == _channels.end())
+        return;
+
+    NetChannel& ch = it->second;
+
+    if (ch.phase() != PHASE_SEND)
+        return;
     if (!ch.txBuffer().empty())
     {
         const std::string& out = ch.txBuffer();
-        ssize_t n = send(fd, out.data(), out.size(), 0);
+        ssize_t n = ch.sendSome(out.data(), out.size());
 
         if (n > 0)
         {
@@ -957,13 +2388,44 @@ void PollReactor::onWritable(int fd)
         }
         else if (n < 0)
         {
-            if (socket_has_fatal_error(fd))
+            if (channel_failed(ch))
                 markDrop(fd);
             return;
         }
     }
+    else if (ch.hasQueuedTx())
+    {
+        if (!sendTxSegment(ch))
+            return;
+    }
+
+    // streamed CGI body: the response is not over until the script is
+    CgiSession& cg = ch.cgi();
+    if (cg.active && cg.streaming)
+    {
+        if (cg.paused && ch.pendingTxBytes() <= CGI_TX_LOW_WATER)
+        {
+            cg.paused = false;
+            if (cg.fdOut >= 0)
+                setPollMask(cg.fdOut, POLLIN | POLLHUP);
+            else if (cg.proxy)
+            {
+                _proxy.pause(ch.sockFd(), false);
+                syncProxyPoll();
+            }
+            else if (cg.fcgi)
+            {
+                _fcgi.pause(ch.sockFd(), false);
+                syncFastCgiPoll();
+            }
+            cg.startTs = std::time(NULL);
+        }
+        feedCgiSpool(ch, false);
+        setCgiClientMask(ch);
+        return;
+    }
 
-    if (ch.txBuffer().empty())
+    if (!ch.hasPendingTx())
     {
         if (ch.closeOnDone())
         {
@@ -972,6 +2434,7 @@ void PollReactor::onWritable(int fd)
             return;
         }
 
+        accountRequest(ch);
         ch.setPhase(PHASE_RECV_HEADERS);
         setPollMask(fd, POLLIN);
         dispatchIfIdle(ch);
@@ -999,10 +2462,13 @@ void PollReactor::onCgiInWritable(int fd)
 
     if (cg.inOff >= cg.inBody.size())
     {
-        removePollItem(fd);
-        _cgiInToClient.erase(fd);
-        closeFd(fd);
-        cg.fdIn = -1;
+        if (cg.bodyLeft > 0)
+            setPollMask(fd, 0);
+        else
+        {
+            closeCgiIn(cg);
+            maybeFinalizeCgi(clientFd);
+        }
         return;
     }
 
@@ -1015,22 +2481,35 @@ void PollReactor::onCgiInWritable(int fd)
         cg.inOff += (size_t)n;
         if (cg.inOff >= cg.inBody.size())
         {
-            removePollItem(fd);
-            _cgiInToClient.erase(fd);
-            closeFd(fd);
-            cg.fdIn = -1;
+            // all caught up: wait for the client, or we are done
+            if (cg.bodyLeft > 0)
+            {
+                cg.inBody.clear();
+                cg.inOff = 0;
+                setPollMask(fd, 0);
+            }
+            else
+            {
+                closeCgiIn(cg);
+                maybeFinalizeCgi(clientFd);
+                return;
+            }
         }
+        if (cg.bodyLeft > 0)
+            setCgiClientMask(ch);
         return;
     }
 
     if (n < 0)
     {
-        cleanupCgiForClient(ch);
-        ch.setInFlight(false);
-        ch.txBuffer() = minimalError(502, "Bad Gateway");
-        ch.setCloseOnDone(true);
-        ch.setPhase(PHASE_SEND);
-        setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+        // the script answered without reading all of its input: not an error
+        if (cg.streaming)
+        {
+            closeCgiIn(cg);
+            maybeFinalizeCgi(clientFd);
+            return;
+        }
+        failCgi(ch, 502, "Bad Gateway");
         return;
     }
 }
@@ -1048,46 +2527,47 @@ void PollReactor::maybeFinalizeCgi(int clientFd)
 
     if (cgiTimedOut(cg))
     {
-        cleanupCgiForClient(ch);
-        ch.setInFlight(false);
-
-        ch.txBuffer() = minimalError(504, "Gateway Timeout");
-        ch.setCloseOnDone(true);
-        ch.setPhase(PHASE_SEND);
-        setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+        ++server_metrics().cgiTimeouts;
+        failCgi(ch, 504, "Gateway Timeout");
         return;
     }
 
-    bool exited = false;
-    int status = 0;
-    if (cg.pid > 0)
+    if (cg.fcgi || cg.proxy)
     {
-        pid_t w = waitpid(cg.pid, &status, WNOHANG);
-        if (w == cg.pid)
-            exited = true;
+        if (!cg.upstreamDone)
+            return;
     }
     else
-        exited = true;
+    {
+        // called from each of the three events; the last one finishes.
+        // pid is cleared by onChildExit() when the child has been reaped.
+        if (!(cg.pid <= 0 && cg.fdOut == -1 && cg.fdIn == -1))
+            return;
+    }
+    mark_once(ch.trace().handledUs);
 
-    if (!(exited && cg.fdOut == -1 && cg.fdIn == -1))
+    if (cg.streaming)
+    {
+        finishCgiStream(ch);
         return;
+    }
 
     ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
     if (!cgiH)
     {
-        cleanupCgiForClient(ch);
-        ch.setInFlight(false);
-
-        ch.txBuffer() = minimalError(500, "Internal Server Error");
-        ch.setCloseOnDone(true);
-        ch.setPhase(PHASE_SEND);
-        setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+        failCgi(ch, 500, "Internal Server Error");
         return;
     }
 
+    // the script exited before finishing its header block
     CgiFinishResult fin = cgiH->finishCgi(ch.acceptFd(), ch.sockFd(), cg.outBuf);
 
+    releaseCgiSlot(cg);
+    landCollapse(cg);
     cg.active = false;
+    cg.fcgi = false;
+    cg.proxy = false;
+    cg.upstreamDone = false;
     cg.pid = -1;
     cg.inBody.clear();
     cg.inOff = 0;
@@ -1120,11 +2600,11 @@ void PollReactor::onCgiOutReadable(int fd)
     if (!cg.active || cg.fdOut != fd)
         return;
 
-    char buf[8192];
+    char buf[65536];
     ssize_t n = read(fd, buf, sizeof(buf));
     if (n > 0)
     {
-        cg.outBuf.append(buf, buf + n);
+        feedCgiOutput(ch, buf, (size_t)n);
         return;
     }
 
@@ -1139,10 +2619,199 @@ void PollReactor::onCgiOutReadable(int fd)
         return;
     }
 
+    failCgi(ch, 502, "Bad Gateway");
+}
+
+// Script output as it arrives. Until the blank line it is collected in
+// outBuf; then the headers are turned into a response head and everything
+// after goes to the client right away.
+void PollReactor::feedCgiOutput(NetChannel& ch, const char* data, size_t len)
+{
+    CgiSession& cg = ch.cgi();
+    if (cg.streaming)
+    {
+        cg.startTs = std::time(NULL);
+        queueCgiBody(ch, data, len, false);
+        return;
+    }
+
+    cg.outBuf.append(data, len);
+
+    size_t bodyStart = 0;
+    size_t from = (cg.hdrScan > 2) ? cg.hdrScan - 2 : 0;
+    std::string::size_type he = cgiHeaderEnd(cg.outBuf, from, bodyStart);
+    cg.hdrScan = cg.outBuf.size();
+    if (he == std::string::npos)
+    {
+        if (cg.outBuf.size() > CGI_MAX_HEADER_BYTES)
+            failCgi(ch, 502, "Bad Gateway");
+        return;
+    }
+
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+    ByteReply file;
+    if (cgiH && cgiH->cgiDelegated(ch.acceptFd(), ch.sockFd(), cg.outBuf.substr(0, he), file))
+    {
+        delegateCgi(ch, file);
+        return;
+    }
+
+    std::string head;
+    if (!cgiH || !cgiH->startCgiResponse(ch.acceptFd(), ch.sockFd(), cg.outBuf.substr(0, he), head))
+    {
+        failCgi(ch, 502, "Bad Gateway");
+        return;
+    }
+
+    cg.streaming = true;
+    cg.startTs = std::time(NULL);
+    ch.txBuffer() = head;
+    ch.setCloseOnDone(true);
+    ch.setPhase(PHASE_SEND);
+
+    std::string rest;
+    if (bodyStart < cg.outBuf.size())
+        rest = cg.outBuf.substr(bodyStart);
+    cg.outBuf.clear();
+    queueCgiBody(ch, rest.data(), rest.size(), false);
+}
+
+// hands a piece of the body (possibly compressed) to the client's send queue.
+// While the client is too far behind, the script is either not read any more
+// or, with cgi_buffer_size, its output goes to a spool file instead.
+void PollReactor::queueCgiBody(NetChannel& ch, const char* data, size_t len, bool last)
+{
+    CgiSession& cg = ch.cgi();
+    ICgiHandler* cgiH = dynamic_cast<ICgiHandler*>(_handler);
+
+    std::string encoded;
+    if (cgiH && cgiH->encodeCgiBody(ch.sockFd(), data, len, last, encoded))
+    {
+        data = encoded.data();
+        len = encoded.size();
+    }
+
+    // a failed open just keeps it in memory (and pauses the script below)
+    if (cg.spoolFd < 0 && cg.bufferSize > 0 && len > 0
+        && ch.pendingTxBytes() + len > cg.bufferSize)
+        cg.spoolFd = openSpoolFile(CGI_SPOOL_DIR);
+
+    if (cg.spoolFd >= 0)
+    {
+        if (!spoolCgiBody(cg, data, len))
+        {
+            // headers are already out: nothing sane to send any more
+            markDrop(ch.sockFd());
+            return;
+        }
+        feedCgiSpool(ch, last);
+    }
+    else if (len > 0)
+        ch.queueShared(SharedBuffer(data, len));
+
+    if (cg.active)
+        setCgiClientMask(ch);
+
+    size_t high = CGI_TX_HIGH_WATER;
+    if (cg.bufferSize > high)
+        high = cg.bufferSize;
+    if (!last && !cg.paused && (cg.fdOut >= 0 || cg.proxy || cg.fcgi) && cg.spoolFd < 0
+        && ch.pendingTxBytes() > high)
+    {
+        cg.paused = true;
+        if (cg.proxy)
+            _proxy.pause(ch.sockFd(), true);
+        else if (cg.fcgi)
+            _fcgi.pause(ch.sockFd(), true);
+        else
+            setPollMask(cg.fdOut, 0);
+    }
+}
+
+bool PollReactor::spoolCgiBody(CgiSession& cg, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(cg.spoolFd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        cg.spoolLen += n;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Moves what the spool file has gained into the send queue as one file span,
+// once the client is down to LOW bytes (or everything, when the script is done).
+// Each span holds its own descriptor, so the spool can be closed early.
+void PollReactor::feedCgiSpool(NetChannel& ch, bool all)
+{
+    CgiSession& cg = ch.cgi();
+    if (cg.spoolFd < 0 || cg.spoolLen == cg.spoolQueued)
+        return;
+    if (!all && ch.pendingTxBytes() > CGI_TX_LOW_WATER)
+        return;
+
+    int fd = dup(cg.spoolFd);
+    if (fd < 0)
+    {
+        markDrop(ch.sockFd());
+        return;
+    }
+    setCloExec(fd);
+    ch.queueFileFd(fd, cg.spoolQueued, (size_t)(cg.spoolLen - cg.spoolQueued));
+    cg.spoolQueued = cg.spoolLen;
+}
+
+void PollReactor::closeCgiSpool(CgiSession& cg)
+{
+    closeFd(cg.spoolFd);
+    cg.spoolFd = -1;
+    cg.spoolLen = 0;
+    cg.spoolQueued = 0;
+}
+
+// X-Accel-Redirect / X-Sendfile: the file goes out instead of the script's
+// output. The script is killed like an abandoned one, so nothing keeps
+// running past cgi_timeout or outside its cgi_max_concurrent slot.
+void PollReactor::delegateCgi(NetChannel& ch, ByteReply& rep)
+{
     cleanupCgiForClient(ch);
+    mark_once(ch.trace().handledUs);
+
     ch.setInFlight(false);
+    ch.txBuffer() = rep.bytes;
+    ch.queueShared(rep.shared);
+    for (size_t i = 0; i < rep.parts.size(); ++i)
+        ch.queuePart(rep.parts[i]);
+    ch.setCloseOnDone(true);
+    ch.setPhase(PHASE_SEND);
+    setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+}
+
+// script is done (stdout closed and reaped, or FastCGI END_REQUEST)
+void PollReactor::finishCgiStream(NetChannel& ch)
+{
+    CgiSession& cg = ch.cgi();
+    queueCgiBody(ch, NULL, 0, true);
+    closeCgiSpool(cg);
 
-    ch.txBuffer() = minimalError(502, "Bad Gateway");
+    releaseCgiSlot(cg);
+    landCollapse(cg);
+    cg.active = false;
+    cg.fcgi = false;
+    cg.proxy = false;
+    cg.upstreamDone = false;
+    cg.pid = -1;
+    cg.inBody.clear();
+    cg.inOff = 0;
+    cg.streaming = false;
+    cg.paused = false;
+
+    ch.setInFlight(false);
     ch.setCloseOnDone(true);
     ch.setPhase(PHASE_SEND);
     setPollMask(ch.sockFd(), POLLIN | POLLOUT);
@@ -1153,12 +2822,44 @@ void PollReactor::onPollEvent(size_t idx)
     const int fd = _pollSet[idx].fd;
     const short re = _pollSet[idx].revents;
 
+    if (fd == _childFd)
+    {
+        onChildExit();
+        return;
+    }
+
+    if (_fcgi.owns(fd))
+    {
+        _fcgi.onEvent(fd, re);
+        drainFastCgiEvents();
+        return;
+    }
+
+    if (_proxy.owns(fd))
+    {
+        _proxy.onEvent(fd, re);
+        drainProxyEvents();
+        return;
+    }
+
+    if (_h2.owns(fd))
+    {
+        _h2.onEvent(fd, re);
+        return;
+    }
+
     if (_cgiOutToClient.find(fd) != _cgiOutToClient.end())
     {
         if (re & (POLLERR | POLLNVAL | POLLHUP | POLLIN))
             onCgiOutReadable(fd);
         return;
     }
+    if (_cgiRefresh.find(fd) != _cgiRefresh.end())
+    {
+        if (re & (POLLERR | POLLNVAL | POLLHUP | POLLIN))
+            onCgiRefreshReadable(fd);
+        return;
+    }
     if (_cgiInToClient.find(fd) != _cgiInToClient.end())
     {
         if (re & (POLLERR | POLLNVAL | POLLHUP))
@@ -1167,14 +2868,13 @@ void PollReactor::onPollEvent(size_t idx)
             std::map<int, NetChannel>::iterator chIt = _channels.find(clientFd);
             if (chIt != _channels.end())
             {
-                NetChannel& ch = chIt->second;
-                cleanupCgiForClient(ch);
-                ch.setInFlight(false);
-
-                ch.txBuffer() = minimalError(502, "Bad Gateway");
-                ch.setCloseOnDone(true);
-                ch.setPhase(PHASE_SEND);
-                setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+                if (chIt->second.cgi().streaming)
+                {
+                    closeCgiIn(chIt->second.cgi());
+                    maybeFinalizeCgi(clientFd);
+                }
+                else
+                    failCgi(chIt->second, 502, "Bad Gateway");
             }
             return;
         }
@@ -1189,6 +2889,13 @@ void PollReactor::onPollEvent(size_t idx)
         return;
     }
 
+    std::map<int, NetChannel>::iterator hs = _channels.find(fd);
+    if (hs != _channels.end() && hs->second.phase() == PHASE_TLS_HANDSHAKE)
+    {
+        continueTlsHandshake(hs->second);
+        return;
+    }
+
     const bool hup = (re & POLLHUP) != 0;
     if (hup && !isListener(fd))
     {
@@ -1205,7 +2912,7 @@ void PollReactor::onPollEvent(size_t idx)
             
             ch.setCloseOnDone(true);
 
-            if (ch.phase() == PHASE_SEND || !ch.txBuffer().empty())
+            if (ch.phase() == PHASE_SEND || ch.hasPendingTx())
                 setPollMask(fd, POLLOUT);
             else
                 setPollMask(fd, 0);
@@ -1232,11 +2939,35 @@ void PollReactor::sweepTimeouts()
 {
     const std::time_t now = std::time(NULL);
 
+    _proxy.sweep(now);
+    drainProxyEvents();
+    _h2.sweep(now);
+
+    std::vector<int> lateRefresh;
+    for (std::map<int, CgiRefresh>::iterator it = _cgiRefresh.begin(); it != _cgiRefresh.end(); ++it)
+    {
+        if (it->second.timeoutSec > 0 && (now - it->second.startTs) >= it->second.timeoutSec)
+            lateRefresh.push_back(it->first);
+    }
+    for (size_t i = 0; i < lateRefresh.size(); ++i)
+        endCgiRefresh(lateRefresh[i], false);
+
+    // the gauges come from this walk over every channel
+    ServerMetrics& m = server_metrics();
+    for (int p = 0; p < METRICS_PHASES; ++p)
+        m.channels[p] = 0;
+    m.cgiRunning = 0;
+
     for (std::map<int, NetChannel>::iterator it = _channels.begin(); it != _channels.end(); ++it)
     {
         int fd = it->first;
         NetChannel& ch = it->second;
 
+        if ((int)ch.phase() < METRICS_PHASES)
+            ++m.channels[ch.phase()];
+        if (ch.cgi().active)
+            ++m.cgiRunning;
+
         if (ch.upload().active)
         {
             continue;
@@ -1246,14 +2977,12 @@ void PollReactor::sweepTimeouts()
         {
             if (cgiTimedOut(ch.cgi()))
             {
-                cleanupCgiForClient(ch);
-                ch.setInFlight(false);
-
-                ch.txBuffer() = minimalError(504, "Gateway Timeout");
-                ch.setCloseOnDone(true);
-                ch.setPhase(PHASE_SEND);
-                setPollMask(ch.sockFd(), POLLIN | POLLOUT);
+                ++m.cgiTimeouts;
+                failCgi(ch, 504, "Gateway Timeout");
             }
+            else if (ch.cgi().paused && _idleTimeoutSec > 0 &&
+                     (now - ch.lastSeen()) > _idleTimeoutSec)
+                markDrop(fd);
             continue;
         }
 
@@ -1266,9 +2995,11 @@ void PollReactor::sweepTimeouts()
         if (ch.inFlight())
             continue;
 
-        if (ch.phase() == PHASE_RECV_HEADERS && _headerTimeoutSec > 0 &&
+        if ((ch.phase() == PHASE_RECV_HEADERS || ch.phase() == PHASE_TLS_HANDSHAKE) && _headerTimeoutSec > 0 &&
             (now - ch.phaseSince()) > _headerTimeoutSec)
         {
+            if (ch.phase() == PHASE_TLS_HANDSHAKE)
+                ++m.tlsHandshakeFailures;
             markDrop(fd);
             continue;
         }
@@ -1300,16 +3031,15 @@ void PollReactor::tickOnce()
             onPollEvent(i);
         }
     }
-    for (std::map<int, NetChannel>::iterator it = _channels.begin(); it != _channels.end(); ++it)
-    {
-        NetChannel& ch = it->second;
-        if (ch.cgi().active)
-            maybeFinalizeCgi(it->first);
-    }
-
+    pumpTlsPending();
     pumpAsyncUploads();
+    pumpCgiQueues();
 
     flushDrops();
     sweepTimeouts();
     flushDrops();
+    syncFastCgiPoll();
+    syncProxyPoll();
+    syncHttp2();
+    access_log().pump();
 }
@@ -0,0 +1,397 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   ServerMetrics.cpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 18:20:03 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 18:20:03 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/sockets/ServerMetrics.hpp"
+#include <sstream>
+#include <cstdio>
+#include <cmath>
+#include <time.h>
+
+// indexed by IoPhase
+static const char* g_phaseNames[METRICS_PHASES] = {
+    "recv_headers", "recv_body", "send", "shutdown", "tls_handshake"
+};
+
+static const char* g_cacheNames[METRICS_CACHE_COUNT] = {
+    "file_meta", "compress", "dir_listing", "cgi"
+};
+
+static const char* g_requestPhaseNames[REQ_PHASES] = {
+    "headers", "body", "queue", "handler", "first_byte", "send"
+};
+
+// percentiles shown for each phase
+static const double g_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const char*  g_quantileKeys[] = { "p50", "p90", "p99", "p999" };
+#define QUANTILES 4
+
+const char* request_phase_name(int phase)
+{
+    return phase >= 0 && phase < REQ_PHASES ? g_requestPhaseNames[phase] : "?";
+}
+
+long long metrics_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long bucketBoundUs(int i)
+{
+    return (long long)METRICS_LATENCY_FIRST_US << i;
+}
+
+// microseconds as seconds, no trailing zeros (Prometheus `le`, JSON numbers)
+static std::string secondsStr(long long us)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%lld.%06lld", us / 1000000LL, us % 1000000LL);
+    std::string s(buf);
+    while (s[s.size() - 1] == '0')
+        s.erase(s.size() - 1);
+    if (s[s.size() - 1] == '.')
+        s.erase(s.size() - 1);
+    return s;
+}
+
+// label values (Prometheus) and strings (JSON) escape the same three things
+static std::string escapeStr(const std::string& s)
+{
+    std::string r;
+    r.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '\\' || s[i] == '"')
+            r += '\\';
+        if (s[i] == '\n')
+            r += "\\n";
+        else if ((unsigned char)s[i] >= 0x20)
+            r += s[i];
+    }
+    return r;
+}
+
+static std::string orDash(const std::string& s)
+{
+    return s.empty() ? "-" : s;
+}
+
+LatencyHistogram::LatencyHistogram() : count(0), sumUs(0)
+{
+    for (int i = 0; i <= METRICS_LATENCY_BUCKETS; ++i)
+        buckets[i] = 0;
+}
+
+void LatencyHistogram::add(long long us)
+{
+    if (us < 0)
+        us = 0;
+    int i = 0;
+    while (i < METRICS_LATENCY_BUCKETS && us > bucketBoundUs(i))
+        ++i;
+    ++buckets[i];
+    ++count;
+    sumUs += us;
+}
+
+// [2^msb, 2^(msb+1)) is split in HDR_SUB_COUNT buckets of 2^(msb - HDR_SUB_BITS)
+static int hdrIndex(long long v)
+{
+    if (v < HDR_SUB_COUNT)
+        return (int)v;
+    int msb = HDR_SUB_BITS;
+    while (msb < HDR_MAX_BIT && (v >> (msb + 1)) != 0)
+        ++msb;
+    if ((v >> (msb + 1)) != 0)
+        return HDR_BUCKETS - 1;
+    int shift = msb - HDR_SUB_BITS;
+    return HDR_SUB_COUNT + shift * HDR_SUB_COUNT + (int)((v >> shift) - HDR_SUB_COUNT);
+}
+
+static long long hdrBucketTop(int i)
+{
+    if (i < HDR_SUB_COUNT)
+        return i;
+    int shift = (i - HDR_SUB_COUNT) / HDR_SUB_COUNT;
+    long long sub = (i - HDR_SUB_COUNT) % HDR_SUB_COUNT + HDR_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+HdrHistogram::HdrHistogram() : count(0), sumUs(0), maxUs(0)
+{
+    for (int i = 0; i < HDR_BUCKETS; ++i)
+        counts[i] = 0;
+}
+
+void HdrHistogram::add(long long us)
+{
+    if (us < 0)
+        us = 0;
+    ++counts[hdrIndex(us)];
+    ++count;
+    sumUs += us;
+    if (us > maxUs)
+        maxUs = us;
+}
+
+long long HdrHistogram::percentile(double q) const
+{
+    if (count == 0)
+        return 0;
+    unsigned long rank = (unsigned long)std::ceil(q * (double)count);
+    if (rank < 1)
+        rank = 1;
+    unsigned long seen = 0;
+    for (int i = 0; i < HDR_BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+        {
+            long long top = hdrBucketTop(i);
+            return top < maxUs ? top : maxUs;
+        }
+    }
+    return maxUs;
+}
+
+ServerMetrics::Route::Route() : server(), location(), bytesIn(0), bytesOut(0), latency()
+{
+    for (int i = 0; i < 5; ++i)
+        byClass[i] = 0;
+}
+
+ServerMetrics::ServerMetrics()
+: connections(0), tlsHandshakeFailures(0), cgiSpawns(0), cgiTimeouts(0),
+  fastcgiRequests(0), proxyRequests(0), uploads(0), uploadBytes(0), uploadUs(0), accessLogDropped(0),
+  cgiRunning(0), _routes(), _started(std::time(NULL))
+{
+    for (int i = 0; i < METRICS_CACHE_COUNT; ++i)
+    {
+        cacheHits[i] = 0;
+        cacheMisses[i] = 0;
+    }
+    for (int i = 0; i < METRICS_PHASES; ++i)
+        channels[i] = 0;
+}
+
+ServerMetrics& server_metrics()
+{
+    static ServerMetrics m;
+    return m;
+}
+
+void ServerMetrics::recordRequest(const std::string& server, const std::string& location, int status,
+                                  size_t bytesIn, size_t bytesOut, long long us, const long long* phaseUs)
+{
+    std::string key = server + '\n' + location;
+    std::map<std::string, Route>::iterator it = _routes.find(key);
+    if (it == _routes.end())
+    {
+        it = _routes.insert(std::make_pair(key, Route())).first;
+        it->second.server = server;
+        it->second.location = location;
+    }
+    Route& r = it->second;
+    int cls = status / 100;
+    if (cls >= 1 && cls <= 5)
+        ++r.byClass[cls - 1];
+    r.bytesIn += bytesIn;
+    r.bytesOut += bytesOut;
+    r.latency.add(us);
+    for (int i = 0; i < REQ_PHASES; ++i)
+        r.phases[i].add(phaseUs[i]);
+}
+
+void ServerMetrics::cacheLookup(MetricsCache cache, bool hit)
+{
+    if (hit)
+        ++cacheHits[cache];
+    else
+        ++cacheMisses[cache];
+}
+
+static void promHeader(std::ostringstream& os, const char* name, const char* type, const char* help)
+{
+    os << "# HELP " << name << " " << help << "\n"
+       << "# TYPE " << name << " " << type << "\n";
+}
+
+void ServerMetrics::renderPrometheus(std::string& out) const
+{
+    std::ostringstream os;
+
+    promHeader(os, "webserv_uptime_seconds", "gauge", "Seconds since the server started.");
+    os << "webserv_uptime_seconds " << (long)(std::time(NULL) - _started) << "\n";
+    promHeader(os, "webserv_connections_accepted_total", "counter", "Client connections accepted.");
+    os << "webserv_connections_accepted_total " << connections << "\n";
+    promHeader(os, "webserv_tls_handshake_failures_total", "counter", "TLS handshakes that failed or timed out.");
+    os << "webserv_tls_handshake_failures_total " << tlsHandshakeFailures << "\n";
+
+    promHeader(os, "webserv_channels", "gauge", "Open client channels by I/O phase.");
+    for (int i = 0; i < METRICS_PHASES; ++i)
+        os << "webserv_channels{phase=\"" << g_phaseNames[i] << "\"} " << channels[i] << "\n";
+
+    promHeader(os, "webserv_cgi_spawns_total", "counter", "CGI scripts started.");
+    os << "webserv_cgi_spawns_total " << cgiSpawns << "\n";
+    promHeader(os, "webserv_cgi_timeouts_total", "counter", "CGI requests that hit cgi_timeout.");
+    os << "webserv_cgi_timeouts_total " << cgiTimeouts << "\n";
+    promHeader(os, "webserv_cgi_running", "gauge", "CGI, FastCGI and proxied requests in progress.");
+    os << "webserv_cgi_running " << cgiRunning << "\n";
+    promHeader(os, "webserv_fastcgi_requests_total", "counter", "Requests handed to a FastCGI upstream.");
+    os << "webserv_fastcgi_requests_total " << fastcgiRequests << "\n";
+    promHeader(os, "webserv_proxy_requests_total", "counter", "Requests handed to a proxy_pass upstream.");
+    os << "webserv_proxy_requests_total " << proxyRequests << "\n";
+
+    promHeader(os, "webserv_uploads_total", "counter", "Uploads written to disk.");
+    os << "webserv_uploads_total " << uploads << "\n";
+    promHeader(os, "webserv_upload_bytes_total", "counter", "Bytes of those uploads.");
+    os << "webserv_upload_bytes_total " << uploadBytes << "\n";
+    promHeader(os, "webserv_upload_seconds_total", "counter", "Time spent writing them.");
+    os << "webserv_upload_seconds_total " << secondsStr(uploadUs) << "\n";
+
+    promHeader(os, "webserv_access_log_dropped_total", "counter",
+               "Access log lines dropped because the log buffer was full.");
+    os << "webserv_access_log_dropped_total " << accessLogDropped << "\n";
+
+    promHeader(os, "webserv_cache_hits_total", "counter", "Cache lookups answered from the cache.");
+    for (int i = 0; i < METRICS_CACHE_COUNT; ++i)
+        os << "webserv_cache_hits_total{cache=\"" << g_cacheNames[i] << "\"} " << cacheHits[i] << "\n";
+    promHeader(os, "webserv_cache_misses_total", "counter", "Cache lookups that had to do the work.");
+    for (int i = 0; i < METRICS_CACHE_COUNT; ++i)
+        os << "webserv_cache_misses_total{cache=\"" << g_cacheNames[i] << "\"} " << cacheMisses[i] << "\n";
+
+    promHeader(os, "webserv_requests_total", "counter", "Requests answered, by server, location and status class.");
+    for (std::map<std::string, Route>::const_iterator it = _routes.begin(); it != _routes.end(); ++it)
+    {
+        std::string lbl = "server=\"" + escapeStr(orDash(it->second.server)) + "\",location=\""
+                          + escapeStr(orDash(it->second.location)) + "\"";
+        for (int c = 0; c < 5; ++c)
+            os << "webserv_requests_total{" << lbl << ",class=\"" << (c + 1) << "xx\"} "
+               << it->second.byClass[c] << "\n";
+    }
+    promHeader(os, "webserv_received_bytes_total", "counter", "Request bytes read from clients.");
+    for (std::map<std::string, Route>::const_iterator it = _routes.begin(); it != _routes.end(); ++it)
+        os << "webserv_received_bytes_total{server=\"" << escapeStr(orDash(it->second.server))
+           << "\",location=\"" << escapeStr(orDash(it->second.location)) << "\"} " << it->second.bytesIn << "\n";
+    promHeader(os, "webserv_sent_bytes_total", "counter", "Response bytes sent to clients.");
+    for (std::map<std::string, Route>::const_iterator it = _routes.begin(); it != _routes.end(); ++it)
+        os << "webserv_sent_bytes_total{server=\"" << escapeStr(orDash(it->second.server))
+           << "\",location=\"" << escapeStr(orDash(it->second.location)) << "\"} " << it->second.bytesOut << "\n";
+
+    promHeader(os, "webserv_request_duration_seconds", "histogram",
+               "First request byte to last response byte.");
+    for (std::map<std::string, Route>::const_iterator it = _routes.begin(); it != _routes.end(); ++it)
+    {
+        const LatencyHistogram& h = it->second.latency;
+        std::string lbl = "server=\"" + escapeStr(orDash(it->second.server)) + "\",location=\""
+                          + escapeStr(orDash(it->second.location)) + "\"";
+        unsigned long cum = 0;
+        for (int i = 0; i < METRICS_LATENCY_BUCKETS; ++i)
+        {
+            cum += h.buckets[i];
+            os << "webserv_request_duration_seconds_bucket{" << lbl << ",le=\""
+               << secondsStr(bucketBoundUs(i)) << "\"} " << cum << "\n";
+        }
+        os << "webserv_request_duration_seconds_bucket{" << lbl << ",le=\"+Inf\"} " << h.count << "\n"
+           << "webserv_request_duration_seconds_sum{" << lbl << "} " << secondsStr(h.sumUs) << "\n"
+           << "webserv_request_duration_seconds_count{" << lbl << "} " << h.count << "\n";
+    }
+
+    promHeader(os, "webserv_request_phase_seconds", "summary",
+               "Time requests spend in each phase, accept to last byte.");
+    for (std::map<std::string, Route>::const_iterator it = _routes.begin(); it != _routes.end(); ++it)
+    {
+        for (int p = 0; p < REQ_PHASES; ++p)
+        {
+            const HdrHistogram& h = it->second.phases[p];
+            std::string lbl = "server=\"" + escapeStr(orDash(it->second.server)) + "\",location=\""
+                              + escapeStr(orDash(it->second.location)) + "\",phase=\""
+                              + g_requestPhaseNames[p] + "\"";
+            for (int q = 0; q < QUANTILES; ++q)
+                os << "webserv_request_phase_seconds{" << lbl << ",quantile=\"" << g_quantiles[q] << "\"} "
+                   << secondsStr(h.percentile(g_quantiles[q])) << "\n";
+            os << "webserv_request_phase_seconds_sum{" << lbl << "} " << secondsStr(h.sumUs) << "\n"
+               << "webserv_request_phase_seconds_count{" << lbl << "} " << h.count << "\n";
+        }
+    }
+    out = os.str();
+}
+
+void ServerMetrics::renderJson(std::string& out) const
+{
+    std::ostringstream os;
+    os << "{\"uptime_seconds\":" << (long)(std::time(NULL) - _started)
+       << ",\"connections_accepted\":" << connections
+       << ",\"tls_handshake_failures\":" << tlsHandshakeFailures;
+
+    os << ",\"channels\":{";
+    for (int i = 0; i < METRICS_PHASES; ++i)
+        os << (i ? "," : "") << "\"" << g_phaseNames[i] << "\":" << channels[i];
+    os << "}";
+
+    os << ",\"cgi\":{\"spawns\":" << cgiSpawns << ",\"timeouts\":" << cgiTimeouts
+       << ",\"running\":" << cgiRunning << ",\"fastcgi_requests\":" << fastcgiRequests
+       << ",\"proxy_requests\":" << proxyRequests << "}";
+
+    os << ",\"uploads\":{\"count\":" << uploads << ",\"bytes\":" << uploadBytes
+       << ",\"seconds\":" << secondsStr(uploadUs) << ",\"bytes_per_second\":"
+       << (uploadUs > 0 ? (unsigned long)((double)uploadBytes * 1000000.0 / (double)uploadUs) : 0UL) << "}";
+
+    os << ",\"access_log\":{\"dropped\":" << accessLogDropped << "}";
+
+    os << ",\"caches\":{";
+    for (int i = 0; i < METRICS_CACHE_COUNT; ++i)
+    {
+        unsigned long total = cacheHits[i] + cacheMisses[i];
+        os << (i ? "," : "") << "\"" << g_cacheNames[i] << "\":{\"hits\":" << cacheHits[i]
+           << ",\"misses\":" << cacheMisses[i] << ",\"hit_rate\":"
+           << (total ? (double)cacheHits[i] / (double)total : 0.0) << "}";
+    }
+    os << "}";
+
+    os << ",\"locations\":[";
+    for (std::map<std::string, Route>::const_iterator it = _routes.begin(); it != _routes.end(); ++it)
+    {
+        const Route& r = it->second;
+        os << (it == _routes.begin() ? "" : ",")
+           << "{\"server\":\"" << escapeStr(orDash(r.server)) << "\",\"location\":\""
+           << escapeStr(orDash(r.location)) << "\",\"requests\":{";
+        for (int c = 0; c < 5; ++c)
+            os << (c ? "," : "") << "\"" << (c + 1) << "xx\":" << r.byClass[c];
+        os << "},\"bytes_in\":" << r.bytesIn << ",\"bytes_out\":" << r.bytesOut
+           << ",\"latency\":{\"count\":" << r.latency.count
+           << ",\"sum_seconds\":" << secondsStr(r.latency.sumUs) << ",\"buckets\":[";
+        for (int i = 0; i <= METRICS_LATENCY_BUCKETS; ++i)
+        {
+            os << (i ? "," : "") << "{\"le\":";
+            if (i < METRICS_LATENCY_BUCKETS)
+                os << secondsStr(bucketBoundUs(i));
+            else
+                os << "null";
+            os << ",\"count\":" << r.latency.buckets[i] << "}";
+        }
+        os << "]},\"phases\":{";
+        for (int p = 0; p < REQ_PHASES; ++p)
+        {
+            const HdrHistogram& h = r.phases[p];
+            os << (p ? "," : "") << "\"" << g_requestPhaseNames[p] << "\":{\"count\":" << h.count
+               << ",\"sum_seconds\":" << secondsStr(h.sumUs);
+            for (int q = 0; q < QUANTILES; ++q)
+                os << ",\"" << g_quantileKeys[q] << "\":" << secondsStr(h.percentile(g_quantiles[q]));
+            os << ",\"max\":" << secondsStr(h.maxUs) << "}";
+        }
+        os << "}}";
+    }
+    os << "]}\n";
+    out = os.str();
+}
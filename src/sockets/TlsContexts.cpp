@@ -0,0 +1,155 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   TlsContexts.cpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: sal-kawa <sal-kawa@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 17:12:40 by sal-kawa          #+#    #+#             */
+/*   Updated: 2026/10/19 17:12:40 by sal-kawa         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "../../include/sockets/TlsContexts.hpp"
+#include "../../include/sockets/NetUtil.hpp"
+#include <openssl/err.h>
+
+// ALPN: every answer is HTTP/1.x (h2 is only spoken in cleartext)
+static const unsigned char g_alpn[] = { 8, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+
+static std::string lastSslError()
+{
+    unsigned long e = ERR_get_error();
+    ERR_clear_error();
+    if (e == 0)
+        return "unknown error";
+    char buf[256];
+    ERR_error_string_n(e, buf, sizeof(buf));
+    return buf;
+}
+
+static int onAlpn(SSL*, const unsigned char** out, unsigned char* outlen,
+                  const unsigned char* in, unsigned int inlen, void*)
+{
+    unsigned char* sel = NULL;
+    if (SSL_select_next_proto(&sel, outlen, g_alpn, sizeof(g_alpn), in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    *out = sel;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+TlsContexts::TlsContexts() : _ports(), _all() {}
+
+TlsContexts::~TlsContexts()
+{
+    for (size_t i = 0; i < _all.size(); ++i)
+        SSL_CTX_free(_all[i]);
+}
+
+SSL_CTX* TlsContexts::build(const TlsSettings& s, std::string& err)
+{
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+    {
+        err = lastSslError();
+        return NULL;
+    }
+    _all.push_back(ctx);
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    long opts = SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION;
+#ifdef SSL_OP_ENABLE_KTLS
+    opts |= SSL_OP_ENABLE_KTLS;
+#endif
+    if (!s.sessionTickets)
+        opts |= SSL_OP_NO_TICKET;
+    SSL_CTX_set_options(ctx, opts);
+
+    // the reactor writes from buffers that move and retries with the same
+    // length; idle connections give their record buffers back
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                          | SSL_MODE_RELEASE_BUFFERS);
+
+    static const unsigned char sid[] = "webserv";
+    SSL_CTX_set_session_id_context(ctx, sid, sizeof(sid) - 1);
+    if (s.sessionCache > 0)
+    {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, (long)s.sessionCache);
+    }
+    else
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    if (s.sessionTimeout > 0)
+        SSL_CTX_set_timeout(ctx, (long)s.sessionTimeout);
+    // TLS 1.3 tickets carry either the whole session or (tickets off) a cache id
+    if (!s.sessionTickets && s.sessionCache == 0)
+        SSL_CTX_set_num_tickets(ctx, 0);
+
+    SSL_CTX_set_alpn_select_cb(ctx, onAlpn, NULL);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, s.certificate.c_str()) != 1)
+    {
+        err = s.certificate + ": " + lastSslError();
+        return NULL;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, s.certificateKey.c_str(), SSL_FILETYPE_PEM) != 1)
+    {
+        err = s.certificateKey + ": " + lastSslError();
+        return NULL;
+    }
+    if (SSL_CTX_check_private_key(ctx) != 1)
+    {
+        err = s.certificateKey + ": does not match " + s.certificate;
+        ERR_clear_error();
+        return NULL;
+    }
+    return ctx;
+}
+
+bool TlsContexts::addServer(int port, const std::string& serverName, const TlsSettings& s,
+                            std::string& err)
+{
+    if (s.certificate.empty() || s.certificateKey.empty())
+    {
+        err = "ssl_certificate and ssl_certificate_key are required";
+        return false;
+    }
+    SSL_CTX* ctx = build(s, err);
+    if (!ctx)
+        return false;
+
+    PortContexts& pc = _ports[port];
+    if (!pc.def)
+    {
+        pc.def = ctx;
+        SSL_CTX_set_tlsext_servername_callback(ctx, onServerName);
+        SSL_CTX_set_tlsext_servername_arg(ctx, &pc);
+    }
+    std::string name = asciiLower(serverName);
+    if (pc.byName.find(name) == pc.byName.end())
+        pc.byName[name] = ctx;
+    return true;
+}
+
+SSL_CTX* TlsContexts::forPort(int port) const
+{
+    std::map<int, PortContexts>::const_iterator it = _ports.find(port);
+    return it == _ports.end() ? NULL : it->second.def;
+}
+
+bool TlsContexts::empty() const { return _ports.empty(); }
+
+// SNI: the certificate of the server block with that server_name; unknown
+// names (or none) keep the port's default
+int TlsContexts::onServerName(SSL* ssl, int*, void* arg)
+{
+    const PortContexts* pc = static_cast<const PortContexts*>(arg);
+    const char* name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!name)
+        return SSL_TLSEXT_ERR_OK;
+    std::map<std::string, SSL_CTX*>::const_iterator it = pc->byName.find(asciiLower(name));
+    if (it != pc->byName.end() && it->second != SSL_get_SSL_CTX(ssl))
+        SSL_set_SSL_CTX(ssl, it->second);
+    return SSL_TLSEXT_ERR_OK;
+}